@@ -0,0 +1,339 @@
+/*
+ * bip 核心数据路径的微基准（make bench）
+ *
+ * 每项在 1k、100k、1M 条合成数据上运行，每行输出一个JSON对象：
+ *   {"bench":"parse_ip_info","n":100000,"ops":1000000,"ns_per_op":85.2,"allocs_per_op":0.000}
+ * 便于在版本之间diff。数据目录由 Makefile 在编译时指向临时目录。
+ */
+#include "common.h"
+#include "ip_utils.h"
+#include "lpm.h"
+#include "store.h"
+#include "ban.h"
+#include "stats.h"
+#include <stdint.h>
+#include <fcntl.h>
+
+#define BENCH_MIN_OPS 1000000       /* 单条操作至少运行的次数 */
+#define BENCH_MAX_APPENDS 20000     /* 追加写封禁的次数上限（每次都是系统调用） */
+
+/* 分配计数：替换malloc族，转发给glibc的实现 */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static size_t alloc_count = 0;
+
+void *malloc(size_t size) {
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    alloc_count++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+typedef struct {
+    uint64_t start_ns;
+    size_t start_allocs;
+} bench_clock_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_start(bench_clock_t *c) {
+    c->start_allocs = alloc_count;
+    c->start_ns = now_ns();
+}
+
+static void bench_report(const bench_clock_t *c, const char *name, size_t n, size_t ops) {
+    uint64_t ns = now_ns() - c->start_ns;
+    size_t allocs = alloc_count - c->start_allocs;
+    printf("{\"bench\":\"%s\",\"n\":%zu,\"ops\":%zu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.3f}\n",
+           name, n, ops, (double)ns / (double)ops, (double)allocs / (double)ops);
+    fflush(stdout);
+}
+
+/* 防止编译器删除结果未使用的调用 */
+static volatile size_t sink;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* 合成数据：90% IPv4主机、5% IPv4 /24、5% IPv6 /64，国家代码取自固定集合 */
+typedef struct {
+    char (*ip)[IP_STR_LEN];
+    ip_addr_t *addr;
+    size_t count;
+} dataset_t;
+
+static const char *countries[] = {
+    "CN", "US", "RU", "BR", "IN", "DE", "VN", "KR", "NL", "FR", "ID", "TW", "GB", "SG", "JP", "UA"
+};
+
+static int dataset_make(dataset_t *d, size_t n) {
+    d->ip = malloc(n * sizeof(*d->ip));
+    d->addr = malloc(n * sizeof(*d->addr));
+    d->count = n;
+    if (!d->ip || !d->addr) {
+        return ERROR_FILE;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = rng_next();
+        unsigned kind = (unsigned)(r % 100);
+        uint32_t v4 = (uint32_t)(r >> 32);
+        if (kind < 90) {
+            snprintf(d->ip[i], IP_STR_LEN, "%u.%u.%u.%u",
+                     (v4 >> 24) & 0xff, (v4 >> 16) & 0xff, (v4 >> 8) & 0xff, v4 & 0xff);
+        } else if (kind < 95) {
+            snprintf(d->ip[i], IP_STR_LEN, "%u.%u.%u.0/24",
+                     (v4 >> 24) & 0xff, (v4 >> 16) & 0xff, (v4 >> 8) & 0xff);
+        } else {
+            snprintf(d->ip[i], IP_STR_LEN, "2001:db8:%x:%x::/64",
+                     (unsigned)(v4 >> 16), (unsigned)(v4 & 0xffff));
+        }
+        if (ip_addr_parse(d->ip[i], &d->addr[i]) != SUCCESS) {
+            return ERROR_INVALID_ARG;
+        }
+    }
+    return SUCCESS;
+}
+
+static void dataset_free(dataset_t *d) {
+    free(d->ip);
+    free(d->addr);
+}
+
+/* 单条操作重复多轮，使小数据集也有足够的样本 */
+static size_t rounds_for(size_t n) {
+    return (n >= BENCH_MIN_OPS) ? 1 : (BENCH_MIN_OPS + n - 1) / n;
+}
+
+static void bench_validate(const dataset_t *d) {
+    size_t rounds = rounds_for(d->count);
+    size_t ok = 0;
+    bench_clock_t c;
+    bench_start(&c);
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < d->count; i++) {
+            ok += validate_ip_format(d->ip[i]);
+        }
+    }
+    bench_report(&c, "validate_ip_format", d->count, rounds * d->count);
+    sink = ok;
+}
+
+static void bench_parse(const dataset_t *d) {
+    size_t rounds = rounds_for(d->count);
+    size_t ok = 0;
+    ip_info_t info;
+    bench_clock_t c;
+    bench_start(&c);
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < d->count; i++) {
+            ok += parse_ip_info(d->ip[i], &info) == SUCCESS;
+        }
+    }
+    bench_report(&c, "parse_ip_info", d->count, rounds * d->count);
+    sink = ok;
+}
+
+static void bench_format(const dataset_t *d) {
+    size_t rounds = rounds_for(d->count);
+    size_t len = 0;
+    char element[MAX_LINE_LEN];
+    bench_clock_t c;
+    bench_start(&c);
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < d->count; i++) {
+            format_nft_element(d->ip[i], element, sizeof(element), "24h");
+            len += (size_t)element[0];
+        }
+    }
+    bench_report(&c, "format_nft_element", d->count, rounds * d->count);
+    sink = len;
+}
+
+/* 白名单匹配：n条前缀建树，查询一半命中、一半随机的地址 */
+static void bench_whitelist(const dataset_t *d) {
+    struct stat src;
+    memset(&src, 0, sizeof(src));
+    lpm_t t;
+    bench_clock_t c;
+    bench_start(&c);
+    if (lpm_build(&t, d->addr, d->count, &src, NULL) != SUCCESS) {
+        return;
+    }
+    bench_report(&c, "whitelist_build", d->count, d->count);
+
+    size_t qn = BENCH_MIN_OPS;
+    ip_addr_t *queries = malloc(qn * sizeof(*queries));
+    if (!queries) {
+        lpm_close(&t);
+        return;
+    }
+    for (size_t i = 0; i < qn; i++) {
+        if (i & 1) {
+            queries[i] = d->addr[rng_next() % d->count];
+        } else {
+            char ip[IP_STR_LEN];
+            uint32_t v4 = (uint32_t)rng_next();
+            snprintf(ip, sizeof(ip), "%u.%u.%u.%u",
+                     (v4 >> 24) & 0xff, (v4 >> 16) & 0xff, (v4 >> 8) & 0xff, v4 & 0xff);
+            ip_addr_parse(ip, &queries[i]);
+        }
+    }
+
+    size_t hits = 0;
+    bench_start(&c);
+    for (size_t i = 0; i < qn; i++) {
+        hits += lpm_lookup(&t, &queries[i]) >= 0;
+    }
+    bench_report(&c, "whitelist_match", d->count, qn);
+    sink = hits;
+
+    free(queries);
+    lpm_close(&t);
+}
+
+/* 清空临时数据目录 */
+static void reset_store(void) {
+    char command[MAX_COMMAND_LEN];
+    snprintf(command, sizeof(command), "rm -rf '%s' && mkdir -p '%s'", CONFIG_DIR, CONFIG_DIR);
+    if (system(command) != 0) {
+        fprintf(stderr, "无法重建数据目录: %s\n", CONFIG_DIR);
+        exit(1);
+    }
+}
+
+/* 由合成数据生成n条记录的封禁库（导入后合并为快照） */
+static int make_store(const dataset_t *d) {
+    reset_store();
+    char list[MAX_PATH_LEN];
+    snprintf(list, sizeof(list), "%s/bench.txt", CONFIG_DIR);
+    FILE *fp = fopen(list, "w");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+    for (size_t i = 0; i < d->count; i++) {
+        fprintf(fp, "%s|%s\n", d->ip[i], countries[i % (sizeof(countries) / sizeof(countries[0]))]);
+    }
+    fclose(fp);
+
+    size_t imported = 0, invalid = 0;
+    int ret = store_import(list, &imported, &invalid);
+    remove(list);
+    return ret;
+}
+
+/* 重复封禁：追加日志，读取时回放去重 */
+static void bench_persist(const dataset_t *d) {
+    size_t ops = d->count < BENCH_MAX_APPENDS ? d->count : BENCH_MAX_APPENDS;
+    bench_clock_t c;
+    bench_start(&c);
+    for (size_t i = 0; i < ops; i++) {
+        persist_add_ip(d->ip[rng_next() % d->count], "", BAN_SOURCE_PAM);
+    }
+    bench_report(&c, "persist_add_ip", d->count, ops);
+
+    store_view_t view;
+    bench_start(&c);
+    if (store_load(&view) == SUCCESS) {
+        bench_report(&c, "store_load_dedup", d->count, 1);
+        sink = view.count;
+        store_view_free(&view);
+    }
+}
+
+/* 聚合统计只输出到终端，计时期间把标准输出重定向到 /dev/null */
+static void bench_report_quiet(const char *name, size_t n, void (*fn)(void)) {
+    size_t rounds = (n >= 1000000) ? 1 : (n >= 100000) ? 3 : 50;
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (saved < 0 || null_fd < 0) {
+        if (saved >= 0) close(saved);
+        if (null_fd >= 0) close(null_fd);
+        return;
+    }
+
+    bench_clock_t c;
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    bench_start(&c);
+    for (size_t r = 0; r < rounds; r++) {
+        fn();
+    }
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(null_fd);
+    bench_report(&c, name, n, rounds);
+}
+
+static void parse_sizes(const char *arg, size_t *sizes, size_t *count) {
+    *count = 0;
+    char buf[MAX_LINE_LEN];
+    snprintf(buf, sizeof(buf), "%s", arg);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok && *count < 8; tok = strtok_r(NULL, ",", &save)) {
+        long long v = atoll(tok);
+        if (v > 0) sizes[(*count)++] = (size_t)v;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    /* 会清空数据目录，只允许使用 make bench 指定的临时目录 */
+    if (strcmp(CONFIG_DIR, "/etc/bip") == 0) {
+        fprintf(stderr, "请使用 make bench 编译（数据目录指向临时目录）\n");
+        return 1;
+    }
+    
+    size_t sizes[8] = { 1000, 100000, 1000000 };
+    size_t size_count = 3;
+    if (argc >= 2) {
+        parse_sizes(argv[1], sizes, &size_count);
+        if (size_count == 0) {
+            fprintf(stderr, "用法: %s [N,N,..]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t s = 0; s < size_count; s++) {
+        dataset_t d;
+        if (dataset_make(&d, sizes[s]) != SUCCESS) {
+            fprintf(stderr, "无法生成 %zu 条数据\n", sizes[s]);
+            return 1;
+        }
+        fprintf(stderr, "[bench] n=%zu\n", d.count);
+
+        bench_validate(&d);
+        bench_parse(&d);
+        bench_format(&d);
+        bench_whitelist(&d);
+
+        if (make_store(&d) == SUCCESS) {
+            bench_report_quiet("subnet_aggregation", d.count, show_subnet_aggregation);
+            bench_report_quiet("country_stats", d.count, show_country_stats);
+            bench_persist(&d);
+        }
+        dataset_free(&d);
+    }
+
+    reset_store();
+    return 0;
+}
@@ -0,0 +1,484 @@
+/*
+ * PAM失败风暴压测（make loadtest）
+ *
+ * 按选定的来源分布并发启动 bip check（PAM_RHOST为合成地址），被测的 bip-load
+ * 与本程序在编译时指向同一个临时数据目录，防火墙使用记录后端（BIP_FIREWALL=record）。
+ * 结束后报告吞吐、每次调用的耗时分位数、丢失的计数更新和封禁正确性。
+ */
+#include "common.h"
+#include "ip_utils.h"
+#include "store.h"
+#include "metrics.h"
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define LOAD_DEFAULT_TOTAL 2000
+#define LOAD_DEFAULT_CONCURRENCY 32
+#define LOAD_DEFAULT_RETRIES 3
+#define LOAD_MAX_CONCURRENCY 1024
+#define LOAD_SETTLE_POLLS 5         /* 后台封禁进程计数连续不变的轮数（每轮100ms） */
+
+typedef enum {
+    DIST_HEAVY = 0,     /* 少数重度攻击源占90% */
+    DIST_BOTNET,        /* 大量来源，每个只尝试一两次 */
+    DIST_MIXED          /* IPv4/IPv6各半，重度来源与僵尸网络混合 */
+} load_dist_t;
+
+typedef struct {
+    size_t total;
+    int concurrency;
+    int retries;
+    load_dist_t dist;
+    bool daemon;
+    const char *bip;
+} load_opts_t;
+
+/* 每个来源的发送次数与记录到的封禁次数 */
+typedef struct {
+    char ip[IP_STR_LEN];
+    size_t sent;
+    size_t bans;
+} source_t;
+
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+#define LOAD_V4_SPACE (1u << 17)    /* 198.18.0.0/15 的地址数 */
+
+/* 第index个来源的地址：奇数乘数在 2^17 内是双射，来源之间互不重复 */
+static void source_addr(size_t index, bool ipv6, char *ip, size_t size) {
+    char text[IP_STR_LEN];
+    if (ipv6) {
+        uint64_t r = rng_next();
+        snprintf(text, sizeof(text), "2001:db8:%x:%x::%x",
+                 (unsigned)(r & 0xffff), (unsigned)((index >> 16) & 0xffff), (unsigned)(index & 0xffff));
+    } else {
+        /* 198.18.0.0/15 为测试保留网段 */
+        uint32_t off = (uint32_t)((index + 1) * 0x9E37u) & (LOAD_V4_SPACE - 1);
+        snprintf(text, sizeof(text), "198.%u.%u.%u", 18 + (off >> 16), (off >> 8) & 0xff, off & 0xff);
+    }
+    /* 统一为规范形式，与封禁记录中的地址直接比较 */
+    ip_canonicalize(text, ip, size);
+}
+
+/* 生成攻击序列：seq[i] 指向 sources 中的来源 */
+static size_t make_sequence(const load_opts_t *o, source_t **sources_out, size_t **seq_out) {
+    size_t heavy = 8;
+    size_t wide = (o->dist == DIST_HEAVY) ? o->total / 20 + 1 : o->total / 2 + 1;
+    size_t pool = heavy + wide;
+
+    if (pool > LOAD_V4_SPACE) {
+        fprintf(stderr, "来源过多: %zu（上限 %u）\n", pool, LOAD_V4_SPACE);
+        exit(1);
+    }
+
+    source_t *sources = calloc(pool, sizeof(*sources));
+    size_t *seq = malloc(o->total * sizeof(*seq));
+    if (!sources || !seq) {
+        fprintf(stderr, "内存不足\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < pool; i++) {
+        bool ipv6 = (o->dist == DIST_MIXED) && (i & 1);
+        source_addr(i, ipv6, sources[i].ip, sizeof(sources[i].ip));
+    }
+
+    for (size_t i = 0; i < o->total; i++) {
+        uint64_t r = rng_next();
+        unsigned pct = (unsigned)(r % 100);
+        size_t pick;
+        switch (o->dist) {
+        case DIST_HEAVY:
+            pick = (pct < 90) ? (size_t)(r >> 8) % heavy : heavy + (size_t)(r >> 8) % wide;
+            break;
+        case DIST_BOTNET:
+            pick = heavy + (size_t)(r >> 8) % wide;
+            break;
+        default:
+            pick = (pct < 30) ? (size_t)(r >> 8) % heavy : heavy + (size_t)(r >> 8) % wide;
+            break;
+        }
+        seq[i] = pick;
+        sources[pick].sent++;
+    }
+
+    *sources_out = sources;
+    *seq_out = seq;
+    return pool;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+/* 重建临时数据目录并写入测试配置 */
+static void prepare_dirs(const load_opts_t *o) {
+    char command[MAX_COMMAND_LEN];
+    snprintf(command, sizeof(command), "rm -rf '%s' && mkdir -p '%s/counts'", CONFIG_DIR, CONFIG_DIR);
+    if (system(command) != 0) {
+        fprintf(stderr, "无法重建数据目录: %s\n", CONFIG_DIR);
+        exit(1);
+    }
+    remove(METRICS_SHM_FILE);
+    remove(DAEMON_SOCKET);
+
+    FILE *fp = fopen(CONFIG_FILE, "w");
+    if (!fp) {
+        fprintf(stderr, "无法写入配置: %s\n", CONFIG_FILE);
+        exit(1);
+    }
+    /* 在线地理查询指向本机关闭的端口，补充国家信息时立即失败 */
+    fprintf(fp, "BAN_TIME=24h\nMAX_RETRIES=%d\nGEO_API=http://127.0.0.1:9/%%s\n", o->retries);
+    fclose(fp);
+
+    fp = fopen(WHITELIST_FILE, "w");
+    if (fp) fclose(fp);
+}
+
+static pid_t spawn_bip(const load_opts_t *o, const char *command, const char *ip) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+        setenv("BIP_FIREWALL", "record", 1);
+        setenv("PAM_TYPE", "auth", 1);
+        if (ip) setenv("PAM_RHOST", ip, 1);
+        execl(o->bip, "bip", command, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_source(const void *a, const void *b) {
+    return strcmp(((const source_t *)a)->ip, ((const source_t *)b)->ip);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, double q) {
+    if (n == 0) return 0;
+    size_t idx = (size_t)(q * (double)(n - 1) + 0.5);
+    return sorted[idx];
+}
+
+/* 并发执行整个序列，返回每次调用的耗时（纳秒） */
+static uint64_t* run_sequence(const load_opts_t *o, const source_t *sources, const size_t *seq,
+                              uint64_t *wall_ns, size_t *failed) {
+    uint64_t *lat = malloc(o->total * sizeof(*lat));
+    pid_t *pids = calloc((size_t)o->concurrency, sizeof(*pids));
+    uint64_t *starts = calloc((size_t)o->concurrency, sizeof(*starts));
+    if (!lat || !pids || !starts) {
+        fprintf(stderr, "内存不足\n");
+        exit(1);
+    }
+
+    size_t next = 0, done = 0;
+    *failed = 0;
+    uint64_t begin = now_ns();
+
+    while (done < o->total) {
+        for (int slot = 0; slot < o->concurrency && next < o->total; slot++) {
+            if (pids[slot] != 0) continue;
+            starts[slot] = now_ns();
+            pids[slot] = spawn_bip(o, "check", sources[seq[next]].ip);
+            if (pids[slot] < 0) {
+                pids[slot] = 0;
+                break;
+            }
+            next++;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int slot = 0; slot < o->concurrency; slot++) {
+            if (pids[slot] != pid) continue;
+            lat[done++] = now_ns() - starts[slot];
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                (*failed)++;
+            }
+            pids[slot] = 0;
+            break;
+        }
+    }
+
+    *wall_ns = now_ns() - begin;
+    free(pids);
+    free(starts);
+    return lat;
+}
+
+/* 认证失败与PAM封禁计数（后台封禁进程、守护进程处理完后不再变化） */
+static void read_counters(uint64_t *failures, uint64_t *bans) {
+    *failures = metrics_value(METRIC_FAILURES_PAM);
+    *bans = metrics_value(METRIC_BANS_PAM);
+}
+
+static void wait_settle(void) {
+    uint64_t last_f = UINT64_MAX, last_b = UINT64_MAX;
+    int stable = 0;
+    for (int i = 0; i < 200 && stable < LOAD_SETTLE_POLLS; i++) {
+        uint64_t f, b;
+        read_counters(&f, &b);
+        stable = (f == last_f && b == last_b) ? stable + 1 : 0;
+        last_f = f;
+        last_b = b;
+        sleep_ms(100);
+    }
+}
+
+static source_t* find_source(source_t *sources, size_t n, const char *ip) {
+    source_t key;
+    snprintf(key.ip, sizeof(key.ip), "%s", ip);
+    return bsearch(&key, sources, n, sizeof(*sources), cmp_source);
+}
+
+/* 统计记录后端中的封禁 */
+static size_t tally_bans(source_t *sources, size_t n, size_t *unknown) {
+    size_t total = 0;
+    *unknown = 0;
+    FILE *fp = fopen(FIREWALL_RECORD_FILE, "r");
+    if (!fp) return 0;
+    char line[MAX_LINE_LEN];
+    while (fgets(line, sizeof(line), fp)) {
+        char op[8], set[64], ip[IP_STR_LEN];
+        if (sscanf(line, "%7s %63s %49s", op, set, ip) != 3 || strcmp(op, "add") != 0) continue;
+        source_t *s = find_source(sources, n, ip);
+        if (s) {
+            s->bans++;
+            total++;
+        } else {
+            (*unknown)++;
+        }
+    }
+    fclose(fp);
+    return total;
+}
+
+/* 独立模式下残留在 counts/ 中的失败计数 */
+static size_t residual_counts(const source_t *sources, size_t n) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s", RECORD_DIR, sources[i].ip);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        int count = 0;
+        if (fscanf(fp, "%d", &count) == 1 && count > 0) {
+            total += (size_t)count;
+        }
+        fclose(fp);
+    }
+    return total;
+}
+
+static void format_ms(uint64_t ns, char *buf, size_t size) {
+    snprintf(buf, size, "%.2fms", (double)ns / 1e6);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "用法: %s [-n 次数] [-c 并发] [-d heavy|botnet|mixed] [-r 重试次数] [--daemon] [-b bip路径]\n"
+            "  默认 -n %d -c %d -d mixed -r %d -b ./bip-load\n",
+            prog, LOAD_DEFAULT_TOTAL, LOAD_DEFAULT_CONCURRENCY, LOAD_DEFAULT_RETRIES);
+}
+
+static int parse_args(int argc, char *argv[], load_opts_t *o) {
+    o->total = LOAD_DEFAULT_TOTAL;
+    o->concurrency = LOAD_DEFAULT_CONCURRENCY;
+    o->retries = LOAD_DEFAULT_RETRIES;
+    o->dist = DIST_MIXED;
+    o->daemon = false;
+    o->bip = "./bip-load";
+
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(a, "--daemon") == 0) {
+            o->daemon = true;
+        } else if (v && strcmp(a, "-n") == 0) {
+            o->total = (size_t)atol(v);
+            i++;
+        } else if (v && strcmp(a, "-c") == 0) {
+            o->concurrency = atoi(v);
+            i++;
+        } else if (v && strcmp(a, "-r") == 0) {
+            o->retries = atoi(v);
+            i++;
+        } else if (v && strcmp(a, "-b") == 0) {
+            o->bip = v;
+            i++;
+        } else if (v && strcmp(a, "-d") == 0) {
+            if (strcmp(v, "heavy") == 0) o->dist = DIST_HEAVY;
+            else if (strcmp(v, "botnet") == 0) o->dist = DIST_BOTNET;
+            else if (strcmp(v, "mixed") == 0) o->dist = DIST_MIXED;
+            else return ERROR_INVALID_ARG;
+            i++;
+        } else {
+            return ERROR_INVALID_ARG;
+        }
+    }
+    if (o->total == 0 || o->concurrency < 1 || o->concurrency > LOAD_MAX_CONCURRENCY ||
+        o->retries < 1 || o->retries > 10) {
+        return ERROR_INVALID_ARG;
+    }
+    return SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    /* 会清空数据目录，只允许使用 make loadtest 指定的临时目录 */
+    if (strcmp(CONFIG_DIR, "/etc/bip") == 0) {
+        fprintf(stderr, "请使用 make loadtest 编译（数据目录指向临时目录）\n");
+        return 1;
+    }
+
+    load_opts_t o;
+    if (parse_args(argc, argv, &o) != SUCCESS) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (access(o.bip, X_OK) != 0) {
+        fprintf(stderr, "找不到被测程序: %s\n", o.bip);
+        return 1;
+    }
+
+    prepare_dirs(&o);
+
+    source_t *sources;
+    size_t *seq;
+    size_t pool = make_sequence(&o, &sources, &seq);
+
+    /* 守护进程模式：先启动 bip daemon，等待套接字出现 */
+    pid_t daemon_pid = 0;
+    if (o.daemon) {
+        daemon_pid = spawn_bip(&o, "daemon", NULL);
+        for (int i = 0; i < 50 && access(DAEMON_SOCKET, F_OK) != 0; i++) {
+            sleep_ms(20);
+        }
+        if (access(DAEMON_SOCKET, F_OK) != 0) {
+            fprintf(stderr, "守护进程未能启动\n");
+            kill(daemon_pid, SIGTERM);
+            return 1;
+        }
+    }
+
+    uint64_t wall_ns;
+    size_t failed;
+    uint64_t *lat = run_sequence(&o, sources, seq, &wall_ns, &failed);
+    wait_settle();
+
+    if (daemon_pid > 0) {
+        kill(daemon_pid, SIGTERM);
+        waitpid(daemon_pid, NULL, 0);
+    }
+
+    /* 排序后按地址查找来源，seq 不再需要 */
+    free(seq);
+    qsort(sources, pool, sizeof(*sources), cmp_source);
+
+    size_t unknown;
+    size_t ban_calls = tally_bans(sources, pool, &unknown);
+    uint64_t counted, metric_bans;
+    read_counters(&counted, &metric_bans);
+
+    size_t expected_ips = 0, expected_calls = 0, banned_ips = 0, missed = 0, false_bans = 0;
+    for (size_t i = 0; i < pool; i++) {
+        const source_t *s = &sources[i];
+        size_t expect = s->sent / (size_t)o.retries;
+        expected_calls += expect;
+        if (expect > 0) expected_ips++;
+        if (s->bans > 0) banned_ips++;
+        if (expect > 0 && s->bans == 0) missed++;
+        if (expect == 0 && s->bans > 0) false_bans++;
+    }
+
+    /*
+     * 丢失的计数更新：每次失败应使计数加1，每次封禁消耗 retries 次计数。
+     * 独立模式的计数文件是读-改-写，并发时会丢失；守护进程模式丢失的是未处理的数据报。
+     */
+    size_t lost;
+    if (o.daemon) {
+        lost = (o.total > counted) ? o.total - (size_t)counted : 0;
+    } else {
+        size_t accounted = ban_calls * (size_t)o.retries + residual_counts(sources, pool);
+        lost = (o.total > accounted) ? o.total - accounted : 0;
+    }
+
+    /* 封禁库中的记录应与防火墙中封禁过的地址一致 */
+    size_t persisted = 0;
+    store_view_t view;
+    if (store_load(&view) == SUCCESS) {
+        persisted = view.count;
+        store_view_free(&view);
+    }
+
+    qsort(lat, o.total, sizeof(*lat), cmp_u64);
+    char p50[32], p99[32], p999[32], max[32];
+    format_ms(percentile(lat, o.total, 0.50), p50, sizeof(p50));
+    format_ms(percentile(lat, o.total, 0.99), p99, sizeof(p99));
+    format_ms(percentile(lat, o.total, 0.999), p999, sizeof(p999));
+    format_ms(lat[o.total - 1], max, sizeof(max));
+    free(lat);
+
+    static const char *dist_names[] = { "heavy", "botnet", "mixed" };
+    printf("模式: %s  分布: %s  来源: %zu  次数: %zu  并发: %d  重试阈值: %d\n",
+           o.daemon ? "daemon" : "standalone", dist_names[o.dist], pool, o.total, o.concurrency, o.retries);
+    printf("吞吐: %.0f 次/秒  (耗时 %.2fs，失败退出 %zu)\n",
+           (double)o.total / ((double)wall_ns / 1e9), (double)wall_ns / 1e9, failed);
+    printf("bip check 耗时: p50 %s  p99 %s  p999 %s  最大 %s\n", p50, p99, p999, max);
+
+    latency_summary_t inner;
+    if (metrics_latency(LATENCY_CHECK_TOTAL, &inner) == SUCCESS && inner.count > 0) {
+        printf("进程内耗时: p50 %.1fus  p99 %.1fus  p999 %.1fus\n",
+               (double)inner.p50_ns / 1e3, (double)inner.p99_ns / 1e3, (double)inner.p999_ns / 1e3);
+    }
+
+    printf("计数: 已计 %llu  丢失更新 %zu (%.2f%%)",
+           (unsigned long long)counted, lost, 100.0 * (double)lost / (double)o.total);
+    if (o.daemon) {
+        /* 队列满时阻塞等待，超时后改为本地计数 */
+        printf("  守护进程发送超时 %llu", (unsigned long long)metrics_value(METRIC_DAEMON_BUSY));
+    }
+    printf("\n");
+    printf("封禁: 应封 %zu 个来源/%zu 次  实封 %zu 个来源/%zu 次  漏封 %zu  误封 %zu  未知地址 %zu\n",
+           expected_ips, expected_calls, banned_ips, ban_calls, missed, false_bans, unknown);
+    printf("封禁库: %zu 条%s\n", persisted, persisted == banned_ips ? "" : "  (与防火墙不一致)");
+
+    /* 独立模式的计数文件读-改-写存在已知竞争，丢失更新可能导致漏封，单独报告不判失败 */
+    if (!o.daemon && missed > 0) {
+        printf("注意: 独立模式漏封 %zu 个来源（丢失更新 %zu 次，已知竞争，不计为失败）\n", missed, lost);
+    }
+
+    free(sources);
+
+    /* 误封、未知地址、封禁库不一致或守护进程模式漏封视为失败 */
+    bool ok = false_bans == 0 && unknown == 0 && persisted == banned_ips && failed == 0 &&
+              (!o.daemon || missed == 0);
+    return ok ? 0 : 1;
+}
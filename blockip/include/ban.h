@@ -3,16 +3,17 @@
 
 #include "common.h"
 #include "ip_utils.h"
+#include "store.h"
 #include <stdbool.h>
 
 /* 封禁IP */
-int ban_ip(const char *ip, bool save_to_disk);
+int ban_ip(const char *ip, bool save_to_disk, ban_source_t source);
 
 /* 解封IP */
 int unban_ip(const char *ip);
 
-/* 添加到持久化列表 */
-int persist_add_ip(const char *ip, const char *country_code);
+/* 添加到持久化列表（到期时间按当前封禁时长计算） */
+int persist_add_ip(const char *ip, const char *country_code, ban_source_t source);
 
 /* 从持久化列表移除 */
 int persist_remove_ip(const char *ip);
@@ -26,4 +27,7 @@ int restore_from_persist(void);
 /* 显示持久化列表 */
 void show_persist_list(void);
 
+/* 显示单个IP的持久化记录 */
+int show_persist_entry(const char *ip);
+
 #endif /* BAN_H */
@@ -0,0 +1,40 @@
+#ifndef COLLAPSE_H
+#define COLLAPSE_H
+
+#include "common.h"
+#include "ip_utils.h"
+#include <stdbool.h>
+
+/*
+ * 黑名单网段合并：删除被更大网段覆盖的条目，同一 /24（IPv6为 /64）内的封禁
+ * 达到阈值时合并为该网段，相邻的兄弟网段合并为上一级网段。
+ * 封禁存储和内核集合在同一次加锁中更新，集合变更为单个netlink事务。
+ */
+
+#define COLLAPSE_PREFIX_V4 24
+#define COLLAPSE_PREFIX_V6 64
+
+/* 合并结果统计 */
+typedef struct {
+    size_t before;          /* 合并前的有效条目数 */
+    size_t after;           /* 合并后的有效条目数 */
+    size_t covered;         /* 被更大网段覆盖而删除的条目 */
+    size_t collapsed;       /* 达到阈值合并出的网段 */
+    size_t merged;          /* 兄弟网段合并次数 */
+    size_t nft_removed;     /* 从集合删除的元素 */
+    size_t nft_added;       /* 向集合新增的元素 */
+} collapse_stats_t;
+
+/* 合并黑名单（threshold小于2时不做阈值合并），dry_run只统计不修改 */
+int collapse_run(int threshold, bool dry_run, collapse_stats_t *stats);
+
+/* 封禁后检查：封禁了网段，或所在 /24、/64 的封禁数达到配置的阈值时执行合并 */
+void collapse_after_ban(const ip_addr_t *addr);
+
+/*
+ * 解封前调用：addr被合并进更大的网段时，把该网段拆成不含addr的子网段，
+ * 存储和集合一起更新；没有覆盖的网段时不做任何修改。split返回拆分的网段数
+ */
+int collapse_split(const ip_addr_t *addr, size_t *split);
+
+#endif /* COLLAPSE_H */
@@ -11,27 +11,65 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <stdbool.h>
 
 /* 配置常量 */
 
 #define BIP_VERSION "v25.11.19"
+/* 数据目录、日志和运行时文件可在编译时覆盖（make bench/loadtest 使用临时目录，不触碰系统配置） */
+#ifndef CONFIG_DIR
 #define CONFIG_DIR "/etc/bip"
+#endif
 #define CONFIG_FILE CONFIG_DIR "/config"
+#ifndef LOG_FILE
 #define LOG_FILE "/var/log/bip.log"
+#endif
 #define MAX_LOG_SIZE 10485760  // 10MB
 #define DEFAULT_MAX_RETRIES 3
 #define DEFAULT_BAN_TIME "24h"
 #define DEFAULT_RATE_LIMIT 10
 #define DEFAULT_RATE_BAN_TIME "10m"
+#define DEFAULT_IDLE_TIMEOUT "10m"
+#define DEFAULT_SSH_LOG "off"
+#define DEFAULT_GEO_API "https://ipinfo.io/%s/country"
+#define DEFAULT_GEO_FILTER "off"
+#define DEFAULT_COLLAPSE 0          /* 同一 /24、/64 内封禁达到该数量时合并为网段，0为关闭 */
+#define DEFAULT_AGG_LEVELS "8,16,24"       /* bip list 聚合统计的IPv4网段层级 */
+#define DEFAULT_AGG_LEVELS_V6 "32,48,64"   /* IPv6网段层级 */
+#define MAX_AGG_LEVELS 8
+#define DEFAULT_METRICS_TEXTFILE "off"   /* node_exporter textfile 指标文件路径，off为关闭 */
+#define DEFAULT_FIREWALL_BACKEND "auto"  /* 防火墙后端：auto、native、cli、record */
 #define RECORD_DIR CONFIG_DIR "/counts"
 #define PERSIST_FILE CONFIG_DIR "/blacklist"
+#define PERSIST_DB_FILE CONFIG_DIR "/blacklist.db"
+#define PERSIST_JOURNAL_FILE CONFIG_DIR "/blacklist.journal"
 #define WHITELIST_FILE CONFIG_DIR "/whitelist"
+#define WHITELIST_LPM_FILE CONFIG_DIR "/whitelist.lpm"
+#define GEO_DB_FILE CONFIG_DIR "/geo.db"
+#define GEO_CACHE_FILE CONFIG_DIR "/geo.cache"
+#define GEO_ENRICH_LOCK_FILE CONFIG_DIR "/geo.lock"
+#define GEO_FILTER_STATE_FILE CONFIG_DIR "/geo.filter"
 #define INSTALL_PATH "/usr/local/bin/bip"
+#ifndef DAEMON_SOCKET
+#define DAEMON_SOCKET "/run/bip.sock"
+#endif
+#ifndef METRICS_SHM_FILE
+#define METRICS_SHM_FILE "/run/bip.metrics"
+#endif
+#define FIREWALL_RECORD_FILE CONFIG_DIR "/firewall.record"
+#define DAEMON_STATE_FILE CONFIG_DIR "/daemon.state"
+#define FOLLOW_POS_FILE CONFIG_DIR "/follow.pos"
 #define NFT_TABLE "inet bip"
+#define NFT_TABLE_NAME "bip"
 #define NFT_SET "blacklist"
 #define NFT_SET_V6 "blacklist_v6"
 #define NFT_WHITELIST "whitelist"
 #define NFT_WHITELIST_V6 "whitelist_v6"
+#define NFT_GEO_SET "geo_filter"
+#define NFT_GEO_SET_V6 "geo_filter_v6"
+#define NFT_RATELIMIT "ssh-ratelimit"
+#define NFT_RATELIMIT_V6 "ssh-ratelimit_v6"
+#define NFT_RULESET_FILE CONFIG_DIR "/bip.nft"
 
 /* 缓冲区大小 */
 #define MAX_LINE_LEN 512
@@ -66,6 +104,38 @@ int check_root(void);
 /* 获取当前时间戳字符串 */
 void get_timestamp(char *buffer, size_t size);
 
+/* 解析时长字符串（如 24h, 30m, 1h30m），返回毫秒；空串返回0，非法返回-1 */
+long long parse_duration_ms(const char *str);
+
+/* 配置文件解析结果，时长和数值已校验（非法值为默认值） */
+typedef struct {
+    char ban_time[32];
+    long long ban_time_ms;          /* 0为永久封禁 */
+    int max_retries;
+    int rate_limit;
+    char rate_ban_time[32];
+    long long rate_ban_time_ms;
+    char idle_timeout[32];
+    long long idle_timeout_ms;      /* 0为常驻不退出 */
+    char ssh_log[MAX_PATH_LEN];
+    char geo_api[MAX_PATH_LEN];
+    char geo_filter[MAX_LINE_LEN];
+    int collapse;
+    int agg_levels[2][MAX_AGG_LEVELS];  /* [0] IPv4，[1] IPv6 */
+    int agg_count[2];
+    char metrics_textfile[MAX_PATH_LEN];
+    char firewall_backend[16];
+} bip_config_t;
+
+/* 获取配置（进程内解析一次，文件变化后自动重新加载；下面的 get_*_from_config 均读取此缓存） */
+const bip_config_t* config_get(void);
+
+/* 开始批量保存：之后的 save_*_to_config 只暂存，直到 config_batch_commit */
+void config_batch_begin(void);
+
+/* 把暂存的全部改动一次原子写入配置文件 */
+int config_batch_commit(void);
+
 /* 读取配置文件中的封禁时间 */
 const char* get_ban_time_from_config(void);
 
@@ -93,4 +163,52 @@ const char* get_rate_ban_time_from_config(void);
 /* 保存速率限制封禁时间 */
 int save_rate_ban_time_to_config(const char *ban_time);
 
+/* 获取守护进程空闲退出时间 */
+const char* get_idle_timeout_from_config(void);
+
+/* 保存守护进程空闲退出时间 */
+int save_idle_timeout_to_config(const char *idle_timeout);
+
+/* 获取守护进程跟踪的sshd日志（off/auto/路径） */
+const char* get_ssh_log_from_config(void);
+
+/* 保存守护进程跟踪的sshd日志 */
+int save_ssh_log_to_config(const char *ssh_log);
+
+/* 获取在线地理查询接口（URL中的 %s 替换为IP，返回两位国家代码） */
+const char* get_geo_api_from_config(void);
+
+/* 保存在线地理查询接口 */
+int save_geo_api_to_config(const char *geo_api);
+
+/* 获取网段合并阈值（0为关闭） */
+int get_collapse_from_config(void);
+
+/* 保存网段合并阈值（0 或 2-256） */
+int save_collapse_to_config(int threshold);
+
+/* 获取聚合统计的网段层级（升序前缀长度），返回层级数 */
+int get_agg_levels_from_config(bool ipv6, int levels[MAX_AGG_LEVELS]);
+
+/* 保存聚合统计的网段层级（如 8,16,24） */
+int save_agg_levels_to_config(bool ipv6, const char *levels);
+
+/* 获取指标文件路径（off 或 .prom 绝对路径） */
+const char* get_metrics_textfile_from_config(void);
+
+/* 保存指标文件路径 */
+int save_metrics_textfile_to_config(const char *path);
+
+/* 获取防火墙后端名称（环境变量 BIP_FIREWALL 优先） */
+const char* get_firewall_backend_from_config(void);
+
+/* 保存防火墙后端（auto、native、cli 或 record） */
+int save_firewall_backend_to_config(const char *backend);
+
+/* 获取国家过滤策略（off、block:CN,RU 或 allow:CN） */
+const char* get_geo_filter_from_config(void);
+
+/* 保存国家过滤策略 */
+int save_geo_filter_to_config(const char *geo_filter);
+
 #endif /* COMMON_H */
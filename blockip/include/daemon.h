@@ -0,0 +1,15 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "common.h"
+
+/* 守护进程主循环（bip daemon / bipd），follow_path为NULL时按配置跟踪sshd日志 */
+int daemon_run(const char *follow_path);
+
+/*
+ * 向守护进程发送一个事件（check/clean）。守护进程不存在时返回 ERROR_FILE（调用方回退到独立模式），
+ * 守护进程存在但发送超时返回 ERROR_NETWORK（调用方在本地计数，由守护进程稍后合并）
+ */
+int daemon_notify(const char *command, const char *ip);
+
+#endif /* DAEMON_H */
@@ -0,0 +1,38 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include "common.h"
+#include <stdbool.h>
+
+/* sshd日志事件 */
+typedef enum {
+    SSHD_EVENT_NONE = 0,
+    SSHD_EVENT_FAILURE,     /* 认证失败或预认证阶段的异常连接 */
+    SSHD_EVENT_SUCCESS      /* 登录成功 */
+} sshd_event_t;
+
+/* 事件回调 */
+typedef void (*follow_cb_t)(sshd_event_t event, const char *ip);
+
+/*
+ * 解析一行日志并提取来源IP（raw为true时整行即消息，如 journalctl -o cat）。
+ * 按顺序逐行调用：Invalid user 行暂存，由同一连接（IP+端口）的认证失败或连接结束行计数一次
+ */
+sshd_event_t sshd_parse_line(const char *line, size_t len, bool raw, char *ip, size_t ip_size);
+
+/* 解析日志路径（"auto" 自动探测），返回NULL表示未找到 */
+const char* follow_resolve_path(const char *path);
+
+/* 开始跟踪日志文件（"-" 为标准输入），返回用于poll的描述符 */
+int follow_open(const char *path);
+
+/* 读取新增内容并回调事件；输入结束返回ERROR_FILE */
+int follow_read(follow_cb_t cb);
+
+/* 保存读取位置（最多每秒一次，force强制写入） */
+void follow_save_position(bool force);
+
+/* 停止跟踪并保存位置 */
+void follow_close(void);
+
+#endif /* FOLLOW_H */
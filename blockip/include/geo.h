@@ -3,13 +3,19 @@
 
 #include "common.h"
 
+#define GEO_ENRICH_BUDGET 32        /* 每次封禁后台最多发出的在线查询数 */
+#define GEO_ENRICH_DEFAULT 1000     /* bip geo enrich 默认的在线查询数 */
+
 /* 查询IP的国家代码 */
 int query_country_code(const char *ip, char *country_code, size_t size);
 
 /* 获取国家名称 */
 const char* get_country_name(const char *country_code);
 
-/* 补充持久化文件中缺失的国家信息 */
-void supplement_country_info(const char *current_ip);
+/*
+ * 补充黑名单中缺失的国家信息：离线库/缓存能解析的全部补齐，其余按网段去重后
+ * 批量在线查询，最多发出 budget 个请求，结果一次写入。已有补充进程运行时直接返回。
+ */
+int geo_enrich_pending(size_t budget, size_t *annotated);
 
 #endif /* GEO_H */
@@ -0,0 +1,45 @@
+#ifndef GEOBLOCK_H
+#define GEOBLOCK_H
+
+#include "common.h"
+#include <stdbool.h>
+
+/*
+ * 国家过滤：由离线地理数据库生成SSH端口的 geo_filter/geo_filter_v6 区间集合，
+ * 内核直接丢弃，不经过PAM、单条nft操作和持久化。
+ */
+
+#define GEO_FILTER_MAX_COUNTRIES 64
+
+typedef enum {
+    GEO_FILTER_OFF = 0,
+    GEO_FILTER_BLOCK,       /* 丢弃来自所列国家的SSH连接 */
+    GEO_FILTER_ALLOW        /* 只允许所列国家（及内网地址）连接SSH */
+} geo_filter_mode_t;
+
+typedef struct {
+    geo_filter_mode_t mode;
+    size_t count;
+    char countries[GEO_FILTER_MAX_COUNTRIES][3];
+} geo_filter_t;
+
+/* 读取配置中的过滤策略（无效配置视为关闭） */
+void geo_filter_load(geo_filter_t *filter);
+
+/* 规则集是否需要加载过滤规则（允许模式下离线数据库不可用时不加载，避免误封） */
+bool geo_filter_active(const geo_filter_t *filter);
+
+/*
+ * 按当前策略和离线数据库同步内核集合，结果记录到 geo.filter。
+ * full为false时与上次加载的区间比较，只提交差异；否则清空后全量加载。
+ * 所有变更在一个netlink事务中提交。
+ */
+int geoblock_sync(bool full, size_t *added, size_t *removed);
+
+/* 修改过滤策略（countries为逗号分隔的国家代码），同步集合并重新加载规则 */
+int geoblock_set(geo_filter_mode_t mode, const char *countries);
+
+/* 显示当前策略和已加载的区间数 */
+void geoblock_show(void);
+
+#endif /* GEOBLOCK_H */
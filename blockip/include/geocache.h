@@ -0,0 +1,40 @@
+#ifndef GEOCACHE_H
+#define GEOCACHE_H
+
+#include "common.h"
+#include "ip_utils.h"
+
+/*
+ * 地理查询缓存：按 /24（IPv4）或 /48（IPv6）缓存在线查询结果，
+ * 查询失败也会缓存（较短TTL），多个bip进程通过文件锁共享。
+ */
+
+/* 已加锁映射的缓存文件，批量查询时打开一次，避免逐条 open/flock/mmap */
+typedef struct {
+    int fd;
+    void *base;
+    size_t size;
+} geocache_t;
+
+/* 打开缓存并持有排他锁（文件不存在或格式不符时重新初始化） */
+int geocache_open(geocache_t *cache);
+
+/* 释放锁并解除映射 */
+void geocache_close(geocache_t *cache);
+
+/* 在已打开的缓存中查询，返回值同 geocache_get */
+int geocache_lookup(geocache_t *cache, const ip_addr_t *addr, char *country_code, size_t size);
+
+/* 在已打开的缓存中写入，参数同 geocache_put */
+void geocache_store(geocache_t *cache, const ip_addr_t *addr, const char *country_code);
+
+/* 查询缓存：命中返回SUCCESS，命中失败记录返回ERROR_NETWORK，未命中返回ERROR_FILE */
+int geocache_get(const ip_addr_t *addr, char *country_code, size_t size);
+
+/* 地址所在的缓存前缀（同一前缀的地址共用一次在线查询） */
+void geocache_prefix(const ip_addr_t *addr, ip_addr_t *prefix);
+
+/* 写入查询结果（country_code为NULL表示查询失败） */
+void geocache_put(const ip_addr_t *addr, const char *country_code);
+
+#endif /* GEOCACHE_H */
@@ -0,0 +1,64 @@
+#ifndef GEODB_H
+#define GEODB_H
+
+#include "common.h"
+#include "ip_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 文件头 */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t v4_count;
+    uint32_t v6_count;
+    int64_t built_at;
+    uint64_t reserved[2];
+} geodb_header_t;
+
+/* IPv4区间（主机字节序，闭区间） */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    char country[2];
+    uint8_t reserved[2];
+} geodb_range_v4_t;
+
+/* IPv6区间（网络字节序，闭区间） */
+typedef struct {
+    uint8_t start[16];
+    uint8_t end[16];
+    char country[2];
+    uint8_t reserved[6];
+} geodb_range_v6_t;
+
+/* 编译结果统计 */
+typedef struct {
+    size_t v4_count;
+    size_t v6_count;
+    size_t invalid;         /* 无法解析的行 */
+    size_t skipped;         /* 无国家代码（如 ZZ、-）的行 */
+} geodb_stats_t;
+
+/*
+ * 由CSV编译区间表，原子替换 db_path。支持的行格式：
+ *   起始IP,结束IP,国家代码[,...]     （如 DB-IP lite）
+ *   起始整数,结束整数,国家代码[,...] （如 IP2Location LITE DB1，仅IPv4）
+ *   网段,国家代码
+ */
+int geodb_compile(const char *csv_path, const char *db_path, geodb_stats_t *stats);
+
+/* 数据库是否可用（文件被替换后自动重新映射） */
+bool geodb_available(void);
+
+/* 二分查找地址所属国家，未收录或无数据库返回ERROR_FILE */
+int geodb_lookup(const ip_addr_t *addr, char *country_code, size_t size);
+
+/* 当前映射的数据库（不可用时返回NULL） */
+const geodb_header_t* geodb_header(void);
+
+/* 当前映射的区间表（按起始地址排序且互不重叠，不可用时返回NULL） */
+const geodb_range_v4_t* geodb_ranges_v4(size_t *count);
+const geodb_range_v6_t* geodb_ranges_v6(size_t *count);
+
+#endif /* GEODB_H */
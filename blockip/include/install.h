@@ -19,4 +19,7 @@ int remove_pam_hooks(void);
 /* 创建systemd服务 */
 int create_systemd_service(void);
 
+/* 按配置创建并启用（或停用并删除）定时写指标文件的systemd定时器 */
+int setup_metrics_timer(void);
+
 #endif /* INSTALL_H */
@@ -3,6 +3,19 @@
 
 #include "common.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* 规范化IP字符串的最大长度（含 "/128"） */
+#define IP_STR_LEN (INET6_ADDRSTRLEN + 4)
+
+/* 二进制地址/前缀：入口处解析一次，内部比较和哈希都是整数运算 */
+typedef struct {
+    uint8_t family;     /* AF_INET / AF_INET6 */
+    uint8_t prefixlen;  /* IPv4: 0-32, IPv6: 0-128 */
+    uint8_t addr[16];   /* IPv4 按 ::ffff:a.b.c.d 存放，前缀外的位清零 */
+} ip_addr_t;
 
 /* IP类型 */
 typedef enum {
@@ -15,12 +28,43 @@ typedef enum {
 
 /* IP信息结构 */
 typedef struct {
-    char ip[MAX_IP_LEN];
+    ip_addr_t addr;
+    char ip[IP_STR_LEN];        /* 规范化形式 */
     char country_code[MAX_COUNTRY_CODE];
     ip_type_t type;
     int cidr_mask;
 } ip_info_t;
 
+/* 解析IP/CIDR（IPv4映射的IPv6地址归为IPv4，主机位清零） */
+int ip_addr_parse(const char *str, ip_addr_t *addr);
+
+/* 输出规范化字符串（单个地址不带前缀长度） */
+void ip_addr_format(const ip_addr_t *addr, char *buf, size_t size);
+
+/* 将IP/CIDR字符串规范化，如 ::ffff:1.2.3.4 → 1.2.3.4，1.2.3.4/24 → 1.2.3.0/24 */
+int ip_canonicalize(const char *str, char *buf, size_t size);
+
+/* 比较两个地址（地址族、地址、前缀长度） */
+int ip_addr_cmp(const ip_addr_t *a, const ip_addr_t *b);
+
+/* 判断两个地址是否相同 */
+bool ip_addr_equal(const ip_addr_t *a, const ip_addr_t *b);
+
+/* 截取前缀：out为addr所在的prefixlen网段（out可与addr相同） */
+void ip_addr_truncate(const ip_addr_t *addr, int prefixlen, ip_addr_t *out);
+
+/* 判断网段net是否包含地址/网段addr */
+bool ip_addr_contains(const ip_addr_t *net, const ip_addr_t *addr);
+
+/* 地址哈希 */
+uint32_t ip_addr_hash(const ip_addr_t *addr);
+
+/* 地址族对应的网络字节序地址及长度（IPv4为4字节，IPv6为16字节） */
+const uint8_t* ip_addr_bytes(const ip_addr_t *addr, uint8_t *len);
+
+/* 判断是否为单个地址 */
+bool ip_addr_is_host(const ip_addr_t *addr);
+
 /* 判断是否为IPv6 */
 bool is_ipv6(const char *ip);
 
@@ -39,7 +83,4 @@ bool validate_ip_format(const char *ip);
 /* 格式化IP为nftables元素 */
 void format_nft_element(const char *ip, char *output, size_t size, const char *timeout);
 
-/* 检查IP是否匹配白名单 */
-bool ip_matches_whitelist_entry(const char *ip, const char *whitelist_entry);
-
 #endif /* IP_UTILS_H */
@@ -0,0 +1,51 @@
+#ifndef LPM_H
+#define LPM_H
+
+#include "common.h"
+#include "ip_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 前缀树节点（下标0表示空，IPv4/IPv6各一个根节点） */
+typedef struct {
+    uint32_t child[2];
+    uint8_t terminal;       /* 该深度上存在一个前缀 */
+    uint8_t reserved[3];
+} lpm_node_t;
+
+/* 文件头：记录源文件状态，用于判断是否需要重新编译 */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t src_ino;
+    uint64_t src_size;
+    int64_t src_mtime_sec;
+    int64_t src_mtime_nsec;
+    uint32_t node_count;
+    uint32_t root_v4;
+    uint32_t root_v6;
+    uint32_t reserved;
+} lpm_header_t;
+
+/* 编译后的前缀树（mmap的旁路文件或内存中构建的副本） */
+typedef struct {
+    void *base;
+    size_t size;
+    bool mapped;
+    const lpm_header_t *header;
+    const lpm_node_t *nodes;
+} lpm_t;
+
+/* 由地址/前缀列表构建前缀树，path非NULL时原子写入旁路文件 */
+int lpm_build(lpm_t *t, const ip_addr_t *entries, size_t count, const struct stat *src, const char *path);
+
+/* 映射旁路文件，源文件状态不一致时返回错误 */
+int lpm_open(lpm_t *t, const char *path, const struct stat *src);
+
+/* 最长前缀匹配，返回匹配的前缀长度，未命中返回-1（无内存分配） */
+int lpm_lookup(const lpm_t *t, const ip_addr_t *addr);
+
+/* 释放前缀树 */
+void lpm_close(lpm_t *t);
+
+#endif /* LPM_H */
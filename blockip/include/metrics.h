@@ -0,0 +1,87 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "common.h"
+#include "store.h"
+#include <stdint.h>
+
+/*
+ * 运行指标：各个bip进程（PAM钩子、守护进程、封禁子进程）对 /run 下的共享计数文件
+ * 做原子递增，导出时只读取计数文件并通过netlink读取集合大小和规则计数器，不启动nft。
+ * 同一文件还保存PAM路径各阶段的耗时直方图（对数分桶，相对误差约6%）。
+ */
+
+typedef enum {
+    METRIC_FAILURES_PAM = 0,    /* PAM上报的认证失败 */
+    METRIC_FAILURES_LOG,        /* 守护进程从sshd日志识别的失败 */
+    METRIC_BANS_MANUAL,         /* 各来源的封禁次数 */
+    METRIC_BANS_PAM,
+    METRIC_BANS_RATELIMIT,
+    METRIC_BANS_IMPORT,
+    METRIC_BANS_LOG,
+    METRIC_UNBANS_MANUAL,       /* bip del 解封 */
+    METRIC_GEOCACHE_HITS,
+    METRIC_GEOCACHE_MISSES,
+    METRIC_DAEMON_BUSY,         /* 守护进程队列满且发送超时，事件改为本地计数 */
+    METRIC_COUNT
+} metric_id_t;
+
+/* PAM路径计时阶段 */
+typedef enum {
+    LATENCY_CHECK_TOTAL = 0,    /* bip check 全程 */
+    LATENCY_CHECK_NOTIFY,       /* 向守护进程发送数据报 */
+    LATENCY_CHECK_WHITELIST,    /* is_in_whitelist */
+    LATENCY_CHECK_COUNT,        /* get_failure_count */
+    LATENCY_CHECK_RECORD,       /* record_failure */
+    LATENCY_CHECK_CONFIG,       /* get_max_retries_from_config */
+    LATENCY_CHECK_LOG,          /* log_write */
+    LATENCY_CHECK_FORK,         /* async_ban_ip 的fork */
+    LATENCY_CLEAN_TOTAL,        /* bip clean 全程 */
+    LATENCY_CLEAN_NOTIFY,
+    LATENCY_CLEAN_COUNT,
+    LATENCY_CLEAN_LOG,
+    LATENCY_CLEAN_CLEAR,        /* clear_failure_record */
+    LATENCY_COUNT
+} latency_phase_t;
+
+/* 某阶段的耗时汇总（纳秒） */
+typedef struct {
+    uint64_t count;
+    uint64_t mean_ns;
+    uint64_t max_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+} latency_summary_t;
+
+/* 计数加n（计数文件不可用时忽略） */
+void metrics_add(metric_id_t id, uint64_t n);
+
+/* 计数加1 */
+void metrics_inc(metric_id_t id);
+
+/* 按封禁来源计数 */
+void metrics_ban(ban_source_t source, uint64_t n);
+
+/* 读取计数当前值 */
+uint64_t metrics_value(metric_id_t id);
+
+/* 单调时钟（纳秒） */
+uint64_t metrics_now_ns(void);
+
+/* 记录从 *start 到现在的耗时，并把 *start 设为记录之后的时间（不计入记录本身的开销） */
+void metrics_lap(latency_phase_t phase, uint64_t *start);
+
+/* 阶段名称，如 check.whitelist */
+const char* latency_phase_name(latency_phase_t phase);
+
+/* 读取某阶段的耗时汇总，计数文件不可用时返回 ERROR_FILE */
+int metrics_latency(latency_phase_t phase, latency_summary_t *summary);
+
+/* 输出Prometheus文本格式指标 */
+int metrics_write(FILE *fp);
+
+/* 写入指标文件（node_exporter textfile），临时文件+rename原子替换；path为NULL时输出到标准输出 */
+int metrics_export(const char *path);
+
+#endif /* METRICS_H */
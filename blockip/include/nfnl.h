@@ -0,0 +1,75 @@
+#ifndef NFNL_H
+#define NFNL_H
+
+#include "common.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 批处理缓冲区（BATCH_BEGIN ... BATCH_END 作为一个原子事务提交） */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t msg_off;         /* 当前消息起始偏移 */
+    size_t nest_off[4];     /* 嵌套属性起始偏移 */
+    int nest_depth;
+    int msg_count;          /* 需要ACK的消息数 */
+    bool oom;
+} nfnl_batch_t;
+
+/* 打开nfnetlink套接字（进程内复用），失败返回 -errno */
+int nfnl_open(void);
+
+/* 关闭套接字 */
+void nfnl_close(void);
+
+/* 初始化/释放批处理缓冲区 */
+void nfnl_batch_init(nfnl_batch_t *b);
+void nfnl_batch_free(nfnl_batch_t *b);
+
+/* 开始一条nf_tables消息（type为NFT_MSG_*） */
+void nfnl_msg_begin(nfnl_batch_t *b, uint16_t type, uint16_t flags, uint8_t family);
+
+/* 结束当前消息 */
+void nfnl_msg_end(nfnl_batch_t *b);
+
+/* 当前消息长度 */
+size_t nfnl_msg_len(const nfnl_batch_t *b);
+
+/* 写入属性 */
+void nfnl_put(nfnl_batch_t *b, uint16_t type, const void *data, size_t len);
+void nfnl_put_str(nfnl_batch_t *b, uint16_t type, const char *str);
+void nfnl_put_be32(nfnl_batch_t *b, uint16_t type, uint32_t value);
+void nfnl_put_be64(nfnl_batch_t *b, uint16_t type, uint64_t value);
+
+/* 嵌套属性 */
+void nfnl_nest_begin(nfnl_batch_t *b, uint16_t type);
+void nfnl_nest_end(nfnl_batch_t *b);
+
+/* 提交批处理：一次sendmsg，等待全部ACK；成功返回0，否则返回第一个 -errno */
+int nfnl_batch_commit(nfnl_batch_t *b);
+
+/* 应答中的一个属性 */
+typedef struct {
+    uint16_t type;
+    uint16_t len;
+    const void *data;
+} nfnl_attr_t;
+
+/* 逐条处理dump应答（data为nfgenmsg之后的属性），返回非0时不再回调 */
+typedef int (*nfnl_dump_fn)(const void *data, size_t len, void *ctx);
+
+/*
+ * 发送req中的一条 NLM_F_DUMP 请求并逐条回调应答，直到内核结束dump。
+ * 应答边收边处理，不缓存整个结果；成功返回0，否则返回 -errno
+ */
+int nfnl_dump(nfnl_batch_t *req, nfnl_dump_fn fn, void *ctx);
+
+/* 遍历属性：取出pos处的属性并前移，没有更多属性时返回false */
+bool nfnl_attr_next(const void **pos, size_t *remain, nfnl_attr_t *attr);
+
+/* 读取属性值 */
+uint32_t nfnl_attr_be32(const nfnl_attr_t *attr);
+uint64_t nfnl_attr_be64(const nfnl_attr_t *attr);
+
+#endif /* NFNL_H */
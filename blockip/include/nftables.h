@@ -3,17 +3,93 @@
 
 #include "common.h"
 #include "ip_utils.h"
+#include "nfnl.h"
 #include <stdbool.h>
+#include <stdint.h>
+
+/* 集合元素区间 [start, end)，end溢出地址空间时 has_end=false */
+typedef struct {
+    uint8_t start[16];
+    uint8_t end[16];
+    uint8_t klen;       /* 4=IPv4, 16=IPv6 */
+    bool has_end;
+} nft_interval_t;
+
+/* 集合中的一个元素（区间及其超时） */
+typedef struct {
+    nft_interval_t iv;
+    uint64_t timeout_ms;    /* 0为永久 */
+    uint64_t expires_ms;    /* 剩余时间 */
+} nft_element_t;
+
+/* 带注释规则的计数器 */
+typedef struct {
+    char comment[32];
+    uint64_t packets;
+    uint64_t bytes;
+} nft_rule_counter_t;
+
+/* 逐个处理规则计数器 */
+typedef int (*nft_counter_fn)(const nft_rule_counter_t *counter, void *ctx);
+
+/* 逐个处理集合元素，返回非0时停止 */
+typedef int (*nft_element_fn)(const nft_element_t *elem, void *ctx);
+
+/* 集合元素批处理（一次提交为一个事务），内容由当前后端解释 */
+typedef struct {
+    nfnl_batch_t nl;        /* netlink后端：消息缓冲 */
+    FILE *fp;               /* 命令行/记录后端：文本脚本（open_memstream） */
+    char *text;
+    size_t text_len;
+    size_t ops;             /* 已追加的操作数 */
+} nft_batch_t;
+
+/*
+ * 防火墙后端：native 直接使用nfnetlink，cli 调用 nft 命令，
+ * record 不访问内核，把操作追加到 FIREWALL_RECORD_FILE 并按记录模拟集合内容和超时。
+ * 环境变量 BIP_FIREWALL 优先于配置项 FIREWALL_BACKEND；auto 优先native，不可用时回退cli
+ */
+typedef struct {
+    const char *name;
+    bool (*available)(void);
+    int (*init_ruleset)(bool recreate);     /* SUCCESS 或 ERROR_* */
+    void (*put_elements)(nft_batch_t *b, const char *set_name, const nft_interval_t *const *ivs,
+                         const uint64_t *timeouts_ms, size_t count, uint64_t timeout_ms);
+    void (*del_elements)(nft_batch_t *b, const char *set_name, const nft_interval_t *const *ivs, size_t count);
+    void (*flush_set)(nft_batch_t *b, const char *set_name);
+    int (*commit)(nft_batch_t *b);          /* 0 或 -errno，批处理可再次提交 */
+    int (*dump_set)(const char *set_name, nft_element_fn fn, void *ctx);
+    int (*dump_counters)(nft_counter_fn fn, void *ctx);
+} nft_backend_t;
+
+extern const nft_backend_t nft_native_backend;
+extern const nft_backend_t nft_cli_backend;
+extern const nft_backend_t nft_record_backend;
+
+/* 当前进程使用的后端（首次调用时选择） */
+const nft_backend_t* nft_backend(void);
+
+/* 当前后端能否使用（native需能打开nfnetlink，cli需有nft命令） */
+bool nft_available(void);
 
 /* 检查并安装nftables环境 */
 int check_and_install_nftables(void);
 
-/* 初始化nftables规则 */
+/* 初始化nftables规则（单事务声明式加载，可重复执行） */
 int init_nftables_rules(void);
 
+/* 删除并重建整个规则集（定义冲突时使用，集合元素需重新恢复） */
+int reset_nftables_rules(void);
+
+/* 写出规则集文件 NFT_RULESET_FILE（各后端加载规则集时共用） */
+int nft_write_ruleset_file(bool recreate);
+
 /* 添加IP到nftables黑名单 */
 int nft_add_to_blacklist(const ip_info_t *ip_info);
 
+/* 按指定超时（毫秒，0为永久）添加到黑名单，用于恢复时保留每条记录的剩余时长 */
+int nft_add_timed_to_blacklist(const ip_addr_t *addr, uint64_t timeout_ms);
+
 /* 从nftables黑名单移除IP */
 int nft_remove_from_blacklist(const char *ip);
 
@@ -23,10 +99,56 @@ int nft_add_to_whitelist(const char *ip);
 /* 从nftables白名单移除IP */
 int nft_remove_from_whitelist(const char *ip);
 
-/* 获取nftables集合中的元素数量 */
-int nft_get_set_count(const char *set_name);
+/* 将IP/CIDR或地址范围（a-b）解析为集合区间 */
+int nft_parse_interval(const char *ip, nft_interval_t *iv);
+
+/* 将集合区间格式化为nft元素文本（单个前缀为IP/CIDR，否则为 a-b） */
+void nft_format_interval(const nft_interval_t *iv, char *buf, size_t size);
+
+/* 将二进制地址/前缀转换为集合区间 */
+void nft_interval_from_addr(const ip_addr_t *addr, nft_interval_t *iv);
+
+/* 将集合区间还原为地址/前缀（区间不是单个前缀时返回 ERROR_INVALID_ARG，addr为起始地址） */
+int nft_interval_to_addr(const nft_interval_t *iv, ip_addr_t *addr);
+
+/*
+ * 逐个读取集合元素（区间）后回调，边收边处理，不缓存整个集合；
+ * 失败返回 ERROR_NETWORK
+ */
+int nft_dump_set(const char *set_name, nft_element_fn fn, void *ctx);
+
+/* 读取input链中带注释和计数器的规则，失败返回 ERROR_NETWORK */
+int nft_dump_counters(nft_counter_fn fn, void *ctx);
+
+/* 初始化/释放批处理 */
+void nft_batch_init(nft_batch_t *b);
+void nft_batch_free(nft_batch_t *b);
+
+/* 批处理是否为空 */
+bool nft_batch_empty(const nft_batch_t *b);
+
+/* 提交批处理（原子事务），返回0或-errno */
+int nft_batch_commit(nft_batch_t *b);
+
+/* 向批处理追加集合元素（按消息大小自动拆分） */
+void nft_batch_put_elements(nft_batch_t *b, const char *set_name,
+                            const nft_interval_t *const *ivs, size_t count, uint64_t timeout_ms);
+
+/* 向批处理追加集合元素，逐个指定超时（0为永久） */
+void nft_batch_put_timed_elements(nft_batch_t *b, const char *set_name,
+                                  const nft_interval_t *const *ivs, const uint64_t *timeouts_ms, size_t count);
+
+/* 向批处理追加集合元素删除（区间须与集合中的元素完全一致） */
+void nft_batch_del_elements(nft_batch_t *b, const char *set_name,
+                            const nft_interval_t *const *ivs, size_t count);
+
+/* 向批处理追加清空集合 */
+void nft_batch_flush_set(nft_batch_t *b, const char *set_name);
+
+/* 后端共用：文本后端的批处理输出流（首次调用时创建） */
+FILE* nft_batch_stream(nft_batch_t *b);
 
-/* 列出nftables集合中的元素 */
-int nft_list_set_elements(const char *set_name, char *buffer, size_t size);
+/* 后端共用：取出文本后端的脚本内容，返回长度 */
+size_t nft_batch_script(nft_batch_t *b, const char **text);
 
 #endif /* NFTABLES_H */
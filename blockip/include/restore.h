@@ -0,0 +1,9 @@
+#ifndef RESTORE_H
+#define RESTORE_H
+
+#include "common.h"
+
+/* 批量恢复黑白名单：一次解析、多线程校验、单个nft事务提交 */
+int restore_all_lists(void);
+
+#endif /* RESTORE_H */
@@ -2,8 +2,39 @@
 #define STATS_H
 
 #include "common.h"
+#include "nftables.h"
 #include <stdbool.h>
 
+#define ACTIVE_SHOW 2       /* 即将过期、最新封禁各显示的条数 */
+
+typedef struct {
+    nft_element_t elem;
+    uint64_t key;
+} elem_row_t;
+
+/* 按key保留最小的若干个元素（大顶堆，堆顶为当前保留的最大key） */
+typedef struct {
+    elem_row_t rows[ACTIVE_SHOW * 2];
+    size_t count;
+} elem_heap_t;
+
+/*
+ * 一次 bip list 使用的内核集合快照：每个集合只dump一次，边收边统计，
+ * 只保留计数和固定大小的堆，内存与集合大小无关
+ */
+typedef struct {
+    bool valid;
+    size_t banned[2];           /* 黑名单区间数（IPv4/IPv6） */
+    size_t permanent;           /* 其中永久封禁 */
+    elem_heap_t soonest;        /* 即将过期：key为剩余时间 */
+    elem_heap_t newest;         /* 最新封禁：key为已封禁时长 */
+    size_t rate_tracked[2];     /* 限速集合中的来源数（IPv4/IPv6） */
+    elem_heap_t rate_newest;    /* 最近的新连接来源 */
+} list_snapshot_t;
+
+/* 读取黑名单和限速集合 */
+int list_snapshot_take(list_snapshot_t *snap);
+
 /* 显示完整统计信息 */
 void show_statistics(void);
 
@@ -11,7 +42,10 @@ void show_statistics(void);
 void show_statistics_watch(bool watch_mode);
 
 /* 显示活跃封禁列表 */
-void show_active_bans(void);
+void show_active_bans(const list_snapshot_t *snap);
+
+/* 显示SSH速率限制状态 */
+void show_rate_limit(const list_snapshot_t *snap);
 
 /* 显示国家统计 */
 void show_country_stats(void);
@@ -19,4 +53,7 @@ void show_country_stats(void);
 /* 显示IP段聚合统计 */
 void show_subnet_aggregation(void);
 
+/* 显示PAM路径各阶段耗时分位数 */
+void show_latency_stats(void);
+
 #endif /* STATS_H */
@@ -0,0 +1,85 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "common.h"
+#include "ip_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 封禁来源 */
+typedef enum {
+    BAN_SOURCE_MANUAL = 0,  /* bip add */
+    BAN_SOURCE_PAM,         /* PAM上报的认证失败次数达到阈值 */
+    BAN_SOURCE_RATELIMIT,   /* 连接速率超限 */
+    BAN_SOURCE_IMPORT,      /* 从文本列表导入 */
+    BAN_SOURCE_LOG          /* 守护进程跟踪sshd日志识别的失败次数达到阈值 */
+} ban_source_t;
+
+/* 持久化封禁记录 */
+typedef struct {
+    ip_addr_t addr;
+    char country[MAX_COUNTRY_CODE];
+    uint8_t source;
+    uint32_t hits;          /* 累计封禁次数 */
+    time_t banned_at;       /* 最近一次封禁时间 */
+    time_t expires_at;      /* 到期时间，0为永久 */
+} store_entry_t;
+
+/* 快照与日志合并后的当前状态（按首次封禁顺序） */
+typedef struct {
+    store_entry_t *entries;
+    size_t count;
+    size_t invalid;         /* 导入文本中无法解析的行数 */
+    size_t corrupt;         /* 日志中校验失败、回放时跳过的记录数 */
+} store_view_t;
+
+/* 追加一条封禁记录（O(1)追加写，重复封禁在回放时累加次数） */
+int store_add(const ip_addr_t *addr, const char *country, ban_source_t source, time_t expires_at);
+
+/* 追加一条解封记录 */
+int store_remove(const ip_addr_t *addr);
+
+/* 追加一条国家信息标注 */
+int store_annotate(const ip_addr_t *addr, const char *country);
+
+/* 一次写入批量标注国家信息（只使用 addr 和 country 字段） */
+int store_annotate_batch(const store_entry_t *entries, size_t count);
+
+/* 按地址查询单条记录（哈希索引+日志，不加载整个列表），返回是否存在 */
+bool store_lookup(const ip_addr_t *addr, store_entry_t *entry);
+
+/* 读取快照并回放日志 */
+int store_load(store_view_t *view);
+
+/* 释放合并结果 */
+void store_view_free(store_view_t *view);
+
+/* 将日志合并进快照并清空日志 */
+int store_compact(void);
+
+/*
+ * 原子改写整个列表：在排他锁内读取当前列表交给回调，回调填写 replacement
+ * （entries为NULL表示不改写）并返回SUCCESS后写成新快照，期间其他封禁等待。
+ */
+typedef int (*store_rewrite_fn)(const store_view_t *current, store_view_t *replacement, void *ctx);
+int store_rewrite(store_rewrite_fn fn, void *ctx);
+
+/* 日志超过阈值时合并（其他进程持有锁时跳过） */
+void store_maybe_compact(void);
+
+/* 从文本列表（每行 "IP" 或 "IP|国家代码"）导入，返回导入条数 */
+int store_import(const char *path, size_t *imported, size_t *invalid);
+
+/* 导出为文本列表 */
+int store_export(FILE *fp);
+
+/* 记录是否仍有效（永久或未到期） */
+bool store_entry_live(const store_entry_t *e, time_t now);
+
+/* 有效记录的剩余封禁时长（毫秒），永久为0 */
+uint64_t store_remaining_ms(const store_entry_t *e, time_t now);
+
+/* 来源名称 */
+const char* ban_source_name(uint8_t source);
+
+#endif /* STORE_H */
@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * 跟踪模式：环境变量 BIP_TRACE=1（或 stderr）输出到标准错误，BIP_TRACE=<绝对路径> 追加到该文件。
+ * 链接时用 -Wl,--wrap 接管 system/popen/pclose/fopen/fclose/open/rename/mkstemp/fdopen/close/unlink，逐条记录外部命令
+ * （命令、耗时、退出状态）和文件打开/重写，进程退出时输出按命令和按文件的汇总。
+ * 未设置 BIP_TRACE 时包装函数直接调用原函数。
+ */
+
+/* 是否处于跟踪模式 */
+bool trace_enabled(void);
+
+/* 开始计时，返回单调时钟纳秒（未跟踪时返回0） */
+uint64_t trace_start(void);
+
+/* 记录由 fork/exec 启动的外部命令（system/popen 之外的路径），status 为 waitpid 状态，-1为启动失败 */
+void trace_command(const char *command, uint64_t start_ns, int status);
+
+#endif /* TRACE_H */
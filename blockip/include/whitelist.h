@@ -2,11 +2,18 @@
 #define WHITELIST_H
 
 #include "common.h"
+#include "ip_utils.h"
 #include <stdbool.h>
 
 /* 检查IP是否在白名单中 */
 bool is_in_whitelist(const char *ip);
 
+/* 白名单文件变化时重新载入前缀树（先尝试映射旁路文件，失效则重新编译） */
+void whitelist_refresh(void);
+
+/* 在已载入的前缀树中查找（需先调用 whitelist_refresh） */
+bool whitelist_match(const ip_addr_t *addr);
+
 /* 添加IP到白名单文件 */
 int whitelist_add_to_file(const char *ip);
 
@@ -1,26 +1,26 @@
 #include "ban.h"
 #if defined(__unix__) || defined(__linux__)
-#include <fcntl.h>      // O_CREAT, O_RDWR
-#include <sys/file.h>   // flock, LOCK_EX, LOCK_UN
 #include <signal.h>     // SIGCHLD, SIG_IGN
 #else
-#define O_CREAT 0x0100
-#define O_RDWR  0x0002
-#define LOCK_EX 2
-#define LOCK_UN 8
 #define SIGCHLD 17
 #define SIG_IGN ((void (*)(int))1)
 #endif
 #include "nftables.h"
+#include "nfnl.h"
 #include "whitelist.h"
 #include "geo.h"
+#include "collapse.h"
 #include "log.h"
+#include "metrics.h"
 
 
-int ban_ip(const char *ip, bool save_to_disk) {
-    if (!ip || !validate_ip_format(ip)) {
+int ban_ip(const char *ip_input, bool save_to_disk, ban_source_t source) {
+    /* 解析为规范形式，后续全部使用规范化的地址 */
+    ip_info_t info;
+    if (!ip_input || parse_ip_info(ip_input, &info) != SUCCESS) {
         return ERROR_INVALID_ARG;
     }
+    const char *ip = info.ip;
     
     /* 检查白名单 */
     if (is_in_whitelist(ip)) {
@@ -28,12 +28,6 @@ int ban_ip(const char *ip, bool save_to_disk) {
         return SUCCESS;
     }
     
-    /* 解析IP信息 */
-    ip_info_t info;
-    if (parse_ip_info(ip, &info) != SUCCESS) {
-        return ERROR_INVALID_ARG;
-    }
-    
     /* 立即添加到nftables（关键操作，不能延迟） */
     if (nft_add_to_blacklist(&info) != SUCCESS) {
         return ERROR_FILE;
@@ -41,32 +35,31 @@ int ban_ip(const char *ip, bool save_to_disk) {
     
     /* 先保存到磁盘（不查询国家） */
     if (save_to_disk) {
-        persist_add_ip(ip, "");
+        persist_add_ip(ip, "", source);
+        metrics_ban(source, 1);
         log_write("[执行封禁] IP=%s 已封禁", ip);
-    }
-    
-    /* 异步查询国家信息（耗时操作，放在后台执行） */
-    bool should_query = save_to_disk && !is_ipv6(ip) && !is_cidr(ip);
-    if (should_query) {
+        
+        /* 国家查询和日志合并都是耗时操作，放在后台执行 */
         /* 设置忽略SIGCHLD信号，防止僵尸进程 */
         signal(SIGCHLD, SIG_IGN);
         
         pid_t pid = fork();
         if (pid == 0) {
-            /* 子进程：执行耗时的网络查询 */
-            char country_code[MAX_COUNTRY_CODE] = {0};
-            if (query_country_code(ip, country_code, sizeof(country_code)) == SUCCESS) {
-                /* 更新持久化文件中的国家信息 */
-                update_ip_country(ip, country_code);
-                log_write("[地理查询] IP=%s 国家=%s", ip, get_country_name(country_code));
-            }
+            /* 子进程不能与守护进程共用继承来的nfnetlink套接字（同一端口号会互抢ACK），按需重新打开 */
+            nfnl_close();
+            
+            /* 封禁了网段或同一网段封禁过多时合并集合元素 */
+            collapse_after_ban(&info.addr);
             
-            /* 补充其他IP的国家信息 */
-            supplement_country_info(ip);
+            /* 批量补充待查询的国家信息（包括刚封禁的地址） */
+            geo_enrich_pending(GEO_ENRICH_BUDGET, NULL);
+            
+            /* 日志过长时合并进快照 */
+            store_maybe_compact();
             _exit(0);
         }
         /* 父进程：立即返回 */
-    } else if (!save_to_disk) {
+    } else {
         log_write("[执行封禁] IP=%s 已封禁", ip);
     }
     
@@ -74,201 +67,84 @@ int ban_ip(const char *ip, bool save_to_disk) {
 }
 
 int unban_ip(const char *ip) {
-    if (!ip) {
+    ip_addr_t addr;
+    if (!ip || ip_addr_parse(ip, &addr) != SUCCESS) {
         return ERROR_INVALID_ARG;
     }
     
+    /* 地址已合并进更大的网段时只删除它自身的元素不起作用，先拆分网段 */
+    if (collapse_split(&addr, NULL) != SUCCESS) {
+        log_write("[手动解封] IP=%s 所在的合并网段拆分失败，未解封", ip);
+        return ERROR_FILE;
+    }
+    
     /* 从nftables移除 */
     nft_remove_from_blacklist(ip);
     
     /* 从持久化文件移除 */
     persist_remove_ip(ip);
+    metrics_inc(METRIC_UNBANS_MANUAL);
     
     log_write("[手动解封] IP=%s", ip);
     
     return SUCCESS;
 }
 
-int persist_add_ip(const char *ip, const char *country_code) {
-    if (!ip) {
+int persist_add_ip(const char *ip, const char *country_code, ban_source_t source) {
+    ip_addr_t addr;
+    if (!ip || ip_addr_parse(ip, &addr) != SUCCESS) {
         return ERROR_INVALID_ARG;
     }
     
-    /* 加锁 */
-    char lock_file[MAX_PATH_LEN];
-    snprintf(lock_file, sizeof(lock_file), "%s.lock", PERSIST_FILE);
-    
-    int lock_fd = open(lock_file, O_CREAT | O_RDWR, 0600);
-    if (lock_fd < 0) {
-        return ERROR_FILE;
-    }
-    
-    flock(lock_fd, LOCK_EX);
-    
-    /* 检查是否已存在 */
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    bool exists = false;
-    
-    if (fp) {
-        char line[MAX_LINE_LEN];
-        while (fgets(line, sizeof(line), fp)) {
-            line[strcspn(line, "\n")] = 0;
-            
-            /* 提取IP部分 */
-            char *pipe = strchr(line, '|');
-            if (pipe) *pipe = '\0';
-            
-            if (strcmp(line, ip) == 0) {
-                exists = true;
-                break;
-            }
-        }
-        fclose(fp);
-    }
-    
-    /* 添加到文件 */
-    if (!exists) {
-        fp = fopen(PERSIST_FILE, "a");
-        if (fp) {
-            if (country_code && strlen(country_code) > 0) {
-                fprintf(fp, "%s|%s\n", ip, country_code);
-            } else {
-                fprintf(fp, "%s\n", ip);
-            }
-            fclose(fp);
-        }
-    }
-    
-    flock(lock_fd, LOCK_UN);
-    close(lock_fd);
+    /* 永久封禁时到期时间为0 */
+    long long ban_ms = config_get()->ban_time_ms;
+    time_t expires_at = (ban_ms > 0) ? time(NULL) + (time_t)(ban_ms / 1000) : 0;
     
-    return SUCCESS;
+    /* 追加写日志，无需重写整个文件 */
+    return store_add(&addr, country_code, source, expires_at);
 }
 
 int persist_remove_ip(const char *ip) {
-    if (!ip) {
+    ip_addr_t addr;
+    if (!ip || ip_addr_parse(ip, &addr) != SUCCESS) {
         return ERROR_INVALID_ARG;
     }
     
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    if (!fp) {
-        return ERROR_FILE;
-    }
-    
-    char temp_file[MAX_PATH_LEN];
-    snprintf(temp_file, sizeof(temp_file), "%s.tmp", PERSIST_FILE);
-    FILE *temp_fp = fopen(temp_file, "w");
-    if (!temp_fp) {
-        fclose(fp);
-        return ERROR_FILE;
-    }
-    
-    char line[MAX_LINE_LEN];
-    while (fgets(line, sizeof(line), fp)) {
-        char line_copy[MAX_LINE_LEN];
-        snprintf(line_copy, sizeof(line_copy), "%s", line);
-        line_copy[strcspn(line_copy, "\n")] = 0;
-        
-        /* 提取IP部分 */
-        char *pipe = strchr(line_copy, '|');
-        if (pipe) *pipe = '\0';
-        
-        if (strcmp(line_copy, ip) != 0) {
-            fputs(line, temp_fp);
-        }
-    }
-    
-    fclose(fp);
-    fclose(temp_fp);
-    
-    rename(temp_file, PERSIST_FILE);
-    return SUCCESS;
+    return store_remove(&addr);
 }
 
 int update_ip_country(const char *ip, const char *country_code) {
-    if (!ip || !country_code) {
+    ip_addr_t addr;
+    if (!ip || !country_code || ip_addr_parse(ip, &addr) != SUCCESS) {
         return ERROR_INVALID_ARG;
     }
     
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    if (!fp) {
-        return ERROR_FILE;
-    }
-    
-    char temp_file[MAX_PATH_LEN];
-    snprintf(temp_file, sizeof(temp_file), "%s.tmp", PERSIST_FILE);
-    FILE *temp_fp = fopen(temp_file, "w");
-    if (!temp_fp) {
-        fclose(fp);
-        return ERROR_FILE;
-    }
-    
-    char line[MAX_LINE_LEN];
-    bool found = false;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        char line_copy[MAX_LINE_LEN];
-        snprintf(line_copy, sizeof(line_copy), "%s", line);
-        line_copy[strcspn(line_copy, "\n")] = 0;
-        
-        /* 提取IP部分 */
-        char *pipe = strchr(line_copy, '|');
-        if (pipe) *pipe = '\0';
-        
-        if (strcmp(line_copy, ip) == 0 && !found) {
-            /* 找到目标IP，更新国家信息 */
-            fprintf(temp_fp, "%s|%s\n", ip, country_code);
-            found = true;
-        } else {
-            /* 保持原样 */
-            fputs(line, temp_fp);
-        }
-    }
-    
-    fclose(fp);
-    fclose(temp_fp);
-    
-    rename(temp_file, PERSIST_FILE);
-    return SUCCESS;
+    return store_annotate(&addr, country_code);
 }
 
 int restore_from_persist(void) {
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    if (!fp) {
-        return SUCCESS;  /* 文件不存在 */
+    store_view_t view;
+    if (store_load(&view) != SUCCESS) {
+        return ERROR_FILE;
     }
     
-    char line[MAX_LINE_LEN];
-    int count = 0;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\n")] = 0;
-        
-        if (strlen(line) == 0) continue;
-        
-        /* 提取IP部分 */
-        char ip[MAX_IP_LEN];
-        char *pipe = strchr(line, '|');
-        if (pipe) {
-            *pipe = '\0';
-            strncpy(ip, line, sizeof(ip) - 1);
-        } else {
-            strncpy(ip, line, sizeof(ip) - 1);
+    /* 已到期的记录不再恢复，其余按剩余时长恢复（不保存到磁盘） */
+    int count = 0, expired = 0;
+    time_t now = time(NULL);
+    for (size_t i = 0; i < view.count; i++) {
+        const store_entry_t *e = &view.entries[i];
+        if (!store_entry_live(e, now)) {
+            expired++;
+            continue;
         }
-        ip[sizeof(ip) - 1] = '\0';
-        
-        /* 恢复到nftables（不保存到磁盘） */
-        ip_info_t info;
-        if (parse_ip_info(ip, &info) == SUCCESS) {
-            if (nft_add_to_blacklist(&info) == SUCCESS) {
-                count++;
-            }
+        if (nft_add_timed_to_blacklist(&e->addr, store_remaining_ms(e, now)) == SUCCESS) {
+            count++;
         }
     }
     
-    fclose(fp);
+    store_view_free(&view);
     
-    log_write("[系统恢复] 已从磁盘恢复 %d 个黑名单 IP", count);
+    log_write("[系统恢复] 已从磁盘恢复 %d 个黑名单 IP (已到期跳过 %d)", count, expired);
     
     char message[MAX_LINE_LEN];
     snprintf(message, sizeof(message), "✅ 已从磁盘恢复 %d 个黑名单 IP", count);
@@ -277,36 +153,30 @@ int restore_from_persist(void) {
     return SUCCESS;
 }
 
-void show_persist_list(void) {
-    msg(C_CYAN, "=== 📋 本地持久化封禁列表 ===");
-    
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    if (!fp) {
-        printf("(暂无持久化记录)\n");
+/* 格式化封禁时间（0显示为"-"） */
+static void format_ban_time(time_t t, char *buf, size_t size) {
+    struct tm tm;
+    if (t <= 0 || !localtime_r(&t, &tm)) {
+        snprintf(buf, size, "-");
         return;
     }
+    strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+void show_persist_list(void) {
+    msg(C_CYAN, "=== 📋 本地持久化封禁列表 ===");
     
-    /* 检查文件是否为空 */
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    if (file_size <= 0) {
-        fclose(fp);
+    store_view_t view;
+    if (store_load(&view) != SUCCESS || view.count == 0) {
+        store_view_free(&view);
         printf("(暂无持久化记录)\n");
         return;
     }
     
-    rewind(fp);
-    
     /* 统计 */
-    int total = 0, ipv4_count = 0, ipv6_count = 0;
-    char line[MAX_LINE_LEN];
-    
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\n")] = 0;
-        if (strlen(line) == 0) continue;
-        
-        total++;
-        if (strchr(line, ':')) {
+    int total = (int)view.count, ipv4_count = 0, ipv6_count = 0;
+    for (size_t i = 0; i < view.count; i++) {
+        if (view.entries[i].addr.family == AF_INET6) {
             ipv6_count++;
         } else {
             ipv4_count++;
@@ -318,26 +188,52 @@ void show_persist_list(void) {
            C_CYAN, ipv4_count, C_RESET,
            C_YELLOW, ipv6_count, C_RESET);
     
-    printf("%s%-25s %-15s%s\n", C_YELLOW, "IP 地址", "国家/地区", C_RESET);
-    printf("------------------------------------------\n");
+    printf("%s%-25s %-10s %-10s %-6s %s%s\n", C_YELLOW, "IP 地址", "国家/地区", "来源", "次数", "封禁时间", C_RESET);
+    printf("--------------------------------------------------------------------------\n");
     
-    rewind(fp);
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\n")] = 0;
-        if (strlen(line) > 0) {
-            /* 解析IP和国家 */
-            char *pipe = strchr(line, '|');
-            
-            if (pipe) {
-                *pipe = '\0';
-                printf("%-25s %s\n", line, get_country_name(pipe + 1));
-            } else {
-                printf("%-25s %s\n", line, "-");
-            }
-        }
+    for (size_t i = 0; i < view.count; i++) {
+        const store_entry_t *e = &view.entries[i];
+        char ip[IP_STR_LEN];
+        char when[32];
+        ip_addr_format(&e->addr, ip, sizeof(ip));
+        format_ban_time(e->banned_at, when, sizeof(when));
+        printf("%-25s %-10s %-10s %-6u %s\n", ip, e->country[0] ? get_country_name(e->country) : "-",
+               ban_source_name(e->source), e->hits, when);
     }
     
-    fclose(fp);
+    size_t corrupt = view.corrupt;
+    store_view_free(&view);
     printf("\n");
-    printf("%s📌 文件位置: %s%s\n", C_CYAN, PERSIST_FILE, C_RESET);
+    if (corrupt > 0) {
+        printf("%s⚠️  追加日志中有 %zu 条记录校验失败，已跳过%s\n", C_YELLOW, corrupt, C_RESET);
+    }
+    printf("%s📌 文件位置: %s（快照）、%s（追加日志）%s\n", C_CYAN, PERSIST_DB_FILE, PERSIST_JOURNAL_FILE, C_RESET);
+}
+
+int show_persist_entry(const char *ip) {
+    ip_addr_t addr;
+    if (!ip || ip_addr_parse(ip, &addr) != SUCCESS) {
+        return ERROR_INVALID_ARG;
+    }
+    
+    char canonical[IP_STR_LEN];
+    ip_addr_format(&addr, canonical, sizeof(canonical));
+    
+    store_entry_t e;
+    if (!store_lookup(&addr, &e)) {
+        printf("%s 不在本地封禁列表中\n", canonical);
+        return ERROR_FILE;
+    }
+    
+    char banned[32], expires[32];
+    format_ban_time(e.banned_at, banned, sizeof(banned));
+    format_ban_time(e.expires_at, expires, sizeof(expires));
+    
+    printf("IP 地址:   %s%s%s\n", C_GREEN, canonical, C_RESET);
+    printf("国家/地区: %s\n", e.country[0] ? get_country_name(e.country) : "-");
+    printf("来源:      %s\n", ban_source_name(e.source));
+    printf("封禁次数:  %u\n", e.hits);
+    printf("封禁时间:  %s\n", banned);
+    printf("到期时间:  %s\n", e.expires_at > 0 ? expires : "永久");
+    return SUCCESS;
 }
@@ -0,0 +1,460 @@
+#include "collapse.h"
+#include "log.h"
+#include "nftables.h"
+#include "store.h"
+#include <errno.h>
+#include <stdint.h>
+
+/* 合并过程中的一个集合元素 */
+typedef struct {
+    store_entry_t entry;
+    size_t orig;            /* 对应的原条目下标，新生成的网段为SIZE_MAX */
+    bool changed;           /* 需要在集合中重新写入（新网段或到期时间变化） */
+} collapse_node_t;
+
+typedef struct {
+    int threshold;
+    bool dry_run;
+    collapse_stats_t stats;
+} collapse_ctx_t;
+
+/*
+ * 把src的记录并入dst：次数累加，返回到期时间是否变化。
+ * 被覆盖的条目并入已有网段时到期时间取较晚者（永久优先）；
+ * 成员合并出的新网段取最早者，不会让任一成员的地址封禁得比原来更久
+ */
+static bool merge_entry(store_entry_t *dst, const store_entry_t *src, bool earliest) {
+    dst->hits += src->hits;
+    if (src->banned_at > dst->banned_at) {
+        dst->banned_at = src->banned_at;
+        dst->source = src->source;
+    }
+    if (strcmp(dst->country, src->country) != 0) {
+        dst->country[0] = '\0';
+    }
+
+    if (earliest) {
+        if (src->expires_at != 0 && (dst->expires_at == 0 || src->expires_at < dst->expires_at)) {
+            dst->expires_at = src->expires_at;
+            return true;
+        }
+        return false;
+    }
+
+    if (dst->expires_at == 0) {
+        return false;
+    }
+    if (src->expires_at == 0 || src->expires_at > dst->expires_at) {
+        dst->expires_at = src->expires_at;
+        return true;
+    }
+    return false;
+}
+
+static int cmp_node(const void *a, const void *b) {
+    return ip_addr_cmp(&((const collapse_node_t *)a)->entry.addr, &((const collapse_node_t *)b)->entry.addr);
+}
+
+/* 删除被覆盖的条目（已排序：网段排在它包含的条目之前） */
+static size_t prune_covered(collapse_node_t *nodes, size_t count, collapse_stats_t *stats) {
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (out > 0 && ip_addr_contains(&nodes[out - 1].entry.addr, &nodes[i].entry.addr)) {
+            if (merge_entry(&nodes[out - 1].entry, &nodes[i].entry, false)) {
+                nodes[out - 1].changed = true;
+            }
+            stats->covered++;
+            continue;
+        }
+        nodes[out++] = nodes[i];
+    }
+    return out;
+}
+
+/* 同一 /24、/64 内达到阈值的条目合并为该网段 */
+static size_t collapse_groups(collapse_node_t *nodes, size_t count, int threshold, collapse_stats_t *stats) {
+    size_t out = 0;
+    size_t i = 0;
+    while (i < count) {
+        const ip_addr_t *addr = &nodes[i].entry.addr;
+        int len = (addr->family == AF_INET) ? COLLAPSE_PREFIX_V4 : COLLAPSE_PREFIX_V6;
+        if (addr->prefixlen <= len) {
+            nodes[out++] = nodes[i++];
+            continue;
+        }
+
+        ip_addr_t group;
+        ip_addr_truncate(addr, len, &group);
+        size_t end = i + 1;
+        while (end < count && nodes[end].entry.addr.prefixlen > len &&
+               ip_addr_contains(&group, &nodes[end].entry.addr)) {
+            end++;
+        }
+
+        if (end - i < (size_t)threshold) {
+            while (i < end) {
+                nodes[out++] = nodes[i++];
+            }
+            continue;
+        }
+
+        collapse_node_t merged = nodes[i];
+        for (size_t k = i + 1; k < end; k++) {
+            merge_entry(&merged.entry, &nodes[k].entry, true);
+        }
+        merged.entry.addr = group;
+        merged.orig = SIZE_MAX;
+        merged.changed = true;
+        nodes[out++] = merged;
+        stats->collapsed++;
+        i = end;
+    }
+    return out;
+}
+
+/* 两个同长度的网段是否可以合并为上一级网段 */
+static bool is_sibling(const ip_addr_t *a, const ip_addr_t *b) {
+    if (a->family != b->family || a->prefixlen != b->prefixlen || a->prefixlen == 0) {
+        return false;
+    }
+    ip_addr_t pa, pb;
+    ip_addr_truncate(a, a->prefixlen - 1, &pa);
+    ip_addr_truncate(b, b->prefixlen - 1, &pb);
+    return ip_addr_equal(&pa, &pb);
+}
+
+/* 兄弟网段逐级向上合并（有序且互不包含的列表，用栈一次扫描完成） */
+static size_t merge_siblings(collapse_node_t *nodes, size_t count, collapse_stats_t *stats) {
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++) {
+        nodes[out++] = nodes[i];
+        while (out >= 2 && is_sibling(&nodes[out - 2].entry.addr, &nodes[out - 1].entry.addr)) {
+            collapse_node_t parent = nodes[out - 2];
+            merge_entry(&parent.entry, &nodes[out - 1].entry, true);
+            ip_addr_truncate(&parent.entry.addr, parent.entry.addr.prefixlen - 1, &parent.entry.addr);
+            parent.orig = SIZE_MAX;
+            parent.changed = true;
+            out--;
+            nodes[out - 1] = parent;
+            stats->merged++;
+        }
+    }
+    return out;
+}
+
+/* 按地址族收集待提交的元素 */
+typedef struct {
+    nft_interval_t *items;
+    const nft_interval_t **ptrs[2];
+    uint64_t *timeouts[2];
+    size_t count[2];
+} element_list_t;
+
+static int elements_init(element_list_t *l, size_t cap) {
+    memset(l, 0, sizeof(*l));
+    l->items = malloc((cap + 1) * sizeof(*l->items));
+    for (int f = 0; f < 2; f++) {
+        l->ptrs[f] = malloc((cap + 1) * sizeof(*l->ptrs[f]));
+        l->timeouts[f] = malloc((cap + 1) * sizeof(*l->timeouts[f]));
+    }
+    return (l->items && l->ptrs[0] && l->ptrs[1] && l->timeouts[0] && l->timeouts[1]) ? SUCCESS : ERROR_FILE;
+}
+
+static void elements_push(element_list_t *l, const store_entry_t *e, time_t now) {
+    int f = (e->addr.family == AF_INET) ? 0 : 1;
+    nft_interval_t *iv = &l->items[l->count[0] + l->count[1]];
+    nft_interval_from_addr(&e->addr, iv);
+    l->ptrs[f][l->count[f]] = iv;
+    l->timeouts[f][l->count[f]] = store_remaining_ms(e, now);
+    l->count[f]++;
+}
+
+static void elements_free(element_list_t *l) {
+    free(l->items);
+    for (int f = 0; f < 2; f++) {
+        free(l->ptrs[f]);
+        free(l->timeouts[f]);
+    }
+}
+
+static const char *const blacklist_sets[2] = {NFT_SET, NFT_SET_V6};
+
+/* 先删后增的差异事务；集合与存储不一致（元素已过期或未写入）时清空后全量写入 */
+static int commit_sets(const element_list_t *del, const element_list_t *add, const element_list_t *all) {
+    nft_batch_t batch;
+    nft_batch_init(&batch);
+    for (int f = 0; f < 2; f++) {
+        nft_batch_del_elements(&batch, blacklist_sets[f], del->ptrs[f], del->count[f]);
+    }
+    for (int f = 0; f < 2; f++) {
+        nft_batch_put_timed_elements(&batch, blacklist_sets[f], add->ptrs[f], add->timeouts[f], add->count[f]);
+    }
+    int err = nft_batch_empty(&batch) ? 0 : nft_batch_commit(&batch);
+    nft_batch_free(&batch);
+    if (err == 0) {
+        return 0;
+    }
+    log_write("[网段合并] 差异提交失败: %s，改为全量写入", strerror(-err));
+
+    nft_batch_init(&batch);
+    for (int f = 0; f < 2; f++) {
+        nft_batch_flush_set(&batch, blacklist_sets[f]);
+        nft_batch_put_timed_elements(&batch, blacklist_sets[f], all->ptrs[f], all->timeouts[f], all->count[f]);
+    }
+    err = nft_batch_commit(&batch);
+    nft_batch_free(&batch);
+    return err;
+}
+
+/* 在存储的排他锁内执行：计算合并结果，先提交集合再交回新列表 */
+static int collapse_rewrite(const store_view_t *current, store_view_t *replacement, void *arg) {
+    collapse_ctx_t *ctx = arg;
+    time_t now = time(NULL);
+
+    collapse_node_t *nodes = malloc((current->count + 1) * sizeof(*nodes));
+    size_t *node_of = malloc((current->count + 1) * sizeof(*node_of));
+    if (!nodes || !node_of) {
+        free(nodes);
+        free(node_of);
+        return ERROR_FILE;
+    }
+
+    /* 已到期的条目不在集合中，原样保留 */
+    size_t count = 0;
+    for (size_t i = 0; i < current->count; i++) {
+        node_of[i] = SIZE_MAX;
+        if (store_entry_live(&current->entries[i], now)) {
+            nodes[count].entry = current->entries[i];
+            nodes[count].orig = i;
+            nodes[count].changed = false;
+            count++;
+        }
+    }
+    ctx->stats.before = count;
+
+    qsort(nodes, count, sizeof(*nodes), cmp_node);
+    count = prune_covered(nodes, count, &ctx->stats);
+    if (ctx->threshold >= 2) {
+        count = collapse_groups(nodes, count, ctx->threshold, &ctx->stats);
+    }
+    count = merge_siblings(nodes, count, &ctx->stats);
+    ctx->stats.after = count;
+
+    bool modified = ctx->stats.covered + ctx->stats.collapsed + ctx->stats.merged > 0;
+    if (!modified || ctx->dry_run) {
+        free(nodes);
+        free(node_of);
+        return SUCCESS;
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        if (nodes[k].orig != SIZE_MAX) {
+            node_of[nodes[k].orig] = k;
+        }
+    }
+
+    element_list_t del, add, all;
+    int ret = ERROR_FILE;
+    bool ok = elements_init(&del, ctx->stats.before) == SUCCESS;
+    ok = elements_init(&add, count) == SUCCESS && ok;
+    ok = elements_init(&all, count) == SUCCESS && ok;
+    if (ok) {
+        for (size_t i = 0; i < current->count; i++) {
+            const store_entry_t *e = &current->entries[i];
+            if (store_entry_live(e, now) && (node_of[i] == SIZE_MAX || nodes[node_of[i]].changed)) {
+                elements_push(&del, e, now);
+            }
+        }
+        for (size_t k = 0; k < count; k++) {
+            if (nodes[k].changed) {
+                elements_push(&add, &nodes[k].entry, now);
+            }
+            elements_push(&all, &nodes[k].entry, now);
+        }
+
+        int err = commit_sets(&del, &add, &all);
+        if (err < 0) {
+            log_write("[网段合并] 集合更新失败: %s，黑名单未修改", strerror(-err));
+        } else {
+            ctx->stats.nft_removed = del.count[0] + del.count[1];
+            ctx->stats.nft_added = add.count[0] + add.count[1];
+            ret = SUCCESS;
+        }
+    }
+    elements_free(&del);
+    elements_free(&add);
+    elements_free(&all);
+
+    /* 新列表保持原有顺序，合并出的网段追加在末尾 */
+    if (ret == SUCCESS) {
+        replacement->entries = malloc((current->count + 1) * sizeof(*replacement->entries));
+        if (!replacement->entries) {
+            ret = ERROR_FILE;
+        } else {
+            size_t n = 0;
+            for (size_t i = 0; i < current->count; i++) {
+                if (!store_entry_live(&current->entries[i], now)) {
+                    replacement->entries[n++] = current->entries[i];
+                } else if (node_of[i] != SIZE_MAX) {
+                    replacement->entries[n++] = nodes[node_of[i]].entry;
+                }
+            }
+            for (size_t k = 0; k < count; k++) {
+                if (nodes[k].orig == SIZE_MAX) {
+                    replacement->entries[n++] = nodes[k].entry;
+                }
+            }
+            replacement->count = n;
+        }
+    }
+
+    free(nodes);
+    free(node_of);
+    return ret;
+}
+
+int collapse_run(int threshold, bool dry_run, collapse_stats_t *stats) {
+    if (!dry_run && !nft_available()) {
+        log_write("[网段合并] 防火墙后端 %s 不可用，未执行合并", nft_backend()->name);
+        return ERROR_FILE;
+    }
+
+    collapse_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.threshold = threshold;
+    ctx.dry_run = dry_run;
+
+    int ret = store_rewrite(collapse_rewrite, &ctx);
+    if (ret == SUCCESS && !dry_run && ctx.stats.before != ctx.stats.after) {
+        log_write("[网段合并] 条目 %zu -> %zu (覆盖 %zu, 阈值合并 %zu, 相邻合并 %zu)",
+                  ctx.stats.before, ctx.stats.after, ctx.stats.covered, ctx.stats.collapsed, ctx.stats.merged);
+    }
+    if (stats) {
+        *stats = ctx.stats;
+    }
+    return ret;
+}
+
+void collapse_after_ban(const ip_addr_t *addr) {
+    int threshold = get_collapse_from_config();
+
+    /* 封禁单个地址时，只有所在网段的封禁数达到阈值才需要合并 */
+    if (ip_addr_is_host(addr)) {
+        if (threshold < 2) return;
+
+        store_view_t view;
+        if (store_load(&view) != SUCCESS) return;
+
+        ip_addr_t group;
+        ip_addr_truncate(addr, addr->family == AF_INET ? COLLAPSE_PREFIX_V4 : COLLAPSE_PREFIX_V6, &group);
+        time_t now = time(NULL);
+        int count = 0;
+        for (size_t i = 0; i < view.count && count < threshold; i++) {
+            if (ip_addr_contains(&group, &view.entries[i].addr) && store_entry_live(&view.entries[i], now)) {
+                count++;
+            }
+        }
+        store_view_free(&view);
+        if (count < threshold) return;
+    }
+
+    collapse_run(threshold, false, NULL);
+}
+
+typedef struct {
+    ip_addr_t addr;
+    size_t split;           /* 被拆分的网段数 */
+} split_ctx_t;
+
+/* 覆盖addr的有效网段（不含addr本身） */
+static bool covers_addr(const store_entry_t *e, const ip_addr_t *addr, time_t now) {
+    return e->addr.prefixlen < addr->prefixlen && ip_addr_contains(&e->addr, addr) && store_entry_live(e, now);
+}
+
+/*
+ * 在存储的排他锁内执行：覆盖addr的网段拆成不含addr的子网段
+ * （addr各级祖先的兄弟网段），子网段沿用原网段的来源、次数和到期时间
+ */
+static int split_rewrite(const store_view_t *current, store_view_t *replacement, void *arg) {
+    split_ctx_t *ctx = arg;
+    const ip_addr_t *addr = &ctx->addr;
+    time_t now = time(NULL);
+
+    size_t covers = 0;
+    for (size_t i = 0; i < current->count; i++) {
+        if (covers_addr(&current->entries[i], addr, now)) covers++;
+    }
+    if (covers == 0) {
+        return SUCCESS;
+    }
+
+    size_t cap = current->count + covers * addr->prefixlen;
+    int base = (addr->family == AF_INET) ? 96 : 0;
+    store_entry_t *entries = malloc(cap * sizeof(*entries));
+    element_list_t del, add, all;
+    bool ok = elements_init(&del, covers) == SUCCESS;
+    ok = elements_init(&add, covers * addr->prefixlen) == SUCCESS && ok;
+    ok = elements_init(&all, cap) == SUCCESS && ok;
+
+    int ret = ERROR_FILE;
+    size_t n = 0;
+    if (entries && ok) {
+        for (size_t i = 0; i < current->count; i++) {
+            const store_entry_t *e = &current->entries[i];
+            if (!covers_addr(e, addr, now)) {
+                entries[n++] = *e;
+                if (store_entry_live(e, now)) {
+                    elements_push(&all, e, now);
+                }
+                continue;
+            }
+
+            elements_push(&del, e, now);
+            for (int len = e->addr.prefixlen + 1; len <= addr->prefixlen; len++) {
+                store_entry_t piece = *e;
+                int bit = base + len - 1;
+                ip_addr_truncate(addr, len, &piece.addr);
+                piece.addr.addr[bit / 8] ^= (uint8_t)(0x80 >> (bit % 8));
+                entries[n++] = piece;
+                elements_push(&add, &piece, now);
+                elements_push(&all, &piece, now);
+            }
+            ctx->split++;
+        }
+
+        int err = commit_sets(&del, &add, &all);
+        if (err < 0) {
+            log_write("[解封拆分] 集合更新失败: %s，黑名单未修改", strerror(-err));
+        } else {
+            ret = SUCCESS;
+        }
+    }
+    elements_free(&del);
+    elements_free(&add);
+    elements_free(&all);
+
+    if (ret == SUCCESS) {
+        replacement->entries = entries;
+        replacement->count = n;
+    } else {
+        free(entries);
+    }
+    return ret;
+}
+
+int collapse_split(const ip_addr_t *addr, size_t *split) {
+    split_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.addr = *addr;
+
+    int ret = store_rewrite(split_rewrite, &ctx);
+    if (ret == SUCCESS && ctx.split > 0) {
+        char ip[IP_STR_LEN];
+        ip_addr_format(addr, ip, sizeof(ip));
+        log_write("[解封拆分] %s 所在的 %zu 个合并网段已拆分", ip, ctx.split);
+    }
+    if (split) {
+        *split = ctx.split;
+    }
+    return ret;
+}
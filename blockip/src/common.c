@@ -19,185 +19,54 @@ void get_timestamp(char *buffer, size_t size) {
     strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
 }
 
-const char* get_ban_time_from_config(void) {
-    static char ban_time[32] = {0};
-    
-    FILE *fp = fopen(CONFIG_FILE, "r");
-    if (!fp) {
-        /* 配置文件不存在，返回默认值 */
-        return DEFAULT_BAN_TIME;
-    }
-    
-    char line[MAX_LINE_LEN];
-    while (fgets(line, sizeof(line), fp)) {
-        /* 跳过注释和空行 */
-        if (line[0] == '#' || line[0] == '\n') {
-            continue;
-        }
-        
-        /* 解析 BAN_TIME=xxx */
-        if (strncmp(line, "BAN_TIME=", 9) == 0) {
-            char *value = line + 9;
-            /* 去除换行符和空白 */
-            char *p = value;
-            while (*p && *p != '\n' && *p != '\r') p++;
-            *p = '\0';
-            
-            /* 去除前导空白 */
-            while (*value == ' ' || *value == '\t') value++;
-            
-            if (strlen(value) > 0) {
-                strncpy(ban_time, value, sizeof(ban_time) - 1);
-                ban_time[sizeof(ban_time) - 1] = '\0';
-                fclose(fp);
-                return ban_time;
-            }
-        }
-    }
-    
-    fclose(fp);
-    return DEFAULT_BAN_TIME;
-}
-
-int save_ban_time_to_config(const char *ban_time) {
-    if (!ban_time) {
-        return ERROR_INVALID_ARG;
-    }
-    
-    /* 创建配置目录 */
-    mkdir(CONFIG_DIR, 0700);
-    
-    /* 读取现有配置 */
-    FILE *fp = fopen(CONFIG_FILE, "r");
-    char temp_file[MAX_PATH_LEN];
-    snprintf(temp_file, sizeof(temp_file), "%s.tmp", CONFIG_FILE);
-    FILE *temp_fp = fopen(temp_file, "w");
-    
-    if (!temp_fp) {
-        if (fp) fclose(fp);
-        return ERROR_FILE;
-    }
-    
-    bool found = false;
-    bool has_header = false;
-    
-    if (fp) {
-        char line[MAX_LINE_LEN];
-        while (fgets(line, sizeof(line), fp)) {
-            if (line[0] == '#') {
-                has_header = true;
-            }
-            
-            if (strncmp(line, "BAN_TIME=", 9) == 0) {
-                fprintf(temp_fp, "BAN_TIME=%s\n", ban_time);
-                found = true;
-            } else {
-                fputs(line, temp_fp);
-            }
-        }
-        fclose(fp);
+long long parse_duration_ms(const char *str) {
+    if (!str) {
+        return -1;
     }
     
-    /* 如果没有找到 BAN_TIME，添加新配置 */
-    if (!found) {
-        /* 如果是新文件，添加完整头部 */
-        if (!has_header && access(CONFIG_FILE, F_OK) != 0) {
-            fprintf(temp_fp, "# Block-IP Configuration\n");
-            fprintf(temp_fp, "# Ban time format: Xh (hours), Xm (minutes), or empty for permanent\n");
-            fprintf(temp_fp, "# Examples: 24h, 12h, 1h, 30m, or empty string for permanent ban\n");
-            fprintf(temp_fp, "# Max retries: 1-10, default is 3\n\n");
-        }
-        fprintf(temp_fp, "BAN_TIME=%s\n", ban_time);
-        /* 如果是新文件，也添加默认的 MAX_RETRIES */
-        if (!has_header && access(CONFIG_FILE, F_OK) != 0) {
-            fprintf(temp_fp, "MAX_RETRIES=%d\n", DEFAULT_MAX_RETRIES);
-        }
+    /* 空字符串表示永久 */
+    while (*str == ' ' || *str == '\t') str++;
+    if (*str == '\0') {
+        return 0;
     }
     
-    fclose(temp_fp);
-    chmod(temp_file, 0600);
-    rename(temp_file, CONFIG_FILE);
-    
-    return SUCCESS;
-}
-
-int get_max_retries_from_config(void) {
-    FILE *fp = fopen(CONFIG_FILE, "r");
-    if (!fp) {
-        return DEFAULT_MAX_RETRIES;  /* 返回默认值 */
-    }
+    /* 支持nft时间格式：7d, 24h, 30m, 10s, 500ms 及组合（如 1h30m） */
+    long long total = 0;
+    const char *p = str;
     
-    char line[MAX_LINE_LEN];
-    while (fgets(line, sizeof(line), fp)) {
-        if (line[0] == '#' || line[0] == '\n') {
-            continue;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+        if (!isdigit((unsigned char)*p)) {
+            return -1;
         }
         
-        if (strncmp(line, "MAX_RETRIES=", 12) == 0) {
-            int retries = atoi(line + 12);
-            fclose(fp);
-            return (retries > 0 && retries <= 10) ? retries : DEFAULT_MAX_RETRIES;
+        long long num = 0;
+        while (isdigit((unsigned char)*p)) {
+            num = num * 10 + (*p - '0');
+            if (num > 100000000LL) return -1;
+            p++;
         }
-    }
-    
-    fclose(fp);
-    return DEFAULT_MAX_RETRIES;
-}
-
-int save_max_retries_to_config(int max_retries) {
-    if (max_retries <= 0 || max_retries > 10) {
-        return ERROR_INVALID_ARG;
-    }
-    
-    mkdir(CONFIG_DIR, 0700);
-    
-    FILE *fp = fopen(CONFIG_FILE, "r");
-    char temp_file[MAX_PATH_LEN];
-    snprintf(temp_file, sizeof(temp_file), "%s.tmp", CONFIG_FILE);
-    FILE *temp_fp = fopen(temp_file, "w");
-    
-    if (!temp_fp) {
-        if (fp) fclose(fp);
-        return ERROR_FILE;
-    }
-    
-    bool found = false;
-    bool has_header = false;
-    
-    if (fp) {
-        char line[MAX_LINE_LEN];
-        while (fgets(line, sizeof(line), fp)) {
-            if (line[0] == '#') {
-                has_header = true;
-            }
-            
-            if (strncmp(line, "MAX_RETRIES=", 12) == 0) {
-                fprintf(temp_fp, "MAX_RETRIES=%d\n", max_retries);
-                found = true;
-            } else {
-                fputs(line, temp_fp);
-            }
-        }
-        fclose(fp);
-    }
-    
-    /* 如果没有找到 MAX_RETRIES，添加新配置 */
-    if (!found) {
-        /* 如果是新文件，添加完整头部 */
-        if (!has_header && access(CONFIG_FILE, F_OK) != 0) {
-            fprintf(temp_fp, "# Block-IP Configuration\n");
-            fprintf(temp_fp, "# Ban time format: Xh (hours), Xm (minutes), or empty for permanent\n");
-            fprintf(temp_fp, "# Max retries: 1-10, default is 3\n\n");
-            fprintf(temp_fp, "BAN_TIME=%s\n", DEFAULT_BAN_TIME);
+        
+        if (p[0] == 'm' && p[1] == 's') {
+            total += num;
+            p += 2;
+        } else if (*p == 'd') {
+            total += num * 86400000LL;
+            p++;
+        } else if (*p == 'h') {
+            total += num * 3600000LL;
+            p++;
+        } else if (*p == 'm') {
+            total += num * 60000LL;
+            p++;
+        } else if (*p == 's' || *p == '\0' || *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+            total += num * 1000LL;
+            if (*p == 's') p++;
+        } else {
+            return -1;
         }
-        fprintf(temp_fp, "MAX_RETRIES=%d\n", max_retries);
     }
     
-    fclose(temp_fp);
-    chmod(temp_file, 0600);
-    rename(temp_file, CONFIG_FILE);
-    
-    return SUCCESS;
+    return total > 0 ? total : -1;
 }
 
 int get_ssh_port(void) {
@@ -256,99 +125,334 @@ int get_ssh_port(void) {
     return port;
 }
 
-/* 通用配置读取函数（整数） */
-static int get_config_int(const char *key, int default_value, int min_val, int max_val) {
-    FILE *fp = fopen(CONFIG_FILE, "r");
-    if (!fp) return default_value;
-    
-    char line[MAX_LINE_LEN];
-    size_t key_len = strlen(key);
-    
-    while (fgets(line, sizeof(line), fp)) {
-        if (line[0] == '#' || line[0] == '\n') continue;
-        if (strncmp(line, key, key_len) == 0 && line[key_len] == '=') {
-            int value = atoi(line + key_len + 1);
-            fclose(fp);
-            return (value >= min_val && value <= max_val) ? value : default_value;
+/*
+ * 配置缓存：整个配置文件解析一次得到 bip_config_t，时长和数值在加载时校验，
+ * 非法值回退为默认值。之后每次读取只 stat 一次文件，mtime/大小/inode 变化时才重新解析。
+ */
+static bip_config_t config_cache;
+static bool config_loaded = false;
+static struct stat config_stat;
+
+/* 批量保存：begin 与 commit 之间的保存只暂存，commit 时一次原子写入 */
+typedef struct {
+    char key[32];
+    char value[MAX_LINE_LEN];
+} config_change_t;
+
+#define CONFIG_MAX_CHANGES 32
+
+static config_change_t config_pending[CONFIG_MAX_CHANGES];
+static size_t config_pending_count = 0;
+static bool config_batching = false;
+
+static void copy_value(char *dst, size_t size, const char *src) {
+    size_t len = strlen(src);
+    if (len >= size) len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static int parse_int_range(const char *value, int default_value, int min_val, int max_val) {
+    int n = atoi(value);
+    return (n >= min_val && n <= max_val) ? n : default_value;
+}
+
+/* 解析逗号分隔的升序前缀长度，返回层级数，非法返回-1 */
+static int parse_agg_levels(const char *str, int max_len, int levels[MAX_AGG_LEVELS]) {
+    int count = 0;
+    const char *p = str;
+    while (*p) {
+        if (!isdigit((unsigned char)*p) || count == MAX_AGG_LEVELS) {
+            return -1;
         }
+        char *end;
+        long len = strtol(p, &end, 10);
+        if (len < 1 || len > max_len || (count > 0 && len <= levels[count - 1])) {
+            return -1;
+        }
+        levels[count++] = (int)len;
+        if (*end == ',') {
+            end++;
+            if (*end == '\0') return -1;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        p = end;
     }
-    fclose(fp);
-    return default_value;
+    return count > 0 ? count : -1;
+}
+
+static void set_agg_levels(bip_config_t *cfg, int family, const char *value) {
+    int max_len = family ? 128 : 32;
+    int count = parse_agg_levels(value, max_len, cfg->agg_levels[family]);
+    if (count < 0) {
+        count = parse_agg_levels(family ? DEFAULT_AGG_LEVELS_V6 : DEFAULT_AGG_LEVELS, max_len, cfg->agg_levels[family]);
+    }
+    cfg->agg_count[family] = count;
 }
 
-/* 通用配置读取函数（字符串） */
-static const char* get_config_str(const char *key, const char *default_value, char *buffer, size_t buf_size) {
+static void set_duration(char *text, size_t size, long long *ms, const char *value, const char *def) {
+    long long parsed = parse_duration_ms(value);
+    if (parsed <= 0 || strlen(value) >= size) {
+        value = def;
+        parsed = parse_duration_ms(def);
+    }
+    copy_value(text, size, value);
+    *ms = parsed;
+}
+
+static void config_defaults(bip_config_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    copy_value(cfg->ban_time, sizeof(cfg->ban_time), DEFAULT_BAN_TIME);
+    cfg->ban_time_ms = parse_duration_ms(DEFAULT_BAN_TIME);
+    cfg->max_retries = DEFAULT_MAX_RETRIES;
+    cfg->rate_limit = DEFAULT_RATE_LIMIT;
+    copy_value(cfg->rate_ban_time, sizeof(cfg->rate_ban_time), DEFAULT_RATE_BAN_TIME);
+    cfg->rate_ban_time_ms = parse_duration_ms(DEFAULT_RATE_BAN_TIME);
+    copy_value(cfg->idle_timeout, sizeof(cfg->idle_timeout), DEFAULT_IDLE_TIMEOUT);
+    cfg->idle_timeout_ms = parse_duration_ms(DEFAULT_IDLE_TIMEOUT);
+    copy_value(cfg->ssh_log, sizeof(cfg->ssh_log), DEFAULT_SSH_LOG);
+    copy_value(cfg->geo_api, sizeof(cfg->geo_api), DEFAULT_GEO_API);
+    copy_value(cfg->geo_filter, sizeof(cfg->geo_filter), DEFAULT_GEO_FILTER);
+    cfg->collapse = DEFAULT_COLLAPSE;
+    set_agg_levels(cfg, 0, DEFAULT_AGG_LEVELS);
+    set_agg_levels(cfg, 1, DEFAULT_AGG_LEVELS_V6);
+    copy_value(cfg->metrics_textfile, sizeof(cfg->metrics_textfile), DEFAULT_METRICS_TEXTFILE);
+    copy_value(cfg->firewall_backend, sizeof(cfg->firewall_backend), DEFAULT_FIREWALL_BACKEND);
+}
+
+/* 应用一个键值，值为空时保持默认（BAN_TIME 为空表示永久封禁） */
+static void config_apply(bip_config_t *cfg, const char *key, const char *value) {
+    if (strcmp(key, "BAN_TIME") == 0) {
+        long long ms = parse_duration_ms(value);
+        if (ms >= 0 && strlen(value) < sizeof(cfg->ban_time)) {
+            copy_value(cfg->ban_time, sizeof(cfg->ban_time), value);
+            cfg->ban_time_ms = ms;
+        }
+        return;
+    }
+    if (*value == '\0') {
+        return;
+    }
+    if (strcmp(key, "MAX_RETRIES") == 0) {
+        cfg->max_retries = parse_int_range(value, DEFAULT_MAX_RETRIES, 1, 10);
+    } else if (strcmp(key, "RATE_LIMIT") == 0) {
+        cfg->rate_limit = parse_int_range(value, DEFAULT_RATE_LIMIT, 1, 1000);
+    } else if (strcmp(key, "RATE_BAN_TIME") == 0) {
+        set_duration(cfg->rate_ban_time, sizeof(cfg->rate_ban_time), &cfg->rate_ban_time_ms,
+                     value, DEFAULT_RATE_BAN_TIME);
+    } else if (strcmp(key, "IDLE_TIMEOUT") == 0) {
+        /* "0" 表示常驻不退出 */
+        if (strcmp(value, "0") == 0) {
+            copy_value(cfg->idle_timeout, sizeof(cfg->idle_timeout), value);
+            cfg->idle_timeout_ms = 0;
+        } else {
+            set_duration(cfg->idle_timeout, sizeof(cfg->idle_timeout), &cfg->idle_timeout_ms,
+                         value, DEFAULT_IDLE_TIMEOUT);
+        }
+    } else if (strcmp(key, "SSH_LOG") == 0) {
+        copy_value(cfg->ssh_log, sizeof(cfg->ssh_log), value);
+    } else if (strcmp(key, "GEO_API") == 0) {
+        copy_value(cfg->geo_api, sizeof(cfg->geo_api), value);
+    } else if (strcmp(key, "GEO_FILTER") == 0) {
+        copy_value(cfg->geo_filter, sizeof(cfg->geo_filter), value);
+    } else if (strcmp(key, "COLLAPSE") == 0) {
+        cfg->collapse = parse_int_range(value, DEFAULT_COLLAPSE, 0, 256);
+    } else if (strcmp(key, "AGG_LEVELS") == 0) {
+        set_agg_levels(cfg, 0, value);
+    } else if (strcmp(key, "AGG_LEVELS_V6") == 0) {
+        set_agg_levels(cfg, 1, value);
+    } else if (strcmp(key, "METRICS_TEXTFILE") == 0) {
+        copy_value(cfg->metrics_textfile, sizeof(cfg->metrics_textfile), value);
+    } else if (strcmp(key, "FIREWALL_BACKEND") == 0) {
+        copy_value(cfg->firewall_backend, sizeof(cfg->firewall_backend), value);
+    }
+}
+
+/* 一次读取解析整个配置文件，同一键出现多次时以第一次为准 */
+static void config_load(bip_config_t *cfg) {
+    config_defaults(cfg);
     FILE *fp = fopen(CONFIG_FILE, "r");
-    if (!fp) return default_value;
-    
+    if (!fp) {
+        return;
+    }
+
+    char seen[32][32];
+    size_t seen_count = 0;
     char line[MAX_LINE_LEN];
-    size_t key_len = strlen(key);
-    
     while (fgets(line, sizeof(line), fp)) {
         if (line[0] == '#' || line[0] == '\n') continue;
-        if (strncmp(line, key, key_len) == 0 && line[key_len] == '=') {
-            char *value = line + key_len + 1;
-            char *p = value;
-            while (*p && *p != '\n' && *p != '\r') p++;
-            *p = '\0';
-            while (*value == ' ' || *value == '\t') value++;
-            
-            size_t len = strlen(value);
-            if (len > 0) {
-                if (len >= buf_size) len = buf_size - 1;
-                memcpy(buffer, value, len);
-                buffer[len] = '\0';
-                fclose(fp);
-                return buffer;
-            }
+        char *eq = strchr(line, '=');
+        if (!eq || (size_t)(eq - line) >= sizeof(seen[0])) continue;
+        *eq = '\0';
+
+        bool dup = false;
+        for (size_t i = 0; i < seen_count && !dup; i++) {
+            dup = strcmp(seen[i], line) == 0;
         }
+        if (dup) continue;
+        if (seen_count < ARRAY_SIZE(seen)) {
+            copy_value(seen[seen_count++], sizeof(seen[0]), line);
+        }
+
+        char *value = eq + 1;
+        value[strcspn(value, "\r\n")] = '\0';
+        while (*value == ' ' || *value == '\t') value++;
+        config_apply(cfg, line, value);
     }
     fclose(fp);
-    return default_value;
 }
 
-/* 通用配置保存函数 */
-static int save_config_value(const char *key, const char *value) {
+const bip_config_t* config_get(void) {
+    struct stat st;
+    if (stat(CONFIG_FILE, &st) != 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    if (config_loaded && st.st_ino == config_stat.st_ino && st.st_size == config_stat.st_size &&
+        st.st_mtim.tv_sec == config_stat.st_mtim.tv_sec &&
+        st.st_mtim.tv_nsec == config_stat.st_mtim.tv_nsec) {
+        return &config_cache;
+    }
+    config_load(&config_cache);
+    config_stat = st;
+    config_loaded = true;
+    return &config_cache;
+}
+
+static const config_change_t* find_change(const config_change_t *changes, size_t count, const char *key) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(changes[i].key, key) == 0) {
+            return &changes[i];
+        }
+    }
+    return NULL;
+}
+
+/* 读一次原文件，替换/追加所有改动后写临时文件并rename，保留注释和未知键 */
+static int write_config_changes(const config_change_t *changes, size_t count) {
+    if (count == 0) {
+        return SUCCESS;
+    }
     mkdir(CONFIG_DIR, 0700);
-    
-    FILE *fp = fopen(CONFIG_FILE, "r");
+
     char temp_file[MAX_PATH_LEN];
     snprintf(temp_file, sizeof(temp_file), "%s.tmp", CONFIG_FILE);
     FILE *temp_fp = fopen(temp_file, "w");
-    
     if (!temp_fp) {
-        if (fp) fclose(fp);
         return ERROR_FILE;
     }
-    
-    bool found = false;
-    size_t key_len = strlen(key);
-    
+
+    bool written[CONFIG_MAX_CHANGES] = {false};
+    FILE *fp = fopen(CONFIG_FILE, "r");
     if (fp) {
         char line[MAX_LINE_LEN];
         while (fgets(line, sizeof(line), fp)) {
-            if (strncmp(line, key, key_len) == 0 && line[key_len] == '=') {
-                fprintf(temp_fp, "%s=%s\n", key, value);
-                found = true;
-            } else {
+            const config_change_t *c = NULL;
+            char *eq = line[0] != '#' ? strchr(line, '=') : NULL;
+            if (eq) {
+                *eq = '\0';
+                c = find_change(changes, count, line);
+                *eq = '=';
+            }
+            if (!c) {
                 fputs(line, temp_fp);
+            } else if (!written[c - changes]) {
+                fprintf(temp_fp, "%s=%s\n", c->key, c->value);
+                written[c - changes] = true;
             }
         }
         fclose(fp);
+    } else {
+        /* 新文件添加说明头部 */
+        fprintf(temp_fp, "# Block-IP Configuration\n");
+        fprintf(temp_fp, "# Ban time format: Xh (hours), Xm (minutes), or empty for permanent\n");
+        fprintf(temp_fp, "# Examples: 24h, 12h, 1h, 30m, or empty string for permanent ban\n");
+        fprintf(temp_fp, "# Max retries: 1-10, default is 3\n\n");
     }
-    
-    if (!found) {
-        fprintf(temp_fp, "%s=%s\n", key, value);
+
+    for (size_t i = 0; i < count; i++) {
+        if (!written[i]) {
+            fprintf(temp_fp, "%s=%s\n", changes[i].key, changes[i].value);
+        }
+    }
+
+    if (fclose(temp_fp) != 0) {
+        unlink(temp_file);
+        return ERROR_FILE;
     }
-    
-    fclose(temp_fp);
     chmod(temp_file, 0600);
-    rename(temp_file, CONFIG_FILE);
+    if (rename(temp_file, CONFIG_FILE) != 0) {
+        unlink(temp_file);
+        return ERROR_FILE;
+    }
+    /* 同一秒内的多次写入mtime可能不变，直接作废缓存 */
+    config_loaded = false;
     return SUCCESS;
 }
 
+void config_batch_begin(void) {
+    config_batching = true;
+    config_pending_count = 0;
+}
+
+int config_batch_commit(void) {
+    config_batching = false;
+    int ret = write_config_changes(config_pending, config_pending_count);
+    config_pending_count = 0;
+    return ret;
+}
+
+/* 通用配置保存函数（批量模式下只暂存，同一键以最后一次为准） */
+static int save_config_value(const char *key, const char *value) {
+    if (strlen(key) >= sizeof(config_pending[0].key) || strlen(value) >= sizeof(config_pending[0].value)) {
+        return ERROR_INVALID_ARG;
+    }
+    if (!config_batching) {
+        config_change_t change;
+        copy_value(change.key, sizeof(change.key), key);
+        copy_value(change.value, sizeof(change.value), value);
+        return write_config_changes(&change, 1);
+    }
+
+    config_change_t *c = (config_change_t *)find_change(config_pending, config_pending_count, key);
+    if (!c) {
+        if (config_pending_count == CONFIG_MAX_CHANGES) {
+            return ERROR_INVALID_ARG;
+        }
+        c = &config_pending[config_pending_count++];
+        copy_value(c->key, sizeof(c->key), key);
+    }
+    copy_value(c->value, sizeof(c->value), value);
+    return SUCCESS;
+}
+
+const char* get_ban_time_from_config(void) {
+    return config_get()->ban_time;
+}
+
+int save_ban_time_to_config(const char *ban_time) {
+    /* 空串为永久封禁 */
+    if (!ban_time || parse_duration_ms(ban_time) < 0) {
+        return ERROR_INVALID_ARG;
+    }
+    return save_config_value("BAN_TIME", ban_time);
+}
+
+int get_max_retries_from_config(void) {
+    return config_get()->max_retries;
+}
+
+int save_max_retries_to_config(int max_retries) {
+    if (max_retries <= 0 || max_retries > 10) {
+        return ERROR_INVALID_ARG;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", max_retries);
+    return save_config_value("MAX_RETRIES", buf);
+}
+
 int get_rate_limit_from_config(void) {
-    return get_config_int("RATE_LIMIT", DEFAULT_RATE_LIMIT, 1, 1000);
+    return config_get()->rate_limit;
 }
 
 int save_rate_limit_to_config(int rate_limit) {
@@ -360,14 +464,143 @@ int save_rate_limit_to_config(int rate_limit) {
     return save_config_value("RATE_LIMIT", buf);
 }
 
+int get_collapse_from_config(void) {
+    return config_get()->collapse;
+}
+
+int save_collapse_to_config(int threshold) {
+    if (threshold < 0 || threshold == 1 || threshold > 256) {
+        return ERROR_INVALID_ARG;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", threshold);
+    return save_config_value("COLLAPSE", buf);
+}
+
+int get_agg_levels_from_config(bool ipv6, int levels[MAX_AGG_LEVELS]) {
+    const bip_config_t *cfg = config_get();
+    int family = ipv6 ? 1 : 0;
+    memcpy(levels, cfg->agg_levels[family], sizeof(cfg->agg_levels[family]));
+    return cfg->agg_count[family];
+}
+
+int save_agg_levels_to_config(bool ipv6, const char *levels) {
+    int parsed[MAX_AGG_LEVELS];
+    if (!levels || parse_agg_levels(levels, ipv6 ? 128 : 32, parsed) < 0) {
+        return ERROR_INVALID_ARG;
+    }
+    return save_config_value(ipv6 ? "AGG_LEVELS_V6" : "AGG_LEVELS", levels);
+}
+
+const char* get_metrics_textfile_from_config(void) {
+    return config_get()->metrics_textfile;
+}
+
+int save_metrics_textfile_to_config(const char *path) {
+    if (!path || strlen(path) == 0 || strlen(path) >= MAX_PATH_LEN) {
+        return ERROR_INVALID_ARG;
+    }
+    if (strcmp(path, "off") != 0 && (path[0] != '/' || strpbrk(path, " \t\r\n"))) {
+        return ERROR_INVALID_ARG;
+    }
+    return save_config_value("METRICS_TEXTFILE", path);
+}
+
+const char* get_firewall_backend_from_config(void) {
+    return config_get()->firewall_backend;
+}
+
+int save_firewall_backend_to_config(const char *backend) {
+    static const char *const names[] = {"auto", "native", "cli", "record"};
+    for (size_t i = 0; backend && i < ARRAY_SIZE(names); i++) {
+        if (strcmp(backend, names[i]) == 0) {
+            return save_config_value("FIREWALL_BACKEND", backend);
+        }
+    }
+    return ERROR_INVALID_ARG;
+}
+
 const char* get_rate_ban_time_from_config(void) {
-    static char ban_time[32] = {0};
-    return get_config_str("RATE_BAN_TIME", DEFAULT_RATE_BAN_TIME, ban_time, sizeof(ban_time));
+    return config_get()->rate_ban_time;
 }
 
 int save_rate_ban_time_to_config(const char *ban_time) {
-    if (!ban_time) {
+    if (!ban_time || parse_duration_ms(ban_time) <= 0) {
         return ERROR_INVALID_ARG;
     }
     return save_config_value("RATE_BAN_TIME", ban_time);
 }
+
+const char* get_idle_timeout_from_config(void) {
+    return config_get()->idle_timeout;
+}
+
+int save_idle_timeout_to_config(const char *idle_timeout) {
+    /* "0" 表示常驻不退出 */
+    if (!idle_timeout || (strcmp(idle_timeout, "0") != 0 && parse_duration_ms(idle_timeout) <= 0)) {
+        return ERROR_INVALID_ARG;
+    }
+    return save_config_value("IDLE_TIMEOUT", idle_timeout);
+}
+
+const char* get_ssh_log_from_config(void) {
+    return config_get()->ssh_log;
+}
+
+int save_ssh_log_to_config(const char *ssh_log) {
+    if (!ssh_log || strlen(ssh_log) == 0 || strlen(ssh_log) >= MAX_PATH_LEN) {
+        return ERROR_INVALID_ARG;
+    }
+    if (strcmp(ssh_log, "off") != 0 && strcmp(ssh_log, "auto") != 0 && ssh_log[0] != '/') {
+        return ERROR_INVALID_ARG;
+    }
+    return save_config_value("SSH_LOG", ssh_log);
+}
+
+const char* get_geo_api_from_config(void) {
+    return config_get()->geo_api;
+}
+
+int save_geo_api_to_config(const char *geo_api) {
+    if (!geo_api || strlen(geo_api) >= MAX_PATH_LEN) {
+        return ERROR_INVALID_ARG;
+    }
+    if (strncmp(geo_api, "http://", 7) != 0 && strncmp(geo_api, "https://", 8) != 0) {
+        return ERROR_INVALID_ARG;
+    }
+    /* 恰好一个 %s，且不含会破坏curl配置文件的字符 */
+    const char *p = strstr(geo_api, "%s");
+    if (!p || strchr(p + 2, '%') || strchr(geo_api, '%') != p || strpbrk(geo_api, "\"\\ \t\r\n")) {
+        return ERROR_INVALID_ARG;
+    }
+    return save_config_value("GEO_API", geo_api);
+}
+
+const char* get_geo_filter_from_config(void) {
+    return config_get()->geo_filter;
+}
+
+int save_geo_filter_to_config(const char *geo_filter) {
+    if (!geo_filter || strlen(geo_filter) >= MAX_LINE_LEN) {
+        return ERROR_INVALID_ARG;
+    }
+    if (strcmp(geo_filter, "off") != 0) {
+        /* block:/allow: 后跟逗号分隔的两位国家代码 */
+        const char *p = geo_filter;
+        if (strncmp(p, "block:", 6) != 0 && strncmp(p, "allow:", 6) != 0) {
+            return ERROR_INVALID_ARG;
+        }
+        p += 6;
+        for (;;) {
+            if (!isupper((unsigned char)p[0]) || !isupper((unsigned char)p[1])) {
+                return ERROR_INVALID_ARG;
+            }
+            p += 2;
+            if (*p == '\0') break;
+            if (*p++ != ',') {
+                return ERROR_INVALID_ARG;
+            }
+        }
+    }
+    return save_config_value("GEO_FILTER", geo_filter);
+}
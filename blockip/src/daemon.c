@@ -0,0 +1,579 @@
+#include "daemon.h"
+#include "ban.h"
+#include "pam.h"
+#include "nftables.h"
+#include "whitelist.h"
+#include "ip_utils.h"
+#include "log.h"
+#include "follow.h"
+#include "metrics.h"
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#define DAEMON_MSG_MAX 256
+#define DAEMON_RCVBUF (1024 * 1024)
+#define DAEMON_SEND_TIMEOUT_MS 500  /* 队列满时阻塞等待守护进程取走数据报的上限 */
+#define COUNTER_INIT_SIZE 1024      /* 初始槽位数（2的幂） */
+#define COUNTER_TTL 86400           /* 扩容前清理超过1天未活动的计数 */
+#define RELOAD_INTERVAL 1           /* 配置/白名单变更检查间隔（秒） */
+
+/* 失败计数（开放寻址哈希表，以二进制地址为键） */
+typedef struct {
+    ip_addr_t addr;
+    bool used;
+    int count;
+    time_t last_seen;
+} counter_entry_t;
+
+static counter_entry_t *counters = NULL;
+static size_t counter_size = 0;
+static size_t counter_used = 0;
+
+/* 缓存的配置和白名单 */
+static int cached_max_retries = DEFAULT_MAX_RETRIES;
+static int cached_idle_ms = 0;
+static time_t config_mtime = 0;
+static time_t last_reload_check = 0;
+static struct timespec record_dir_mtime;
+
+static bool following = false;       /* 直接跟踪sshd日志时忽略PAM上报的失败 */
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+static counter_entry_t* counter_find(const ip_addr_t *addr) {
+    if (!counters) return NULL;
+
+    size_t mask = counter_size - 1;
+    for (size_t i = ip_addr_hash(addr) & mask; counters[i].used; i = (i + 1) & mask) {
+        if (ip_addr_equal(&counters[i].addr, addr)) {
+            return &counters[i];
+        }
+    }
+    return NULL;
+}
+
+/* 删除后向前回填，保持线性探测链完整 */
+static void counter_remove(counter_entry_t *e) {
+    size_t mask = counter_size - 1;
+    size_t hole = (size_t)(e - counters);
+    size_t i = hole;
+
+    counters[hole].used = false;
+    counter_used--;
+
+    for (i = (i + 1) & mask; counters[i].used; i = (i + 1) & mask) {
+        size_t home = ip_addr_hash(&counters[i].addr) & mask;
+        /* home不在(hole, i]区间内时可移入空洞 */
+        bool movable = (hole <= i) ? (home <= hole || home > i) : (home <= hole && home > i);
+        if (movable) {
+            counters[hole] = counters[i];
+            counters[i].used = false;
+            hole = i;
+        }
+    }
+}
+
+static int counter_rehash(size_t new_size) {
+    counter_entry_t *old = counters;
+    size_t old_size = counter_size;
+
+    counters = calloc(new_size, sizeof(*counters));
+    if (!counters) {
+        counters = old;
+        return ERROR_FILE;
+    }
+    counter_size = new_size;
+    counter_used = 0;
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < old_size; i++) {
+        if (!old[i].used || now - old[i].last_seen > COUNTER_TTL) continue;
+        size_t mask = counter_size - 1;
+        size_t j = ip_addr_hash(&old[i].addr) & mask;
+        while (counters[j].used) j = (j + 1) & mask;
+        counters[j] = old[i];
+        counter_used++;
+    }
+
+    free(old);
+    return SUCCESS;
+}
+
+static counter_entry_t* counter_get(const ip_addr_t *addr) {
+    counter_entry_t *e = counter_find(addr);
+    if (e) return e;
+
+    if (!counters || (counter_used + 1) * 10 > counter_size * 7) {
+        size_t new_size = counters ? counter_size * 2 : COUNTER_INIT_SIZE;
+        if (counter_rehash(new_size) != SUCCESS) {
+            return NULL;
+        }
+    }
+
+    size_t mask = counter_size - 1;
+    size_t i = ip_addr_hash(addr) & mask;
+    while (counters[i].used) i = (i + 1) & mask;
+
+    counters[i].addr = *addr;
+    counters[i].used = true;
+    counters[i].count = 0;
+    counters[i].last_seen = time(NULL);
+    counter_used++;
+    return &counters[i];
+}
+
+/*
+ * 接管计数文件（独立模式运行期间，或守护进程繁忙时 bip check 在本地计数）：
+ * 累加进内存计数并删除文件，合并后达到阈值的立即封禁
+ */
+static void import_count_files(void) {
+    DIR *dir = opendir(RECORD_DIR);
+    if (!dir) return;
+
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        ip_addr_t addr;
+        if (de->d_name[0] == '.' || ip_addr_parse(de->d_name, &addr) != SUCCESS) continue;
+
+        int count = get_failure_count(de->d_name);
+        clear_failure_record(de->d_name);
+        /* 跟踪日志时失败已从日志计数，PAM上报的本地计数只清理不累加 */
+        if (following || count <= 0) continue;
+        counter_entry_t *e = counter_get(&addr);
+        if (!e) continue;
+
+        e->count += count;
+        e->last_seen = time(NULL);
+        if (e->count >= cached_max_retries) {
+            char ip[IP_STR_LEN];
+            ip_addr_format(&addr, ip, sizeof(ip));
+            log_write("[验证失败] IP=%s (第 %d/%d 次，含本地计数)", ip, e->count, cached_max_retries);
+            counter_remove(e);
+            ban_ip(ip, true, BAN_SOURCE_PAM);
+        }
+    }
+    closedir(dir);
+}
+
+/* 快照文件格式：头部 + 定长记录（地址族长度、二进制地址、计数、最后活动时间） */
+#define SNAPSHOT_MAGIC "BIPS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER_LEN 16
+#define SNAPSHOT_RECORD_LEN 25
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);  p[3] = (uint8_t)v;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* 退出时把内存状态写成紧凑快照，下次启动毫秒级载入 */
+static int save_snapshot(void) {
+    size_t size = SNAPSHOT_HEADER_LEN + counter_used * SNAPSHOT_RECORD_LEN;
+    uint8_t *buf = calloc(1, size);
+    if (!buf) {
+        return ERROR_FILE;
+    }
+
+    memcpy(buf, SNAPSHOT_MAGIC, 4);
+    put_u32(buf + 4, SNAPSHOT_VERSION);
+    put_u32(buf + 12, (uint32_t)time(NULL));
+
+    uint32_t n = 0;
+    uint8_t *rec = buf + SNAPSHOT_HEADER_LEN;
+    for (size_t i = 0; i < counter_size; i++) {
+        if (!counters[i].used || counters[i].count <= 0) continue;
+
+        const uint8_t *bytes = ip_addr_bytes(&counters[i].addr, &rec[0]);
+        memcpy(rec + 1, bytes, rec[0]);
+        put_u32(rec + 17, (uint32_t)counters[i].count);
+        put_u32(rec + 21, (uint32_t)counters[i].last_seen);
+        rec += SNAPSHOT_RECORD_LEN;
+        n++;
+    }
+    put_u32(buf + 8, n);
+    size = SNAPSHOT_HEADER_LEN + n * SNAPSHOT_RECORD_LEN;
+
+    char temp_file[MAX_PATH_LEN];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", DAEMON_STATE_FILE);
+    FILE *fp = fopen(temp_file, "wb");
+    if (!fp) {
+        free(buf);
+        return ERROR_FILE;
+    }
+    size_t written = fwrite(buf, 1, size, fp);
+    fclose(fp);
+    free(buf);
+
+    if (written != size) {
+        remove(temp_file);
+        return ERROR_FILE;
+    }
+    chmod(temp_file, 0600);
+    rename(temp_file, DAEMON_STATE_FILE);
+    return SUCCESS;
+}
+
+static void load_snapshot(void) {
+    FILE *fp = fopen(DAEMON_STATE_FILE, "rb");
+    if (!fp) return;
+
+    uint8_t header[SNAPSHOT_HEADER_LEN];
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+        memcmp(header, SNAPSHOT_MAGIC, 4) != 0 || get_u32(header + 4) != SNAPSHOT_VERSION) {
+        fclose(fp);
+        return;
+    }
+
+    uint32_t n = get_u32(header + 8);
+    time_t now = time(NULL);
+    uint8_t rec[SNAPSHOT_RECORD_LEN];
+
+    for (uint32_t i = 0; i < n && fread(rec, 1, sizeof(rec), fp) == sizeof(rec); i++) {
+        time_t last_seen = (time_t)get_u32(rec + 21);
+        if (now - last_seen > COUNTER_TTL) continue;
+
+        ip_addr_t addr;
+        memset(&addr, 0, sizeof(addr));
+        if (rec[0] == 16) {
+            addr.family = AF_INET6;
+            addr.prefixlen = 128;
+            memcpy(addr.addr, rec + 1, 16);
+        } else {
+            addr.family = AF_INET;
+            addr.prefixlen = 32;
+            addr.addr[10] = addr.addr[11] = 0xff;
+            memcpy(addr.addr + 12, rec + 1, 4);
+        }
+
+        counter_entry_t *e = counter_get(&addr);
+        if (e) {
+            e->count = (int)get_u32(rec + 17);
+            e->last_seen = last_seen;
+        }
+    }
+    fclose(fp);
+}
+
+/* 按mtime检测配置和白名单变更（最多每秒检查一次） */
+static void reload_if_changed(void) {
+    time_t now = time(NULL);
+    if (now - last_reload_check < RELOAD_INTERVAL) return;
+    last_reload_check = now;
+
+    struct stat st;
+    time_t mtime = (stat(CONFIG_FILE, &st) == 0) ? st.st_mtime : 0;
+    if (mtime != config_mtime) {
+        config_mtime = mtime;
+        const bip_config_t *cfg = config_get();
+        cached_max_retries = cfg->max_retries;
+        long long idle_ms = cfg->idle_timeout_ms;
+        /* poll的超时是int毫秒，超长的空闲时间截断到上限（约24.8天），0仍表示常驻 */
+        cached_idle_ms = (idle_ms > INT_MAX) ? INT_MAX : (int)idle_ms;
+    }
+
+    whitelist_refresh();
+
+    /* 计数目录有变化说明有事件在本地计数，合并进内存 */
+    if (stat(RECORD_DIR, &st) == 0 &&
+        (st.st_mtim.tv_sec != record_dir_mtime.tv_sec || st.st_mtim.tv_nsec != record_dir_mtime.tv_nsec)) {
+        import_count_files();
+        if (stat(RECORD_DIR, &st) == 0) {
+            record_dir_mtime = st.st_mtim;
+        }
+    }
+}
+
+/* 记录一次失败；failure为失败计数项，source为达到阈值时记入封禁库的来源 */
+static void handle_check(const ip_addr_t *addr, const char *ip, metric_id_t failure, ban_source_t source) {
+    if (whitelist_match(addr)) {
+        log_write("[白名单放行] IP=%s", ip);
+        return;
+    }
+    metrics_inc(failure);
+
+    counter_entry_t *e = counter_get(addr);
+    if (!e) return;
+
+    e->count++;
+    e->last_seen = time(NULL);
+    int count = e->count;
+    log_write("[验证失败] IP=%s (第 %d/%d 次)", ip, count, cached_max_retries);
+
+    if (count >= cached_max_retries) {
+        counter_remove(e);
+        ban_ip(ip, true, source);
+    }
+}
+
+static void handle_clean(const ip_addr_t *addr, const char *ip) {
+    counter_entry_t *e = counter_find(addr);
+    if (e) {
+        log_write("[登录成功] IP=%s (计数已重置)", ip);
+        counter_remove(e);
+    }
+}
+
+/* 解析 "<command> <ip>" 格式的数据报 */
+static void handle_message(char *buf) {
+    buf[strcspn(buf, "\r\n")] = 0;
+
+    char *space = strchr(buf, ' ');
+    if (!space) return;
+    *space = '\0';
+
+    /* 只接受单个地址，统一为规范形式 */
+    ip_addr_t addr;
+    if (ip_addr_parse(space + 1, &addr) != SUCCESS || !ip_addr_is_host(&addr)) return;
+    char ip[IP_STR_LEN];
+    ip_addr_format(&addr, ip, sizeof(ip));
+
+    reload_if_changed();
+
+    if (strcmp(buf, "check") == 0) {
+        if (!following) {
+            handle_check(&addr, ip, METRIC_FAILURES_PAM, BAN_SOURCE_PAM);
+        }
+    } else if (strcmp(buf, "clean") == 0) {
+        handle_clean(&addr, ip);
+    }
+}
+
+/* 日志事件与PAM上报走同一套计数和封禁逻辑 */
+static void handle_log_event(sshd_event_t event, const char *ip) {
+    ip_addr_t addr;
+    if (ip_addr_parse(ip, &addr) != SUCCESS) return;
+
+    reload_if_changed();
+
+    if (event == SSHD_EVENT_FAILURE) {
+        handle_check(&addr, ip, METRIC_FAILURES_LOG, BAN_SOURCE_LOG);
+    } else if (event == SSHD_EVENT_SUCCESS) {
+        handle_clean(&addr, ip);
+    }
+}
+
+/* systemd套接字激活：LISTEN_PID/LISTEN_FDS，首个描述符为3 */
+static int get_activated_socket(void) {
+    const char *pid_str = getenv("LISTEN_PID");
+    const char *fds_str = getenv("LISTEN_FDS");
+    if (!pid_str || !fds_str || atol(pid_str) != (long)getpid() || atoi(fds_str) < 1) {
+        return -1;
+    }
+
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    int fd = 3;
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_DGRAM) {
+        return -1;
+    }
+    return fd;
+}
+
+static int open_daemon_socket(void) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DAEMON_SOCKET);
+
+    /* 已有守护进程在运行 */
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    unlink(DAEMON_SOCKET);
+    mode_t old_mask = umask(0077);
+    int ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (ret < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    int rcvbuf = DAEMON_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    return fd;
+}
+
+int daemon_run(const char *follow_path) {
+    if (check_root() != SUCCESS) {
+        return ERROR_PERMISSION;
+    }
+
+    /* 未指定时按配置决定是否跟踪日志 */
+    if (!follow_path) {
+        const char *ssh_log = get_ssh_log_from_config();
+        if (strcmp(ssh_log, "off") != 0) {
+            follow_path = follow_resolve_path(ssh_log);
+            if (!follow_path) {
+                log_write("[守护进程] 未找到sshd日志，仅接收PAM事件");
+            }
+        }
+    } else if (strcmp(follow_path, "-") != 0) {
+        follow_path = follow_resolve_path(follow_path);
+    }
+
+    /* 优先使用systemd传入的套接字，否则自行监听 */
+    int fd = get_activated_socket();
+    bool activated = (fd >= 0);
+    if (!activated) {
+        fd = open_daemon_socket();
+    }
+    if (fd < 0) {
+        char error_msg[MAX_LINE_LEN];
+        snprintf(error_msg, sizeof(error_msg), "❌ 无法监听 %s: %s", DAEMON_SOCKET, strerror(errno));
+        msg(C_RED, error_msg);
+        return ERROR_FILE;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;  /* 不设SA_RESTART，让poll被中断 */
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* 常驻状态：nft句柄（native后端）、配置、白名单、失败计数 */
+    if (nft_backend() == &nft_native_backend) {
+        nfnl_open();
+    }
+    load_snapshot();
+    reload_if_changed();
+    log_write("[守护进程] 已启动，监听 %s%s", DAEMON_SOCKET, activated ? " (套接字激活)" : "");
+
+    int follow_fd = -1;
+    if (follow_path) {
+        follow_fd = follow_open(follow_path);
+        if (follow_fd < 0) {
+            log_write("[守护进程] 无法跟踪日志 %s: %s", follow_path, strerror(errno));
+        }
+        following = (follow_fd >= 0);
+
+        /* 先补读上次停止后积压的内容（标准输入由poll驱动） */
+        if (following && strcmp(follow_path, "-") != 0) {
+            follow_read(handle_log_event);
+        }
+    }
+
+    char buf[DAEMON_MSG_MAX];
+    struct pollfd pfds[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = follow_fd, .events = POLLIN }
+    };
+    nfds_t nfds = following ? 2 : 1;
+
+    while (!daemon_stop) {
+        /* 只有套接字激活且未跟踪日志时才空闲退出，下一个事件会由systemd重新拉起 */
+        int timeout = (activated && !following && cached_idle_ms > 0) ? cached_idle_ms : -1;
+        int ready = poll(pfds, nfds, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (ready == 0) {
+            log_write("[守护进程] 空闲超时，保存状态后退出");
+            break;
+        }
+
+        /* 一次唤醒处理完队列中的全部数据报 */
+        if (pfds[0].revents) {
+            for (;;) {
+                ssize_t n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+                if (n < 0) break;
+                buf[n] = '\0';
+                handle_message(buf);
+            }
+        }
+
+        if (nfds > 1 && pfds[1].revents && follow_read(handle_log_event) != SUCCESS) {
+            log_write("[守护进程] 日志输入已结束");
+            break;
+        }
+    }
+
+    if (following) {
+        follow_close();
+    }
+    save_snapshot();
+    close(fd);
+    if (!activated) {
+        unlink(DAEMON_SOCKET);
+    }
+    nfnl_close();
+    log_write("[守护进程] 已退出");
+
+    free(counters);
+    return SUCCESS;
+}
+
+int daemon_notify(const char *command, const char *ip) {
+    if (!command || !ip) {
+        return ERROR_INVALID_ARG;
+    }
+
+    char buf[DAEMON_MSG_MAX];
+    int len = snprintf(buf, sizeof(buf), "%s %s", command, ip);
+    if (len < 0 || len >= (int)sizeof(buf)) {
+        return ERROR_INVALID_ARG;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return ERROR_FILE;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DAEMON_SOCKET);
+
+    /*
+     * 阻塞发送并设置超时：数据报队列长度受 net.unix.max_dgram_qlen 限制（与SO_RCVBUF无关），
+     * 突发时队列满是常态，等待守护进程取走即可。超时后调用方在本地计数，
+     * 守护进程每秒检查计数目录并把本地计数合并进内存
+     */
+    struct timeval tv = { .tv_sec = 0, .tv_usec = DAEMON_SEND_TIMEOUT_MS * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    ssize_t sent = sendto(fd, buf, (size_t)len, 0, (struct sockaddr *)&addr, sizeof(addr));
+    int err = errno;
+    close(fd);
+
+    if (sent == len) {
+        return SUCCESS;
+    }
+    if (sent < 0 && (err == ECONNREFUSED || err == ENOENT)) {
+        return ERROR_FILE;
+    }
+    metrics_inc(METRIC_DAEMON_BUSY);
+    return ERROR_NETWORK;
+}
@@ -0,0 +1,474 @@
+#include "follow.h"
+#include "ip_utils.h"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+
+#define FOLLOW_READ_BUF 65536
+#define FOLLOW_LINE_MAX 4096
+
+/* 自动探测的日志位置 */
+static const char *default_logs[] = {
+    "/var/log/auth.log",    /* Debian/Ubuntu */
+    "/var/log/secure",      /* CentOS/RHEL */
+    "/var/log/messages"     /* Alpine/OpenWrt */
+};
+
+/* 消息前缀的处理方式 */
+typedef enum {
+    MATCH_COUNT,            /* 直接计为事件 */
+    MATCH_INVALID_USER,     /* 不存在的用户：暂存，等待同一连接的后续行 */
+    MATCH_INVALID_CLOSE     /* 不存在用户的连接结束：暂存未被认证失败消化时才计数 */
+} sshd_match_t;
+
+/* 消息前缀匹配表 */
+#define SSHD_PATTERN(prefix, event, preauth, match) {prefix, sizeof(prefix) - 1, event, preauth, match}
+
+static const struct {
+    const char *prefix;
+    size_t len;
+    sshd_event_t event;
+    bool need_preauth;      /* 仅匹配预认证阶段（带 [preauth] 后缀） */
+    sshd_match_t match;
+} sshd_patterns[] = {
+    SSHD_PATTERN("Failed password for ", SSHD_EVENT_FAILURE, false, MATCH_COUNT),
+    SSHD_PATTERN("Failed keyboard-interactive", SSHD_EVENT_FAILURE, false, MATCH_COUNT),
+    SSHD_PATTERN("Invalid user ", SSHD_EVENT_FAILURE, false, MATCH_INVALID_USER),
+    SSHD_PATTERN("Connection closed by invalid user ", SSHD_EVENT_FAILURE, false, MATCH_INVALID_CLOSE),
+    SSHD_PATTERN("Disconnected from invalid user ", SSHD_EVENT_FAILURE, false, MATCH_INVALID_CLOSE),
+    SSHD_PATTERN("Connection closed by ", SSHD_EVENT_FAILURE, true, MATCH_COUNT),
+    SSHD_PATTERN("Did not receive identification string from ", SSHD_EVENT_FAILURE, false, MATCH_COUNT),
+    SSHD_PATTERN("banner exchange: ", SSHD_EVENT_FAILURE, false, MATCH_COUNT),
+    SSHD_PATTERN("Unable to negotiate with ", SSHD_EVENT_FAILURE, false, MATCH_COUNT),
+    SSHD_PATTERN("Accepted ", SSHD_EVENT_SUCCESS, false, MATCH_COUNT)
+};
+
+/*
+ * "Invalid user X from IP port P" 之后通常紧跟同一连接的 "Failed password for invalid user ..."，
+ * 两行都计数会让不存在的用户只需一半次数就被封禁。按 IP+端口 暂存前者：
+ * 同一连接出现认证失败时只计那一次，连接结束时仍未消化才补计一次（只探测用户名的扫描器）
+ */
+#define PENDING_MAX 64
+
+static struct {
+    char ip[IP_STR_LEN];
+    unsigned port;
+    bool used;
+} pending[PENDING_MAX];
+static size_t pending_next = 0;
+
+static int pending_find(const char *ip, unsigned port) {
+    for (size_t i = 0; i < PENDING_MAX; i++) {
+        if (pending[i].used && pending[i].port == port && strcmp(pending[i].ip, ip) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* 表满时覆盖最早的暂存（对应连接已很久没有后续日志） */
+static void pending_add(const char *ip, unsigned port) {
+    if (pending_find(ip, port) >= 0) return;
+    size_t i = pending_next;
+    pending_next = (pending_next + 1) % PENDING_MAX;
+    snprintf(pending[i].ip, sizeof(pending[i].ip), "%s", ip);
+    pending[i].port = port;
+    pending[i].used = true;
+}
+
+static bool pending_take(const char *ip, unsigned port) {
+    int i = pending_find(ip, port);
+    if (i < 0) return false;
+    pending[i].used = false;
+    return true;
+}
+
+static int log_fd = -1;
+static int notify_fd = -1;
+static int rotated_fd = -1;         /* 启动时尚未读完的轮转文件 */
+static bool from_stdin = false;
+static char log_path[MAX_PATH_LEN];
+static char log_name[MAX_PATH_LEN];
+static ino_t log_ino = 0;
+static off_t log_offset = 0;
+static char carry[FOLLOW_LINE_MAX];
+static size_t carry_len = 0;
+static time_t last_save = 0;
+
+/* 在 [s, s+len) 中查找 needle */
+static const char* find_bytes(const char *s, size_t len, const char *needle, size_t nlen) {
+    while (len >= nlen) {
+        const char *p = memchr(s, needle[0], len - nlen + 1);
+        if (!p) return NULL;
+        if (memcmp(p, needle, nlen) == 0) return p;
+        len -= (size_t)(p - s) + 1;
+        s = p + 1;
+    }
+    return NULL;
+}
+
+/* 从后往前查找 needle（用户名可被攻击者控制，真实的端口字段总在最后） */
+static const char* find_bytes_last(const char *s, size_t len, const char *needle, size_t nlen) {
+    if (len < nlen) return NULL;
+    for (const char *p = s + len - nlen; p >= s; p--) {
+        if (*p == needle[0] && memcmp(p, needle, nlen) == 0) return p;
+    }
+    return NULL;
+}
+
+/* 取出 [start, end) 范围内的最后一个空白分隔词作为IP */
+static bool copy_ip_token(const char *start, const char *end, char *ip, size_t ip_size) {
+    const char *tok_end = end;
+    while (tok_end > start && tok_end[-1] == ' ') tok_end--;
+    const char *tok = tok_end;
+    while (tok > start && tok[-1] != ' ') tok--;
+
+    char token[INET6_ADDRSTRLEN];
+    size_t n = (size_t)(tok_end - tok);
+    if (n == 0 || n >= sizeof(token)) return false;
+
+    memcpy(token, tok, n);
+    token[n] = '\0';
+
+    /* 只接受单个地址，输出规范形式 */
+    ip_addr_t addr;
+    if (ip_addr_parse(token, &addr) != SUCCESS || !ip_addr_is_host(&addr)) return false;
+    ip_addr_format(&addr, ip, ip_size);
+    return true;
+}
+
+sshd_event_t sshd_parse_line(const char *line, size_t len, bool raw, char *ip, size_t ip_size) {
+    if (!line || !ip || len == 0) return SSHD_EVENT_NONE;
+
+    /* 定位 "sshd[pid]: " / "sshd-session[pid]: " 之后的消息 */
+    const char *msg = line;
+    const char *tag = find_bytes(line, len, "sshd", 4);
+    if (tag) {
+        const char *colon = find_bytes(tag, len - (size_t)(tag - line), ": ", 2);
+        if (!colon) return SSHD_EVENT_NONE;
+        msg = colon + 2;
+    } else if (!raw) {
+        return SSHD_EVENT_NONE;
+    }
+
+    size_t msg_len = len - (size_t)(msg - line);
+    while (msg_len > 0 && (msg[msg_len - 1] == '\r' || msg[msg_len - 1] == ' ')) msg_len--;
+
+    sshd_event_t event = SSHD_EVENT_NONE;
+    sshd_match_t match = MATCH_COUNT;
+    for (size_t i = 0; i < ARRAY_SIZE(sshd_patterns); i++) {
+        if (msg_len < sshd_patterns[i].len || msg[0] != sshd_patterns[i].prefix[0] ||
+            memcmp(msg, sshd_patterns[i].prefix, sshd_patterns[i].len) != 0) {
+            continue;
+        }
+        if (sshd_patterns[i].need_preauth) {
+            /* 带用户名的关闭紧跟在已计数的失败之后，只统计未尝试认证的连接 */
+            const char *rest = msg + sshd_patterns[i].len;
+            if (msg_len < 9 || memcmp(msg + msg_len - 9, "[preauth]", 9) != 0 ||
+                !(isxdigit((unsigned char)rest[0]) || rest[0] == ':') ||
+                find_bytes(rest, msg_len - sshd_patterns[i].len, " user ", 6)) {
+                return SSHD_EVENT_NONE;
+            }
+        }
+        event = sshd_patterns[i].event;
+        match = sshd_patterns[i].match;
+        break;
+    }
+    if (event == SSHD_EVENT_NONE) return SSHD_EVENT_NONE;
+
+    /* IP位于最后一个 " port " 之前；老版本sshd没有端口字段时取 " from " 之后 */
+    unsigned port_num = 0;
+    bool parsed = false;
+    const char *port = find_bytes_last(msg, msg_len, " port ", 6);
+    if (port) {
+        parsed = copy_ip_token(msg, port, ip, ip_size);
+        for (const char *d = port + 6; d < msg + msg_len && isdigit((unsigned char)*d); d++) {
+            port_num = port_num * 10 + (unsigned)(*d - '0');
+            if (port_num > 65535) break;
+        }
+    } else {
+        const char *from = find_bytes_last(msg, msg_len, " from ", 6);
+        if (from) {
+            const char *start = from + 6;
+            const char *end = memchr(start, ' ', msg_len - (size_t)(start - msg));
+            if (!end) end = msg + msg_len;
+            parsed = copy_ip_token(start, end, ip, ip_size);
+        }
+    }
+    if (!parsed) return SSHD_EVENT_NONE;
+
+    switch (match) {
+    case MATCH_INVALID_USER:
+        pending_add(ip, port_num);
+        return SSHD_EVENT_NONE;
+    case MATCH_INVALID_CLOSE:
+        return pending_take(ip, port_num) ? event : SSHD_EVENT_NONE;
+    case MATCH_COUNT:
+        /* 同一连接的认证失败已计数，暂存的 Invalid user 不再补计 */
+        if (event == SSHD_EVENT_FAILURE) {
+            pending_take(ip, port_num);
+        }
+        break;
+    }
+    return event;
+}
+
+const char* follow_resolve_path(const char *path) {
+    if (path && strlen(path) > 0 && strcmp(path, "auto") != 0) {
+        return path;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(default_logs); i++) {
+        if (access(default_logs[i], R_OK) == 0) {
+            return default_logs[i];
+        }
+    }
+    return NULL;
+}
+
+static void process_line(const char *line, size_t len, follow_cb_t cb) {
+    char ip[IP_STR_LEN];
+    sshd_event_t event = sshd_parse_line(line, len, from_stdin, ip, sizeof(ip));
+    if (event != SSHD_EVENT_NONE) {
+        cb(event, ip);
+    }
+}
+
+/* 按行切分，跨块的半行暂存在carry中 */
+static void process_chunk(const char *buf, size_t n, follow_cb_t cb) {
+    const char *p = buf;
+    const char *end = buf + n;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl) {
+            size_t rest = (size_t)(end - p);
+            if (carry_len + rest < sizeof(carry)) {
+                memcpy(carry + carry_len, p, rest);
+                carry_len += rest;
+            } else {
+                carry_len = sizeof(carry);  /* 超长行直接丢弃 */
+            }
+            return;
+        }
+
+        if (carry_len > 0) {
+            size_t part = (size_t)(nl - p);
+            if (carry_len < sizeof(carry) && carry_len + part < sizeof(carry)) {
+                memcpy(carry + carry_len, p, part);
+                process_line(carry, carry_len + part, cb);
+            }
+            carry_len = 0;
+        } else {
+            process_line(p, (size_t)(nl - p), cb);
+        }
+        p = nl + 1;
+    }
+}
+
+/* 读到文件末尾，返回读取的字节数 */
+static ssize_t drain_fd(int fd, follow_cb_t cb) {
+    static char buf[FOLLOW_READ_BUF];
+    ssize_t total = 0;
+
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (n == 0) break;
+        process_chunk(buf, (size_t)n, cb);
+        total += n;
+    }
+    return total;
+}
+
+static void load_position(ino_t *ino, off_t *offset) {
+    *ino = 0;
+    *offset = 0;
+
+    FILE *fp = fopen(FOLLOW_POS_FILE, "r");
+    if (!fp) return;
+
+    unsigned long long saved_ino = 0;
+    long long saved_off = 0;
+    char saved_path[MAX_PATH_LEN] = {0};
+    if (fscanf(fp, "%llu %lld %255s", &saved_ino, &saved_off, saved_path) == 3 &&
+        strcmp(saved_path, log_path) == 0 && saved_off >= 0) {
+        *ino = (ino_t)saved_ino;
+        *offset = (off_t)saved_off;
+    }
+    fclose(fp);
+}
+
+void follow_save_position(bool force) {
+    if (from_stdin || log_fd < 0) return;
+
+    time_t now = time(NULL);
+    if (!force && now == last_save) return;
+    last_save = now;
+
+    char temp_file[MAX_PATH_LEN];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", FOLLOW_POS_FILE);
+    FILE *fp = fopen(temp_file, "w");
+    if (!fp) return;
+
+    /* 未处理完的半行下次重新读取 */
+    off_t offset = log_offset - (off_t)(carry_len < sizeof(carry) ? carry_len : 0);
+    fprintf(fp, "%llu %lld %s\n", (unsigned long long)log_ino, (long long)offset, log_path);
+    fclose(fp);
+    rename(temp_file, FOLLOW_POS_FILE);
+}
+
+int follow_open(const char *path) {
+    if (!path) {
+        return -1;
+    }
+
+    if (strcmp(path, "-") == 0) {
+        from_stdin = true;
+        log_fd = STDIN_FILENO;
+        return log_fd;
+    }
+
+    snprintf(log_path, sizeof(log_path), "%s", path);
+    char path_copy[MAX_PATH_LEN];
+    snprintf(path_copy, sizeof(path_copy), "%s", path);
+    snprintf(log_name, sizeof(log_name), "%s", basename(path_copy));
+
+    log_fd = open(log_path, O_RDONLY | O_CLOEXEC);
+    if (log_fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    fstat(log_fd, &st);
+    log_ino = st.st_ino;
+
+    ino_t saved_ino;
+    off_t saved_off;
+    load_position(&saved_ino, &saved_off);
+
+    if (saved_ino == st.st_ino && saved_off <= st.st_size) {
+        /* 同一个文件：从上次位置继续 */
+        log_offset = saved_off;
+    } else if (saved_ino == st.st_ino) {
+        /* 同一个文件但比上次位置短：已被截断（copytruncate），从头读取 */
+        log_offset = 0;
+    } else if (saved_ino != 0 && saved_ino != st.st_ino) {
+        /* 文件已轮转：先读完旧文件剩余部分，再从头读新文件 */
+        char rotated[MAX_PATH_LEN + 2];
+        snprintf(rotated, sizeof(rotated), "%s.1", log_path);
+        int fd = open(rotated, O_RDONLY | O_CLOEXEC);
+        struct stat rst;
+        if (fd >= 0 && fstat(fd, &rst) == 0 && rst.st_ino == saved_ino && saved_off <= rst.st_size) {
+            lseek(fd, saved_off, SEEK_SET);
+            rotated_fd = fd;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        log_offset = 0;
+    } else {
+        /* 首次跟踪：不回放历史日志 */
+        log_offset = st.st_size;
+    }
+    lseek(log_fd, log_offset, SEEK_SET);
+
+    /* 监视所在目录，轮转时能收到新文件的创建事件 */
+    char dir_copy[MAX_PATH_LEN];
+    snprintf(dir_copy, sizeof(dir_copy), "%s", path);
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify_fd < 0 ||
+        inotify_add_watch(notify_fd, dirname(dir_copy),
+                          IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+
+    log_write("[日志跟踪] 开始跟踪 %s (偏移 %lld)", log_path, (long long)log_offset);
+    return notify_fd;
+}
+
+int follow_read(follow_cb_t cb) {
+    if (log_fd < 0) {
+        return ERROR_FILE;
+    }
+
+    if (from_stdin) {
+        static char buf[FOLLOW_READ_BUF];
+        ssize_t n = read(log_fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            return SUCCESS;
+        }
+        if (n <= 0) {
+            if (carry_len > 0 && carry_len < sizeof(carry)) {
+                process_line(carry, carry_len, cb);
+            }
+            carry_len = 0;
+            return ERROR_FILE;
+        }
+        process_chunk(buf, (size_t)n, cb);
+        return SUCCESS;
+    }
+
+    /* 清空inotify事件，具体变化通过stat判断 */
+    char events[4096];
+    while (read(notify_fd, events, sizeof(events)) > 0) {
+    }
+
+    if (rotated_fd >= 0) {
+        drain_fd(rotated_fd, cb);
+        close(rotated_fd);
+        rotated_fd = -1;
+        carry_len = 0;
+    }
+
+    log_offset += drain_fd(log_fd, cb);
+
+    struct stat st;
+    if (stat(log_path, &st) != 0) {
+        return SUCCESS;  /* 已被移走，等待新文件创建 */
+    }
+
+    if (st.st_ino != log_ino) {
+        /* 轮转：旧文件已读完，切换到新文件 */
+        int fd = open(log_path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            close(log_fd);
+            log_fd = fd;
+            log_ino = st.st_ino;
+            log_offset = 0;
+            carry_len = 0;
+            log_offset += drain_fd(log_fd, cb);
+        }
+    } else if (st.st_size < log_offset) {
+        /* copytruncate 截断：从头开始 */
+        lseek(log_fd, 0, SEEK_SET);
+        log_offset = 0;
+        carry_len = 0;
+        log_offset += drain_fd(log_fd, cb);
+    }
+
+    follow_save_position(false);
+    return SUCCESS;
+}
+
+void follow_close(void) {
+    follow_save_position(true);
+
+    if (rotated_fd >= 0) {
+        close(rotated_fd);
+        rotated_fd = -1;
+    }
+    if (notify_fd >= 0) {
+        close(notify_fd);
+        notify_fd = -1;
+    }
+    if (log_fd >= 0 && !from_stdin) {
+        close(log_fd);
+    }
+    log_fd = -1;
+}
@@ -1,150 +1,616 @@
 #include "geo.h"
 #include "log.h"
+#include "ip_utils.h"
+#include "store.h"
+#include "geodb.h"
+#include "geocache.h"
+#include "trace.h"
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/wait.h>
 
-/* 国家代码映射表 */
-static const struct {
+#define GEO_FETCH_PARALLEL 4        /* 在线查询的并发连接数 */
+#define GEO_ENRICH_BATCH 64         /* 每轮最多在线查询的网段数 */
+
+/* ISO 3166-1 国家/地区代码表（按代码排序，二分查找） */
+typedef struct {
     const char *code;
     const char *name;
-} country_map[] = {
+} country_entry_t;
+
+static const country_entry_t country_map[] = {
+    {"AD", "安道尔"},
+    {"AE", "阿联酋"},
+    {"AF", "阿富汗"},
+    {"AG", "安提瓜和巴布达"},
+    {"AI", "安圭拉"},
+    {"AL", "阿尔巴尼亚"},
+    {"AM", "亚美尼亚"},
+    {"AO", "安哥拉"},
+    {"AQ", "南极洲"},
+    {"AR", "阿根廷"},
+    {"AS", "美属萨摩亚"},
+    {"AT", "奥地利"},
+    {"AU", "澳大利亚"},
+    {"AW", "阿鲁巴"},
+    {"AX", "奥兰群岛"},
+    {"AZ", "阿塞拜疆"},
+    {"BA", "波黑"},
+    {"BB", "巴巴多斯"},
+    {"BD", "孟加拉国"},
+    {"BE", "比利时"},
+    {"BF", "布基纳法索"},
+    {"BG", "保加利亚"},
+    {"BH", "巴林"},
+    {"BI", "布隆迪"},
+    {"BJ", "贝宁"},
+    {"BL", "圣巴泰勒米"},
+    {"BM", "百慕大"},
+    {"BN", "文莱"},
+    {"BO", "玻利维亚"},
+    {"BQ", "荷兰加勒比区"},
+    {"BR", "巴西"},
+    {"BS", "巴哈马"},
+    {"BT", "不丹"},
+    {"BV", "布韦岛"},
+    {"BW", "博茨瓦纳"},
+    {"BY", "白俄罗斯"},
+    {"BZ", "伯利兹"},
+    {"CA", "加拿大"},
+    {"CC", "科科斯群岛"},
+    {"CD", "刚果（金）"},
+    {"CF", "中非"},
+    {"CG", "刚果（布）"},
+    {"CH", "瑞士"},
+    {"CI", "科特迪瓦"},
+    {"CK", "库克群岛"},
+    {"CL", "智利"},
+    {"CM", "喀麦隆"},
     {"CN", "中国"},
-    {"US", "美国"},
-    {"RU", "俄罗斯"},
-    {"MY", "马来西亚"},
-    {"NL", "荷兰"},
+    {"CO", "哥伦比亚"},
+    {"CR", "哥斯达黎加"},
+    {"CU", "古巴"},
+    {"CV", "佛得角"},
+    {"CW", "库拉索"},
+    {"CX", "圣诞岛"},
+    {"CY", "塞浦路斯"},
+    {"CZ", "捷克"},
     {"DE", "德国"},
-    {"GB", "英国"},
+    {"DJ", "吉布提"},
+    {"DK", "丹麦"},
+    {"DM", "多米尼克"},
+    {"DO", "多米尼加"},
+    {"DZ", "阿尔及利亚"},
+    {"EC", "厄瓜多尔"},
+    {"EE", "爱沙尼亚"},
+    {"EG", "埃及"},
+    {"EH", "西撒哈拉"},
+    {"ER", "厄立特里亚"},
+    {"ES", "西班牙"},
+    {"ET", "埃塞俄比亚"},
+    {"FI", "芬兰"},
+    {"FJ", "斐济"},
+    {"FK", "福克兰群岛"},
+    {"FM", "密克罗尼西亚"},
+    {"FO", "法罗群岛"},
     {"FR", "法国"},
-    {"JP", "日本"},
-    {"KR", "韩国"},
-    {"SG", "新加坡"},
+    {"GA", "加蓬"},
+    {"GB", "英国"},
+    {"GD", "格林纳达"},
+    {"GE", "格鲁吉亚"},
+    {"GF", "法属圭亚那"},
+    {"GG", "根西"},
+    {"GH", "加纳"},
+    {"GI", "直布罗陀"},
+    {"GL", "格陵兰"},
+    {"GM", "冈比亚"},
+    {"GN", "几内亚"},
+    {"GP", "瓜德罗普"},
+    {"GQ", "赤道几内亚"},
+    {"GR", "希腊"},
+    {"GS", "南乔治亚和南桑威奇群岛"},
+    {"GT", "危地马拉"},
+    {"GU", "关岛"},
+    {"GW", "几内亚比绍"},
+    {"GY", "圭亚那"},
     {"HK", "香港"},
-    {"TW", "台湾"},
+    {"HM", "赫德岛和麦克唐纳群岛"},
+    {"HN", "洪都拉斯"},
+    {"HR", "克罗地亚"},
+    {"HT", "海地"},
+    {"HU", "匈牙利"},
+    {"ID", "印度尼西亚"},
+    {"IE", "爱尔兰"},
+    {"IL", "以色列"},
+    {"IM", "马恩岛"},
     {"IN", "印度"},
-    {"BR", "巴西"},
-    {"CA", "加拿大"},
-    {"AU", "澳大利亚"},
+    {"IO", "英属印度洋领地"},
+    {"IQ", "伊拉克"},
+    {"IR", "伊朗"},
+    {"IS", "冰岛"},
     {"IT", "意大利"},
-    {"ES", "西班牙"},
-    {"SE", "瑞典"},
+    {"JE", "泽西"},
+    {"JM", "牙买加"},
+    {"JO", "约旦"},
+    {"JP", "日本"},
+    {"KE", "肯尼亚"},
+    {"KG", "吉尔吉斯斯坦"},
+    {"KH", "柬埔寨"},
+    {"KI", "基里巴斯"},
+    {"KM", "科摩罗"},
+    {"KN", "圣基茨和尼维斯"},
+    {"KP", "朝鲜"},
+    {"KR", "韩国"},
+    {"KW", "科威特"},
+    {"KY", "开曼群岛"},
+    {"KZ", "哈萨克斯坦"},
+    {"LA", "老挝"},
+    {"LB", "黎巴嫩"},
+    {"LC", "圣卢西亚"},
+    {"LI", "列支敦士登"},
+    {"LK", "斯里兰卡"},
+    {"LR", "利比里亚"},
+    {"LS", "莱索托"},
+    {"LT", "立陶宛"},
+    {"LU", "卢森堡"},
+    {"LV", "拉脱维亚"},
+    {"LY", "利比亚"},
+    {"MA", "摩洛哥"},
+    {"MC", "摩纳哥"},
+    {"MD", "摩尔多瓦"},
+    {"ME", "黑山"},
+    {"MF", "法属圣马丁"},
+    {"MG", "马达加斯加"},
+    {"MH", "马绍尔群岛"},
+    {"MK", "北马其顿"},
+    {"ML", "马里"},
+    {"MM", "缅甸"},
+    {"MN", "蒙古"},
+    {"MO", "澳门"},
+    {"MP", "北马里亚纳群岛"},
+    {"MQ", "马提尼克"},
+    {"MR", "毛里塔尼亚"},
+    {"MS", "蒙特塞拉特"},
+    {"MT", "马耳他"},
+    {"MU", "毛里求斯"},
+    {"MV", "马尔代夫"},
+    {"MW", "马拉维"},
+    {"MX", "墨西哥"},
+    {"MY", "马来西亚"},
+    {"MZ", "莫桑比克"},
+    {"NA", "纳米比亚"},
+    {"NC", "新喀里多尼亚"},
+    {"NE", "尼日尔"},
+    {"NF", "诺福克岛"},
+    {"NG", "尼日利亚"},
+    {"NI", "尼加拉瓜"},
+    {"NL", "荷兰"},
+    {"NO", "挪威"},
+    {"NP", "尼泊尔"},
+    {"NR", "瑙鲁"},
+    {"NU", "纽埃"},
+    {"NZ", "新西兰"},
+    {"OM", "阿曼"},
+    {"PA", "巴拿马"},
+    {"PE", "秘鲁"},
+    {"PF", "法属波利尼西亚"},
+    {"PG", "巴布亚新几内亚"},
+    {"PH", "菲律宾"},
+    {"PK", "巴基斯坦"},
     {"PL", "波兰"},
-    {"UA", "乌克兰"},
-    {"TR", "土耳其"},
-    {"ID", "印度尼西亚"},
+    {"PM", "圣皮埃尔和密克隆"},
+    {"PN", "皮特凯恩群岛"},
+    {"PR", "波多黎各"},
+    {"PS", "巴勒斯坦"},
+    {"PT", "葡萄牙"},
+    {"PW", "帕劳"},
+    {"PY", "巴拉圭"},
+    {"QA", "卡塔尔"},
+    {"RE", "留尼汪"},
+    {"RO", "罗马尼亚"},
+    {"RS", "塞尔维亚"},
+    {"RU", "俄罗斯"},
+    {"RW", "卢旺达"},
+    {"SA", "沙特阿拉伯"},
+    {"SB", "所罗门群岛"},
+    {"SC", "塞舌尔"},
+    {"SD", "苏丹"},
+    {"SE", "瑞典"},
+    {"SG", "新加坡"},
+    {"SH", "圣赫勒拿"},
+    {"SI", "斯洛文尼亚"},
+    {"SJ", "斯瓦尔巴和扬马延"},
+    {"SK", "斯洛伐克"},
+    {"SL", "塞拉利昂"},
+    {"SM", "圣马力诺"},
+    {"SN", "塞内加尔"},
+    {"SO", "索马里"},
+    {"SR", "苏里南"},
+    {"SS", "南苏丹"},
+    {"ST", "圣多美和普林西比"},
+    {"SV", "萨尔瓦多"},
+    {"SX", "荷属圣马丁"},
+    {"SY", "叙利亚"},
+    {"SZ", "斯威士兰"},
+    {"TC", "特克斯和凯科斯群岛"},
+    {"TD", "乍得"},
+    {"TF", "法属南部领地"},
+    {"TG", "多哥"},
     {"TH", "泰国"},
+    {"TJ", "塔吉克斯坦"},
+    {"TK", "托克劳"},
+    {"TL", "东帝汶"},
+    {"TM", "土库曼斯坦"},
+    {"TN", "突尼斯"},
+    {"TO", "汤加"},
+    {"TR", "土耳其"},
+    {"TT", "特立尼达和多巴哥"},
+    {"TV", "图瓦卢"},
+    {"TW", "台湾"},
+    {"TZ", "坦桑尼亚"},
+    {"UA", "乌克兰"},
+    {"UG", "乌干达"},
+    {"UM", "美国本土外小岛屿"},
+    {"US", "美国"},
+    {"UY", "乌拉圭"},
+    {"UZ", "乌兹别克斯坦"},
+    {"VA", "梵蒂冈"},
+    {"VC", "圣文森特和格林纳丁斯"},
+    {"VE", "委内瑞拉"},
+    {"VG", "英属维尔京群岛"},
+    {"VI", "美属维尔京群岛"},
     {"VN", "越南"},
-    {"MX", "墨西哥"},
-    {"AR", "阿根廷"},
-    {"CL", "智利"},
-    {"RO", "罗马尼亚"},
-    {"CZ", "捷克"}
+    {"VU", "瓦努阿图"},
+    {"WF", "瓦利斯和富图纳"},
+    {"WS", "萨摩亚"},
+    {"YE", "也门"},
+    {"YT", "马约特"},
+    {"ZA", "南非"},
+    {"ZM", "赞比亚"},
+    {"ZW", "津巴布韦"}
 };
 
-int query_country_code(const char *ip, char *country_code, size_t size) {
-    if (!ip || !country_code) {
-        return ERROR_INVALID_ARG;
+/* 按配置的接口模板生成查询URL（模板不合法时使用默认接口） */
+static void build_query_url(const char *ip, char *url, size_t size) {
+    const char *api = get_geo_api_from_config();
+    const char *p = strstr(api, "%s");
+    if (!p || strpbrk(api, "\"\\ \t")) {
+        api = DEFAULT_GEO_API;
+        p = strstr(api, "%s");
     }
+    snprintf(url, size, "%.*s%s%s", (int)(p - api), api, ip, p + 2);
+}
+
+/* 读取一个响应文件，内容是两位字母时视为国家代码 */
+static void read_country_reply(const char *path, char *country_code) {
+    country_code[0] = '\0';
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
     
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command),
-             "curl -s --max-time 2 \"https://ipinfo.io/%s/country\" 2>/dev/null | tr -d '\\n\\r '",
-             ip);
+    char buf[16] = {0};
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
     
-    FILE *fp = popen(command, "r");
-    if (!fp) {
-        return ERROR_NETWORK;
+    char *p = buf;
+    while (*p && isspace((unsigned char)*p)) p++;
+    char *end = p + strlen(p);
+    while (end > p && isspace((unsigned char)end[-1])) end--;
+    
+    if (end - p == 2 && isalpha((unsigned char)p[0]) && isalpha((unsigned char)p[1])) {
+        country_code[0] = (char)toupper((unsigned char)p[0]);
+        country_code[1] = (char)toupper((unsigned char)p[1]);
+        country_code[2] = '\0';
+    }
+}
+
+/*
+ * 用一个curl进程完成一批查询：请求写进curl配置文件，--parallel 下同一主机
+ * 复用keep-alive连接，并发数不超过 GEO_FETCH_PARALLEL。
+ * results[i] 为空串表示该地址查询失败；curl无法运行时返回ERROR_FILE。
+ */
+static int fetch_batch(char (*ips)[IP_STR_LEN], size_t count, char (*results)[MAX_COUNTRY_CODE]) {
+    for (size_t i = 0; i < count; i++) {
+        results[i][0] = '\0';
+    }
+    if (count == 0) {
+        return SUCCESS;
     }
     
-    char result[16] = {0};
-    if (fgets(result, sizeof(result), fp)) {
-        /* 去除空白字符 */
-        char *p = result;
-        while (*p && isspace(*p)) p++;
-        
-        if (strlen(p) == 2 && isalpha(p[0]) && isalpha(p[1])) {
-            strncpy(country_code, p, size - 1);
-            country_code[size - 1] = '\0';
-            pclose(fp);
-            return SUCCESS;
+    char dir[] = "/tmp/bip-geo.XXXXXX";
+    if (!mkdtemp(dir)) {
+        return ERROR_FILE;
+    }
+    
+    char path[MAX_PATH_LEN];
+    char cfg_path[MAX_PATH_LEN];
+    snprintf(cfg_path, sizeof(cfg_path), "%s/curl.conf", dir);
+    FILE *cfg = fopen(cfg_path, "w");
+    if (!cfg) {
+        rmdir(dir);
+        return ERROR_FILE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        char url[MAX_PATH_LEN + IP_STR_LEN];
+        build_query_url(ips[i], url, sizeof(url));
+        fprintf(cfg, "url = \"%s\"\noutput = \"%s/%zu\"\n", url, dir, i);
+    }
+    fclose(cfg);
+    
+    char parallel[16];
+    snprintf(parallel, sizeof(parallel), "%d", GEO_FETCH_PARALLEL);
+    char *const argv[] = {
+        "curl", "-s", "-g", "--fail",
+        "--connect-timeout", "2", "--max-time", "2",
+        "--parallel", "--parallel-max", parallel,
+        "-K", cfg_path, NULL
+    };
+    
+    /* 封禁流程的后台进程忽略了SIGCHLD，等待curl前需要恢复默认处理 */
+    void (*old_handler)(int) = signal(SIGCHLD, SIG_DFL);
+    int ret = ERROR_FILE;
+    uint64_t trace_t0 = trace_start();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
         }
+        execvp("curl", argv);
+        _exit(127);
     }
+    if (pid > 0) {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (WIFEXITED(status) && WEXITSTATUS(status) != 127) {
+            ret = SUCCESS;
+        }
+        if (trace_t0) {
+            char command[MAX_COMMAND_LEN];
+            snprintf(command, sizeof(command), "curl --parallel -K %s (%zu 个查询)", cfg_path, count);
+            trace_command(command, trace_t0, status);
+        }
+    }
+    signal(SIGCHLD, old_handler);
     
-    pclose(fp);
-    return ERROR_NETWORK;
+    for (size_t i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%zu", dir, i);
+        if (ret == SUCCESS) {
+            read_country_reply(path, results[i]);
+        }
+        unlink(path);
+    }
+    unlink(cfg_path);
+    rmdir(dir);
+    return ret;
+}
+
+static int query_remote(const char *ip, char *country_code, size_t size) {
+    char ips[1][IP_STR_LEN];
+    char results[1][MAX_COUNTRY_CODE];
+    snprintf(ips[0], sizeof(ips[0]), "%s", ip);
+    
+    if (fetch_batch(ips, 1, results) != SUCCESS) {
+        return ERROR_FILE;
+    }
+    if (results[0][0] == '\0') {
+        return ERROR_NETWORK;
+    }
+    snprintf(country_code, size, "%s", results[0]);
+    return SUCCESS;
+}
+
+int query_country_code(const char *ip, char *country_code, size_t size) {
+    ip_addr_t addr;
+    if (!ip || !country_code || size < 3 || ip_addr_parse(ip, &addr) != SUCCESS) {
+        return ERROR_INVALID_ARG;
+    }
+    
+    /* 安装了离线数据库时只查本地，不再访问网络 */
+    if (geodb_available()) {
+        return geodb_lookup(&addr, country_code, size);
+    }
+    
+    /* 同一网段的结果（包括查询失败）在有效期内直接复用 */
+    int ret = geocache_get(&addr, country_code, size);
+    if (ret == SUCCESS || ret == ERROR_NETWORK) {
+        return ret;
+    }
+    
+    char ip_str[IP_STR_LEN];
+    ip_addr_format(&addr, ip_str, sizeof(ip_str));
+    ret = query_remote(ip_str, country_code, size);
+    if (ret == SUCCESS) {
+        geocache_put(&addr, country_code);
+    } else if (ret == ERROR_NETWORK) {
+        geocache_put(&addr, NULL);
+    } else {
+        ret = ERROR_NETWORK;
+    }
+    return ret;
+}
+
+static int cmp_country(const void *key, const void *elem) {
+    return strcmp((const char *)key, ((const country_entry_t *)elem)->code);
 }
 
 const char* get_country_name(const char *country_code) {
     if (!country_code) return country_code;
     
-    for (size_t i = 0; i < ARRAY_SIZE(country_map); i++) {
-        if (strcmp(country_map[i].code, country_code) == 0) {
-            return country_map[i].name;
-        }
+    const country_entry_t *entry = bsearch(country_code, country_map, ARRAY_SIZE(country_map),
+                                           sizeof(country_map[0]), cmp_country);
+    return entry ? entry->name : country_code;
+}
+
+/* 本轮已排队的在线查询（按缓存前缀去重） */
+typedef struct {
+    ip_addr_t addr;             /* 代表该网段发起查询的地址 */
+    ip_addr_t prefix;
+} geo_query_t;
+
+/* 本地能解析的直接返回，返回ERROR_FILE表示需要在线查询（cache为NULL时使用离线数据库） */
+static int resolve_local(geocache_t *cache, const ip_addr_t *addr, char *country_code, size_t size) {
+    if (!cache) {
+        return (geodb_lookup(addr, country_code, size) == SUCCESS) ? SUCCESS : ERROR_NETWORK;
     }
-    
-    return country_code;
+    if (!cache->base) {
+        return ERROR_FILE;  /* 缓存无法打开时全部走在线查询 */
+    }
+    return geocache_lookup(cache, addr, country_code, size);
 }
 
-void supplement_country_info(const char *current_ip) {
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    if (!fp) return;
+/* 一轮补充：本地解析全部待补充条目，未命中的网段最多在线查询 limit 个，结果一次写入 */
+static int enrich_round(size_t limit, size_t *queried, size_t *annotated) {
+    *queried = 0;
+    *annotated = 0;
     
-    char line[MAX_LINE_LEN];
-    int update_count = 0;
-    const int MAX_UPDATES = 3;
+    store_view_t view;
+    if (store_load(&view) != SUCCESS) {
+        return ERROR_FILE;
+    }
     
-    /* 创建临时文件 */
-    char temp_file[MAX_PATH_LEN];
-    snprintf(temp_file, sizeof(temp_file), "%s.tmp", PERSIST_FILE);
-    FILE *temp_fp = fopen(temp_file, "w");
-    if (!temp_fp) {
-        fclose(fp);
-        return;
+    store_entry_t *resolved = malloc((view.count + 1) * sizeof(*resolved));
+    int *query_of = malloc((view.count + 1) * sizeof(*query_of));
+    geo_query_t *queries = malloc(GEO_ENRICH_BATCH * sizeof(*queries));
+    char (*ips)[IP_STR_LEN] = malloc(GEO_ENRICH_BATCH * sizeof(*ips));
+    char (*results)[MAX_COUNTRY_CODE] = malloc(GEO_ENRICH_BATCH * sizeof(*results));
+    if (!resolved || !query_of || !queries || !ips || !results) {
+        free(resolved);
+        free(query_of);
+        free(queries);
+        free(ips);
+        free(results);
+        store_view_free(&view);
+        return ERROR_FILE;
     }
     
-    while (fgets(line, sizeof(line), fp) && update_count < MAX_UPDATES) {
-        /* 去除换行符 */
-        line[strcspn(line, "\n")] = 0;
-        
-        if (strlen(line) == 0) continue;
+    if (limit > GEO_ENRICH_BATCH) limit = GEO_ENRICH_BATCH;
+    size_t n_resolved = 0;
+    size_t n_queries = 0;
+    
+    /* 本轮的本地解析只打开一次缓存，在线查询期间不持有缓存锁 */
+    geocache_t cache;
+    bool use_cache = !geodb_available();
+    if (use_cache) {
+        geocache_open(&cache);
+    }
+    
+    for (size_t i = 0; i < view.count; i++) {
+        const store_entry_t *entry = &view.entries[i];
+        query_of[i] = -1;
         
-        /* 检查是否已有国家信息 */
-        if (strchr(line, '|')) {
-            fprintf(temp_fp, "%s\n", line);
+        /* 只补充单个地址（网段没有唯一归属） */
+        if (entry->country[0] != '\0' || !ip_addr_is_host(&entry->addr)) {
             continue;
         }
         
-        /* 检查是否是IPv6或CIDR */
-        if (strchr(line, ':') || strchr(line, '/')) {
-            fprintf(temp_fp, "%s\n", line);
+        char country_code[MAX_COUNTRY_CODE];
+        int ret = resolve_local(use_cache ? &cache : NULL, &entry->addr, country_code, sizeof(country_code));
+        if (ret == SUCCESS) {
+            resolved[n_resolved] = *entry;
+            snprintf(resolved[n_resolved].country, sizeof(resolved[n_resolved].country), "%s", country_code);
+            n_resolved++;
             continue;
         }
-        
-        /* 跳过当前正在处理的IP */
-        if (current_ip && strcmp(line, current_ip) == 0) {
-            fprintf(temp_fp, "%s\n", line);
+        if (ret != ERROR_FILE) {
             continue;
         }
         
-        /* 查询国家信息 */
-        char country_code[MAX_COUNTRY_CODE];
-        if (query_country_code(line, country_code, sizeof(country_code)) == SUCCESS) {
-            fprintf(temp_fp, "%s|%s\n", line, country_code);
-            log_write("[补充地区] IP=%s 国家=%s", line, get_country_name(country_code));
-            update_count++;
-        } else {
-            fprintf(temp_fp, "%s\n", line);
+        ip_addr_t prefix;
+        geocache_prefix(&entry->addr, &prefix);
+        size_t q = 0;
+        while (q < n_queries && !ip_addr_equal(&queries[q].prefix, &prefix)) q++;
+        if (q == n_queries) {
+            if (n_queries >= limit) continue;
+            queries[q].addr = entry->addr;
+            queries[q].prefix = prefix;
+            ip_addr_format(&entry->addr, ips[q], sizeof(ips[q]));
+            n_queries++;
         }
+        query_of[i] = (int)q;
+    }
+    if (use_cache) {
+        geocache_close(&cache);
     }
     
-    /* 复制剩余内容 */
-    while (fgets(line, sizeof(line), fp)) {
-        fputs(line, temp_fp);
+    int ret = SUCCESS;
+    if (n_queries > 0) {
+        ret = fetch_batch(ips, n_queries, results);
+        if (ret == SUCCESS) {
+            /* 查询结果（含失败）一次打开缓存全部写入 */
+            if (geocache_open(&cache) == SUCCESS) {
+                for (size_t q = 0; q < n_queries; q++) {
+                    geocache_store(&cache, &queries[q].addr, results[q][0] ? results[q] : NULL);
+                }
+                geocache_close(&cache);
+            }
+            for (size_t q = 0; q < n_queries; q++) {
+                if (results[q][0]) {
+                    log_write("[地理查询] IP=%s 国家=%s", ips[q], get_country_name(results[q]));
+                }
+            }
+            for (size_t i = 0; i < view.count; i++) {
+                if (query_of[i] < 0 || results[query_of[i]][0] == '\0') continue;
+                resolved[n_resolved] = view.entries[i];
+                snprintf(resolved[n_resolved].country, sizeof(resolved[n_resolved].country),
+                         "%s", results[query_of[i]]);
+                n_resolved++;
+            }
+            *queried = n_queries;
+        }
     }
     
-    fclose(fp);
-    fclose(temp_fp);
+    if (n_resolved > 0 && store_annotate_batch(resolved, n_resolved) == SUCCESS) {
+        *annotated = n_resolved;
+    }
+    
+    free(resolved);
+    free(query_of);
+    free(queries);
+    free(ips);
+    free(results);
+    store_view_free(&view);
+    return ret;
+}
+
+int geo_enrich_pending(size_t budget, size_t *annotated) {
+    if (annotated) *annotated = 0;
+    
+    /* 同一时间只运行一个补充进程，其余直接返回 */
+    int lock_fd = open(GEO_ENRICH_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0) {
+        return ERROR_FILE;
+    }
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        close(lock_fd);
+        return SUCCESS;
+    }
+    
+    int ret = SUCCESS;
+    size_t total = 0;
+    for (;;) {
+        size_t queried = 0;
+        size_t done = 0;
+        ret = enrich_round(budget, &queried, &done);
+        total += done;
+        if (done > 0 || queried > 0) {
+            log_write("[补充地区] 标注%zu条，在线查询%zu个网段", done, queried);
+        }
+        
+        /* 查询结果（含失败）已写入缓存，下一轮从剩余的网段继续 */
+        budget -= queried;
+        if (ret != SUCCESS || queried < GEO_ENRICH_BATCH || budget == 0) {
+            break;
+        }
+    }
     
-    /* 替换原文件 */
-    rename(temp_file, PERSIST_FILE);
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    if (annotated) *annotated = total;
+    return ret;
 }
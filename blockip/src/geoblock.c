@@ -0,0 +1,527 @@
+#include "geoblock.h"
+#include "geo.h"
+#include "geodb.h"
+#include "log.h"
+#include "nftables.h"
+#include "whitelist.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define GEOBLOCK_MAGIC "BGFS"
+#define GEOBLOCK_VERSION 1
+
+/* geo.filter 文件头，其后依次为IPv4、IPv6区间（nft_interval_t） */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t v4_count;
+    uint32_t v6_count;
+} geoblock_state_header_t;
+
+typedef struct {
+    nft_interval_t *items;
+    size_t count;
+    size_t cap;
+} interval_list_t;
+
+/* 允许模式下始终放行的本机、内网和链路本地地址 */
+static const char *const reserved_ranges[] = {
+    "0.0.0.0/8", "10.0.0.0/8", "100.64.0.0/10", "127.0.0.0/8",
+    "169.254.0.0/16", "172.16.0.0/12", "192.168.0.0/16",
+    "::1/128", "fc00::/7", "fe80::/10",
+};
+
+static const char *const set_names[2] = {NFT_GEO_SET, NFT_GEO_SET_V6};
+
+static int parse_countries(const char *list, geo_filter_t *filter) {
+    filter->count = 0;
+    const char *p = list;
+
+    while (*p) {
+        if (!isalpha((unsigned char)p[0]) || !isalpha((unsigned char)p[1]) ||
+            (p[2] != '\0' && p[2] != ',')) {
+            return ERROR_INVALID_ARG;
+        }
+        char cc[3] = {(char)toupper((unsigned char)p[0]), (char)toupper((unsigned char)p[1]), '\0'};
+        p += (p[2] == ',') ? 3 : 2;
+
+        bool dup = false;
+        for (size_t i = 0; i < filter->count && !dup; i++) {
+            dup = strcmp(filter->countries[i], cc) == 0;
+        }
+        if (dup) continue;
+        if (filter->count >= GEO_FILTER_MAX_COUNTRIES) {
+            return ERROR_INVALID_ARG;
+        }
+        memcpy(filter->countries[filter->count++], cc, sizeof(cc));
+    }
+    return filter->count > 0 ? SUCCESS : ERROR_INVALID_ARG;
+}
+
+void geo_filter_load(geo_filter_t *filter) {
+    memset(filter, 0, sizeof(*filter));
+
+    const char *spec = get_geo_filter_from_config();
+    geo_filter_mode_t mode;
+    if (strncmp(spec, "block:", 6) == 0) {
+        mode = GEO_FILTER_BLOCK;
+    } else if (strncmp(spec, "allow:", 6) == 0) {
+        mode = GEO_FILTER_ALLOW;
+    } else {
+        return;
+    }
+    if (parse_countries(spec + 6, filter) == SUCCESS) {
+        filter->mode = mode;
+    }
+}
+
+bool geo_filter_active(const geo_filter_t *filter) {
+    return filter->mode == GEO_FILTER_BLOCK || (filter->mode == GEO_FILTER_ALLOW && geodb_available());
+}
+
+static bool filter_has_country(const geo_filter_t *filter, const char *cc) {
+    for (size_t i = 0; i < filter->count; i++) {
+        if (filter->countries[i][0] == cc[0] && filter->countries[i][1] == cc[1]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int list_push(interval_list_t *list, const nft_interval_t *iv) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 1024;
+        nft_interval_t *items = realloc(list->items, cap * sizeof(*items));
+        if (!items) {
+            return ERROR_FILE;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->count++] = *iv;
+    return SUCCESS;
+}
+
+static void list_free(interval_list_t *list) {
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+static int cmp_interval(const void *a, const void *b) {
+    const nft_interval_t *x = a;
+    const nft_interval_t *y = b;
+    return memcmp(x->start, y->start, x->klen);
+}
+
+/* 排序后合并重叠和相邻的区间，得到最少的集合元素 */
+static void merge_intervals(interval_list_t *list) {
+    if (list->count == 0) return;
+    qsort(list->items, list->count, sizeof(list->items[0]), cmp_interval);
+
+    size_t out = 0;
+    for (size_t i = 1; i < list->count; i++) {
+        nft_interval_t *cur = &list->items[out];
+        const nft_interval_t *next = &list->items[i];
+        if (!cur->has_end) {
+            continue;   /* 已覆盖到地址空间末尾 */
+        }
+        if (memcmp(next->start, cur->end, cur->klen) <= 0) {
+            if (!next->has_end) {
+                cur->has_end = false;
+            } else if (memcmp(next->end, cur->end, cur->klen) > 0) {
+                memcpy(cur->end, next->end, cur->klen);
+            }
+        } else {
+            list->items[++out] = *next;
+        }
+    }
+    list->count = out + 1;
+}
+
+/* 按策略从离线数据库生成目标区间（lists[0]为IPv4，lists[1]为IPv6） */
+static int build_target(const geo_filter_t *filter, interval_list_t lists[2]) {
+    if (filter->mode == GEO_FILTER_OFF) {
+        return SUCCESS;
+    }
+
+    nft_interval_t iv;
+    size_t n4, n6;
+    const geodb_range_v4_t *r4 = geodb_ranges_v4(&n4);
+    const geodb_range_v6_t *r6 = geodb_ranges_v6(&n6);
+
+    memset(&iv, 0, sizeof(iv));
+    iv.klen = 4;
+    for (size_t i = 0; i < n4; i++) {
+        if (!filter_has_country(filter, r4[i].country)) continue;
+        uint32_t start = htonl(r4[i].start);
+        uint32_t end = htonl(r4[i].end + 1);
+        memcpy(iv.start, &start, 4);
+        memcpy(iv.end, &end, 4);
+        iv.has_end = r4[i].end != UINT32_MAX;
+        if (list_push(&lists[0], &iv) != SUCCESS) return ERROR_FILE;
+    }
+
+    memset(&iv, 0, sizeof(iv));
+    iv.klen = 16;
+    for (size_t i = 0; i < n6; i++) {
+        if (!filter_has_country(filter, r6[i].country)) continue;
+        memcpy(iv.start, r6[i].start, 16);
+        memcpy(iv.end, r6[i].end, 16);
+        iv.has_end = false;
+        for (int b = 15; b >= 0; b--) {
+            if (++iv.end[b] != 0) {
+                iv.has_end = true;
+                break;
+            }
+        }
+        if (list_push(&lists[1], &iv) != SUCCESS) return ERROR_FILE;
+    }
+
+    if (filter->mode == GEO_FILTER_ALLOW) {
+        for (size_t i = 0; i < ARRAY_SIZE(reserved_ranges); i++) {
+            nft_parse_interval(reserved_ranges[i], &iv);
+            if (list_push(&lists[iv.klen == 4 ? 0 : 1], &iv) != SUCCESS) return ERROR_FILE;
+        }
+        /* 数据库不含IPv6数据时不限制IPv6，否则会拒绝全部IPv6连接 */
+        if (n6 == 0) {
+            nft_parse_interval("::/0", &iv);
+            if (list_push(&lists[1], &iv) != SUCCESS) return ERROR_FILE;
+        }
+    }
+
+    merge_intervals(&lists[0]);
+    merge_intervals(&lists[1]);
+    return SUCCESS;
+}
+
+/* 读取上次加载到内核的区间 */
+static int load_state(interval_list_t lists[2]) {
+    FILE *fp = fopen(GEO_FILTER_STATE_FILE, "rb");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+
+    geoblock_state_header_t h;
+    struct stat st;
+    if (fread(&h, sizeof(h), 1, fp) != 1 || fstat(fileno(fp), &st) != 0 ||
+        memcmp(h.magic, GEOBLOCK_MAGIC, 4) != 0 || h.version != GEOBLOCK_VERSION ||
+        (size_t)st.st_size != sizeof(h) + ((size_t)h.v4_count + h.v6_count) * sizeof(nft_interval_t)) {
+        fclose(fp);
+        return ERROR_FILE;
+    }
+
+    uint32_t counts[2] = {h.v4_count, h.v6_count};
+    for (int f = 0; f < 2; f++) {
+        lists[f].items = malloc(((size_t)counts[f] + 1) * sizeof(nft_interval_t));
+        if (!lists[f].items || fread(lists[f].items, sizeof(nft_interval_t), counts[f], fp) != counts[f]) {
+            fclose(fp);
+            return ERROR_FILE;
+        }
+        lists[f].count = lists[f].cap = counts[f];
+    }
+    fclose(fp);
+    return SUCCESS;
+}
+
+static int save_state(const interval_list_t lists[2]) {
+    char temp_file[MAX_PATH_LEN];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", GEO_FILTER_STATE_FILE);
+    FILE *fp = fopen(temp_file, "wb");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+
+    geoblock_state_header_t h = {0};
+    memcpy(h.magic, GEOBLOCK_MAGIC, 4);
+    h.version = GEOBLOCK_VERSION;
+    h.v4_count = (uint32_t)lists[0].count;
+    h.v6_count = (uint32_t)lists[1].count;
+
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    for (int f = 0; f < 2 && ok; f++) {
+        ok = fwrite(lists[f].items, sizeof(nft_interval_t), lists[f].count, fp) == lists[f].count;
+    }
+    if (fclose(fp) != 0 || !ok || rename(temp_file, GEO_FILTER_STATE_FILE) != 0) {
+        remove(temp_file);
+        return ERROR_FILE;
+    }
+    return SUCCESS;
+}
+
+static bool interval_equal(const nft_interval_t *a, const nft_interval_t *b) {
+    return a->has_end == b->has_end && memcmp(a->start, b->start, a->klen) == 0 &&
+           (!a->has_end || memcmp(a->end, b->end, a->klen) == 0);
+}
+
+/* 比较两个有序区间表，分别收集需要删除和新增的元素 */
+static int diff_intervals(const interval_list_t *old, const interval_list_t *cur,
+                          const nft_interval_t ***del, size_t *n_del,
+                          const nft_interval_t ***add, size_t *n_add) {
+    *del = malloc((old->count + 1) * sizeof(**del));
+    *add = malloc((cur->count + 1) * sizeof(**add));
+    *n_del = *n_add = 0;
+    if (!*del || !*add) {
+        free(*del);
+        free(*add);
+        *del = *add = NULL;
+        return ERROR_FILE;
+    }
+
+    size_t i = 0, j = 0;
+    while (i < old->count || j < cur->count) {
+        if (i < old->count && j < cur->count && interval_equal(&old->items[i], &cur->items[j])) {
+            i++;
+            j++;
+        } else if (j >= cur->count ||
+                   (i < old->count && memcmp(old->items[i].start, cur->items[j].start, old->items[i].klen) <= 0)) {
+            (*del)[(*n_del)++] = &old->items[i++];
+        } else {
+            (*add)[(*n_add)++] = &cur->items[j++];
+        }
+    }
+    return SUCCESS;
+}
+
+/* 差异事务：先删除后新增，已加载且未变化的区间不受影响 */
+static int commit_delta(const interval_list_t old[2], const interval_list_t cur[2],
+                        size_t *added, size_t *removed) {
+    nft_batch_t batch;
+    nft_batch_init(&batch);
+
+    const nft_interval_t **del[2] = {NULL, NULL};
+    const nft_interval_t **add[2] = {NULL, NULL};
+    size_t n_del[2] = {0, 0};
+    size_t n_add[2] = {0, 0};
+    int err = 0;
+
+    for (int f = 0; f < 2 && err == 0; f++) {
+        if (diff_intervals(&old[f], &cur[f], &del[f], &n_del[f], &add[f], &n_add[f]) != SUCCESS) {
+            err = -ENOMEM;
+        }
+    }
+    if (err == 0) {
+        for (int f = 0; f < 2; f++) {
+            nft_batch_del_elements(&batch, set_names[f], del[f], n_del[f]);
+        }
+        for (int f = 0; f < 2; f++) {
+            nft_batch_put_elements(&batch, set_names[f], add[f], n_add[f], 0);
+        }
+        if (!nft_batch_empty(&batch)) {
+            err = nft_batch_commit(&batch);
+        }
+        *added = n_add[0] + n_add[1];
+        *removed = n_del[0] + n_del[1];
+    }
+
+    for (int f = 0; f < 2; f++) {
+        free(del[f]);
+        free(add[f]);
+    }
+    nft_batch_free(&batch);
+    return err;
+}
+
+/* 全量事务：清空两个集合后加载全部区间 */
+static int commit_full(const interval_list_t cur[2], size_t *added) {
+    nft_batch_t batch;
+    nft_batch_init(&batch);
+
+    const nft_interval_t **ivs[2] = {NULL, NULL};
+    int err = 0;
+    for (int f = 0; f < 2; f++) {
+        ivs[f] = malloc((cur[f].count + 1) * sizeof(*ivs[f]));
+        if (!ivs[f]) {
+            err = -ENOMEM;
+            break;
+        }
+        for (size_t i = 0; i < cur[f].count; i++) {
+            ivs[f][i] = &cur[f].items[i];
+        }
+        nft_batch_flush_set(&batch, set_names[f]);
+    }
+
+    if (err == 0) {
+        for (int f = 0; f < 2; f++) {
+            nft_batch_put_elements(&batch, set_names[f], ivs[f], cur[f].count, 0);
+        }
+        err = nft_batch_commit(&batch);
+        if (err == -ENOENT) {
+            /* 规则集尚未包含国家过滤集合 */
+            init_nftables_rules();
+            err = nft_batch_commit(&batch);
+        }
+        *added = cur[0].count + cur[1].count;
+    }
+
+    free(ivs[0]);
+    free(ivs[1]);
+    nft_batch_free(&batch);
+    return err;
+}
+
+int geoblock_sync(bool full, size_t *added, size_t *removed) {
+    size_t n_added = 0, n_removed = 0;
+    if (added) *added = 0;
+    if (removed) *removed = 0;
+
+    geo_filter_t filter;
+    geo_filter_load(&filter);
+
+    /* 数据库暂不可用时保留内核中已加载的区间 */
+    if (filter.mode != GEO_FILTER_OFF && !geodb_available()) {
+        log_write("[国家过滤] 离线地理数据库不可用，保持当前集合");
+        return ERROR_FILE;
+    }
+    if (!nft_available()) {
+        log_write("[国家过滤] 防火墙后端 %s 不可用，集合未同步", nft_backend()->name);
+        return ERROR_FILE;
+    }
+
+    interval_list_t cur[2];
+    interval_list_t old[2];
+    memset(cur, 0, sizeof(cur));
+    memset(old, 0, sizeof(old));
+
+    int ret = build_target(&filter, cur);
+    if (ret == SUCCESS) {
+        int err = -1;
+        if (!full && load_state(old) == SUCCESS) {
+            err = commit_delta(old, cur, &n_added, &n_removed);
+            if (err < 0) {
+                log_write("[国家过滤] 差异提交失败: %s，改为全量加载", strerror(-err));
+            }
+        }
+        if (err < 0) {
+            n_removed = 0;
+            err = commit_full(cur, &n_added);
+        }
+
+        if (err < 0) {
+            log_write("[国家过滤] 集合加载失败: %s", strerror(-err));
+            ret = ERROR_FILE;
+        } else {
+            save_state(cur);
+            log_write("[国家过滤] 集合已同步: IPv4 %zu 段, IPv6 %zu 段 (新增 %zu, 删除 %zu)",
+                      cur[0].count, cur[1].count, n_added, n_removed);
+        }
+    }
+
+    for (int f = 0; f < 2; f++) {
+        list_free(&cur[f]);
+        list_free(&old[f]);
+    }
+    if (added) *added = n_added;
+    if (removed) *removed = n_removed;
+    return ret;
+}
+
+/* 当前SSH会话的来源会被新策略拒绝时返回true（避免把自己锁在外面） */
+static bool session_blocked(const geo_filter_t *filter, char *ip, size_t size, char *cc) {
+    const char *client = getenv("SSH_CLIENT");
+    if (!client) return false;
+
+    snprintf(ip, size, "%s", client);
+    ip[strcspn(ip, " ")] = '\0';
+
+    ip_addr_t addr;
+    if (ip_addr_parse(ip, &addr) != SUCCESS || is_in_whitelist(ip)) {
+        return false;
+    }
+
+    if (geodb_lookup(&addr, cc, MAX_COUNTRY_CODE) != SUCCESS) {
+        snprintf(cc, MAX_COUNTRY_CODE, "--");
+    }
+    bool listed = filter_has_country(filter, cc);
+    if (filter->mode == GEO_FILTER_BLOCK) {
+        return listed;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(reserved_ranges); i++) {
+        ip_addr_t net;
+        if (ip_addr_parse(reserved_ranges[i], &net) == SUCCESS && ip_addr_contains(&net, &addr)) {
+            return false;
+        }
+    }
+    return !listed;
+}
+
+int geoblock_set(geo_filter_mode_t mode, const char *countries) {
+    geo_filter_t filter;
+    memset(&filter, 0, sizeof(filter));
+    char spec[MAX_LINE_LEN] = "off";
+
+    if (mode != GEO_FILTER_OFF) {
+        if (!countries || parse_countries(countries, &filter) != SUCCESS) {
+            msg(C_RED, "❌ 国家代码格式错误，请使用逗号分隔的两位代码，如 CN,RU");
+            return ERROR_INVALID_ARG;
+        }
+        if (!geodb_available()) {
+            msg(C_YELLOW, "未安装离线地理数据库，请先执行 bip geo update <csv>");
+            return ERROR_FILE;
+        }
+        filter.mode = mode;
+
+        char ip[IP_STR_LEN];
+        char cc[MAX_COUNTRY_CODE];
+        if (session_blocked(&filter, ip, sizeof(ip), cc)) {
+            char error_msg[MAX_LINE_LEN];
+            snprintf(error_msg, sizeof(error_msg), "❌ 当前SSH会话来自 %s (%s)，新策略会拒绝该地址，请先执行 bip vip add %s",
+                     ip, get_country_name(cc), ip);
+            msg(C_RED, error_msg);
+            return ERROR_INVALID_ARG;
+        }
+
+        size_t len = (size_t)snprintf(spec, sizeof(spec), "%s:", mode == GEO_FILTER_BLOCK ? "block" : "allow");
+        for (size_t i = 0; i < filter.count && len < sizeof(spec); i++) {
+            len += (size_t)snprintf(spec + len, sizeof(spec) - len, "%s%s", i ? "," : "", filter.countries[i]);
+        }
+    }
+
+    /* 切换模式时先撤下旧规则，避免新集合配旧规则的短暂窗口误封 */
+    geo_filter_t current;
+    geo_filter_load(&current);
+    if (current.mode != GEO_FILTER_OFF && current.mode != mode) {
+        save_geo_filter_to_config("off");
+        init_nftables_rules();
+    }
+
+    if (save_geo_filter_to_config(spec) != SUCCESS) {
+        return ERROR_FILE;
+    }
+
+    size_t added = 0, removed = 0;
+    int ret = geoblock_sync(false, &added, &removed);
+    if (init_nftables_rules() != SUCCESS) {
+        ret = ERROR_FILE;
+    }
+    log_write("[国家过滤] 策略已设置为 %s", spec);
+    return ret;
+}
+
+void geoblock_show(void) {
+    geo_filter_t filter;
+    geo_filter_load(&filter);
+
+    if (filter.mode == GEO_FILTER_OFF) {
+        printf("国家过滤: %s未启用%s\n", C_YELLOW, C_RESET);
+        return;
+    }
+
+    printf("国家过滤: %s%s%s ", C_GREEN, filter.mode == GEO_FILTER_BLOCK ? "封禁" : "仅允许", C_RESET);
+    for (size_t i = 0; i < filter.count; i++) {
+        printf("%s%s(%s)", i ? ", " : "", get_country_name(filter.countries[i]), filter.countries[i]);
+    }
+    printf("\n");
+
+    interval_list_t lists[2];
+    memset(lists, 0, sizeof(lists));
+    if (load_state(lists) == SUCCESS) {
+        printf("已加载区间: IPv4 %zu  |  IPv6 %zu\n", lists[0].count, lists[1].count);
+    }
+    if (!geo_filter_active(&filter)) {
+        printf("%s离线地理数据库不可用，过滤规则未加载%s\n", C_YELLOW, C_RESET);
+    }
+    list_free(&lists[0]);
+    list_free(&lists[1]);
+}
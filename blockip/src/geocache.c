@@ -0,0 +1,231 @@
+#include "geocache.h"
+#include "metrics.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define GEOCACHE_MAGIC "BGCA"
+#define GEOCACHE_VERSION 1
+#define GEOCACHE_BUCKETS 1024
+#define GEOCACHE_WAYS 8                 /* 每组8路，组内按最近使用时间淘汰 */
+#define GEOCACHE_TTL (30 * 86400)       /* 查询成功的结果保留30天 */
+#define GEOCACHE_NEGATIVE_TTL (6 * 3600) /* 查询失败6小时内不再重试 */
+#define GEOCACHE_PREFIX_V4 24
+#define GEOCACHE_PREFIX_V6 48
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t buckets;
+    uint32_t ways;
+} geocache_header_t;
+
+typedef struct {
+    uint8_t family;             /* 0表示空槽 */
+    uint8_t negative;           /* 查询失败的记录 */
+    char country[2];
+    uint32_t reserved;
+    uint8_t prefix[16];
+    int64_t stored_at;
+    int64_t last_used;
+} geocache_slot_t;
+
+#define GEOCACHE_FILE_SIZE (sizeof(geocache_header_t) + \
+                            (size_t)GEOCACHE_BUCKETS * GEOCACHE_WAYS * sizeof(geocache_slot_t))
+
+/* 缓存键：地址所在的 /24 或 /48 */
+static void cache_key(const ip_addr_t *addr, uint8_t *prefix) {
+    memcpy(prefix, addr->addr, 16);
+    int bits = (addr->family == AF_INET) ? 96 + GEOCACHE_PREFIX_V4 : GEOCACHE_PREFIX_V6;
+    for (int i = bits; i < 128; i++) {
+        prefix[i / 8] &= (uint8_t)~(0x80 >> (i % 8));
+    }
+}
+
+void geocache_prefix(const ip_addr_t *addr, ip_addr_t *prefix) {
+    *prefix = *addr;
+    cache_key(addr, prefix->addr);
+    prefix->prefixlen = (addr->family == AF_INET) ? GEOCACHE_PREFIX_V4 : GEOCACHE_PREFIX_V6;
+}
+
+static uint32_t cache_bucket(const uint8_t *prefix) {
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 16; i++) {
+        h = (h ^ prefix[i]) * 16777619u;
+    }
+    return h % GEOCACHE_BUCKETS;
+}
+
+int geocache_open(geocache_t *cache) {
+    memset(cache, 0, sizeof(*cache));
+    cache->fd = -1;
+
+    int fd = open(GEO_CACHE_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return ERROR_FILE;
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return ERROR_FILE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return ERROR_FILE;
+    }
+
+    if ((size_t)st.st_size != GEOCACHE_FILE_SIZE) {
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)GEOCACHE_FILE_SIZE) != 0) {
+            close(fd);
+            return ERROR_FILE;
+        }
+    }
+
+    void *base = mmap(NULL, GEOCACHE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return ERROR_FILE;
+    }
+
+    geocache_header_t *h = base;
+    bool valid = memcmp(h->magic, GEOCACHE_MAGIC, 4) == 0 && h->version == GEOCACHE_VERSION &&
+                 h->buckets == GEOCACHE_BUCKETS && h->ways == GEOCACHE_WAYS;
+    if (!valid) {
+        memset(base, 0, GEOCACHE_FILE_SIZE);
+        memcpy(h->magic, GEOCACHE_MAGIC, 4);
+        h->version = GEOCACHE_VERSION;
+        h->buckets = GEOCACHE_BUCKETS;
+        h->ways = GEOCACHE_WAYS;
+    }
+
+    cache->fd = fd;
+    cache->base = base;
+    cache->size = GEOCACHE_FILE_SIZE;
+    return SUCCESS;
+}
+
+void geocache_close(geocache_t *cache) {
+    if (cache->base) {
+        munmap(cache->base, cache->size);
+    }
+    if (cache->fd >= 0) {
+        flock(cache->fd, LOCK_UN);
+        close(cache->fd);
+    }
+    memset(cache, 0, sizeof(*cache));
+    cache->fd = -1;
+}
+
+/* 前缀所在的组 */
+static geocache_slot_t* cache_bucket_slots(const geocache_t *cache, const uint8_t *prefix) {
+    geocache_slot_t *slots = (geocache_slot_t *)((uint8_t *)cache->base + sizeof(geocache_header_t));
+    return &slots[cache_bucket(prefix) * GEOCACHE_WAYS];
+}
+
+static bool slot_expired(const geocache_slot_t *slot, time_t now) {
+    time_t ttl = slot->negative ? GEOCACHE_NEGATIVE_TTL : GEOCACHE_TTL;
+    return slot->family == 0 || now - (time_t)slot->stored_at >= ttl || (time_t)slot->stored_at > now;
+}
+
+int geocache_lookup(geocache_t *cache, const ip_addr_t *addr, char *country_code, size_t size) {
+    if (!cache || !cache->base || !addr || !country_code || size < 3) {
+        return ERROR_INVALID_ARG;
+    }
+
+    uint8_t prefix[16];
+    cache_key(addr, prefix);
+
+    /* 命中时要更新最近使用时间，读写都持有排他锁 */
+    time_t now = time(NULL);
+    geocache_slot_t *bucket = cache_bucket_slots(cache, prefix);
+    int ret = ERROR_FILE;
+
+    for (int i = 0; i < GEOCACHE_WAYS; i++) {
+        geocache_slot_t *slot = &bucket[i];
+        if (slot->family != addr->family || memcmp(slot->prefix, prefix, 16) != 0 || slot_expired(slot, now)) {
+            continue;
+        }
+        slot->last_used = (int64_t)now;
+        if (slot->negative) {
+            ret = ERROR_NETWORK;
+        } else {
+            country_code[0] = slot->country[0];
+            country_code[1] = slot->country[1];
+            country_code[2] = '\0';
+            ret = SUCCESS;
+        }
+        break;
+    }
+
+    metrics_inc(ret == ERROR_FILE ? METRIC_GEOCACHE_MISSES : METRIC_GEOCACHE_HITS);
+    return ret;
+}
+
+void geocache_store(geocache_t *cache, const ip_addr_t *addr, const char *country_code) {
+    if (!cache || !cache->base || !addr) return;
+
+    uint8_t prefix[16];
+    cache_key(addr, prefix);
+
+    time_t now = time(NULL);
+    geocache_slot_t *bucket = cache_bucket_slots(cache, prefix);
+
+    /* 优先覆盖同一前缀，其次空槽或过期槽，否则淘汰最久未使用的 */
+    geocache_slot_t *target = NULL;
+    for (int i = 0; i < GEOCACHE_WAYS && !target; i++) {
+        if (bucket[i].family == addr->family && memcmp(bucket[i].prefix, prefix, 16) == 0) {
+            target = &bucket[i];
+        }
+    }
+    for (int i = 0; i < GEOCACHE_WAYS && !target; i++) {
+        if (slot_expired(&bucket[i], now)) {
+            target = &bucket[i];
+        }
+    }
+    if (!target) {
+        target = &bucket[0];
+        for (int i = 1; i < GEOCACHE_WAYS; i++) {
+            if (bucket[i].last_used < target->last_used) {
+                target = &bucket[i];
+            }
+        }
+    }
+
+    memset(target, 0, sizeof(*target));
+    target->family = addr->family;
+    memcpy(target->prefix, prefix, 16);
+    if (country_code && strlen(country_code) == 2) {
+        target->country[0] = country_code[0];
+        target->country[1] = country_code[1];
+    } else {
+        target->negative = 1;
+    }
+    target->stored_at = (int64_t)now;
+    target->last_used = (int64_t)now;
+}
+
+int geocache_get(const ip_addr_t *addr, char *country_code, size_t size) {
+    if (!addr || !country_code || size < 3) {
+        return ERROR_INVALID_ARG;
+    }
+    geocache_t cache;
+    if (geocache_open(&cache) != SUCCESS) {
+        return ERROR_FILE;
+    }
+    int ret = geocache_lookup(&cache, addr, country_code, size);
+    geocache_close(&cache);
+    return ret;
+}
+
+void geocache_put(const ip_addr_t *addr, const char *country_code) {
+    if (!addr) return;
+    geocache_t cache;
+    if (geocache_open(&cache) != SUCCESS) {
+        return;
+    }
+    geocache_store(&cache, addr, country_code);
+    geocache_close(&cache);
+}
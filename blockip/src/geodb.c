@@ -0,0 +1,430 @@
+#include "geodb.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define GEODB_MAGIC "BGEO"
+#define GEODB_VERSION 1
+
+/* 编译时使用的统一区间（IPv4按v4映射地址存放，便于统一排序） */
+typedef struct {
+    uint8_t family;
+    uint8_t start[16];
+    uint8_t end[16];
+    char country[2];
+} build_range_t;
+
+typedef struct {
+    build_range_t *ranges;
+    size_t count;
+    size_t cap;
+} range_list_t;
+
+/* 当前映射的数据库，文件被原子替换后按 inode/mtime 识别并重新映射 */
+static struct {
+    void *base;
+    size_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    const geodb_header_t *header;
+    const geodb_range_v4_t *v4;
+    const geodb_range_v6_t *v6;
+} g_db;
+
+/* 大端地址加一，溢出返回false */
+static bool be_increment(uint8_t *bytes) {
+    for (int i = 15; i >= 0; i--) {
+        if (++bytes[i] != 0) return true;
+    }
+    return false;
+}
+
+static bool parse_country(const char *str, char *country) {
+    if (strlen(str) != 2 || !isalpha((unsigned char)str[0]) || !isalpha((unsigned char)str[1])) {
+        return false;
+    }
+    country[0] = (char)toupper((unsigned char)str[0]);
+    country[1] = (char)toupper((unsigned char)str[1]);
+
+    /* ZZ 为未分配地址 */
+    return !(country[0] == 'Z' && country[1] == 'Z');
+}
+
+/* 解析区间端点：IPv4/IPv6地址或IPv4十进制整数 */
+static bool parse_endpoint(const char *str, uint8_t *family, uint8_t *bytes) {
+    ip_addr_t addr;
+    if (ip_addr_parse(str, &addr) == SUCCESS && ip_addr_is_host(&addr)) {
+        *family = addr.family;
+        memcpy(bytes, addr.addr, 16);
+        return true;
+    }
+
+    if (*str == '\0' || strspn(str, "0123456789") != strlen(str) || strlen(str) > 10) {
+        return false;
+    }
+    unsigned long long v = strtoull(str, NULL, 10);
+    if (v > 0xFFFFFFFFull) {
+        return false;
+    }
+    memset(bytes, 0, 16);
+    bytes[10] = bytes[11] = 0xFF;
+    bytes[12] = (uint8_t)(v >> 24);
+    bytes[13] = (uint8_t)(v >> 16);
+    bytes[14] = (uint8_t)(v >> 8);
+    bytes[15] = (uint8_t)v;
+    *family = AF_INET;
+    return true;
+}
+
+/* 去除字段两端的空白和引号 */
+static char* trim_field(char *s) {
+    while (*s == ' ' || *s == '\t' || *s == '"') s++;
+    size_t len = strlen(s);
+    while (len > 0 && (s[len - 1] == ' ' || s[len - 1] == '\t' || s[len - 1] == '"' ||
+                       s[len - 1] == '\r' || s[len - 1] == '\n')) {
+        s[--len] = '\0';
+    }
+    return s;
+}
+
+/* 解析一行，返回1成功、0跳过（无国家）、-1无效 */
+static int parse_line(char *line, build_range_t *r) {
+    char *fields[3] = {NULL};
+    int n = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, ",", &save); tok && n < 3; tok = strtok_r(NULL, ",", &save)) {
+        fields[n++] = trim_field(tok);
+    }
+    if (n < 2) {
+        return -1;
+    }
+
+    memset(r, 0, sizeof(*r));
+
+    if (n == 2) {
+        ip_addr_t net;
+        if (ip_addr_parse(fields[0], &net) != SUCCESS) {
+            return -1;
+        }
+        if (!parse_country(fields[1], r->country)) {
+            return 0;
+        }
+        r->family = net.family;
+        memcpy(r->start, net.addr, 16);
+        memcpy(r->end, net.addr, 16);
+
+        /* 主机位全部置1得到区间终点 */
+        int bits = (net.family == AF_INET) ? 96 + net.prefixlen : net.prefixlen;
+        for (int i = bits; i < 128; i++) {
+            r->end[i / 8] |= (uint8_t)(0x80 >> (i % 8));
+        }
+        return 1;
+    }
+
+    uint8_t end_family;
+    if (!parse_endpoint(fields[0], &r->family, r->start) ||
+        !parse_endpoint(fields[1], &end_family, r->end) ||
+        end_family != r->family || memcmp(r->start, r->end, 16) > 0) {
+        return -1;
+    }
+    return parse_country(fields[2], r->country) ? 1 : 0;
+}
+
+static int list_push(range_list_t *list, const build_range_t *r) {
+    if (list->count == list->cap) {
+        size_t new_cap = list->cap ? list->cap * 2 : 4096;
+        build_range_t *p = realloc(list->ranges, new_cap * sizeof(*p));
+        if (!p) return ERROR_FILE;
+        list->ranges = p;
+        list->cap = new_cap;
+    }
+    list->ranges[list->count++] = *r;
+    return SUCCESS;
+}
+
+static int cmp_range(const void *a, const void *b) {
+    const build_range_t *x = a;
+    const build_range_t *y = b;
+    if (x->family != y->family) {
+        return x->family - y->family;
+    }
+    int c = memcmp(x->start, y->start, 16);
+    return c != 0 ? c : memcmp(x->end, y->end, 16);
+}
+
+/* 排序后合并相邻同国家区间，重叠部分以先出现（起点更小）的区间为准 */
+static size_t merge_ranges(build_range_t *ranges, size_t count) {
+    qsort(ranges, count, sizeof(*ranges), cmp_range);
+
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++) {
+        build_range_t r = ranges[i];
+
+        if (out > 0 && ranges[out - 1].family == r.family) {
+            build_range_t *last = &ranges[out - 1];
+            uint8_t next[16];
+            memcpy(next, last->end, 16);
+            bool has_next = be_increment(next);
+
+            /* 已被完全覆盖 */
+            if (!has_next || memcmp(r.end, last->end, 16) <= 0) {
+                continue;
+            }
+            if (memcmp(r.start, next, 16) <= 0) {
+                if (memcmp(r.country, last->country, 2) == 0) {
+                    memcpy(last->end, r.end, 16);
+                    continue;
+                }
+                memcpy(r.start, next, 16);
+            }
+        }
+        ranges[out++] = r;
+    }
+    return out;
+}
+
+static uint32_t v4_value(const uint8_t *bytes) {
+    return ((uint32_t)bytes[12] << 24) | ((uint32_t)bytes[13] << 16) |
+           ((uint32_t)bytes[14] << 8) | (uint32_t)bytes[15];
+}
+
+static int write_db(const build_range_t *ranges, size_t count, const char *db_path, geodb_stats_t *stats) {
+    size_t v4 = 0;
+    while (v4 < count && ranges[v4].family == AF_INET) v4++;
+    size_t v6 = count - v4;
+
+    size_t size = sizeof(geodb_header_t) + v4 * sizeof(geodb_range_v4_t) + v6 * sizeof(geodb_range_v6_t);
+    uint8_t *base = calloc(1, size);
+    if (!base) {
+        return ERROR_FILE;
+    }
+
+    geodb_header_t *h = (geodb_header_t *)base;
+    memcpy(h->magic, GEODB_MAGIC, 4);
+    h->version = GEODB_VERSION;
+    h->v4_count = (uint32_t)v4;
+    h->v6_count = (uint32_t)v6;
+    h->built_at = (int64_t)time(NULL);
+
+    geodb_range_v4_t *out4 = (geodb_range_v4_t *)(base + sizeof(*h));
+    geodb_range_v6_t *out6 = (geodb_range_v6_t *)(out4 + v4);
+    for (size_t i = 0; i < v4; i++) {
+        out4[i].start = v4_value(ranges[i].start);
+        out4[i].end = v4_value(ranges[i].end);
+        memcpy(out4[i].country, ranges[i].country, 2);
+    }
+    for (size_t i = 0; i < v6; i++) {
+        memcpy(out6[i].start, ranges[v4 + i].start, 16);
+        memcpy(out6[i].end, ranges[v4 + i].end, 16);
+        memcpy(out6[i].country, ranges[v4 + i].country, 2);
+    }
+
+    /* 写入临时文件后原子替换，正在使用旧映射的进程不受影响 */
+    char temp_file[MAX_PATH_LEN];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", db_path);
+    int fd = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(base);
+        return ERROR_FILE;
+    }
+
+    const uint8_t *p = base;
+    size_t left = size;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0) break;
+        p += n;
+        left -= (size_t)n;
+    }
+    free(base);
+
+    bool ok = left == 0 && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(temp_file, db_path) != 0) {
+        remove(temp_file);
+        return ERROR_FILE;
+    }
+
+    stats->v4_count = v4;
+    stats->v6_count = v6;
+    return SUCCESS;
+}
+
+int geodb_compile(const char *csv_path, const char *db_path, geodb_stats_t *stats) {
+    if (!csv_path || !db_path || !stats) {
+        return ERROR_INVALID_ARG;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    FILE *fp = fopen(csv_path, "r");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+
+    range_list_t list = {0};
+    char line[MAX_LINE_LEN];
+    bool first = true;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+
+        build_range_t r;
+        int ret = parse_line(line, &r);
+        if (ret > 0) {
+            if (list_push(&list, &r) != SUCCESS) {
+                fclose(fp);
+                free(list.ranges);
+                return ERROR_FILE;
+            }
+        } else if (ret == 0) {
+            stats->skipped++;
+        } else if (!first) {
+            /* 首行无法解析时视为表头 */
+            stats->invalid++;
+        }
+        first = false;
+    }
+    fclose(fp);
+
+    size_t count = merge_ranges(list.ranges, list.count);
+    int ret = write_db(list.ranges, count, db_path, stats);
+    free(list.ranges);
+    return ret;
+}
+
+static void db_unmap(void) {
+    if (g_db.base) {
+        munmap(g_db.base, g_db.size);
+    }
+    memset(&g_db, 0, sizeof(g_db));
+}
+
+/* 文件未变化时沿用当前映射，被替换后重新映射 */
+static bool db_refresh(void) {
+    struct stat st;
+    if (stat(GEO_DB_FILE, &st) != 0) {
+        db_unmap();
+        return false;
+    }
+    if (g_db.base && g_db.dev == st.st_dev && g_db.ino == st.st_ino &&
+        g_db.mtime.tv_sec == st.st_mtim.tv_sec && g_db.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        return true;
+    }
+    db_unmap();
+
+    int fd = open(GEO_DB_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(geodb_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    const geodb_header_t *h = base;
+    bool valid = memcmp(h->magic, GEODB_MAGIC, 4) == 0 && h->version == GEODB_VERSION &&
+                 (size_t)st.st_size == sizeof(*h) + (size_t)h->v4_count * sizeof(geodb_range_v4_t) +
+                                       (size_t)h->v6_count * sizeof(geodb_range_v6_t);
+    if (!valid) {
+        munmap(base, (size_t)st.st_size);
+        return false;
+    }
+
+    g_db.base = base;
+    g_db.size = (size_t)st.st_size;
+    g_db.dev = st.st_dev;
+    g_db.ino = st.st_ino;
+    g_db.mtime = st.st_mtim;
+    g_db.header = h;
+    g_db.v4 = (const geodb_range_v4_t *)((const uint8_t *)base + sizeof(*h));
+    g_db.v6 = (const geodb_range_v6_t *)(g_db.v4 + h->v4_count);
+    return true;
+}
+
+bool geodb_available(void) {
+    return db_refresh();
+}
+
+const geodb_header_t* geodb_header(void) {
+    return db_refresh() ? g_db.header : NULL;
+}
+
+const geodb_range_v4_t* geodb_ranges_v4(size_t *count) {
+    if (!db_refresh()) {
+        *count = 0;
+        return NULL;
+    }
+    *count = g_db.header->v4_count;
+    return g_db.v4;
+}
+
+const geodb_range_v6_t* geodb_ranges_v6(size_t *count) {
+    if (!db_refresh()) {
+        *count = 0;
+        return NULL;
+    }
+    *count = g_db.header->v6_count;
+    return g_db.v6;
+}
+
+static const char* lookup_v4(uint32_t key) {
+    size_t lo = 0, hi = g_db.header->v4_count;
+
+    /* 找到最后一个起点不大于key的区间 */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (g_db.v4[mid].start <= key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || g_db.v4[lo - 1].end < key) {
+        return NULL;
+    }
+    return g_db.v4[lo - 1].country;
+}
+
+static const char* lookup_v6(const uint8_t *key) {
+    size_t lo = 0, hi = g_db.header->v6_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (memcmp(g_db.v6[mid].start, key, 16) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || memcmp(g_db.v6[lo - 1].end, key, 16) < 0) {
+        return NULL;
+    }
+    return g_db.v6[lo - 1].country;
+}
+
+int geodb_lookup(const ip_addr_t *addr, char *country_code, size_t size) {
+    if (!addr || !country_code || size < 3) {
+        return ERROR_INVALID_ARG;
+    }
+    if (!db_refresh()) {
+        return ERROR_FILE;
+    }
+
+    const char *cc = (addr->family == AF_INET) ? lookup_v4(v4_value(addr->addr)) : lookup_v6(addr->addr);
+    if (!cc) {
+        return ERROR_FILE;
+    }
+    country_code[0] = cc[0];
+    country_code[1] = cc[1];
+    country_code[2] = '\0';
+    return SUCCESS;
+}
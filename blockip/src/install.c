@@ -2,8 +2,15 @@
 #include "nftables.h"
 #include "ban.h"
 #include "whitelist.h"
+#include "restore.h"
 #include "log.h"
 
+#define DAEMON_SERVICE_FILE "/etc/systemd/system/bipd.service"
+#define DAEMON_SOCKET_FILE "/etc/systemd/system/bipd.socket"
+#define METRICS_SERVICE_FILE "/etc/systemd/system/bip-metrics.service"
+#define METRICS_TIMER_FILE "/etc/systemd/system/bip-metrics.timer"
+#define METRICS_INTERVAL "15s"
+
 int setup_pam_hooks(void) {
     const char *pam_file = "/etc/pam.d/sshd";
     
@@ -82,26 +89,193 @@ int create_systemd_service(void) {
     
     fclose(fp);
     
+    /* 常驻守护进程：由套接字按需激活，空闲后自动退出 */
+    fp = fopen(DAEMON_SERVICE_FILE, "w");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+    
+    fprintf(fp, "[Unit]\n");
+    fprintf(fp, "Description=BIP (Block-IP) Daemon\n");
+    fprintf(fp, "Requires=bipd.socket\n");
+    fprintf(fp, "After=network.target bip.service bipd.socket\n\n");
+    fprintf(fp, "[Service]\n");
+    fprintf(fp, "Type=simple\n");
+    fprintf(fp, "ExecStart=%s daemon\n", INSTALL_PATH);
+    fprintf(fp, "Restart=on-failure\n\n");
+    fprintf(fp, "[Install]\n");
+    fprintf(fp, "WantedBy=multi-user.target\n");
+    
+    fclose(fp);
+    
+    /* 第一个 bip check 发来的数据报会拉起守护进程 */
+    fp = fopen(DAEMON_SOCKET_FILE, "w");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+    
+    fprintf(fp, "[Unit]\n");
+    fprintf(fp, "Description=BIP (Block-IP) Daemon Socket\n\n");
+    fprintf(fp, "[Socket]\n");
+    fprintf(fp, "ListenDatagram=%s\n", DAEMON_SOCKET);
+    fprintf(fp, "SocketMode=0600\n");
+    fprintf(fp, "ReceiveBuffer=1M\n\n");
+    fprintf(fp, "[Install]\n");
+    fprintf(fp, "WantedBy=sockets.target\n");
+    
+    fclose(fp);
+    
     /* 重载systemd配置 */
     system("systemctl daemon-reload");
     
     /* 启用服务 */
     system("systemctl enable bip.service");
+    system("systemctl stop bipd.service 2>/dev/null");
+    system("systemctl enable --now bipd.socket");
+    
+    /* 跟踪sshd日志时守护进程需要常驻 */
+    if (strcmp(get_ssh_log_from_config(), "off") != 0) {
+        system("systemctl enable --now bipd.service");
+    }
+    
+    setup_metrics_timer();
     
     log_write("[安装] systemd服务已创建");
     return SUCCESS;
 }
 
+int setup_metrics_timer(void) {
+    const char *path = get_metrics_textfile_from_config();
+    
+    if (strcmp(path, "off") == 0) {
+        if (access(METRICS_TIMER_FILE, F_OK) == 0) {
+            system("systemctl disable --now bip-metrics.timer >/dev/null 2>&1");
+            remove(METRICS_TIMER_FILE);
+            remove(METRICS_SERVICE_FILE);
+            system("systemctl daemon-reload >/dev/null 2>&1");
+        }
+        return SUCCESS;
+    }
+    
+    /* node_exporter textfile 收集器：定时由计数文件和netlink生成 .prom 文件 */
+    FILE *fp = fopen(METRICS_SERVICE_FILE, "w");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+    
+    fprintf(fp, "[Unit]\n");
+    fprintf(fp, "Description=BIP (Block-IP) Metrics Writer\n\n");
+    fprintf(fp, "[Service]\n");
+    fprintf(fp, "Type=oneshot\n");
+    fprintf(fp, "ExecStart=%s metrics %s\n", INSTALL_PATH, path);
+    
+    fclose(fp);
+    
+    fp = fopen(METRICS_TIMER_FILE, "w");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+    
+    fprintf(fp, "[Unit]\n");
+    fprintf(fp, "Description=BIP (Block-IP) Metrics Timer\n\n");
+    fprintf(fp, "[Timer]\n");
+    fprintf(fp, "OnBootSec=%s\n", METRICS_INTERVAL);
+    fprintf(fp, "OnUnitActiveSec=%s\n", METRICS_INTERVAL);
+    fprintf(fp, "AccuracySec=1s\n\n");
+    fprintf(fp, "[Install]\n");
+    fprintf(fp, "WantedBy=timers.target\n");
+    
+    fclose(fp);
+    
+    system("systemctl daemon-reload >/dev/null 2>&1");
+    system("systemctl enable --now bip-metrics.timer >/dev/null 2>&1");
+    return SUCCESS;
+}
+
+/* 重建前暂存的黑名单元素 */
+typedef struct {
+    nft_interval_t *ivs;
+    uint64_t *timeouts;
+    size_t count;
+    size_t cap;
+} saved_set_t;
+
+static int save_element(const nft_element_t *elem, void *ctx) {
+    saved_set_t *s = ctx;
+    /* 带超时但已到期的元素不再恢复 */
+    if (elem->timeout_ms > 0 && elem->expires_ms == 0) {
+        return 0;
+    }
+    if (s->count == s->cap) {
+        size_t new_cap = s->cap ? s->cap * 2 : 1024;
+        nft_interval_t *ivs = realloc(s->ivs, new_cap * sizeof(*ivs));
+        if (ivs) s->ivs = ivs;
+        uint64_t *timeouts = realloc(s->timeouts, new_cap * sizeof(*timeouts));
+        if (timeouts) s->timeouts = timeouts;
+        if (!ivs || !timeouts) return 1;
+        s->cap = new_cap;
+    }
+    s->ivs[s->count] = elem->iv;
+    s->timeouts[s->count] = elem->timeout_ms > 0 ? elem->expires_ms : 0;
+    s->count++;
+    return 0;
+}
+
+/*
+ * 重建规则集会删除整张表，内核中的黑名单元素（包括尚未持久化的）随之丢失：
+ * 重建前读出两个黑名单集合，重建后按剩余时长写回，再由 restore_all_lists 补齐存储中的记录
+ */
+static int reset_keep_blacklist(void) {
+    const char *sets[2] = { NFT_SET, NFT_SET_V6 };
+    saved_set_t saved[2];
+    memset(saved, 0, sizeof(saved));
+    for (size_t i = 0; i < ARRAY_SIZE(sets); i++) {
+        nft_dump_set(sets[i], save_element, &saved[i]);
+    }
+
+    int ret = reset_nftables_rules();
+    if (ret == SUCCESS) {
+        nft_batch_t batch;
+        nft_batch_init(&batch);
+        for (size_t i = 0; i < ARRAY_SIZE(sets); i++) {
+            const nft_interval_t **ivs = malloc((saved[i].count ? saved[i].count : 1) * sizeof(*ivs));
+            if (!ivs) continue;
+            for (size_t j = 0; j < saved[i].count; j++) {
+                ivs[j] = &saved[i].ivs[j];
+            }
+            nft_batch_put_timed_elements(&batch, sets[i], ivs, saved[i].timeouts, saved[i].count);
+            free(ivs);
+        }
+        if (!nft_batch_empty(&batch) && nft_batch_commit(&batch) < 0) {
+            log_write("[安装] 规则集重建后写回黑名单失败，改由持久化存储恢复");
+        }
+        nft_batch_free(&batch);
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(sets); i++) {
+        free(saved[i].ivs);
+        free(saved[i].timeouts);
+    }
+    return ret;
+}
+
 static int remove_systemd_service(void) {
     /* 停止并禁用服务 */
+    system("systemctl stop bipd.socket bipd.service 2>/dev/null");
+    system("systemctl disable bipd.socket bipd.service 2>/dev/null");
     system("systemctl stop bip.service 2>/dev/null");
     system("systemctl disable bip.service 2>/dev/null");
+    system("systemctl disable --now bip-metrics.timer 2>/dev/null");
     
     /* 删除服务文件 */
     remove("/etc/systemd/system/bip.service");
+    remove(DAEMON_SERVICE_FILE);
+    remove(DAEMON_SOCKET_FILE);
+    remove(METRICS_SERVICE_FILE);
+    remove(METRICS_TIMER_FILE);
     
     /* 重载systemd配置 */
-    system("systemctl daemon-reload");
+    system("systemctl daemon-reload >/dev/null 2>&1");
     
     log_write("[卸载] systemd服务已移除");
     return SUCCESS;
@@ -154,11 +328,21 @@ int install_service(void) {
     
     /* 创建默认配置文件 */
     if (access(CONFIG_FILE, F_OK) != 0) {
+        config_batch_begin();
         save_ban_time_to_config(DEFAULT_BAN_TIME);
         save_max_retries_to_config(DEFAULT_MAX_RETRIES);
         save_rate_limit_to_config(DEFAULT_RATE_LIMIT);
         save_rate_ban_time_to_config(DEFAULT_RATE_BAN_TIME);
-        msg(C_GREEN, "  ✓ 已创建默认配置文件");
+        save_idle_timeout_to_config(DEFAULT_IDLE_TIMEOUT);
+        save_ssh_log_to_config(DEFAULT_SSH_LOG);
+        save_geo_api_to_config(DEFAULT_GEO_API);
+        save_collapse_to_config(DEFAULT_COLLAPSE);
+        save_agg_levels_to_config(false, DEFAULT_AGG_LEVELS);
+        save_agg_levels_to_config(true, DEFAULT_AGG_LEVELS_V6);
+        save_metrics_textfile_to_config(DEFAULT_METRICS_TEXTFILE);
+        if (config_batch_commit() == SUCCESS) {
+            msg(C_GREEN, "  ✓ 已创建默认配置文件");
+        }
     }
     
     log_init();
@@ -166,20 +350,13 @@ int install_service(void) {
     /* 安装nftables */
     check_and_install_nftables();
 
-    /* 清空bip相关nft表和集合，防止历史残留 */
-    char nft_clear_cmd[MAX_COMMAND_LEN];
-    snprintf(nft_clear_cmd, sizeof(nft_clear_cmd),
-        "nft flush table %s 2>/dev/null; "
-        "nft delete table %s 2>/dev/null;",
-        NFT_TABLE, NFT_TABLE);
-    system(nft_clear_cmd);
-
-    /* 初始化规则 */
-    init_nftables_rules();
+    /* 初始化规则：原地更新，封禁集合始终生效；与历史残留定义冲突时重建并保留黑名单元素 */
+    if (init_nftables_rules() != SUCCESS) {
+        reset_keep_blacklist();
+    }
     
     /* 恢复数据 */
-    restore_from_persist();
-    whitelist_restore();
+    restore_all_lists();
     
     /* 配置PAM钩子 */
     setup_pam_hooks();
@@ -199,35 +376,9 @@ int uninstall_service(void) {
     remove_systemd_service();
     msg(C_GREEN, "  ✓ 已移除 systemd 服务");
     
-    /* 清除nftables规则 */
+    /* 清除nftables规则：删除整张表，黑白名单、国家过滤、限速集合和全部规则一并移除 */
     char command[MAX_COMMAND_LEN];
-    
-    snprintf(command, sizeof(command), "nft delete rule %s input ip saddr @%s drop 2>/dev/null", 
-             NFT_TABLE, NFT_SET);
-    system(command);
-    
-    snprintf(command, sizeof(command), "nft delete rule %s input ip6 saddr @%s drop 2>/dev/null", 
-             NFT_TABLE, NFT_SET_V6);
-    system(command);
-    
-    snprintf(command, sizeof(command), "nft delete rule %s input ip saddr @%s accept 2>/dev/null", 
-             NFT_TABLE, NFT_WHITELIST);
-    system(command);
-    
-    snprintf(command, sizeof(command), "nft delete rule %s input ip6 saddr @%s accept 2>/dev/null", 
-             NFT_TABLE, NFT_WHITELIST_V6);
-    system(command);
-    
-    snprintf(command, sizeof(command), "nft delete set %s %s 2>/dev/null", NFT_TABLE, NFT_SET);
-    system(command);
-    
-    snprintf(command, sizeof(command), "nft delete set %s %s 2>/dev/null", NFT_TABLE, NFT_SET_V6);
-    system(command);
-    
-    snprintf(command, sizeof(command), "nft delete set %s %s 2>/dev/null", NFT_TABLE, NFT_WHITELIST);
-    system(command);
-    
-    snprintf(command, sizeof(command), "nft delete set %s %s 2>/dev/null", NFT_TABLE, NFT_WHITELIST_V6);
+    snprintf(command, sizeof(command), "nft delete table %s 2>/dev/null", NFT_TABLE);
     system(command);
     
     msg(C_GREEN, "  ✓ 已清除防火墙规则");
@@ -2,22 +2,174 @@
 #include <arpa/inet.h>
 #include <ctype.h>
 
-bool is_ipv6(const char *ip) {
-    if (!ip) return false;
+static const uint8_t v4_mapped_prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+/* 按地址族换算为128位内的前缀长度 */
+static int full_prefixlen(const ip_addr_t *addr) {
+    return addr->family == AF_INET ? addr->prefixlen + 96 : addr->prefixlen;
+}
+
+int ip_addr_parse(const char *str, ip_addr_t *addr) {
+    if (!str || !addr) {
+        return ERROR_INVALID_ARG;
+    }
+    
+    char buf[IP_STR_LEN];
+    size_t len = strlen(str);
+    if (len == 0 || len >= sizeof(buf)) {
+        return ERROR_INVALID_ARG;
+    }
+    memcpy(buf, str, len + 1);
+    
+    int prefixlen = -1;
+    char *slash = strchr(buf, '/');
+    if (slash) {
+        *slash = '\0';
+        const char *p = slash + 1;
+        if (*p == '\0' || strlen(p) > 3) {
+            return ERROR_INVALID_ARG;
+        }
+        prefixlen = 0;
+        for (; *p; p++) {
+            if (!isdigit((unsigned char)*p)) return ERROR_INVALID_ARG;
+            prefixlen = prefixlen * 10 + (*p - '0');
+        }
+    }
+    
+    memset(addr, 0, sizeof(*addr));
+    if (inet_pton(AF_INET, buf, addr->addr + 12) == 1) {
+        memcpy(addr->addr, v4_mapped_prefix, sizeof(v4_mapped_prefix));
+        addr->family = AF_INET;
+        if (prefixlen < 0) prefixlen = 32;
+        if (prefixlen > 32) return ERROR_INVALID_ARG;
+    } else if (inet_pton(AF_INET6, buf, addr->addr) == 1) {
+        if (prefixlen < 0) prefixlen = 128;
+        if (prefixlen > 128) return ERROR_INVALID_ARG;
+        
+        /* ::ffff:a.b.c.d 与 a.b.c.d 视为同一个地址 */
+        if (memcmp(addr->addr, v4_mapped_prefix, sizeof(v4_mapped_prefix)) == 0 && prefixlen >= 96) {
+            addr->family = AF_INET;
+            prefixlen -= 96;
+        } else {
+            addr->family = AF_INET6;
+        }
+    } else {
+        return ERROR_INVALID_ARG;
+    }
+    addr->prefixlen = (uint8_t)prefixlen;
+    
+    /* 清除主机位 */
+    int keep = full_prefixlen(addr);
+    for (int i = 0; i < 16; i++, keep -= 8) {
+        if (keep >= 8) continue;
+        addr->addr[i] &= keep <= 0 ? 0x00 : (uint8_t)(0xff << (8 - keep));
+    }
     
-    /* 移除CIDR部分 */
-    char ip_copy[MAX_IP_LEN];
-    strncpy(ip_copy, ip, sizeof(ip_copy) - 1);
-    ip_copy[sizeof(ip_copy) - 1] = '\0';
+    return SUCCESS;
+}
+
+void ip_addr_format(const ip_addr_t *addr, char *buf, size_t size) {
+    if (!addr || !buf || size == 0) return;
+    
+    char text[INET6_ADDRSTRLEN];
+    uint8_t len;
+    const uint8_t *bytes = ip_addr_bytes(addr, &len);
+    if (!inet_ntop(addr->family, bytes, text, sizeof(text))) {
+        buf[0] = '\0';
+        return;
+    }
     
-    char *slash = strchr(ip_copy, '/');
-    if (slash) *slash = '\0';
+    if (ip_addr_is_host(addr)) {
+        snprintf(buf, size, "%s", text);
+    } else {
+        snprintf(buf, size, "%s/%u", text, addr->prefixlen);
+    }
+}
+
+int ip_canonicalize(const char *str, char *buf, size_t size) {
+    ip_addr_t addr;
+    if (ip_addr_parse(str, &addr) != SUCCESS) {
+        return ERROR_INVALID_ARG;
+    }
+    ip_addr_format(&addr, buf, size);
+    return SUCCESS;
+}
+
+int ip_addr_cmp(const ip_addr_t *a, const ip_addr_t *b) {
+    if (a->family != b->family) {
+        return a->family < b->family ? -1 : 1;
+    }
+    int c = memcmp(a->addr, b->addr, sizeof(a->addr));
+    if (c != 0) return c;
+    return (int)a->prefixlen - (int)b->prefixlen;
+}
+
+bool ip_addr_equal(const ip_addr_t *a, const ip_addr_t *b) {
+    return a->family == b->family && a->prefixlen == b->prefixlen &&
+           memcmp(a->addr, b->addr, sizeof(a->addr)) == 0;
+}
+
+void ip_addr_truncate(const ip_addr_t *addr, int prefixlen, ip_addr_t *out) {
+    *out = *addr;
+    out->prefixlen = (uint8_t)prefixlen;
+    int bits = full_prefixlen(out);
+    int i = bits / 8;
+    if (bits % 8 != 0) {
+        out->addr[i++] &= (uint8_t)(0xff << (8 - bits % 8));
+    }
+    memset(out->addr + i, 0, sizeof(out->addr) - (size_t)i);
+}
+
+bool ip_addr_contains(const ip_addr_t *net, const ip_addr_t *addr) {
+    if (net->family != addr->family || net->prefixlen > addr->prefixlen) {
+        return false;
+    }
     
-    return strchr(ip_copy, ':') != NULL;
+    int bits = full_prefixlen(net);
+    int bytes = bits / 8;
+    if (memcmp(net->addr, addr->addr, (size_t)bytes) != 0) {
+        return false;
+    }
+    if (bits % 8 == 0) {
+        return true;
+    }
+    uint8_t mask = (uint8_t)(0xff << (8 - bits % 8));
+    return (net->addr[bytes] & mask) == (addr->addr[bytes] & mask);
+}
+
+uint32_t ip_addr_hash(const ip_addr_t *addr) {
+    uint64_t hi, lo;
+    memcpy(&hi, addr->addr, 8);
+    memcpy(&lo, addr->addr + 8, 8);
+    
+    uint64_t h = (hi ^ (lo * 0x9e3779b97f4a7c15ULL)) + addr->prefixlen;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+const uint8_t* ip_addr_bytes(const ip_addr_t *addr, uint8_t *len) {
+    if (addr->family == AF_INET) {
+        if (len) *len = 4;
+        return addr->addr + 12;
+    }
+    if (len) *len = 16;
+    return addr->addr;
+}
+
+bool ip_addr_is_host(const ip_addr_t *addr) {
+    return addr->prefixlen == (addr->family == AF_INET ? 32 : 128);
+}
+
+bool is_ipv6(const char *ip) {
+    ip_addr_t addr;
+    return ip_addr_parse(ip, &addr) == SUCCESS && addr.family == AF_INET6;
 }
 
 bool is_cidr(const char *ip) {
-    return strchr(ip, '/') != NULL;
+    ip_addr_t addr;
+    return ip_addr_parse(ip, &addr) == SUCCESS && !ip_addr_is_host(&addr);
 }
 
 int parse_ip_info(const char *input, ip_info_t *info) {
@@ -26,33 +178,24 @@ int parse_ip_info(const char *input, ip_info_t *info) {
     }
     
     memset(info, 0, sizeof(ip_info_t));
-    strncpy(info->ip, input, sizeof(info->ip) - 1);
+    if (ip_addr_parse(input, &info->addr) != SUCCESS) {
+        return ERROR_INVALID_ARG;
+    }
+    ip_addr_format(&info->addr, info->ip, sizeof(info->ip));
     
-    /* 检查是否是CIDR */
-    char *slash = strchr(info->ip, '/');
-    if (slash) {
-        *slash = '\0';
-        info->cidr_mask = atoi(slash + 1);
-        
-        if (is_ipv6(info->ip)) {
-            info->type = IP_TYPE_V6_CIDR;
-        } else {
-            info->type = IP_TYPE_V4_CIDR;
-        }
-        *slash = '/';  /* 恢复 */
+    bool v6 = (info->addr.family == AF_INET6);
+    if (ip_addr_is_host(&info->addr)) {
+        info->type = v6 ? IP_TYPE_V6 : IP_TYPE_V4;
     } else {
-        if (is_ipv6(info->ip)) {
-            info->type = IP_TYPE_V6;
-        } else {
-            info->type = IP_TYPE_V4;
-        }
+        info->type = v6 ? IP_TYPE_V6_CIDR : IP_TYPE_V4_CIDR;
+        info->cidr_mask = info->addr.prefixlen;
     }
     
     return SUCCESS;
 }
 
 char* get_remote_ip(void) {
-    static char ip[MAX_IP_LEN];
+    static char ip[IP_STR_LEN];
     char *env_ip = NULL;
     
     env_ip = getenv("PAM_RHOST");
@@ -60,9 +203,8 @@ char* get_remote_ip(void) {
         env_ip = getenv("RHOST");
     }
     
-    if (env_ip) {
-        strncpy(ip, env_ip, sizeof(ip) - 1);
-        ip[sizeof(ip) - 1] = '\0';
+    /* 统一为规范形式，非IP的主机名直接忽略 */
+    if (env_ip && ip_canonicalize(env_ip, ip, sizeof(ip)) == SUCCESS) {
         return ip;
     }
     
@@ -70,111 +212,28 @@ char* get_remote_ip(void) {
 }
 
 bool validate_ip_format(const char *ip) {
-    if (!ip) return false;
-    
-    char ip_copy[MAX_IP_LEN];
-    strncpy(ip_copy, ip, sizeof(ip_copy) - 1);
-    ip_copy[sizeof(ip_copy) - 1] = '\0';
-    
-    /* 检查CIDR */
-    char *slash = strchr(ip_copy, '/');
-    if (slash) {
-        *slash = '\0';
-        int mask = atoi(slash + 1);
-        
-        if (is_ipv6(ip_copy)) {
-            if (mask < 0 || mask > 128) return false;
-        } else {
-            if (mask < 0 || mask > 32) return false;
-        }
-    }
-    
-    /* 验证IP地址 */
-    struct sockaddr_in sa;
-    struct sockaddr_in6 sa6;
-    
-    if (inet_pton(AF_INET, ip_copy, &(sa.sin_addr)) == 1) {
-        return true;
-    }
-    if (inet_pton(AF_INET6, ip_copy, &(sa6.sin6_addr)) == 1) {
-        return true;
-    }
-    
-    return false;
+    ip_addr_t addr;
+    return ip_addr_parse(ip, &addr) == SUCCESS;
 }
 
 void format_nft_element(const char *ip, char *output, size_t size, const char *timeout) {
     if (!ip || !output) return;
     
-    char element[MAX_LINE_LEN];
-    
-    if (is_cidr(ip)) {
-        strncpy(element, ip, sizeof(element) - 1);
-    } else if (is_ipv6(ip)) {
-        snprintf(element, sizeof(element), "%s/128", ip);
-    } else {
-        snprintf(element, sizeof(element), "%s/32", ip);
+    ip_addr_t addr;
+    if (ip_addr_parse(ip, &addr) != SUCCESS) {
+        output[0] = '\0';
+        return;
     }
     
+    char element[IP_STR_LEN];
+    char text[INET6_ADDRSTRLEN];
+    uint8_t len;
+    inet_ntop(addr.family, ip_addr_bytes(&addr, &len), text, sizeof(text));
+    snprintf(element, sizeof(element), "%s/%u", text, addr.prefixlen);
+    
     if (timeout && strlen(timeout) > 0) {
         snprintf(output, size, "%s timeout %s", element, timeout);
     } else {
         snprintf(output, size, "%s", element);
     }
 }
-
-bool ip_matches_whitelist_entry(const char *ip, const char *whitelist_entry) {
-    if (!ip || !whitelist_entry) return false;
-    
-    /* 完全匹配 */
-    if (strcmp(ip, whitelist_entry) == 0) {
-        return true;
-    }
-    
-    /* CIDR匹配 */
-    if (strchr(whitelist_entry, '/')) {
-        char wl_copy[MAX_IP_LEN];
-        strncpy(wl_copy, whitelist_entry, sizeof(wl_copy) - 1);
-        wl_copy[sizeof(wl_copy) - 1] = '\0';
-        
-        char *slash = strchr(wl_copy, '/');
-        if (slash) {
-            *slash = '\0';
-            int mask = atoi(slash + 1);
-            
-            /* 简单的IPv4段匹配 */
-            if (!is_ipv6(ip)) {
-                char ip_prefix[MAX_IP_LEN];
-                strncpy(ip_prefix, ip, sizeof(ip_prefix) - 1);
-                
-                if (mask == 8) {
-                    /* 匹配 A.*.*.* */
-                    char *dot = strchr(ip_prefix, '.');
-                    if (dot) *dot = '\0';
-                    return strncmp(ip, wl_copy, strlen(ip_prefix)) == 0;
-                } else if (mask == 16) {
-                    /* 匹配 A.B.*.* */
-                    char *dot1 = strchr(ip_prefix, '.');
-                    if (dot1) {
-                        char *dot2 = strchr(dot1 + 1, '.');
-                        if (dot2) *dot2 = '\0';
-                    }
-                    return strncmp(ip, wl_copy, strlen(ip_prefix)) == 0;
-                } else if (mask == 24) {
-                    /* 匹配 A.B.C.* */
-                    char *dot1 = strchr(ip_prefix, '.');
-                    if (dot1) {
-                        char *dot2 = strchr(dot1 + 1, '.');
-                        if (dot2) {
-                            char *dot3 = strchr(dot2 + 1, '.');
-                            if (dot3) *dot3 = '\0';
-                        }
-                    }
-                    return strncmp(ip, wl_copy, strlen(ip_prefix)) == 0;
-                }
-            }
-        }
-    }
-    
-    return false;
-}
@@ -0,0 +1,212 @@
+#include "lpm.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define LPM_MAGIC "BLPM"
+#define LPM_VERSION 1
+#define LPM_ROOT_V4 1
+#define LPM_ROOT_V6 2
+
+/* 构建时使用的可增长节点数组 */
+typedef struct {
+    lpm_node_t *nodes;
+    uint32_t count;
+    uint32_t cap;
+} lpm_builder_t;
+
+static uint32_t builder_alloc(lpm_builder_t *b) {
+    if (b->count == b->cap) {
+        uint32_t new_cap = b->cap ? b->cap * 2 : 64;
+        lpm_node_t *p = realloc(b->nodes, new_cap * sizeof(*p));
+        if (!p) return 0;
+        b->nodes = p;
+        b->cap = new_cap;
+    }
+    memset(&b->nodes[b->count], 0, sizeof(lpm_node_t));
+    return b->count++;
+}
+
+static int builder_insert(lpm_builder_t *b, const ip_addr_t *addr) {
+    const uint8_t *bytes = ip_addr_bytes(addr, NULL);
+    uint32_t n = (addr->family == AF_INET) ? LPM_ROOT_V4 : LPM_ROOT_V6;
+
+    for (int depth = 0; depth < addr->prefixlen; depth++) {
+        int bit = (bytes[depth / 8] >> (7 - depth % 8)) & 1;
+        if (b->nodes[n].child[bit] == 0) {
+            uint32_t child = builder_alloc(b);
+            if (child == 0) return ERROR_FILE;
+            b->nodes[n].child[bit] = child;
+        }
+        n = b->nodes[n].child[bit];
+    }
+    b->nodes[n].terminal = 1;
+    return SUCCESS;
+}
+
+static void fill_source(lpm_header_t *h, const struct stat *src) {
+    h->src_ino = (uint64_t)src->st_ino;
+    h->src_size = (uint64_t)src->st_size;
+    h->src_mtime_sec = (int64_t)src->st_mtim.tv_sec;
+    h->src_mtime_nsec = (int64_t)src->st_mtim.tv_nsec;
+}
+
+static void write_sidecar(const void *data, size_t size, const char *path) {
+    char temp_file[MAX_PATH_LEN];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", path);
+
+    int fd = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+
+    const uint8_t *p = data;
+    size_t left = size;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0) break;
+        p += n;
+        left -= (size_t)n;
+    }
+    close(fd);
+
+    if (left == 0) {
+        rename(temp_file, path);
+    } else {
+        remove(temp_file);
+    }
+}
+
+int lpm_build(lpm_t *t, const ip_addr_t *entries, size_t count, const struct stat *src, const char *path) {
+    if (!t || (!entries && count > 0) || !src) {
+        return ERROR_INVALID_ARG;
+    }
+    memset(t, 0, sizeof(*t));
+
+    /* 下标0保留为空指针，1/2为IPv4/IPv6根节点 */
+    lpm_builder_t b = {0};
+    for (int i = 0; i <= LPM_ROOT_V6; i++) {
+        if (builder_alloc(&b) != (uint32_t)i) {
+            free(b.nodes);
+            return ERROR_FILE;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (builder_insert(&b, &entries[i]) != SUCCESS) {
+            free(b.nodes);
+            return ERROR_FILE;
+        }
+    }
+
+    size_t size = sizeof(lpm_header_t) + (size_t)b.count * sizeof(lpm_node_t);
+    uint8_t *base = calloc(1, size);
+    if (!base) {
+        free(b.nodes);
+        return ERROR_FILE;
+    }
+
+    lpm_header_t *h = (lpm_header_t *)base;
+    memcpy(h->magic, LPM_MAGIC, 4);
+    h->version = LPM_VERSION;
+    fill_source(h, src);
+    h->node_count = b.count;
+    h->root_v4 = LPM_ROOT_V4;
+    h->root_v6 = LPM_ROOT_V6;
+    memcpy(base + sizeof(lpm_header_t), b.nodes, (size_t)b.count * sizeof(lpm_node_t));
+    free(b.nodes);
+
+    t->base = base;
+    t->size = size;
+    t->mapped = false;
+    t->header = h;
+    t->nodes = (const lpm_node_t *)(base + sizeof(lpm_header_t));
+
+    /* 写入失败（如非root）不影响本进程使用内存中的副本 */
+    if (path) {
+        write_sidecar(base, size, path);
+    }
+    return SUCCESS;
+}
+
+int lpm_open(lpm_t *t, const char *path, const struct stat *src) {
+    if (!t || !path || !src) {
+        return ERROR_INVALID_ARG;
+    }
+    memset(t, 0, sizeof(*t));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ERROR_FILE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(lpm_header_t)) {
+        close(fd);
+        return ERROR_FILE;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return ERROR_FILE;
+    }
+
+    t->base = base;
+    t->size = (size_t)st.st_size;
+    t->mapped = true;
+    t->header = base;
+    t->nodes = (const lpm_node_t *)((const uint8_t *)base + sizeof(lpm_header_t));
+
+    /* 校验文件头、源文件状态和所有子节点下标，查询时无需再做边界检查 */
+    const lpm_header_t *h = t->header;
+    lpm_header_t expect;
+    fill_source(&expect, src);
+    bool valid = memcmp(h->magic, LPM_MAGIC, 4) == 0 && h->version == LPM_VERSION &&
+                 h->src_ino == expect.src_ino && h->src_size == expect.src_size &&
+                 h->src_mtime_sec == expect.src_mtime_sec && h->src_mtime_nsec == expect.src_mtime_nsec &&
+                 h->node_count > LPM_ROOT_V6 && h->root_v4 == LPM_ROOT_V4 && h->root_v6 == LPM_ROOT_V6 &&
+                 t->size == sizeof(lpm_header_t) + (size_t)h->node_count * sizeof(lpm_node_t);
+
+    for (uint32_t i = 0; valid && i < h->node_count; i++) {
+        if (t->nodes[i].child[0] >= h->node_count || t->nodes[i].child[1] >= h->node_count) {
+            valid = false;
+        }
+    }
+
+    if (!valid) {
+        lpm_close(t);
+        return ERROR_FILE;
+    }
+    return SUCCESS;
+}
+
+int lpm_lookup(const lpm_t *t, const ip_addr_t *addr) {
+    if (!t || !t->header || !addr) {
+        return -1;
+    }
+
+    const uint8_t *bytes = ip_addr_bytes(addr, NULL);
+    uint32_t n = (addr->family == AF_INET) ? t->header->root_v4 : t->header->root_v6;
+    int best = -1;
+
+    /* 查询本身是网段时，只有不长于它的前缀才算包含 */
+    for (int depth = 0; n != 0; depth++) {
+        if (t->nodes[n].terminal) {
+            best = depth;
+        }
+        if (depth >= addr->prefixlen) {
+            break;
+        }
+        int bit = (bytes[depth / 8] >> (7 - depth % 8)) & 1;
+        n = t->nodes[n].child[bit];
+    }
+    return best;
+}
+
+void lpm_close(lpm_t *t) {
+    if (!t || !t->base) return;
+
+    if (t->mapped) {
+        munmap(t->base, t->size);
+    } else {
+        free(t->base);
+    }
+    memset(t, 0, sizeof(*t));
+}
@@ -2,11 +2,19 @@
 #include "log.h"
 #include "ban.h"
 #include "whitelist.h"
+#include "restore.h"
 #include "stats.h"
 #include "pam.h"
 #include "install.h"
 #include "nftables.h"
 #include "ip_utils.h"
+#include "daemon.h"
+#include "store.h"
+#include "geodb.h"
+#include "geo.h"
+#include "geoblock.h"
+#include "collapse.h"
+#include "metrics.h"
 
 /* 显示帮助信息 */
 void show_help(void) {
@@ -15,18 +23,40 @@ void show_help(void) {
     printf("使用方法:\n");
     printf("  bip list                查看实时统计/活跃列表/日志\n");
     printf("  bip list -w/--watch     动态监控模式（每2秒刷新）\n");
+    printf("  bip stats --latency     查看PAM路径各阶段耗时 (p50/p99/p999)\n");
     printf("  bip show                显示本地持久化封禁列表\n");
+    printf("  bip show <IP>           显示单个IP的封禁记录\n");
     printf("  bip add <IP>            手动封禁 IP (支持IPv4/IPv6/CIDR)\n");
     printf("  bip del <IP>            手动解封 IP (支持IPv4/IPv6/CIDR)\n");
     printf("  bip vip add <IP>        添加IP到白名单 (支持IPv4/IPv6/CIDR)\n");
     printf("  bip vip del <IP>        从白名单移除IP\n");
     printf("  bip vip list            显示白名单列表\n");
+    printf("  bip geo                 显示离线地理数据库信息\n");
+    printf("  bip geo update <csv>    由CSV编译离线地理数据库 (IP段,国家代码)\n");
+    printf("  bip geo lookup <IP>     查询IP所属国家/地区\n");
+    printf("  bip geo enrich [N]      补充黑名单缺失的国家信息 (最多在线查询N个网段)\n");
+    printf("  bip geo block <CC,..>   拒绝来自所列国家的SSH连接 (如 CN,RU)\n");
+    printf("  bip geo allow-only <CC> 只允许所列国家及内网地址连接SSH\n");
+    printf("  bip geo off             关闭国家过滤\n");
     printf("  bip config                显示当前配置\n");
     printf("  bip config time <time>    设置封禁时间 (如: 7d, 24h, \"\" 为永久)\n");
     printf("  bip config retries <N>    设置最大重试次数 (1-10)\n");
     printf("  bip config ratelimit <N>  设置SSH端口速率 (1-1000/分钟)\n");
     printf("  bip config rateban <time> 设置超速封禁时长 (如: 10m, 1h)\n");
+    printf("  bip config idle <time>    设置守护进程空闲退出时间 (如: 10m, 0 为常驻)\n");
+    printf("  bip config follow <log>   守护进程直接跟踪sshd日志 (auto/路径/off)\n");
+    printf("  bip config geoapi <url>   设置在线地理查询接口 (%%s 替换为IP)\n");
+    printf("  bip config collapse <N>   同一/24、/64封禁达到N个时合并为网段 (0 为关闭)\n");
+    printf("  bip config agg <v4|v6> <N,..> 设置聚合统计的网段层级 (如 v4 8,16,24)\n");
+    printf("  bip config metrics <path> 定时写入node_exporter指标文件 (off 为关闭)\n");
+    printf("  bip config firewall <name> 设置防火墙后端 (auto/native/cli/record)\n");
     printf("  bip restore               从持久化文件恢复黑白名单\n");
+    printf("  bip import <file>         从文本列表导入黑名单 (每行 IP 或 IP|国家代码)\n");
+    printf("  bip export [file]         导出黑名单为文本列表 (默认标准输出)\n");
+    printf("  bip compact [-n] [N]      合并黑名单网段 (-n 只预览，N 覆盖配置的阈值)\n");
+    printf("  bip metrics [file]        输出Prometheus指标 (默认标准输出)\n");
+    printf("  bip daemon                前台运行常驻守护进程 (bipd)\n");
+    printf("  bip daemon --follow <log> 前台运行并跟踪日志 (- 为标准输入)\n");
     printf("  bip install             安装/重装服务\n");
     printf("  bip uninstall           卸载服务\n");
     printf("--------------------------------------------------------\n");
@@ -51,11 +81,10 @@ static int handle_vip_command(int argc, char *argv[]) {
         return ERROR_INVALID_ARG;
     }
     
-    const char *ip = argv[3];
-    
-    if (!validate_ip_format(ip)) {
+    char ip[IP_STR_LEN];
+    if (ip_canonicalize(argv[3], ip, sizeof(ip)) != SUCCESS) {
         char error_msg[MAX_LINE_LEN];
-        snprintf(error_msg, sizeof(error_msg), "❌ 无效的IP格式: %s", ip);
+        snprintf(error_msg, sizeof(error_msg), "❌ 无效的IP格式: %s", argv[3]);
         msg(C_RED, error_msg);
         return ERROR_INVALID_ARG;
     }
@@ -88,8 +117,152 @@ static int handle_vip_command(int argc, char *argv[]) {
     return ERROR_INVALID_ARG;
 }
 
+/* geo子命令处理 */
+static int handle_geo_command(int argc, char *argv[]) {
+    const char *subcmd = argc >= 3 ? argv[2] : "info";
+    
+    if (strcmp(subcmd, "update") == 0 && argc == 4) {
+        if (check_root() != SUCCESS) {
+            return ERROR_PERMISSION;
+        }
+        
+        geodb_stats_t stats;
+        if (geodb_compile(argv[3], GEO_DB_FILE, &stats) != SUCCESS) {
+            char error_msg[MAX_LINE_LEN];
+            snprintf(error_msg, sizeof(error_msg), "❌ 编译地理数据库失败: %s", argv[3]);
+            msg(C_RED, error_msg);
+            return ERROR_FILE;
+        }
+        log_write("[地理数据库] 已更新: IPv4 %zu 段, IPv6 %zu 段, 无效 %zu 行",
+                  stats.v4_count, stats.v6_count, stats.invalid);
+        
+        char success_msg[MAX_LINE_LEN];
+        snprintf(success_msg, sizeof(success_msg), "✅ 已更新 %s: IPv4 %zu 段, IPv6 %zu 段 (跳过 %zu 行, 无效 %zu 行)",
+                 GEO_DB_FILE, stats.v4_count, stats.v6_count, stats.skipped, stats.invalid);
+        msg(C_GREEN, success_msg);
+        
+        /* 启用了国家过滤时只提交区间差异 */
+        geo_filter_t filter;
+        geo_filter_load(&filter);
+        if (filter.mode != GEO_FILTER_OFF) {
+            size_t added = 0, removed = 0;
+            if (geoblock_sync(false, &added, &removed) == SUCCESS) {
+                snprintf(success_msg, sizeof(success_msg), "✅ 国家过滤集合已更新: 新增 %zu 段, 删除 %zu 段", added, removed);
+                msg(C_GREEN, success_msg);
+            } else {
+                msg(C_YELLOW, "⚠️  国家过滤集合更新失败，详见日志");
+            }
+        }
+        return SUCCESS;
+    }
+    
+    if ((strcmp(subcmd, "block") == 0 || strcmp(subcmd, "allow-only") == 0) && argc == 4) {
+        if (check_root() != SUCCESS) {
+            return ERROR_PERMISSION;
+        }
+        
+        geo_filter_mode_t mode = (strcmp(subcmd, "block") == 0) ? GEO_FILTER_BLOCK : GEO_FILTER_ALLOW;
+        int ret = geoblock_set(mode, argv[3]);
+        if (ret == ERROR_FILE) {
+            msg(C_YELLOW, "⚠️  国家过滤规则加载失败，详见日志");
+        }
+        if (ret == SUCCESS) {
+            geoblock_show();
+        }
+        return ret;
+    }
+    
+    if (strcmp(subcmd, "off") == 0 && argc == 3) {
+        if (check_root() != SUCCESS) {
+            return ERROR_PERMISSION;
+        }
+        
+        int ret = geoblock_set(GEO_FILTER_OFF, NULL);
+        if (ret == SUCCESS) {
+            msg(C_GREEN, "✅ 已关闭国家过滤");
+        } else if (ret == ERROR_FILE) {
+            msg(C_YELLOW, "⚠️  国家过滤规则加载失败，详见日志");
+        }
+        return ret;
+    }
+    
+    if (strcmp(subcmd, "lookup") == 0 && argc == 4) {
+        ip_addr_t addr;
+        if (ip_addr_parse(argv[3], &addr) != SUCCESS) {
+            char error_msg[MAX_LINE_LEN];
+            snprintf(error_msg, sizeof(error_msg), "❌ 无效的IP格式: %s", argv[3]);
+            msg(C_RED, error_msg);
+            return ERROR_INVALID_ARG;
+        }
+        if (!geodb_available()) {
+            msg(C_YELLOW, "未安装离线地理数据库，请先执行 bip geo update <csv>");
+            return ERROR_FILE;
+        }
+        
+        char ip[IP_STR_LEN];
+        char country_code[MAX_COUNTRY_CODE];
+        ip_addr_format(&addr, ip, sizeof(ip));
+        if (geodb_lookup(&addr, country_code, sizeof(country_code)) == SUCCESS) {
+            printf("%s  %s (%s)\n", ip, get_country_name(country_code), country_code);
+            return SUCCESS;
+        }
+        printf("%s  (未收录)\n", ip);
+        return ERROR_FILE;
+    }
+    
+    if (strcmp(subcmd, "enrich") == 0 && argc <= 4) {
+        if (check_root() != SUCCESS) {
+            return ERROR_PERMISSION;
+        }
+        
+        int budget = (argc == 4) ? atoi(argv[3]) : GEO_ENRICH_DEFAULT;
+        if (budget < 0) {
+            msg(C_RED, "❌ 查询数量必须是非负整数");
+            return ERROR_INVALID_ARG;
+        }
+        
+        size_t annotated = 0;
+        if (geo_enrich_pending((size_t)budget, &annotated) != SUCCESS) {
+            msg(C_YELLOW, "⚠️  在线查询失败，仅补充了本地可解析的条目");
+        }
+        char success_msg[MAX_LINE_LEN];
+        snprintf(success_msg, sizeof(success_msg), "✅ 已补充 %zu 条国家信息", annotated);
+        msg(C_GREEN, success_msg);
+        return SUCCESS;
+    }
+    
+    if (strcmp(subcmd, "info") == 0) {
+        const geodb_header_t *h = geodb_header();
+        if (!h) {
+            printf("离线地理数据库: %s未安装%s (使用在线查询)\n", C_YELLOW, C_RESET);
+            geoblock_show();
+            return SUCCESS;
+        }
+        
+        char built[32];
+        time_t built_at = (time_t)h->built_at;
+        struct tm tm;
+        localtime_r(&built_at, &tm);
+        strftime(built, sizeof(built), "%Y-%m-%d %H:%M:%S", &tm);
+        printf("离线地理数据库: %s%s%s\n", C_GREEN, GEO_DB_FILE, C_RESET);
+        printf("IPv4 区间: %u  |  IPv6 区间: %u  |  编译时间: %s\n", h->v4_count, h->v6_count, built);
+        geoblock_show();
+        return SUCCESS;
+    }
+    
+    msg(C_RED, "用法: bip geo {info|update <csv>|lookup <IP>|enrich [N]|block <CC,..>|allow-only <CC,..>|off}");
+    return ERROR_INVALID_ARG;
+}
+
 /* 主函数 */
 int main(int argc, char *argv[]) {
+    /* 以 bipd 名称启动时直接进入守护进程 */
+    const char *prog = strrchr(argv[0], '/');
+    prog = prog ? prog + 1 : argv[0];
+    if (strcmp(prog, "bipd") == 0) {
+        return daemon_run(NULL);
+    }
+    
     /* 无参数显示帮助 */
     if (argc < 2) {
         show_help();
@@ -113,6 +286,18 @@ int main(int argc, char *argv[]) {
         return pam_clean_on_success();
     }
     
+    /* daemon命令：常驻守护进程 */
+    if (strcmp(command, "daemon") == 0) {
+        if (argc == 4 && strcmp(argv[2], "--follow") == 0) {
+            return daemon_run(argv[3]);
+        }
+        if (argc != 2) {
+            msg(C_RED, "用法: bip daemon [--follow <日志路径|auto|->]");
+            return ERROR_INVALID_ARG;
+        }
+        return daemon_run(NULL);
+    }
+    
     /* list命令：显示统计信息 */
     if (strcmp(command, "list") == 0) {
         bool watch_mode = false;
@@ -123,17 +308,131 @@ int main(int argc, char *argv[]) {
         return SUCCESS;
     }
     
+    /* stats命令：--latency 显示PAM路径耗时，否则同 bip list */
+    if (strcmp(command, "stats") == 0) {
+        if (argc >= 3 && strcmp(argv[2], "--latency") == 0) {
+            show_latency_stats();
+        } else {
+            show_statistics();
+        }
+        return SUCCESS;
+    }
+    
     /* show命令：显示持久化列表 */
     if (strcmp(command, "show") == 0) {
+        if (argc >= 3) {
+            return show_persist_entry(argv[2]);
+        }
         show_persist_list();
         return SUCCESS;
     }
     
+    /* import命令：从文本列表导入黑名单 */
+    if (strcmp(command, "import") == 0) {
+        if (argc < 3) {
+            msg(C_RED, "用法: bip import <文件>");
+            return ERROR_INVALID_ARG;
+        }
+        if (check_root() != SUCCESS) {
+            return ERROR_PERMISSION;
+        }
+        
+        size_t imported = 0, invalid = 0;
+        if (store_import(argv[2], &imported, &invalid) != SUCCESS) {
+            char error_msg[MAX_LINE_LEN];
+            snprintf(error_msg, sizeof(error_msg), "❌ 导入失败: %s", argv[2]);
+            msg(C_RED, error_msg);
+            return ERROR_FILE;
+        }
+        metrics_ban(BAN_SOURCE_IMPORT, imported);
+        log_write("[导入黑名单] 文件=%s 导入 %zu 条，无效 %zu 条", argv[2], imported, invalid);
+        
+        char success_msg[MAX_LINE_LEN];
+        snprintf(success_msg, sizeof(success_msg), "✅ 已导入 %zu 条 (无效 %zu 条)", imported, invalid);
+        msg(C_GREEN, success_msg);
+        
+        /* 导入后立即生效 */
+        init_nftables_rules();
+        restore_all_lists();
+        return SUCCESS;
+    }
+    
+    /* metrics命令：输出Prometheus文本格式指标 */
+    if (strcmp(command, "metrics") == 0) {
+        const char *path = (argc >= 3 && strcmp(argv[2], "-") != 0) ? argv[2] : NULL;
+        if (metrics_export(path) != SUCCESS) {
+            if (path) {
+                char error_msg[MAX_LINE_LEN];
+                snprintf(error_msg, sizeof(error_msg), "❌ 写入指标失败: %s", path);
+                msg(C_RED, error_msg);
+            }
+            return ERROR_FILE;
+        }
+        return SUCCESS;
+    }
+    
+    /* export命令：导出黑名单为文本列表 */
+    if (strcmp(command, "export") == 0) {
+        if (argc < 3 || strcmp(argv[2], "-") == 0) {
+            return store_export(stdout);
+        }
+        
+        FILE *fp = fopen(argv[2], "w");
+        if (!fp) {
+            char error_msg[MAX_LINE_LEN];
+            snprintf(error_msg, sizeof(error_msg), "❌ 无法写入: %s", argv[2]);
+            msg(C_RED, error_msg);
+            return ERROR_FILE;
+        }
+        int ret = store_export(fp);
+        fclose(fp);
+        return ret;
+    }
+    
+    /* compact命令：合并黑名单网段 */
+    if (strcmp(command, "compact") == 0) {
+        bool dry_run = false;
+        int threshold = get_collapse_from_config();
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--dry-run") == 0) {
+                dry_run = true;
+            } else if (isdigit((unsigned char)argv[i][0])) {
+                threshold = atoi(argv[i]);
+            } else {
+                msg(C_RED, "用法: bip compact [-n] [阈值]");
+                return ERROR_INVALID_ARG;
+            }
+        }
+        if (check_root() != SUCCESS) {
+            return ERROR_PERMISSION;
+        }
+        
+        collapse_stats_t stats;
+        if (collapse_run(threshold, dry_run, &stats) != SUCCESS) {
+            msg(C_RED, "❌ 合并失败，黑名单未修改，详见日志");
+            return ERROR_FILE;
+        }
+        
+        char success_msg[MAX_LINE_LEN];
+        snprintf(success_msg, sizeof(success_msg), "%s有效条目 %zu -> %zu (覆盖删除 %zu, 阈值合并 %zu 个网段, 相邻合并 %zu 次)",
+                 dry_run ? "预览: " : "✅ ", stats.before, stats.after, stats.covered, stats.collapsed, stats.merged);
+        msg(dry_run ? C_YELLOW : C_GREEN, success_msg);
+        if (!dry_run && stats.before != stats.after) {
+            printf("集合变更: 删除 %zu 个元素, 新增 %zu 个元素\n", stats.nft_removed, stats.nft_added);
+        }
+        return SUCCESS;
+    }
+    
     /* vip命令：白名单管理 */
     if (strcmp(command, "vip") == 0) {
         return handle_vip_command(argc, argv);
     }
     
+    /* geo命令：离线地理数据库 */
+    if (strcmp(command, "geo") == 0) {
+        return handle_geo_command(argc, argv);
+    }
+    
     /* config命令：配置管理 */
     if (strcmp(command, "config") == 0) {
         if (argc == 2) {
@@ -142,6 +441,23 @@ int main(int argc, char *argv[]) {
             int max_retries = get_max_retries_from_config();
             int rate_limit = get_rate_limit_from_config();
             const char *rate_ban_time = get_rate_ban_time_from_config();
+            const char *idle_timeout = get_idle_timeout_from_config();
+            const char *ssh_log = get_ssh_log_from_config();
+            const char *geo_api = get_geo_api_from_config();
+            int collapse = get_collapse_from_config();
+            const char *metrics_textfile = get_metrics_textfile_from_config();
+            const char *firewall_backend = get_firewall_backend_from_config();
+            char agg_levels[2][64];
+            for (int f = 0; f < 2; f++) {
+                int levels[MAX_AGG_LEVELS];
+                int count = get_agg_levels_from_config(f == 1, levels);
+                size_t len = 0;
+                agg_levels[f][0] = '\0';
+                for (int l = 0; l < count; l++) {
+                    len += (size_t)snprintf(agg_levels[f] + len, sizeof(agg_levels[f]) - len, "%s/%d",
+                                            l ? " " : "", levels[l]);
+                }
+            }
             printf("%s当前配置%s\n", C_CYAN, C_RESET);
             printf("====防爆破===\n");
             printf("封禁时间: %s%s%s", C_GREEN, ban_time, C_RESET);
@@ -151,9 +467,26 @@ int main(int argc, char *argv[]) {
                 printf("\n");
             }
             printf("最大重试次数: %s%d%s\n", C_GREEN, max_retries, C_RESET);
+            if (collapse >= 2) {
+                printf("网段合并阈值: %s%d%s\n", C_GREEN, collapse, C_RESET);
+            } else {
+                printf("网段合并阈值: %s关闭%s\n", C_GREEN, C_RESET);
+            }
             printf("====防洪水攻击===\n");
             printf("SSH端口速率: %s%d/分钟%s\n", C_GREEN, rate_limit, C_RESET);
             printf("超速封禁时长: %s%s%s\n", C_GREEN, rate_ban_time, C_RESET);
+            printf("====守护进程===\n");
+            printf("空闲退出时间: %s%s%s\n", C_GREEN, idle_timeout, C_RESET);
+            printf("日志跟踪: %s%s%s\n", C_GREEN, ssh_log, C_RESET);
+            printf("====地理查询===\n");
+            printf("在线接口: %s%s%s\n", C_GREEN, geo_api, C_RESET);
+            printf("====聚合统计===\n");
+            printf("IPv4网段层级: %s%s%s\n", C_GREEN, agg_levels[0], C_RESET);
+            printf("IPv6网段层级: %s%s%s\n", C_GREEN, agg_levels[1], C_RESET);
+            printf("====运行指标===\n");
+            printf("指标文件: %s%s%s\n", C_GREEN, metrics_textfile, C_RESET);
+            printf("====防火墙===\n");
+            printf("后端: %s%s%s (当前进程: %s)\n", C_GREEN, firewall_backend, C_RESET, nft_backend()->name);
             printf("配置文件: %s\n", CONFIG_FILE);
             return SUCCESS;
         } else if (argc == 4 && strcmp(argv[2], "time") == 0) {
@@ -217,12 +550,121 @@ int main(int argc, char *argv[]) {
                 return SUCCESS;
             }
             return ERROR_FILE;
+        } else if (argc == 4 && strcmp(argv[2], "idle") == 0) {
+            /* 设置守护进程空闲退出时间 */
+            const char *new_time = argv[3];
+            if (save_idle_timeout_to_config(new_time) == SUCCESS) {
+                char msg_buf[MAX_LINE_LEN];
+                snprintf(msg_buf, sizeof(msg_buf), "✅ 守护进程空闲退出时间已设置为: %s", new_time);
+                msg(C_GREEN, msg_buf);
+                return SUCCESS;
+            }
+            msg(C_RED, "❌ 设置失败: 请使用如 30s, 10m, 1h 的时长格式");
+            return ERROR_INVALID_ARG;
+        } else if (argc == 4 && strcmp(argv[2], "follow") == 0) {
+            /* 设置守护进程跟踪的sshd日志 */
+            const char *ssh_log = argv[3];
+            if (save_ssh_log_to_config(ssh_log) != SUCCESS) {
+                msg(C_RED, "❌ 设置失败: 请使用 auto、off 或日志文件绝对路径");
+                return ERROR_INVALID_ARG;
+            }
+            char msg_buf[MAX_LINE_LEN];
+            snprintf(msg_buf, sizeof(msg_buf), "✅ 日志跟踪已设置为: %s", ssh_log);
+            msg(C_GREEN, msg_buf);
+            /* 跟踪日志时守护进程常驻，关闭后恢复按需激活 */
+            if (strcmp(ssh_log, "off") != 0) {
+                system("systemctl enable bipd.service >/dev/null 2>&1");
+                system("systemctl restart bipd.service >/dev/null 2>&1");
+            } else {
+                system("systemctl disable bipd.service >/dev/null 2>&1");
+                system("systemctl stop bipd.service >/dev/null 2>&1");
+            }
+            return SUCCESS;
+        } else if (argc == 4 && strcmp(argv[2], "collapse") == 0) {
+            /* 设置网段合并阈值 */
+            int threshold = atoi(argv[3]);
+            if (save_collapse_to_config(threshold) != SUCCESS) {
+                msg(C_RED, "❌ 设置失败: 请使用0（关闭）或2-256之间的整数");
+                return ERROR_INVALID_ARG;
+            }
+            char msg_buf[MAX_LINE_LEN];
+            if (threshold == 0) {
+                snprintf(msg_buf, sizeof(msg_buf), "✅ 已关闭网段合并");
+            } else {
+                snprintf(msg_buf, sizeof(msg_buf), "✅ 同一网段封禁达到 %d 个时合并为 /%d 或 /%d",
+                         threshold, COLLAPSE_PREFIX_V4, COLLAPSE_PREFIX_V6);
+            }
+            msg(C_GREEN, msg_buf);
+            return SUCCESS;
+        } else if (argc == 5 && strcmp(argv[2], "agg") == 0 &&
+                   (strcmp(argv[3], "v4") == 0 || strcmp(argv[3], "v6") == 0)) {
+            /* 设置聚合统计的网段层级 */
+            bool ipv6 = strcmp(argv[3], "v6") == 0;
+            if (save_agg_levels_to_config(ipv6, argv[4]) != SUCCESS) {
+                char error_msg[MAX_LINE_LEN];
+                snprintf(error_msg, sizeof(error_msg), "❌ 设置失败: 请使用逗号分隔的升序前缀长度 (1-%d，最多%d级)",
+                         ipv6 ? 128 : 32, MAX_AGG_LEVELS);
+                msg(C_RED, error_msg);
+                return ERROR_INVALID_ARG;
+            }
+            char msg_buf[MAX_LINE_LEN];
+            snprintf(msg_buf, sizeof(msg_buf), "✅ %s 聚合统计网段层级已设置为: %s", ipv6 ? "IPv6" : "IPv4", argv[4]);
+            msg(C_GREEN, msg_buf);
+            return SUCCESS;
+        } else if (argc == 4 && strcmp(argv[2], "metrics") == 0) {
+            /* 设置node_exporter指标文件 */
+            const char *path = argv[3];
+            if (save_metrics_textfile_to_config(path) != SUCCESS) {
+                msg(C_RED, "❌ 设置失败: 请使用 off 或 .prom 文件绝对路径");
+                return ERROR_INVALID_ARG;
+            }
+            setup_metrics_timer();
+            char msg_buf[MAX_LINE_LEN];
+            if (strcmp(path, "off") == 0) {
+                snprintf(msg_buf, sizeof(msg_buf), "✅ 已关闭指标文件");
+            } else {
+                snprintf(msg_buf, sizeof(msg_buf), "✅ 指标将定时写入: %s", path);
+            }
+            msg(C_GREEN, msg_buf);
+            return SUCCESS;
+        } else if (argc == 4 && strcmp(argv[2], "firewall") == 0) {
+            /* 设置防火墙后端 */
+            const char *backend = argv[3];
+            if (save_firewall_backend_to_config(backend) != SUCCESS) {
+                msg(C_RED, "❌ 设置失败: 请使用 auto、native、cli 或 record");
+                return ERROR_INVALID_ARG;
+            }
+            char msg_buf[MAX_LINE_LEN];
+            snprintf(msg_buf, sizeof(msg_buf), "✅ 防火墙后端已设置为: %s", backend);
+            msg(C_GREEN, msg_buf);
+            if (strcmp(backend, "record") == 0) {
+                msg(C_YELLOW, "⚠️  record 后端只记录操作，不修改nftables，仅用于测试");
+            }
+            return SUCCESS;
+        } else if (argc == 4 && strcmp(argv[2], "geoapi") == 0) {
+            /* 设置在线地理查询接口 */
+            const char *geo_api = argv[3];
+            if (save_geo_api_to_config(geo_api) != SUCCESS) {
+                msg(C_RED, "❌ 设置失败: 请使用含一个 %s 的 http(s) 地址，如 " DEFAULT_GEO_API);
+                return ERROR_INVALID_ARG;
+            }
+            char msg_buf[MAX_LINE_LEN];
+            snprintf(msg_buf, sizeof(msg_buf), "✅ 在线地理查询接口已设置为: %s", geo_api);
+            msg(C_GREEN, msg_buf);
+            return SUCCESS;
         } else {
             msg(C_RED, "用法: bip config");
             msg(C_RED, "      bip config time <time>");
             msg(C_RED, "      bip config retries <count>");
             msg(C_RED, "      bip config ratelimit <rate>");
             msg(C_RED, "      bip config rateban <time>");
+            msg(C_RED, "      bip config idle <time>");
+            msg(C_RED, "      bip config follow <auto|path|off>");
+            msg(C_RED, "      bip config geoapi <url>");
+            msg(C_RED, "      bip config collapse <N>");
+            msg(C_RED, "      bip config agg <v4|v6> <N,N,..>");
+            msg(C_RED, "      bip config metrics <path|off>");
+            msg(C_RED, "      bip config firewall <auto|native|cli|record>");
             return ERROR_INVALID_ARG;
         }
     }
@@ -234,16 +676,15 @@ int main(int argc, char *argv[]) {
             return ERROR_INVALID_ARG;
         }
         
-        const char *ip = argv[2];
-        
-        if (!validate_ip_format(ip)) {
+        char ip[IP_STR_LEN];
+        if (ip_canonicalize(argv[2], ip, sizeof(ip)) != SUCCESS) {
             char error_msg[MAX_LINE_LEN];
-            snprintf(error_msg, sizeof(error_msg), "❌ 无效的IP格式: %s", ip);
+            snprintf(error_msg, sizeof(error_msg), "❌ 无效的IP格式: %s", argv[2]);
             msg(C_RED, error_msg);
             return ERROR_INVALID_ARG;
         }
         
-        if (ban_ip(ip, true) == SUCCESS) {
+        if (ban_ip(ip, true, BAN_SOURCE_MANUAL) == SUCCESS) {
             char success_msg[MAX_LINE_LEN];
             snprintf(success_msg, sizeof(success_msg), "✅ 已封禁: %s", ip);
             msg(C_GREEN, success_msg);
@@ -260,7 +701,13 @@ int main(int argc, char *argv[]) {
             return ERROR_INVALID_ARG;
         }
         
-        const char *ip = argv[2];
+        char ip[IP_STR_LEN];
+        if (ip_canonicalize(argv[2], ip, sizeof(ip)) != SUCCESS) {
+            char error_msg[MAX_LINE_LEN];
+            snprintf(error_msg, sizeof(error_msg), "❌ 无效的IP格式: %s", argv[2]);
+            msg(C_RED, error_msg);
+            return ERROR_INVALID_ARG;
+        }
         
         if (unban_ip(ip) == SUCCESS) {
             char success_msg[MAX_LINE_LEN];
@@ -269,6 +716,9 @@ int main(int argc, char *argv[]) {
             return SUCCESS;
         }
         
+        char error_msg[MAX_LINE_LEN];
+        snprintf(error_msg, sizeof(error_msg), "❌ 解封失败: %s 所在的合并网段无法拆分，详见 %s", ip, LOG_FILE);
+        msg(C_RED, error_msg);
         return ERROR_FILE;
     }
     
@@ -280,8 +730,7 @@ int main(int argc, char *argv[]) {
         
         check_and_install_nftables();
         init_nftables_rules();
-        restore_from_persist();
-        whitelist_restore();
+        restore_all_lists();
         
         return SUCCESS;
     }
@@ -0,0 +1,349 @@
+#include "metrics.h"
+#include "nftables.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define METRICS_MAGIC "BIPM"
+#define METRICS_VERSION 4
+#define METRICS_SLOTS 32            /* 预留槽位，新增指标不改变文件布局 */
+#define LATENCY_SLOTS 16
+
+/*
+ * HDR式对数线性分桶：小于16ns的值各占一桶，之后每个2的幂区间分16个子桶，
+ * 桶宽与数值成比例，相对误差不超过1/16；上限约2^42ns（73分钟），更大的值计入最后一桶。
+ */
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_SHIFT 37
+#define LATENCY_BUCKETS ((LATENCY_MAX_SHIFT + 1) * LATENCY_SUB + LATENCY_SUB)
+
+typedef struct {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+/* 共享计数文件布局 */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    _Atomic uint64_t counters[METRICS_SLOTS];
+    latency_hist_t latency[LATENCY_SLOTS];
+} metrics_shm_t;
+
+_Static_assert(METRIC_COUNT <= METRICS_SLOTS, "metrics slots exhausted");
+_Static_assert(LATENCY_COUNT <= LATENCY_SLOTS, "latency slots exhausted");
+
+static const char *latency_names[LATENCY_COUNT] = {
+    "check.total", "check.notify", "check.whitelist", "check.count", "check.record",
+    "check.config", "check.log", "check.fork",
+    "clean.total", "clean.notify", "clean.count", "clean.log", "clean.clear"
+};
+
+static metrics_shm_t *shm = NULL;
+static bool shm_failed = false;
+
+/* 每个进程首次计数时映射一次，之后的递增只是一次原子加法 */
+static metrics_shm_t* metrics_map(void) {
+    if (shm || shm_failed) {
+        return shm;
+    }
+
+    int fd = open(METRICS_SHM_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        shm_failed = true;
+        return NULL;
+    }
+
+    /* 初始化文件头时加锁，防止多个进程同时创建 */
+    flock(fd, LOCK_EX);
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size < sizeof(metrics_shm_t) && ftruncate(fd, sizeof(metrics_shm_t)) != 0)) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        shm_failed = true;
+        return NULL;
+    }
+
+    void *p = mmap(NULL, sizeof(metrics_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        shm_failed = true;
+        return NULL;
+    }
+
+    metrics_shm_t *m = p;
+    /* 新建文件或旧版本布局（扩展部分为0）时重新初始化 */
+    if (memcmp(m->magic, METRICS_MAGIC, 4) != 0 || m->version != METRICS_VERSION) {
+        memset(m, 0, sizeof(*m));
+        m->version = METRICS_VERSION;
+        memcpy(m->magic, METRICS_MAGIC, 4);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    shm = m;
+    return shm;
+}
+
+void metrics_add(metric_id_t id, uint64_t n) {
+    if ((unsigned)id >= METRIC_COUNT || n == 0) {
+        return;
+    }
+    metrics_shm_t *m = metrics_map();
+    if (m) {
+        atomic_fetch_add_explicit(&m->counters[id], n, memory_order_relaxed);
+    }
+}
+
+void metrics_inc(metric_id_t id) {
+    metrics_add(id, 1);
+}
+
+/* 封禁来源与计数项的对应关系 */
+static const struct {
+    ban_source_t source;
+    metric_id_t metric;
+} ban_metrics[] = {
+    {BAN_SOURCE_MANUAL, METRIC_BANS_MANUAL},
+    {BAN_SOURCE_PAM, METRIC_BANS_PAM},
+    {BAN_SOURCE_RATELIMIT, METRIC_BANS_RATELIMIT},
+    {BAN_SOURCE_IMPORT, METRIC_BANS_IMPORT},
+    {BAN_SOURCE_LOG, METRIC_BANS_LOG},
+};
+
+void metrics_ban(ban_source_t source, uint64_t n) {
+    for (size_t i = 0; i < ARRAY_SIZE(ban_metrics); i++) {
+        if (ban_metrics[i].source == source) {
+            metrics_add(ban_metrics[i].metric, n);
+            return;
+        }
+    }
+}
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static size_t latency_bucket(uint64_t ns) {
+    if (ns < LATENCY_SUB) {
+        return (size_t)ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    if (shift > LATENCY_MAX_SHIFT) {
+        return LATENCY_BUCKETS - 1;
+    }
+    return (size_t)(shift + 1) * LATENCY_SUB + (size_t)((ns >> shift) - LATENCY_SUB);
+}
+
+/* 桶内的最大值（与HDR直方图一样按桶上界报告分位数） */
+static uint64_t latency_bucket_high(size_t index) {
+    if (index < LATENCY_SUB) {
+        return index;
+    }
+    int shift = (int)(index / LATENCY_SUB) - 1;
+    uint64_t sub = index % LATENCY_SUB + LATENCY_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+void metrics_lap(latency_phase_t phase, uint64_t *start) {
+    uint64_t ns = metrics_now_ns() - *start;
+    metrics_shm_t *m = ((unsigned)phase < LATENCY_COUNT) ? metrics_map() : NULL;
+    if (m) {
+        latency_hist_t *h = &m->latency[phase];
+        atomic_fetch_add_explicit(&h->buckets[latency_bucket(ns)], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&h->sum_ns, ns, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+        while (ns > max && !atomic_compare_exchange_weak_explicit(&h->max_ns, &max, ns,
+                                                                  memory_order_relaxed, memory_order_relaxed)) {
+        }
+        atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    }
+    *start = metrics_now_ns();
+}
+
+const char* latency_phase_name(latency_phase_t phase) {
+    return ((unsigned)phase < LATENCY_COUNT) ? latency_names[phase] : "-";
+}
+
+int metrics_latency(latency_phase_t phase, latency_summary_t *summary) {
+    if ((unsigned)phase >= LATENCY_COUNT || !summary) {
+        return ERROR_INVALID_ARG;
+    }
+    memset(summary, 0, sizeof(*summary));
+    metrics_shm_t *m = metrics_map();
+    if (!m) {
+        return ERROR_FILE;
+    }
+
+    /* 先复制桶，分位数以桶内合计为准，不受并发写入影响 */
+    latency_hist_t *h = &m->latency[phase];
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t total = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        buckets[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        total += buckets[i];
+    }
+    if (total == 0) {
+        return SUCCESS;
+    }
+
+    summary->count = total;
+    summary->mean_ns = atomic_load_explicit(&h->sum_ns, memory_order_relaxed) / total;
+    summary->max_ns = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+
+    const double quantiles[3] = { 0.50, 0.99, 0.999 };
+    uint64_t *targets[3] = { &summary->p50_ns, &summary->p99_ns, &summary->p999_ns };
+    uint64_t seen = 0;
+    size_t q = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS && q < 3; i++) {
+        seen += buckets[i];
+        while (q < 3 && (double)seen >= quantiles[q] * (double)total) {
+            uint64_t high = latency_bucket_high(i);
+            *targets[q++] = (high < summary->max_ns) ? high : summary->max_ns;
+        }
+    }
+    return SUCCESS;
+}
+
+static uint64_t metrics_get(const metrics_shm_t *m, metric_id_t id) {
+    return m ? atomic_load_explicit(&m->counters[id], memory_order_relaxed) : 0;
+}
+
+uint64_t metrics_value(metric_id_t id) {
+    return ((unsigned)id < METRIC_COUNT) ? metrics_get(metrics_map(), id) : 0;
+}
+
+static int count_element(const nft_element_t *elem, void *ctx) {
+    (void)elem;
+    (*(size_t *)ctx)++;
+    return 0;
+}
+
+static void write_header(FILE *fp, const char *name, const char *type, const char *help) {
+    fprintf(fp, "# HELP %s %s\n", name, help);
+    fprintf(fp, "# TYPE %s %s\n", name, type);
+}
+
+static void write_rule_counter(FILE *fp, const nft_rule_counter_t *counter, bool bytes) {
+    fprintf(fp, "bip_rule_%s_total{rule=\"%s\"} %llu\n", bytes ? "bytes" : "packets", counter->comment,
+            (unsigned long long)(bytes ? counter->bytes : counter->packets));
+}
+
+typedef struct {
+    nft_rule_counter_t rows[16];
+    size_t count;
+} counter_list_t;
+
+static int collect_counter(const nft_rule_counter_t *counter, void *ctx) {
+    counter_list_t *list = ctx;
+    if (list->count < sizeof(list->rows) / sizeof(list->rows[0])) {
+        list->rows[list->count++] = *counter;
+    }
+    return 0;
+}
+
+int metrics_write(FILE *fp) {
+    if (!fp) {
+        return ERROR_INVALID_ARG;
+    }
+
+    const metrics_shm_t *m = metrics_map();
+
+    write_header(fp, "bip_failures_total", "counter", "SSH authentication failures seen by bip.");
+    fprintf(fp, "bip_failures_total{source=\"pam\"} %llu\n",
+            (unsigned long long)metrics_get(m, METRIC_FAILURES_PAM));
+    fprintf(fp, "bip_failures_total{source=\"log\"} %llu\n",
+            (unsigned long long)metrics_get(m, METRIC_FAILURES_LOG));
+
+    write_header(fp, "bip_bans_total", "counter", "Addresses added to the blacklist.");
+    for (size_t i = 0; i < ARRAY_SIZE(ban_metrics); i++) {
+        fprintf(fp, "bip_bans_total{source=\"%s\"} %llu\n", ban_source_name((uint8_t)ban_metrics[i].source),
+                (unsigned long long)metrics_get(m, ban_metrics[i].metric));
+    }
+
+    write_header(fp, "bip_unbans_total", "counter", "Addresses removed from the blacklist.");
+    fprintf(fp, "bip_unbans_total{source=\"manual\"} %llu\n",
+            (unsigned long long)metrics_get(m, METRIC_UNBANS_MANUAL));
+
+    uint64_t hits = metrics_get(m, METRIC_GEOCACHE_HITS);
+    uint64_t misses = metrics_get(m, METRIC_GEOCACHE_MISSES);
+    write_header(fp, "bip_geocache_hits_total", "counter", "Geo cache lookups answered from the cache.");
+    fprintf(fp, "bip_geocache_hits_total %llu\n", (unsigned long long)hits);
+    write_header(fp, "bip_geocache_misses_total", "counter", "Geo cache lookups that missed.");
+    fprintf(fp, "bip_geocache_misses_total %llu\n", (unsigned long long)misses);
+    write_header(fp, "bip_geocache_hit_ratio", "gauge", "Geo cache hit ratio since the counters were created.");
+    fprintf(fp, "bip_geocache_hit_ratio %.4f\n", hits + misses ? (double)hits / (double)(hits + misses) : 0.0);
+
+    write_header(fp, "bip_daemon_busy_total", "counter", "PAM reports counted locally because the daemon queue stayed full past the send timeout.");
+    fprintf(fp, "bip_daemon_busy_total %llu\n", (unsigned long long)metrics_get(m, METRIC_DAEMON_BUSY));
+
+    /* 集合大小：逐个dump计数，集合不存在时跳过 */
+    static const char *sets[] = {
+        NFT_SET, NFT_SET_V6, NFT_WHITELIST, NFT_WHITELIST_V6, NFT_RATELIMIT, NFT_RATELIMIT_V6
+    };
+    write_header(fp, "bip_set_elements", "gauge", "Elements in the bip nftables sets.");
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        size_t count = 0;
+        if (nft_dump_set(sets[i], count_element, &count) == SUCCESS) {
+            fprintf(fp, "bip_set_elements{set=\"%s\"} %zu\n", sets[i], count);
+        }
+    }
+
+    /* 规则计数器：一次规则dump */
+    counter_list_t counters;
+    counters.count = 0;
+    if (nft_dump_counters(collect_counter, &counters) == SUCCESS && counters.count > 0) {
+        write_header(fp, "bip_rule_packets_total", "counter", "Packets matched by bip rules.");
+        for (size_t i = 0; i < counters.count; i++) {
+            write_rule_counter(fp, &counters.rows[i], false);
+        }
+        write_header(fp, "bip_rule_bytes_total", "counter", "Bytes matched by bip rules.");
+        for (size_t i = 0; i < counters.count; i++) {
+            write_rule_counter(fp, &counters.rows[i], true);
+        }
+    }
+
+    return ferror(fp) ? ERROR_FILE : SUCCESS;
+}
+
+int metrics_export(const char *path) {
+    if (!path) {
+        int ret = metrics_write(stdout);
+        fflush(stdout);
+        return ret;
+    }
+
+    /* node_exporter 只读取完整文件：写入同目录临时文件后rename */
+    char temp_file[MAX_PATH_LEN];
+    if (snprintf(temp_file, sizeof(temp_file), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(temp_file)) {
+        return ERROR_INVALID_ARG;
+    }
+
+    FILE *fp = fopen(temp_file, "w");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+
+    int ret = metrics_write(fp);
+    if (fclose(fp) != 0) {
+        ret = ERROR_FILE;
+    }
+    if (ret == SUCCESS) {
+        chmod(temp_file, 0644);
+        if (rename(temp_file, path) != 0) {
+            ret = ERROR_FILE;
+        }
+    }
+    if (ret != SUCCESS) {
+        unlink(temp_file);
+    }
+    return ret;
+}
@@ -0,0 +1,365 @@
+#include "nfnl.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#define NFNL_RECV_BUF 65536
+#define NFNL_RECV_TIMEOUT_MS 5000   /* 等待内核应答的上限，避免应答丢失时永久阻塞 */
+
+#ifndef SO_SNDBUFFORCE
+#define SO_SNDBUFFORCE 32
+#endif
+
+static int nfnl_fd = -1;
+static uint32_t nfnl_seq = 0;
+
+int nfnl_open(void) {
+    if (nfnl_fd >= 0) {
+        return 0;
+    }
+
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    /* ACK只回传消息头，避免大批量出错时撑爆接收缓冲区 */
+    int one = 1;
+    setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+    struct timeval tv = { NFNL_RECV_TIMEOUT_MS / 1000, (NFNL_RECV_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    nfnl_fd = fd;
+    nfnl_seq = (uint32_t)time(NULL);
+    return 0;
+}
+
+void nfnl_close(void) {
+    if (nfnl_fd >= 0) {
+        close(nfnl_fd);
+        nfnl_fd = -1;
+    }
+}
+
+void nfnl_batch_init(nfnl_batch_t *b) {
+    memset(b, 0, sizeof(*b));
+}
+
+void nfnl_batch_free(nfnl_batch_t *b) {
+    free(b->buf);
+    memset(b, 0, sizeof(*b));
+}
+
+/* 预留空间，返回写入位置（已按NLA对齐清零） */
+static char* batch_reserve(nfnl_batch_t *b, size_t size) {
+    size_t aligned = NLA_ALIGN(size);
+    if (b->oom) {
+        return NULL;
+    }
+    if (b->len + aligned > b->cap) {
+        size_t new_cap = b->cap ? b->cap * 2 : 4096;
+        while (new_cap < b->len + aligned) new_cap *= 2;
+        char *p = realloc(b->buf, new_cap);
+        if (!p) {
+            b->oom = true;
+            return NULL;
+        }
+        b->buf = p;
+        b->cap = new_cap;
+    }
+    char *pos = b->buf + b->len;
+    memset(pos, 0, aligned);
+    b->len += aligned;
+    return pos;
+}
+
+void nfnl_msg_begin(nfnl_batch_t *b, uint16_t type, uint16_t flags, uint8_t family) {
+    size_t off = b->len;
+    char *pos = batch_reserve(b, NLMSG_HDRLEN + sizeof(struct nfgenmsg));
+    if (!pos) return;
+
+    struct nlmsghdr *nlh = (struct nlmsghdr *)pos;
+    nlh->nlmsg_type = (NFNL_SUBSYS_NFTABLES << 8) | type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    nlh->nlmsg_seq = ++nfnl_seq;
+
+    struct nfgenmsg *nfg = (struct nfgenmsg *)(pos + NLMSG_HDRLEN);
+    nfg->nfgen_family = family;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = 0;
+
+    b->msg_off = off;
+    b->nest_depth = 0;
+    if (flags & NLM_F_ACK) {
+        b->msg_count++;
+    }
+}
+
+void nfnl_msg_end(nfnl_batch_t *b) {
+    if (b->oom) return;
+    struct nlmsghdr *nlh = (struct nlmsghdr *)(b->buf + b->msg_off);
+    nlh->nlmsg_len = (uint32_t)(b->len - b->msg_off);
+}
+
+size_t nfnl_msg_len(const nfnl_batch_t *b) {
+    return b->len - b->msg_off;
+}
+
+void nfnl_put(nfnl_batch_t *b, uint16_t type, const void *data, size_t len) {
+    char *pos = batch_reserve(b, NLA_HDRLEN + len);
+    if (!pos) return;
+
+    struct nlattr *nla = (struct nlattr *)pos;
+    nla->nla_type = type;
+    nla->nla_len = (uint16_t)(NLA_HDRLEN + len);
+    if (len > 0) {
+        memcpy(pos + NLA_HDRLEN, data, len);
+    }
+}
+
+void nfnl_put_str(nfnl_batch_t *b, uint16_t type, const char *str) {
+    nfnl_put(b, type, str, strlen(str) + 1);
+}
+
+void nfnl_put_be32(nfnl_batch_t *b, uint16_t type, uint32_t value) {
+    uint32_t be = htonl(value);
+    nfnl_put(b, type, &be, sizeof(be));
+}
+
+void nfnl_put_be64(nfnl_batch_t *b, uint16_t type, uint64_t value) {
+    uint32_t be[2] = { htonl((uint32_t)(value >> 32)), htonl((uint32_t)value) };
+    nfnl_put(b, type, be, sizeof(be));
+}
+
+void nfnl_nest_begin(nfnl_batch_t *b, uint16_t type) {
+    size_t off = b->len;
+    char *pos = batch_reserve(b, NLA_HDRLEN);
+    if (!pos || b->nest_depth >= (int)ARRAY_SIZE(b->nest_off)) {
+        b->oom = true;
+        return;
+    }
+
+    struct nlattr *nla = (struct nlattr *)pos;
+    nla->nla_type = NLA_F_NESTED | type;
+    b->nest_off[b->nest_depth++] = off;
+}
+
+void nfnl_nest_end(nfnl_batch_t *b) {
+    if (b->oom || b->nest_depth == 0) return;
+    size_t off = b->nest_off[--b->nest_depth];
+    struct nlattr *nla = (struct nlattr *)(b->buf + off);
+    nla->nla_len = (uint16_t)(b->len - off);
+}
+
+/* 构造批处理边界消息 */
+static void fill_batch_marker(char *buf, uint16_t type) {
+    memset(buf, 0, NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_len = NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nfgenmsg));
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    nlh->nlmsg_seq = ++nfnl_seq;
+
+    struct nfgenmsg *nfg = (struct nfgenmsg *)(buf + NLMSG_HDRLEN);
+    nfg->nfgen_family = AF_UNSPEC;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(NFNL_SUBSYS_NFTABLES);
+}
+
+int nfnl_batch_commit(nfnl_batch_t *b) {
+    if (b->oom) {
+        return -ENOMEM;
+    }
+    if (b->len == 0) {
+        return 0;
+    }
+
+    int ret = nfnl_open();
+    if (ret < 0) {
+        return ret;
+    }
+
+    char begin[NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nfgenmsg))];
+    char end[NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nfgenmsg))];
+    fill_batch_marker(begin, NFNL_MSG_BATCH_BEGIN);
+    fill_batch_marker(end, NFNL_MSG_BATCH_END);
+
+    /* 整个批处理必须在一个skb内，大批量时扩大发送缓冲区 */
+    size_t total = sizeof(begin) + b->len + sizeof(end);
+    if (total > 212992) {
+        int sndbuf = (int)total;
+        if (setsockopt(nfnl_fd, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf)) < 0) {
+            setsockopt(nfnl_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        }
+    }
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+
+    struct iovec iov[3] = {
+        { begin, sizeof(begin) },
+        { b->buf, b->len },
+        { end, sizeof(end) }
+    };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = &kernel;
+    mh.msg_namelen = sizeof(kernel);
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 3;
+
+    if (sendmsg(nfnl_fd, &mh, 0) < 0) {
+        return -errno;
+    }
+
+    /* 收集ACK：出错后只读取已排队的剩余应答 */
+    static char rbuf[NFNL_RECV_BUF];
+    int acked = 0;
+    int first_err = 0;
+
+    /* 本批处理的序号范围（首条消息到BATCH_END），之前请求残留的应答不计入 */
+    uint32_t seq_lo = ((const struct nlmsghdr *)b->buf)->nlmsg_seq;
+    uint32_t seq_span = ((const struct nlmsghdr *)end)->nlmsg_seq - seq_lo;
+
+    while (acked < b->msg_count) {
+        ssize_t n = recv(nfnl_fd, rbuf, sizeof(rbuf), first_err ? MSG_DONTWAIT : 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* 阻塞等待超时：内核应答丢失，按失败处理 */
+                if (!first_err) first_err = -ETIMEDOUT;
+                break;
+            }
+            if (!first_err) first_err = -errno;
+            break;
+        }
+
+        int remain = (int)n;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)rbuf; NLMSG_OK(nlh, remain);
+             nlh = NLMSG_NEXT(nlh, remain)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR) continue;
+            if (nlh->nlmsg_seq - seq_lo > seq_span) continue;
+
+            struct nlmsgerr *e = (struct nlmsgerr *)NLMSG_DATA(nlh);
+            if (e->error < 0 && !first_err) {
+                first_err = e->error;
+            }
+            acked++;
+        }
+    }
+
+    return first_err;
+}
+
+int nfnl_dump(nfnl_batch_t *req, nfnl_dump_fn fn, void *ctx) {
+    if (req->oom) {
+        return -ENOMEM;
+    }
+    if (req->len == 0) {
+        return -EINVAL;
+    }
+
+    int ret = nfnl_open();
+    if (ret < 0) {
+        return ret;
+    }
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    if (sendto(nfnl_fd, req->buf, req->len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+        return -errno;
+    }
+
+    /* 跳过之前批处理出错后残留的ACK，只处理本次请求的应答 */
+    uint32_t seq = ((const struct nlmsghdr *)req->buf)->nlmsg_seq;
+    static char rbuf[NFNL_RECV_BUF];
+    bool stopped = false;
+    int err = 0;
+
+    for (;;) {
+        ssize_t n = recv(nfnl_fd, rbuf, sizeof(rbuf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return -ETIMEDOUT;
+            return -errno;
+        }
+
+        int remain = (int)n;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)rbuf; NLMSG_OK(nlh, remain);
+             nlh = NLMSG_NEXT(nlh, remain)) {
+            if (nlh->nlmsg_seq != seq) continue;
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                return err;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *e = (const struct nlmsgerr *)NLMSG_DATA(nlh);
+                if (e->error < 0) {
+                    return e->error;
+                }
+                continue;
+            }
+            /* 回调要求停止后继续读完，避免残留应答干扰下一次请求 */
+            size_t hdr = NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nfgenmsg));
+            if (!stopped && nlh->nlmsg_len >= hdr) {
+                stopped = fn((const char *)nlh + hdr, nlh->nlmsg_len - hdr, ctx) != 0;
+            }
+        }
+    }
+}
+
+bool nfnl_attr_next(const void **pos, size_t *remain, nfnl_attr_t *attr) {
+    if (*remain < NLA_HDRLEN) {
+        return false;
+    }
+    const struct nlattr *nla = (const struct nlattr *)*pos;
+    if (nla->nla_len < NLA_HDRLEN || nla->nla_len > *remain) {
+        return false;
+    }
+
+    attr->type = nla->nla_type & NLA_TYPE_MASK;
+    attr->len = (uint16_t)(nla->nla_len - NLA_HDRLEN);
+    attr->data = (const char *)nla + NLA_HDRLEN;
+
+    size_t step = NLA_ALIGN(nla->nla_len);
+    if (step > *remain) step = *remain;
+    *pos = (const char *)*pos + step;
+    *remain -= step;
+    return true;
+}
+
+uint32_t nfnl_attr_be32(const nfnl_attr_t *attr) {
+    uint32_t value = 0;
+    if (attr->len >= sizeof(value)) {
+        memcpy(&value, attr->data, sizeof(value));
+    }
+    return ntohl(value);
+}
+
+uint64_t nfnl_attr_be64(const nfnl_attr_t *attr) {
+    uint64_t value = 0;
+    if (attr->len >= sizeof(value)) {
+        const uint8_t *p = attr->data;
+        for (int i = 0; i < 8; i++) {
+            value = (value << 8) | p[i];
+        }
+    }
+    return value;
+}
@@ -0,0 +1,279 @@
+#include "nftables.h"
+#include "log.h"
+#include <errno.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+/* 每条 add/delete element 命令携带的元素数 */
+#define CLI_ELEMS_PER_CMD 512
+
+/* 区间元素文本（a-b形式最长） */
+#define CLI_ELEM_LEN (2 * INET6_ADDRSTRLEN)
+
+static bool cli_available(void) {
+    return access("/usr/sbin/nft", X_OK) == 0 || access("/sbin/nft", X_OK) == 0;
+}
+
+/* 用 nft -f 加载脚本文件，按输出把失败原因映射为 -errno */
+static int run_nft_file(const char *path) {
+    char command[MAX_COMMAND_LEN];
+    snprintf(command, sizeof(command), "nft -f %s 2>&1", path);
+    FILE *fp = popen(command, "r");
+    if (!fp) {
+        return -errno;
+    }
+
+    char output[MAX_LINE_LEN] = {0};
+    char line[MAX_LINE_LEN];
+    while (fgets(line, sizeof(line), fp)) {
+        if (output[0] == '\0') {
+            line[strcspn(line, "\r\n")] = '\0';
+            snprintf(output, sizeof(output), "%s", line);
+        }
+    }
+    int status = pclose(fp);
+    if (status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        return 0;
+    }
+
+    log_write("[nftables] nft -f %s 失败: %s", path, output);
+    if (strstr(output, "No such file or directory")) {
+        return -ENOENT;
+    }
+    if (strstr(output, "Operation not permitted")) {
+        return -EPERM;
+    }
+    if (strstr(output, "File exists")) {
+        return -EEXIST;
+    }
+    return -EINVAL;
+}
+
+static int cli_init_ruleset(bool recreate) {
+    int ret = nft_write_ruleset_file(recreate);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    if (run_nft_file(NFT_RULESET_FILE) != 0) {
+        log_write("[nftables] 规则集加载失败: %s", NFT_RULESET_FILE);
+        return ERROR_FILE;
+    }
+    return SUCCESS;
+}
+
+/* 毫秒格式化为nft时间（如 1d2h30m），nft不接受超大的单一单位数值 */
+static void format_timeout(uint64_t ms, char *buf, size_t size) {
+    static const struct { uint64_t unit; const char *suffix; } units[] = {
+        {86400000, "d"}, {3600000, "h"}, {60000, "m"}, {1000, "s"}, {1, "ms"},
+    };
+    size_t len = 0;
+    buf[0] = '\0';
+    for (size_t i = 0; i < ARRAY_SIZE(units) && len < size; i++) {
+        uint64_t n = ms / units[i].unit;
+        ms %= units[i].unit;
+        if (n > 0) {
+            len += (size_t)snprintf(buf + len, size - len, "%llu%s", (unsigned long long)n, units[i].suffix);
+        }
+    }
+}
+
+/* 元素按命令分组写入脚本：verb element 表 集合 { e1 timeout X, e2, ... } */
+static void put_element_cmds(nft_batch_t *b, const char *verb, const char *set_name,
+                             const nft_interval_t *const *ivs, const uint64_t *timeouts_ms,
+                             size_t count, uint64_t timeout_ms) {
+    FILE *fp = nft_batch_stream(b);
+    if (!fp) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (i % CLI_ELEMS_PER_CMD == 0) {
+            fprintf(fp, "%s%s element %s %s { ", i ? " }\n" : "", verb, NFT_TABLE, set_name);
+        } else {
+            fputs(", ", fp);
+        }
+        char elem[CLI_ELEM_LEN];
+        nft_format_interval(ivs[i], elem, sizeof(elem));
+        fputs(elem, fp);
+
+        uint64_t timeout = timeouts_ms ? timeouts_ms[i] : timeout_ms;
+        if (timeout > 0) {
+            char text[64];
+            format_timeout(timeout, text, sizeof(text));
+            fprintf(fp, " timeout %s", text);
+        }
+    }
+    fputs(" }\n", fp);
+}
+
+static void cli_put_elements(nft_batch_t *b, const char *set_name, const nft_interval_t *const *ivs,
+                             const uint64_t *timeouts_ms, size_t count, uint64_t timeout_ms) {
+    put_element_cmds(b, "add", set_name, ivs, timeouts_ms, count, timeout_ms);
+}
+
+static void cli_del_elements(nft_batch_t *b, const char *set_name,
+                             const nft_interval_t *const *ivs, size_t count) {
+    put_element_cmds(b, "delete", set_name, ivs, NULL, count, 0);
+}
+
+static void cli_flush_set(nft_batch_t *b, const char *set_name) {
+    FILE *fp = nft_batch_stream(b);
+    if (fp) {
+        fprintf(fp, "flush set %s %s\n", NFT_TABLE, set_name);
+    }
+}
+
+/* 脚本写入临时文件后由一次 nft -f 加载，nft保证整个文件在一个事务中生效 */
+static int cli_commit(nft_batch_t *b) {
+    const char *text;
+    size_t len = nft_batch_script(b, &text);
+    if (len == 0) {
+        return b->ops > 0 ? -ENOMEM : 0;
+    }
+
+    mkdir(CONFIG_DIR, 0700);
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/nft-batch.XXXXXX", CONFIG_DIR);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -errno;
+    }
+    FILE *fp = fdopen(fd, "w");
+    if (!fp) {
+        int err = errno;
+        close(fd);
+        unlink(path);
+        return -err;
+    }
+    size_t written = fwrite(text, 1, len, fp);
+    if (fclose(fp) != 0 || written != len) {
+        unlink(path);
+        return -EIO;
+    }
+
+    int ret = run_nft_file(path);
+    unlink(path);
+    return ret;
+}
+
+/* 解析一个元素：地址或区间，后跟可选的 timeout/expires 等属性 */
+static bool parse_element(char *item, nft_element_t *elem) {
+    memset(elem, 0, sizeof(*elem));
+    char *save = NULL;
+    char *tok = strtok_r(item, " \t\r\n", &save);
+    if (!tok || nft_parse_interval(tok, &elem->iv) != SUCCESS) {
+        return false;
+    }
+    while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        bool is_timeout = strcmp(tok, "timeout") == 0;
+        if (!is_timeout && strcmp(tok, "expires") != 0) {
+            continue;
+        }
+        char *value = strtok_r(NULL, " \t\r\n", &save);
+        long long ms = value ? parse_duration_ms(value) : -1;
+        if (ms > 0) {
+            if (is_timeout) {
+                elem->timeout_ms = (uint64_t)ms;
+            } else {
+                elem->expires_ms = (uint64_t)ms;
+            }
+        }
+    }
+    return true;
+}
+
+/* 解析 nft list set 的 elements = { ... } 部分，元素以逗号分隔并可跨行 */
+static int cli_dump_set(const char *set_name, nft_element_fn fn, void *ctx) {
+    char command[MAX_COMMAND_LEN];
+    snprintf(command, sizeof(command), "nft list set %s %s 2>/dev/null", NFT_TABLE, set_name);
+    FILE *fp = popen(command, "r");
+    if (!fp) {
+        return ERROR_NETWORK;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    bool inside = false;
+    bool stopped = false;
+    while (getline(&line, &cap, fp) > 0) {
+        char *p = line;
+        if (!inside) {
+            char *start = strstr(p, "elements = {");
+            if (!start) continue;
+            p = start + strlen("elements = {");
+            inside = true;
+        }
+        char *end = strchr(p, '}');
+        if (end) {
+            *end = '\0';
+            inside = false;
+        }
+
+        char *save = NULL;
+        for (char *item = strtok_r(p, ",", &save); item && !stopped; item = strtok_r(NULL, ",", &save)) {
+            nft_element_t elem;
+            if (parse_element(item, &elem) && fn(&elem, ctx) != 0) {
+                stopped = true;
+            }
+        }
+    }
+    free(line);
+
+    int status = pclose(fp);
+    if (!stopped && (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        return ERROR_NETWORK;
+    }
+    return SUCCESS;
+}
+
+/* 解析 nft list chain 的规则行：... counter packets N bytes M ... comment "名称" */
+static int cli_dump_counters(nft_counter_fn fn, void *ctx) {
+    char command[MAX_COMMAND_LEN];
+    snprintf(command, sizeof(command), "nft list chain %s input 2>/dev/null", NFT_TABLE);
+    FILE *fp = popen(command, "r");
+    if (!fp) {
+        return ERROR_NETWORK;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    bool stopped = false;
+    while (!stopped && getline(&line, &cap, fp) > 0) {
+        const char *c = strstr(line, "counter packets ");
+        const char *q = strstr(line, "comment \"");
+        unsigned long long packets, bytes;
+        if (!c || !q || sscanf(c, "counter packets %llu bytes %llu", &packets, &bytes) != 2) {
+            continue;
+        }
+
+        nft_rule_counter_t counter;
+        memset(&counter, 0, sizeof(counter));
+        q += strlen("comment \"");
+        size_t len = strcspn(q, "\"");
+        if (len >= sizeof(counter.comment)) len = sizeof(counter.comment) - 1;
+        memcpy(counter.comment, q, len);
+        counter.packets = packets;
+        counter.bytes = bytes;
+        if (fn(&counter, ctx) != 0) {
+            stopped = true;
+        }
+    }
+    free(line);
+
+    int status = pclose(fp);
+    if (!stopped && (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        return ERROR_NETWORK;
+    }
+    return SUCCESS;
+}
+
+const nft_backend_t nft_cli_backend = {
+    .name = "cli",
+    .available = cli_available,
+    .init_ruleset = cli_init_ruleset,
+    .put_elements = cli_put_elements,
+    .del_elements = cli_del_elements,
+    .flush_set = cli_flush_set,
+    .commit = cli_commit,
+    .dump_set = cli_dump_set,
+    .dump_counters = cli_dump_counters,
+};
@@ -0,0 +1,313 @@
+#include "nftables.h"
+#include "nfnl.h"
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+
+/* 单条NEWSETELEM消息的元素列表上限（嵌套属性长度不能超过64KB） */
+#define NFT_ELEM_MSG_MAX 32768
+
+/* dump状态：区间的起始和结束元素相邻（内核按降序输出，结束元素在前），配对后回调 */
+typedef struct {
+    nft_element_fn fn;
+    void *ctx;
+    bool interval;          /* 限速集合为普通哈希集合，每个元素是单个地址 */
+    nft_element_t pending;
+    bool has_pending;
+    bool pending_end;       /* pending是结束元素 */
+    bool stopped;
+} dump_state_t;
+
+static void dump_emit(dump_state_t *st, const nft_element_t *elem) {
+    if (!st->stopped && st->fn(elem, st->ctx) != 0) {
+        st->stopped = true;
+    }
+}
+
+/* 处理pending：起始元素没有配对的结束元素时区间延伸到地址空间末尾，孤立的结束元素丢弃 */
+static void dump_flush(dump_state_t *st) {
+    if (st->has_pending && !st->pending_end) {
+        st->pending.iv.has_end = false;
+        dump_emit(st, &st->pending);
+    }
+    st->has_pending = false;
+}
+
+static void dump_element(dump_state_t *st, const nft_element_t *elem, bool is_end) {
+    if (!st->interval) {
+        nft_element_t host = *elem;
+        ip_addr_t addr;
+        nft_interval_to_addr(&elem->iv, &addr);
+        addr.prefixlen = (addr.family == AF_INET) ? 32 : 128;
+        nft_interval_from_addr(&addr, &host.iv);
+        dump_emit(st, &host);
+        return;
+    }
+    if (st->has_pending && st->pending_end != is_end) {
+        const nft_element_t *start = is_end ? &st->pending : elem;
+        const nft_element_t *end = is_end ? elem : &st->pending;
+        if (start->iv.klen == end->iv.klen && memcmp(end->iv.start, start->iv.start, start->iv.klen) > 0) {
+            nft_element_t pair = *start;
+            memcpy(pair.iv.end, end->iv.start, start->iv.klen);
+            pair.iv.has_end = true;
+            st->has_pending = false;
+            dump_emit(st, &pair);
+            return;
+        }
+    }
+    dump_flush(st);
+    st->pending = *elem;
+    st->pending_end = is_end;
+    st->has_pending = true;
+}
+
+static int dump_set_msg(const void *data, size_t len, void *arg) {
+    dump_state_t *st = arg;
+    nfnl_attr_t list;
+    while (nfnl_attr_next(&data, &len, &list)) {
+        if (list.type != NFTA_SET_ELEM_LIST_ELEMENTS) continue;
+        
+        const void *lp = list.data;
+        size_t lrem = list.len;
+        nfnl_attr_t item;
+        while (nfnl_attr_next(&lp, &lrem, &item)) {
+            if (item.type != NFTA_LIST_ELEM) continue;
+            
+            nft_element_t elem;
+            memset(&elem, 0, sizeof(elem));
+            bool is_end = false;
+            const void *ep = item.data;
+            size_t erem = item.len;
+            nfnl_attr_t a;
+            while (nfnl_attr_next(&ep, &erem, &a)) {
+                if (a.type == NFTA_SET_ELEM_KEY) {
+                    const void *kp = a.data;
+                    size_t krem = a.len;
+                    nfnl_attr_t key;
+                    while (nfnl_attr_next(&kp, &krem, &key)) {
+                        if (key.type == NFTA_DATA_VALUE && (key.len == 4 || key.len == 16)) {
+                            memcpy(elem.iv.start, key.data, key.len);
+                            elem.iv.klen = (uint8_t)key.len;
+                        }
+                    }
+                } else if (a.type == NFTA_SET_ELEM_FLAGS) {
+                    is_end = (nfnl_attr_be32(&a) & NFT_SET_ELEM_INTERVAL_END) != 0;
+                } else if (a.type == NFTA_SET_ELEM_TIMEOUT) {
+                    elem.timeout_ms = nfnl_attr_be64(&a);
+                } else if (a.type == NFTA_SET_ELEM_EXPIRATION) {
+                    elem.expires_ms = nfnl_attr_be64(&a);
+                }
+            }
+            if (elem.iv.klen != 0) {
+                dump_element(st, &elem, is_end);
+            }
+        }
+    }
+    return st->stopped;
+}
+
+static int native_dump_set(const char *set_name, nft_element_fn fn, void *ctx) {
+    nfnl_batch_t req;
+    nfnl_batch_init(&req);
+    nfnl_msg_begin(&req, NFT_MSG_GETSETELEM, NLM_F_DUMP, NFPROTO_INET);
+    nfnl_put_str(&req, NFTA_SET_ELEM_LIST_TABLE, NFT_TABLE_NAME);
+    nfnl_put_str(&req, NFTA_SET_ELEM_LIST_SET, set_name);
+    nfnl_msg_end(&req);
+    
+    dump_state_t st;
+    memset(&st, 0, sizeof(st));
+    st.fn = fn;
+    st.ctx = ctx;
+    st.interval = strcmp(set_name, NFT_RATELIMIT) != 0 && strcmp(set_name, NFT_RATELIMIT_V6) != 0;
+    int ret = nfnl_dump(&req, dump_set_msg, &st);
+    nfnl_batch_free(&req);
+    if (ret < 0) {
+        return ERROR_NETWORK;
+    }
+    dump_flush(&st);
+    return SUCCESS;
+}
+
+/* 规则注释保存在userdata中：类型(1字节) 长度(1字节) 值，注释类型为0 */
+#define NFT_UDATA_RULE_COMMENT 0
+
+typedef struct {
+    nft_counter_fn fn;
+    void *ctx;
+    bool stopped;
+} counter_state_t;
+
+static void parse_rule_comment(const nfnl_attr_t *udata, char *comment, size_t size) {
+    const uint8_t *p = udata->data;
+    size_t remain = udata->len;
+    while (remain >= 2 && (size_t)p[1] + 2 <= remain) {
+        if (p[0] == NFT_UDATA_RULE_COMMENT) {
+            size_t len = strnlen((const char *)p + 2, p[1]);
+            if (len >= size) len = size - 1;
+            memcpy(comment, p + 2, len);
+            comment[len] = '\0';
+            return;
+        }
+        remain -= (size_t)p[1] + 2;
+        p += (size_t)p[1] + 2;
+    }
+}
+
+/* 在规则的表达式列表中查找counter表达式 */
+static bool parse_rule_counter(const nfnl_attr_t *exprs, nft_rule_counter_t *counter) {
+    const void *lp = exprs->data;
+    size_t lrem = exprs->len;
+    nfnl_attr_t item;
+    while (nfnl_attr_next(&lp, &lrem, &item)) {
+        if (item.type != NFTA_LIST_ELEM) continue;
+        
+        const void *ep = item.data;
+        size_t erem = item.len;
+        nfnl_attr_t a;
+        bool is_counter = false;
+        nfnl_attr_t data = {0, 0, NULL};
+        while (nfnl_attr_next(&ep, &erem, &a)) {
+            if (a.type == NFTA_EXPR_NAME) {
+                is_counter = strncmp(a.data, "counter", a.len) == 0;
+            } else if (a.type == NFTA_EXPR_DATA) {
+                data = a;
+            }
+        }
+        if (!is_counter || !data.data) continue;
+        
+        const void *cp = data.data;
+        size_t crem = data.len;
+        while (nfnl_attr_next(&cp, &crem, &a)) {
+            if (a.type == NFTA_COUNTER_PACKETS) {
+                counter->packets = nfnl_attr_be64(&a);
+            } else if (a.type == NFTA_COUNTER_BYTES) {
+                counter->bytes = nfnl_attr_be64(&a);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+static int dump_rule_msg(const void *data, size_t len, void *arg) {
+    counter_state_t *st = arg;
+    nft_rule_counter_t counter;
+    memset(&counter, 0, sizeof(counter));
+    bool has_counter = false;
+    
+    nfnl_attr_t a;
+    while (nfnl_attr_next(&data, &len, &a)) {
+        if (a.type == NFTA_RULE_USERDATA) {
+            parse_rule_comment(&a, counter.comment, sizeof(counter.comment));
+        } else if (a.type == NFTA_RULE_EXPRESSIONS) {
+            has_counter = parse_rule_counter(&a, &counter);
+        }
+    }
+    if (has_counter && counter.comment[0] && st->fn(&counter, st->ctx) != 0) {
+        st->stopped = true;
+    }
+    return st->stopped;
+}
+
+static int native_dump_counters(nft_counter_fn fn, void *ctx) {
+    nfnl_batch_t req;
+    nfnl_batch_init(&req);
+    nfnl_msg_begin(&req, NFT_MSG_GETRULE, NLM_F_DUMP, NFPROTO_INET);
+    nfnl_put_str(&req, NFTA_RULE_TABLE, NFT_TABLE_NAME);
+    nfnl_put_str(&req, NFTA_RULE_CHAIN, "input");
+    nfnl_msg_end(&req);
+    
+    counter_state_t st = { fn, ctx, false };
+    int ret = nfnl_dump(&req, dump_rule_msg, &st);
+    nfnl_batch_free(&req);
+    return ret < 0 ? ERROR_NETWORK : SUCCESS;
+}
+
+/* 写入一个区间元素（起始元素带超时，结束元素带INTERVAL_END标志） */
+static void put_interval(nfnl_batch_t *b, const nft_interval_t *iv, uint64_t timeout_ms) {
+    nfnl_nest_begin(b, NFTA_LIST_ELEM);
+    nfnl_nest_begin(b, NFTA_SET_ELEM_KEY);
+    nfnl_put(b, NFTA_DATA_VALUE, iv->start, iv->klen);
+    nfnl_nest_end(b);
+    if (timeout_ms > 0) {
+        nfnl_put_be64(b, NFTA_SET_ELEM_TIMEOUT, timeout_ms);
+    }
+    nfnl_nest_end(b);
+    
+    if (iv->has_end) {
+        nfnl_nest_begin(b, NFTA_LIST_ELEM);
+        nfnl_nest_begin(b, NFTA_SET_ELEM_KEY);
+        nfnl_put(b, NFTA_DATA_VALUE, iv->end, iv->klen);
+        nfnl_nest_end(b);
+        nfnl_put_be32(b, NFTA_SET_ELEM_FLAGS, NFT_SET_ELEM_INTERVAL_END);
+        nfnl_nest_end(b);
+    }
+}
+
+/* timeouts不为NULL时逐个元素指定超时，否则统一使用timeout_ms */
+static void put_element_msgs(nfnl_batch_t *b, uint16_t msg_type, const char *set_name,
+                             const nft_interval_t *const *ivs, const uint64_t *timeouts,
+                             size_t count, uint64_t timeout_ms) {
+    uint16_t flags = NLM_F_ACK;
+    if (msg_type == NFT_MSG_NEWSETELEM) {
+        flags |= NLM_F_CREATE;
+    }
+    size_t i = 0;
+    
+    /* 属性长度为16位，元素列表按消息拆分 */
+    while (i < count) {
+        nfnl_msg_begin(b, msg_type, flags, NFPROTO_INET);
+        nfnl_put_str(b, NFTA_SET_ELEM_LIST_TABLE, NFT_TABLE_NAME);
+        nfnl_put_str(b, NFTA_SET_ELEM_LIST_SET, set_name);
+        nfnl_nest_begin(b, NFTA_SET_ELEM_LIST_ELEMENTS);
+        while (i < count && nfnl_msg_len(b) < NFT_ELEM_MSG_MAX) {
+            put_interval(b, ivs[i], timeouts ? timeouts[i] : timeout_ms);
+            i++;
+        }
+        nfnl_nest_end(b);
+        nfnl_msg_end(b);
+    }
+}
+
+static void native_put_elements(nft_batch_t *b, const char *set_name, const nft_interval_t *const *ivs,
+                                const uint64_t *timeouts_ms, size_t count, uint64_t timeout_ms) {
+    put_element_msgs(&b->nl, NFT_MSG_NEWSETELEM, set_name, ivs, timeouts_ms, count, timeout_ms);
+}
+
+static void native_del_elements(nft_batch_t *b, const char *set_name,
+                                const nft_interval_t *const *ivs, size_t count) {
+    put_element_msgs(&b->nl, NFT_MSG_DELSETELEM, set_name, ivs, NULL, count, 0);
+}
+
+static void native_flush_set(nft_batch_t *b, const char *set_name) {
+    /* 不带元素列表的DELSETELEM清空整个集合 */
+    nfnl_msg_begin(&b->nl, NFT_MSG_DELSETELEM, NLM_F_ACK, NFPROTO_INET);
+    nfnl_put_str(&b->nl, NFTA_SET_ELEM_LIST_TABLE, NFT_TABLE_NAME);
+    nfnl_put_str(&b->nl, NFTA_SET_ELEM_LIST_SET, set_name);
+    nfnl_msg_end(&b->nl);
+}
+
+static int native_commit(nft_batch_t *b) {
+    return nfnl_batch_commit(&b->nl);
+}
+
+static bool native_available(void) {
+    return nfnl_open() >= 0;
+}
+
+/* 规则表达式未做netlink编码，规则集仍由 nft -f 在一个事务中加载 */
+static int native_init_ruleset(bool recreate) {
+    return nft_cli_backend.init_ruleset(recreate);
+}
+
+const nft_backend_t nft_native_backend = {
+    .name = "native",
+    .available = native_available,
+    .init_ruleset = native_init_ruleset,
+    .put_elements = native_put_elements,
+    .del_elements = native_del_elements,
+    .flush_set = native_flush_set,
+    .commit = native_commit,
+    .dump_set = native_dump_set,
+    .dump_counters = native_dump_counters,
+};
@@ -0,0 +1,432 @@
+#include "nftables.h"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+/*
+ * 记录后端：不访问内核，每次提交以一次 O_APPEND 写入追加到 FIREWALL_RECORD_FILE，
+ * 并发进程的记录不会交错。格式（每行一条）：
+ *   commit <提交时间ms>
+ *   add <集合> <元素> <超时ms>
+ *   del <集合> <元素> 0
+ *   flush <集合>
+ *   init|reset <时间ms>        加载规则集（init保留集合元素，reset清空全部集合）
+ * 读取集合时按记录重放，超时按提交时间和当前时间模拟。
+ * 提交时按同样的重放检查删除操作，删除不存在的元素返回 -ENOENT（与内核一致），不写入记录
+ */
+
+#define RECORD_ELEM_LEN (2 * INET6_ADDRSTRLEN)
+
+/* 重放用的单条元素操作 */
+typedef struct {
+    nft_interval_t iv;
+    uint64_t timeout_ms;
+    uint64_t time_ms;       /* 所在提交的时间 */
+    size_t seq;             /* 记录中的顺序 */
+    bool add;
+} record_op_t;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static bool record_available(void) {
+    return true;
+}
+
+/* 一次write追加，O_APPEND保证多进程的整块记录互不交错 */
+static int append_record(const char *head, const char *text, size_t len) {
+    mkdir(CONFIG_DIR, 0700);
+    size_t head_len = strlen(head);
+    char *buf = malloc(head_len + len);
+    if (!buf) {
+        return -ENOMEM;
+    }
+    memcpy(buf, head, head_len);
+    memcpy(buf + head_len, text, len);
+
+    int ret = 0;
+    int fd = open(FIREWALL_RECORD_FILE, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        ret = -errno;
+    } else {
+        ssize_t n = write(fd, buf, head_len + len);
+        if (n < 0) {
+            ret = -errno;
+        } else if ((size_t)n != head_len + len) {
+            ret = -EIO;
+        }
+        close(fd);
+    }
+    free(buf);
+    return ret;
+}
+
+/* 规则集文件照常生成，便于检查配置是否能生成有效规则 */
+static int record_init_ruleset(bool recreate) {
+    int ret = nft_write_ruleset_file(recreate);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    char head[64];
+    snprintf(head, sizeof(head), "%s %llu\n", recreate ? "reset" : "init", (unsigned long long)now_ms());
+    return append_record(head, "", 0) == 0 ? SUCCESS : ERROR_FILE;
+}
+
+static void put_record_ops(nft_batch_t *b, const char *op, const char *set_name,
+                           const nft_interval_t *const *ivs, const uint64_t *timeouts_ms,
+                           size_t count, uint64_t timeout_ms) {
+    FILE *fp = nft_batch_stream(b);
+    if (!fp) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        char elem[RECORD_ELEM_LEN];
+        nft_format_interval(ivs[i], elem, sizeof(elem));
+        fprintf(fp, "%s %s %s %llu\n", op, set_name, elem,
+                (unsigned long long)(timeouts_ms ? timeouts_ms[i] : timeout_ms));
+    }
+}
+
+static void record_put_elements(nft_batch_t *b, const char *set_name, const nft_interval_t *const *ivs,
+                                const uint64_t *timeouts_ms, size_t count, uint64_t timeout_ms) {
+    put_record_ops(b, "add", set_name, ivs, timeouts_ms, count, timeout_ms);
+}
+
+static void record_del_elements(nft_batch_t *b, const char *set_name,
+                                const nft_interval_t *const *ivs, size_t count) {
+    put_record_ops(b, "del", set_name, ivs, NULL, count, 0);
+}
+
+static void record_flush_set(nft_batch_t *b, const char *set_name) {
+    FILE *fp = nft_batch_stream(b);
+    if (fp) {
+        fprintf(fp, "flush %s\n", set_name);
+    }
+}
+
+static int compare_intervals(const nft_interval_t *x, const nft_interval_t *y) {
+    if (x->klen != y->klen) {
+        return x->klen < y->klen ? -1 : 1;
+    }
+    int c = memcmp(x->start, y->start, x->klen);
+    if (c == 0) c = (int)x->has_end - (int)y->has_end;
+    if (c == 0) c = memcmp(x->end, y->end, x->klen);
+    return c;
+}
+
+/* 按区间排序，同一区间内保持记录顺序 */
+static int compare_ops(const void *a, const void *b) {
+    const record_op_t *x = a;
+    const record_op_t *y = b;
+    int c = compare_intervals(&x->iv, &y->iv);
+    if (c == 0) c = (x->seq > y->seq) - (x->seq < y->seq);
+    return c;
+}
+
+/* 读取记录中该集合最近一次清空之后的元素操作 */
+static int load_ops(const char *set_name, record_op_t **out, size_t *count) {
+    *out = NULL;
+    *count = 0;
+    FILE *fp = fopen(FIREWALL_RECORD_FILE, "r");
+    if (!fp) {
+        return errno == ENOENT ? SUCCESS : ERROR_FILE;
+    }
+
+    record_op_t *ops = NULL;
+    size_t n = 0, cap = 0, seq = 0;
+    uint64_t commit_ms = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    int ret = SUCCESS;
+
+    while ((len = getline(&line, &line_cap, fp)) > 0) {
+        /* 并发写入中的最后一行可能不完整 */
+        if (line[len - 1] != '\n') break;
+
+        char op[16], set[64], elem[128];
+        unsigned long long value = 0;
+        int fields = sscanf(line, "%15s %63s %127s %llu", op, set, elem, &value);
+        if (fields < 2) continue;
+
+        if (strcmp(op, "commit") == 0) {
+            commit_ms = strtoull(set, NULL, 10);
+        } else if (strcmp(op, "reset") == 0) {
+            n = 0;
+        } else if (strcmp(op, "flush") == 0) {
+            if (strcmp(set, set_name) == 0) n = 0;
+        } else if (fields == 4 && strcmp(set, set_name) == 0 &&
+                   (strcmp(op, "add") == 0 || strcmp(op, "del") == 0)) {
+            if (n == cap) {
+                size_t new_cap = cap ? cap * 2 : 256;
+                record_op_t *grown = realloc(ops, new_cap * sizeof(*ops));
+                if (!grown) {
+                    ret = ERROR_FILE;
+                    break;
+                }
+                ops = grown;
+                cap = new_cap;
+            }
+            record_op_t *r = &ops[n];
+            if (nft_parse_interval(elem, &r->iv) != SUCCESS) continue;
+            r->add = op[0] == 'a';
+            r->timeout_ms = r->add ? value : 0;
+            r->time_ms = commit_ms;
+            r->seq = seq++;
+            n++;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (ret != SUCCESS) {
+        free(ops);
+        return ret;
+    }
+    *out = ops;
+    *count = n;
+    return SUCCESS;
+}
+
+/*
+ * 重放 ops[i] 开始的同一区间的操作，返回下一个区间的下标。
+ * 元素存在（且未超时）时重复添加不刷新超时，与内核行为一致
+ */
+static size_t replay_group(const record_op_t *ops, size_t i, size_t count, uint64_t now,
+                           bool *live, uint64_t *timeout, uint64_t *expires_at) {
+    size_t j = i;
+    bool present = false;
+    *timeout = 0;
+    *expires_at = 0;
+    for (; j < count && compare_intervals(&ops[i].iv, &ops[j].iv) == 0; j++) {
+        const record_op_t *r = &ops[j];
+        if (!r->add) {
+            present = false;
+        } else if (!present || (*expires_at != 0 && *expires_at <= r->time_ms)) {
+            present = true;
+            *timeout = r->timeout_ms;
+            *expires_at = *timeout ? r->time_ms + *timeout : 0;
+        }
+    }
+    *live = present && (*expires_at == 0 || *expires_at > now);
+    return j;
+}
+
+static int record_dump_set(const char *set_name, nft_element_fn fn, void *ctx) {
+    record_op_t *ops;
+    size_t count;
+    if (load_ops(set_name, &ops, &count) != SUCCESS) {
+        return ERROR_NETWORK;
+    }
+    qsort(ops, count, sizeof(*ops), compare_ops);
+
+    uint64_t now = now_ms();
+    size_t i = 0;
+    while (i < count) {
+        bool live;
+        uint64_t timeout, expires_at;
+        size_t j = replay_group(ops, i, count, now, &live, &timeout, &expires_at);
+        if (live) {
+            nft_element_t elem;
+            memset(&elem, 0, sizeof(elem));
+            elem.iv = ops[i].iv;
+            elem.timeout_ms = timeout;
+            elem.expires_ms = expires_at ? expires_at - now : 0;
+            if (fn(&elem, ctx) != 0) {
+                break;
+            }
+        }
+        i = j;
+    }
+    free(ops);
+    return SUCCESS;
+}
+
+/* 提交前检查删除的元素是否存在：按记录重放的集合状态，加上本批次中之前的操作 */
+typedef struct {
+    char set[64];
+    record_op_t *ops;       /* 已排序的记录操作 */
+    size_t count;
+} check_set_t;
+
+typedef struct {
+    char set[64];
+    nft_interval_t iv;
+    bool present;
+} check_elem_t;
+
+static int compare_op_interval(const void *key, const void *elem) {
+    return compare_intervals(key, &((const record_op_t *)elem)->iv);
+}
+
+static bool journal_live(check_set_t *sets, size_t *n_sets, size_t max_sets,
+                         const char *set_name, const nft_interval_t *iv, uint64_t now) {
+    check_set_t *cs = NULL;
+    for (size_t i = 0; i < *n_sets && !cs; i++) {
+        if (strcmp(sets[i].set, set_name) == 0) cs = &sets[i];
+    }
+    if (!cs) {
+        if (*n_sets == max_sets) return true;   /* 集合过多时不检查 */
+        cs = &sets[(*n_sets)++];
+        snprintf(cs->set, sizeof(cs->set), "%s", set_name);
+        if (load_ops(set_name, &cs->ops, &cs->count) != SUCCESS) {
+            cs->ops = NULL;
+            cs->count = 0;
+        }
+        if (cs->count > 0) {
+            qsort(cs->ops, cs->count, sizeof(*cs->ops), compare_ops);
+        }
+    }
+
+    const record_op_t *hit = bsearch(iv, cs->ops, cs->count, sizeof(*cs->ops), compare_op_interval);
+    if (!hit) return false;
+    size_t i = (size_t)(hit - cs->ops);
+    while (i > 0 && compare_intervals(&cs->ops[i - 1].iv, iv) == 0) i--;
+
+    bool live;
+    uint64_t timeout, expires_at;
+    replay_group(cs->ops, i, cs->count, now, &live, &timeout, &expires_at);
+    return live;
+}
+
+/* 与内核一致：删除不存在的元素时整个事务失败，返回 -ENOENT */
+static int check_deletes(const char *text) {
+    if (strncmp(text, "del ", 4) != 0 && !strstr(text, "\ndel ")) {
+        return 0;
+    }
+
+    check_set_t sets[8];
+    size_t n_sets = 0;
+    check_elem_t *elems = NULL;
+    size_t n_elems = 0, cap = 0;
+    char flushed[8][64];
+    size_t n_flushed = 0;
+    uint64_t now = now_ms();
+    int ret = 0;
+
+    for (const char *line = text; *line && ret == 0; ) {
+        const char *nl = strchr(line, '\n');
+        size_t len = nl ? (size_t)(nl - line) : strlen(line);
+        char buf[256];
+        if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+        memcpy(buf, line, len);
+        buf[len] = '\0';
+        line = nl ? nl + 1 : line + len;
+
+        char op[16], set[64], elem[128];
+        int fields = sscanf(buf, "%15s %63s %127s", op, set, elem);
+        if (fields == 2 && strcmp(op, "flush") == 0) {
+            if (n_flushed < ARRAY_SIZE(flushed)) {
+                snprintf(flushed[n_flushed++], sizeof(flushed[0]), "%s", set);
+            }
+            for (size_t i = 0; i < n_elems; i++) {
+                if (strcmp(elems[i].set, set) == 0) elems[i].present = false;
+            }
+            continue;
+        }
+        nft_interval_t iv;
+        if (fields != 3 || (strcmp(op, "add") != 0 && strcmp(op, "del") != 0) ||
+            nft_parse_interval(elem, &iv) != SUCCESS) {
+            continue;
+        }
+
+        check_elem_t *e = NULL;
+        for (size_t i = 0; i < n_elems && !e; i++) {
+            if (strcmp(elems[i].set, set) == 0 && compare_intervals(&elems[i].iv, &iv) == 0) e = &elems[i];
+        }
+
+        bool present;
+        if (e) {
+            present = e->present;
+        } else {
+            bool was_flushed = false;
+            for (size_t i = 0; i < n_flushed; i++) {
+                if (strcmp(flushed[i], set) == 0) was_flushed = true;
+            }
+            present = !was_flushed && op[0] == 'd' &&
+                      journal_live(sets, &n_sets, ARRAY_SIZE(sets), set, &iv, now);
+            if (n_elems == cap) {
+                size_t new_cap = cap ? cap * 2 : 64;
+                check_elem_t *grown = realloc(elems, new_cap * sizeof(*elems));
+                if (!grown) {
+                    ret = -ENOMEM;
+                    break;
+                }
+                elems = grown;
+                cap = new_cap;
+            }
+            e = &elems[n_elems++];
+            snprintf(e->set, sizeof(e->set), "%s", set);
+            e->iv = iv;
+        }
+
+        if (op[0] == 'd' && !present) {
+            ret = -ENOENT;
+        }
+        e->present = op[0] == 'a';
+    }
+
+    for (size_t i = 0; i < n_sets; i++) {
+        free(sets[i].ops);
+    }
+    free(elems);
+    return ret;
+}
+
+static int record_commit(nft_batch_t *b) {
+    const char *text;
+    size_t len = nft_batch_script(b, &text);
+    if (len == 0) {
+        return b->ops > 0 ? -ENOMEM : 0;
+    }
+    int ret = check_deletes(text);
+    if (ret != 0) {
+        return ret;
+    }
+    char head[64];
+    snprintf(head, sizeof(head), "commit %llu\n", (unsigned long long)now_ms());
+    return append_record(head, text, len);
+}
+
+/* 没有数据包经过，按生成的规则集文件给出各规则的零计数 */
+static int record_dump_counters(nft_counter_fn fn, void *ctx) {
+    FILE *fp = fopen(NFT_RULESET_FILE, "r");
+    if (!fp) {
+        return SUCCESS;
+    }
+    char line[MAX_LINE_LEN];
+    while (fgets(line, sizeof(line), fp)) {
+        const char *q = strstr(line, "counter ");
+        if (q) q = strstr(q, "comment \"");
+        if (!q) continue;
+
+        nft_rule_counter_t counter;
+        memset(&counter, 0, sizeof(counter));
+        q += strlen("comment \"");
+        size_t len = strcspn(q, "\"");
+        if (len >= sizeof(counter.comment)) len = sizeof(counter.comment) - 1;
+        memcpy(counter.comment, q, len);
+        if (fn(&counter, ctx) != 0) {
+            break;
+        }
+    }
+    fclose(fp);
+    return SUCCESS;
+}
+
+const nft_backend_t nft_record_backend = {
+    .name = "record",
+    .available = record_available,
+    .init_ruleset = record_init_ruleset,
+    .put_elements = record_put_elements,
+    .del_elements = record_del_elements,
+    .flush_set = record_flush_set,
+    .commit = record_commit,
+    .dump_set = record_dump_set,
+    .dump_counters = record_dump_counters,
+};
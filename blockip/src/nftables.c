@@ -1,8 +1,16 @@
 #include "nftables.h"
+#include "geoblock.h"
 #include "log.h"
-#include <sys/wait.h>
+#include <errno.h>
+#include <stdint.h>
+#include <arpa/inet.h>
 
 int check_and_install_nftables(void) {
+    /* 记录后端不访问内核 */
+    if (nft_backend() == &nft_record_backend) {
+        return SUCCESS;
+    }
+    
     /* 检查nft命令是否存在 */
     if (access("/usr/sbin/nft", X_OK) == 0 || access("/sbin/nft", X_OK) == 0) {
         return SUCCESS;
@@ -53,281 +61,409 @@ int check_and_install_nftables(void) {
     return SUCCESS;
 }
 
-int init_nftables_rules(void) {
-    char command[MAX_COMMAND_LEN];
-    
-    /* 创建表 */
-    snprintf(command, sizeof(command), "nft add table %s 2>/dev/null", NFT_TABLE);
-    system(command);
-    
-    /* 创建黑名单集合 */
-    snprintf(command, sizeof(command),
-             "nft add set %s %s '{ type ipv4_addr; flags interval,timeout; }' 2>/dev/null",
-             NFT_TABLE, NFT_SET);
-    system(command);
-    
-    snprintf(command, sizeof(command),
-             "nft add set %s %s '{ type ipv6_addr; flags interval,timeout; }' 2>/dev/null",
-             NFT_TABLE, NFT_SET_V6);
-    system(command);
-    
-    /* 创建白名单集合 */
-    snprintf(command, sizeof(command),
-             "nft add set %s %s '{ type ipv4_addr; flags interval; }' 2>/dev/null",
-             NFT_TABLE, NFT_WHITELIST);
-    system(command);
-    
-    snprintf(command, sizeof(command),
-             "nft add set %s %s '{ type ipv6_addr; flags interval; }' 2>/dev/null",
-             NFT_TABLE, NFT_WHITELIST_V6);
-    system(command);
-    
-    /* 创建input链 */
-    snprintf(command, sizeof(command),
-             "nft add chain %s input '{ type filter hook input priority 0; }' 2>/dev/null",
-             NFT_TABLE);
-    system(command);
-    
-    /* 添加规则：白名单必须在黑名单之前，使用add按顺序添加 */
-    /* 1. IPv4白名单 accept */
-    snprintf(command, sizeof(command),
-             "nft list chain %s input | grep -q '@%s' || nft add rule %s input ip saddr @%s accept",
-             NFT_TABLE, NFT_WHITELIST, NFT_TABLE, NFT_WHITELIST);
-    system(command);
+/* 生成完整规则集文档（表、集合、链和规则），由nft在一个事务中加载 */
+static int write_ruleset(FILE *fp, bool recreate) {
+    int ssh_port = get_ssh_port();
+    /* 配置加载时已校验时长，非法值已回退为默认值 */
+    const bip_config_t *cfg = config_get();
+    int rate_limit = cfg->rate_limit;
+    const char *rate_ban_time = cfg->rate_ban_time;
+    geo_filter_t geo_filter;
+    geo_filter_load(&geo_filter);
+    
+    fprintf(fp, "#!/usr/sbin/nft -f\n");
+    fprintf(fp, "# 由 bip 自动生成，请勿手动修改\n\n");
+    
+    /* 重建：先确保表存在再删除，与新定义处于同一事务 */
+    if (recreate) {
+        fprintf(fp, "table %s {}\n", NFT_TABLE);
+        fprintf(fp, "delete table %s\n\n", NFT_TABLE);
+    }
     
-    /* 2. IPv6白名单 accept */
-    snprintf(command, sizeof(command),
-             "nft list chain %s input | grep -q '@%s' || nft add rule %s input ip6 saddr @%s accept",
-             NFT_TABLE, NFT_WHITELIST_V6, NFT_TABLE, NFT_WHITELIST_V6);
-    system(command);
+    /* 声明式定义：已存在且定义一致的对象保持不变，集合元素不受影响 */
+    fprintf(fp, "table %s {\n", NFT_TABLE);
+    fprintf(fp, "    set %s { type ipv4_addr; flags interval,timeout; }\n", NFT_SET);
+    fprintf(fp, "    set %s { type ipv6_addr; flags interval,timeout; }\n", NFT_SET_V6);
+    fprintf(fp, "    set %s { type ipv4_addr; flags interval; }\n", NFT_WHITELIST);
+    fprintf(fp, "    set %s { type ipv6_addr; flags interval; }\n", NFT_WHITELIST_V6);
+    fprintf(fp, "    set %s { type ipv4_addr; flags interval; }\n", NFT_GEO_SET);
+    fprintf(fp, "    set %s { type ipv6_addr; flags interval; }\n", NFT_GEO_SET_V6);
+    fprintf(fp, "    set %s { type ipv4_addr; size 65535; flags dynamic,timeout; }\n", NFT_RATELIMIT);
+    fprintf(fp, "    set %s { type ipv6_addr; size 65535; flags dynamic,timeout; }\n", NFT_RATELIMIT_V6);
+    fprintf(fp, "    chain input { type filter hook input priority 0; }\n");
+    fprintf(fp, "}\n\n");
+    
+    /*
+     * 只清空旧规则，新规则在同一事务内生效，不存在无防护窗口；
+     * 限速集合保留，规则集重新加载（包括ENOENT恢复）不会放走正在被限速的地址
+     */
+    fprintf(fp, "flush chain %s input\n\n", NFT_TABLE);
+    
+    /* 白名单必须在黑名单之前 */
+    fprintf(fp, "table %s {\n", NFT_TABLE);
+    fprintf(fp, "    chain input {\n");
+    fprintf(fp, "        ip saddr @%s counter accept comment \"%s\"\n", NFT_WHITELIST, NFT_WHITELIST);
+    fprintf(fp, "        ip6 saddr @%s counter accept comment \"%s\"\n", NFT_WHITELIST_V6, NFT_WHITELIST_V6);
+    fprintf(fp, "        ip saddr @%s counter drop comment \"%s\"\n", NFT_SET, NFT_SET);
+    fprintf(fp, "        ip6 saddr @%s counter drop comment \"%s\"\n", NFT_SET_V6, NFT_SET_V6);
+    
+    /* 国家过滤（集合元素由 bip geo block/allow-only 单独同步） */
+    if (geo_filter_active(&geo_filter)) {
+        const char *match = (geo_filter.mode == GEO_FILTER_ALLOW) ? "!= " : "";
+        fprintf(fp, "        tcp dport %d ip saddr %s@%s counter drop comment \"%s\"\n",
+                ssh_port, match, NFT_GEO_SET, NFT_GEO_SET);
+        fprintf(fp, "        tcp dport %d ip6 saddr %s@%s counter drop comment \"%s\"\n",
+                ssh_port, match, NFT_GEO_SET_V6, NFT_GEO_SET_V6);
+    }
     
-    /* 3. IPv4黑名单 drop */
-    snprintf(command, sizeof(command),
-             "nft list chain %s input | grep -q '@%s' || nft add rule %s input ip saddr @%s drop",
-             NFT_TABLE, NFT_SET, NFT_TABLE, NFT_SET);
-    system(command);
+    /* SSH端口速率（防止TCP洪水，超速临时封禁） */
+    fprintf(fp, "        tcp dport %d ct state new add @%s { ip saddr timeout %s limit rate over %d/minute burst 5 packets } counter drop comment \"%s\"\n",
+            ssh_port, NFT_RATELIMIT, rate_ban_time, rate_limit, NFT_RATELIMIT);
+    fprintf(fp, "        tcp dport %d ct state new add @%s { ip6 saddr timeout %s limit rate over %d/minute burst 5 packets } counter drop comment \"%s\"\n",
+            ssh_port, NFT_RATELIMIT_V6, rate_ban_time, rate_limit, NFT_RATELIMIT_V6);
+    fprintf(fp, "    }\n");
+    fprintf(fp, "}\n");
     
-    /* 4. IPv6黑名单 drop */
-    snprintf(command, sizeof(command),
-             "nft list chain %s input | grep -q '@%s' || nft add rule %s input ip6 saddr @%s drop",
-             NFT_TABLE, NFT_SET_V6, NFT_TABLE, NFT_SET_V6);
-    system(command);
+    return ferror(fp) ? ERROR_FILE : SUCCESS;
+}
 
-    /* 5. SSH端口速率（防止TCP洪水，超速临时封禁） */
-    int ssh_port = get_ssh_port();
-    int rate_limit = get_rate_limit_from_config();
-    const char *rate_ban_time = get_rate_ban_time_from_config();
-    
-    /* 创建SSH端口速率动态集合 */
-    snprintf(command, sizeof(command),
-             "nft add set %s ssh-ratelimit '{ type ipv4_addr; size 65535; flags dynamic,timeout; }' 2>/dev/null",
-             NFT_TABLE);
-    system(command);
-    snprintf(command, sizeof(command),
-             "nft add set %s ssh-ratelimit_v6 '{ type ipv6_addr; size 65535; flags dynamic,timeout; }' 2>/dev/null",
-             NFT_TABLE);
-    system(command);
+int nft_write_ruleset_file(bool recreate) {
+    mkdir(CONFIG_DIR, 0700);
     
-    /* 删除旧的限速规则（如果存在） */
-    snprintf(command, sizeof(command),
-             "nft -a list chain %s input 2>/dev/null | grep -E 'tcp dport.*ssh-ratelimit' | awk '{print $NF}' | "
-             "xargs -r -I {} nft delete rule %s input handle {}",
-             NFT_TABLE, NFT_TABLE);
-    system(command);
+    char temp_file[MAX_PATH_LEN];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", NFT_RULESET_FILE);
+    FILE *fp = fopen(temp_file, "w");
+    if (!fp) {
+        return ERROR_FILE;
+    }
     
-    /* 重建动态集合以清空旧的限速记录 */
-    snprintf(command, sizeof(command),
-             "nft delete set %s ssh-ratelimit 2>/dev/null; "
-             "nft add set %s ssh-ratelimit '{ type ipv4_addr; size 65535; flags dynamic,timeout; }'",
-             NFT_TABLE, NFT_TABLE);
-    system(command);
-    snprintf(command, sizeof(command),
-             "nft delete set %s ssh-ratelimit_v6 2>/dev/null; "
-             "nft add set %s ssh-ratelimit_v6 '{ type ipv6_addr; size 65535; flags dynamic,timeout; }'",
-             NFT_TABLE, NFT_TABLE);
-    system(command);
+    int ret = write_ruleset(fp, recreate);
+    fclose(fp);
+    if (ret != SUCCESS) {
+        remove(temp_file);
+        return ret;
+    }
     
-    /* 添加新的限速规则：超速IP加入临时封禁集合 */
-    snprintf(command, sizeof(command),
-             "nft add rule %s input tcp dport %d ct state new "
-             "add @ssh-ratelimit { ip saddr timeout %s limit rate over %d/minute burst 5 packets } drop",
-             NFT_TABLE, ssh_port, rate_ban_time, rate_limit);
-    system(command);
-    snprintf(command, sizeof(command),
-             "nft add rule %s input tcp dport %d ct state new "
-             "add @ssh-ratelimit_v6 { ip6 saddr timeout %s limit rate over %d/minute burst 5 packets } drop",
-             NFT_TABLE, ssh_port, rate_ban_time, rate_limit);
-    system(command);
-
+    chmod(temp_file, 0600);
+    rename(temp_file, NFT_RULESET_FILE);
     return SUCCESS;
 }
 
-int nft_add_to_blacklist(const ip_info_t *ip_info) {
-    if (!ip_info) {
+int init_nftables_rules(void) {
+    return nft_backend()->init_ruleset(false);
+}
+
+int reset_nftables_rules(void) {
+    return nft_backend()->init_ruleset(true);
+}
+
+int nft_parse_interval(const char *ip, nft_interval_t *iv) {
+    if (!ip || !iv) {
         return ERROR_INVALID_ARG;
     }
     
-    /* 从配置文件读取封禁时间 */
-    const char *ban_time = get_ban_time_from_config();
-    
-    char element[MAX_LINE_LEN];
-    format_nft_element(ip_info->ip, element, sizeof(element), ban_time);
-    
-    const char *set_name = (ip_info->type == IP_TYPE_V6 || ip_info->type == IP_TYPE_V6_CIDR) 
-                          ? NFT_SET_V6 : NFT_SET;
-    
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command),
-             "nft add element %s %s '{ %s }' 2>&1",
-             NFT_TABLE, set_name, element);
+    /* 地址范围 a-b（nft输出非前缀区间时使用） */
+    const char *dash = strchr(ip, '-');
+    if (dash) {
+        char first[IP_STR_LEN];
+        size_t len = (size_t)(dash - ip);
+        if (len >= sizeof(first)) {
+            return ERROR_INVALID_ARG;
+        }
+        memcpy(first, ip, len);
+        first[len] = '\0';
+        
+        ip_addr_t lo, hi;
+        if (ip_addr_parse(first, &lo) != SUCCESS || ip_addr_parse(dash + 1, &hi) != SUCCESS ||
+            !ip_addr_is_host(&lo) || !ip_addr_is_host(&hi) || lo.family != hi.family ||
+            memcmp(lo.addr, hi.addr, sizeof(lo.addr)) > 0) {
+            return ERROR_INVALID_ARG;
+        }
+        nft_interval_t last;
+        nft_interval_from_addr(&lo, iv);
+        nft_interval_from_addr(&hi, &last);
+        memcpy(iv->end, last.end, iv->klen);
+        iv->has_end = last.has_end;
+        return SUCCESS;
+    }
     
-    FILE *fp = popen(command, "r");
-    if (!fp) {
-        return ERROR_FILE;
+    ip_addr_t addr;
+    if (ip_addr_parse(ip, &addr) != SUCCESS) {
+        return ERROR_INVALID_ARG;
+    }
+    nft_interval_from_addr(&addr, iv);
+    return SUCCESS;
+}
+
+void nft_format_interval(const nft_interval_t *iv, char *buf, size_t size) {
+    ip_addr_t addr;
+    if (nft_interval_to_addr(iv, &addr) == SUCCESS) {
+        ip_addr_format(&addr, buf, size);
+        return;
     }
     
-    char output[MAX_LINE_LEN];
-    bool need_init = false;
+    /* 结束地址减1得到区间内最后一个地址 */
+    uint8_t last[16];
+    memset(last, 0xff, sizeof(last));
+    if (iv->has_end) {
+        memcpy(last, iv->end, iv->klen);
+        for (int i = iv->klen - 1; i >= 0; i--) {
+            if (last[i]-- != 0) break;
+        }
+    }
+    int family = (iv->klen == 4) ? AF_INET : AF_INET6;
+    char lo[INET6_ADDRSTRLEN], hi[INET6_ADDRSTRLEN];
+    if (!inet_ntop(family, iv->start, lo, sizeof(lo)) || !inet_ntop(family, last, hi, sizeof(hi))) {
+        buf[0] = '\0';
+        return;
+    }
+    snprintf(buf, size, "%s-%s", lo, hi);
+}
+
+void nft_interval_from_addr(const ip_addr_t *addr, nft_interval_t *iv) {
+    /* 解析时主机位已清零，主机位全1再加1得到结束地址 */
+    const uint8_t *bytes = ip_addr_bytes(addr, &iv->klen);
+    memcpy(iv->start, bytes, iv->klen);
+    for (int i = 0; i < iv->klen; i++) {
+        int keep = addr->prefixlen - i * 8;
+        uint8_t m = keep >= 8 ? 0xff : keep <= 0 ? 0x00 : (uint8_t)(0xff << (8 - keep));
+        iv->end[i] = iv->start[i] | (uint8_t)~m;
+    }
     
-    if (fgets(output, sizeof(output), fp)) {
-        if (strstr(output, "No such file")) {
-            need_init = true;
+    /* 结束地址溢出地址空间时不写结束元素 */
+    iv->has_end = false;
+    for (int i = iv->klen - 1; i >= 0; i--) {
+        if (++iv->end[i] != 0) {
+            iv->has_end = true;
+            break;
         }
     }
-    pclose(fp);
+}
+
+int nft_interval_to_addr(const nft_interval_t *iv, ip_addr_t *addr) {
+    memset(addr, 0, sizeof(*addr));
+    if (iv->klen == 4) {
+        addr->family = AF_INET;
+        addr->prefixlen = 32;
+        addr->addr[10] = addr->addr[11] = 0xff;
+        memcpy(addr->addr + 12, iv->start, 4);
+    } else {
+        addr->family = AF_INET6;
+        addr->prefixlen = 128;
+        memcpy(addr->addr, iv->start, 16);
+    }
     
-    if (need_init) {
-        init_nftables_rules();
-        system(command);
+    /* 从单个地址开始逐位缩短前缀，直到区间一致或起始地址的主机位不为0 */
+    for (int len = addr->prefixlen; len >= 0; len--) {
+        ip_addr_t net;
+        ip_addr_truncate(addr, len, &net);
+        if (memcmp(net.addr, addr->addr, sizeof(net.addr)) != 0) {
+            break;
+        }
+        nft_interval_t candidate;
+        nft_interval_from_addr(&net, &candidate);
+        if (candidate.has_end == iv->has_end &&
+            (!iv->has_end || memcmp(candidate.end, iv->end, iv->klen) == 0)) {
+            *addr = net;
+            return SUCCESS;
+        }
+    }
+    return ERROR_INVALID_ARG;
+}
+
+
+/* 按名称查找后端，auto和未知名称返回NULL */
+static const nft_backend_t* backend_by_name(const char *name) {
+    static const nft_backend_t *const backends[] = {
+        &nft_native_backend, &nft_cli_backend, &nft_record_backend,
+    };
+    for (size_t i = 0; name && i < ARRAY_SIZE(backends); i++) {
+        if (strcmp(name, backends[i]->name) == 0) {
+            return backends[i];
+        }
+    }
+    return NULL;
+}
+
+const nft_backend_t* nft_backend(void) {
+    static const nft_backend_t *backend = NULL;
+    if (backend) {
+        return backend;
     }
     
-    return SUCCESS;
+    const char *name = getenv("BIP_FIREWALL");
+    if (!name || name[0] == '\0') {
+        name = get_firewall_backend_from_config();
+    }
+    backend = backend_by_name(name);
+    if (!backend) {
+        if (strcmp(name, "auto") != 0) {
+            log_write("[nftables] 未知的防火墙后端 %s，自动选择", name);
+        }
+        backend = nft_native_backend.available() ? &nft_native_backend : &nft_cli_backend;
+    }
+    return backend;
 }
 
-int nft_remove_from_blacklist(const char *ip) {
-    if (!ip) {
+bool nft_available(void) {
+    return nft_backend()->available();
+}
+
+int nft_dump_set(const char *set_name, nft_element_fn fn, void *ctx) {
+    if (!set_name || !fn) {
         return ERROR_INVALID_ARG;
     }
-    
-    char element[MAX_LINE_LEN];
-    format_nft_element(ip, element, sizeof(element), NULL);
-    
-    const char *set_name = is_ipv6(ip) ? NFT_SET_V6 : NFT_SET;
-    
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command),
-             "nft delete element %s %s '{ %s }' >/dev/null 2>&1",
-             NFT_TABLE, set_name, element);
-    
-    system(command);
-    return SUCCESS;
+    return nft_backend()->dump_set(set_name, fn, ctx);
 }
 
-int nft_add_to_whitelist(const char *ip) {
-    if (!ip) {
+int nft_dump_counters(nft_counter_fn fn, void *ctx) {
+    if (!fn) {
         return ERROR_INVALID_ARG;
     }
+    return nft_backend()->dump_counters(fn, ctx);
+}
+
+void nft_batch_init(nft_batch_t *b) {
+    memset(b, 0, sizeof(*b));
+    nfnl_batch_init(&b->nl);
+}
+
+void nft_batch_free(nft_batch_t *b) {
+    nfnl_batch_free(&b->nl);
+    if (b->fp) {
+        fclose(b->fp);
+    }
+    free(b->text);
+    memset(b, 0, sizeof(*b));
+}
+
+bool nft_batch_empty(const nft_batch_t *b) {
+    return b->ops == 0;
+}
+
+int nft_batch_commit(nft_batch_t *b) {
+    return nft_backend()->commit(b);
+}
+
+void nft_batch_put_elements(nft_batch_t *b, const char *set_name,
+                            const nft_interval_t *const *ivs, size_t count, uint64_t timeout_ms) {
+    if (count > 0) {
+        nft_backend()->put_elements(b, set_name, ivs, NULL, count, timeout_ms);
+        b->ops += count;
+    }
+}
+
+void nft_batch_put_timed_elements(nft_batch_t *b, const char *set_name,
+                                  const nft_interval_t *const *ivs, const uint64_t *timeouts_ms, size_t count) {
+    if (count > 0) {
+        nft_backend()->put_elements(b, set_name, ivs, timeouts_ms, count, 0);
+        b->ops += count;
+    }
+}
+
+void nft_batch_del_elements(nft_batch_t *b, const char *set_name,
+                            const nft_interval_t *const *ivs, size_t count) {
+    if (count > 0) {
+        nft_backend()->del_elements(b, set_name, ivs, count);
+        b->ops += count;
+    }
+}
+
+void nft_batch_flush_set(nft_batch_t *b, const char *set_name) {
+    nft_backend()->flush_set(b, set_name);
+    b->ops++;
+}
+
+FILE* nft_batch_stream(nft_batch_t *b) {
+    if (!b->fp) {
+        b->fp = open_memstream(&b->text, &b->text_len);
+    }
+    return b->fp;
+}
+
+size_t nft_batch_script(nft_batch_t *b, const char **text) {
+    if (b->fp) {
+        fflush(b->fp);
+    }
+    *text = b->text ? b->text : "";
+    return b->text ? b->text_len : 0;
+}
+
+/* 增删单个元素：按地址族选择集合，表/集合不存在时初始化规则后重试 */
+static int nft_update_element(bool add, bool blacklist, const ip_addr_t *addr, uint64_t timeout_ms) {
+    const char *set_name;
+    if (addr->family == AF_INET6) {
+        set_name = blacklist ? NFT_SET_V6 : NFT_WHITELIST_V6;
+    } else {
+        set_name = blacklist ? NFT_SET : NFT_WHITELIST;
+    }
     
-    char element[MAX_LINE_LEN];
-    format_nft_element(ip, element, sizeof(element), NULL);
-    
-    const char *set_name = is_ipv6(ip) ? NFT_WHITELIST_V6 : NFT_WHITELIST;
-    
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command),
-             "nft add element %s %s '{ %s }' 2>&1",
-             NFT_TABLE, set_name, element);
+    nft_interval_t iv;
+    nft_interval_from_addr(addr, &iv);
+    const nft_interval_t *ivs[1] = { &iv };
     
-    FILE *fp = popen(command, "r");
-    if (!fp) {
-        return ERROR_FILE;
+    nft_batch_t batch;
+    nft_batch_init(&batch);
+    if (add) {
+        nft_batch_put_elements(&batch, set_name, ivs, 1, timeout_ms);
+    } else {
+        nft_batch_del_elements(&batch, set_name, ivs, 1);
     }
+    int ret = nft_batch_commit(&batch);
     
-    char output[MAX_LINE_LEN];
-    bool need_init = false;
-    
-    if (fgets(output, sizeof(output), fp)) {
-        if (strstr(output, "No such file")) {
-            need_init = true;
+    if (ret == -ENOENT) {
+        if (!add) {
+            nft_batch_free(&batch);
+            return SUCCESS;  /* 元素本就不存在 */
         }
+        init_nftables_rules();
+        ret = nft_batch_commit(&batch);
     }
-    pclose(fp);
+    nft_batch_free(&batch);
     
-    if (need_init) {
-        init_nftables_rules();
-        system(command);
+    if (ret < 0) {
+        char ip[IP_STR_LEN];
+        ip_addr_format(addr, ip, sizeof(ip));
+        log_write("[nftables] %s %s %s 失败: %s", add ? "添加" : "删除", set_name, ip, strerror(-ret));
+        return (ret == -EPERM || ret == -EACCES) ? ERROR_PERMISSION : ERROR_FILE;
     }
     
     return SUCCESS;
 }
 
-int nft_remove_from_whitelist(const char *ip) {
-    if (!ip) {
+/* 字符串入口：解析一次后走二进制路径 */
+static int nft_update_string(bool add, bool blacklist, const char *ip) {
+    ip_addr_t addr;
+    if (!ip || ip_addr_parse(ip, &addr) != SUCCESS) {
         return ERROR_INVALID_ARG;
     }
-    
-    char element[MAX_LINE_LEN];
-    format_nft_element(ip, element, sizeof(element), NULL);
-    
-    const char *set_name = is_ipv6(ip) ? NFT_WHITELIST_V6 : NFT_WHITELIST;
-    
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command),
-             "nft delete element %s %s '{ %s }' >/dev/null 2>&1",
-             NFT_TABLE, set_name, element);
-    
-    system(command);
-    return SUCCESS;
+    return nft_update_element(add, blacklist, &addr, 0);
 }
 
-int nft_get_set_count(const char *set_name) {
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command),
-             "nft list set %s %s 2>/dev/null | sed 's/,/\\n/g' | sed 's/elements = {//g; s/}//g' | awk '{for(i=1;i<=NF;i++) if($i==\"expires\") print $1}' | wc -l",
-             NFT_TABLE, set_name);
-    
-    FILE *fp = popen(command, "r");
-    if (!fp) {
-        return 0;
+int nft_add_to_blacklist(const ip_info_t *ip_info) {
+    if (!ip_info) {
+        return ERROR_INVALID_ARG;
     }
     
-    int count = 0;
-    fscanf(fp, "%d", &count);
-    pclose(fp);
-    
-    return count;
+    /* 封禁时间取自配置缓存，不再逐次读取配置文件 */
+    return nft_update_element(true, true, &ip_info->addr, (uint64_t)config_get()->ban_time_ms);
 }
 
-int nft_list_set_elements(const char *set_name, char *buffer, size_t size) {
-    if (!set_name || !buffer) {
+int nft_add_timed_to_blacklist(const ip_addr_t *addr, uint64_t timeout_ms) {
+    if (!addr) {
         return ERROR_INVALID_ARG;
     }
-    
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command),
-             "nft list set %s %s 2>/dev/null",
-             NFT_TABLE, set_name);
-    
-    FILE *fp = popen(command, "r");
-    if (!fp) {
-        return ERROR_FILE;
-    }
-    
-    size_t offset = 0;
-    char line[MAX_LINE_LEN];
-    
-    while (fgets(line, sizeof(line), fp) && offset < size - 1) {
-        size_t len = strlen(line);
-        if (offset + len < size - 1) {
-            memcpy(buffer + offset, line, len);
-            offset += len;
-        } else {
-            break;
-        }
-    }
-    
-    buffer[offset] = '\0';
-    pclose(fp);
-    
-    return SUCCESS;
+    return nft_update_element(true, true, addr, timeout_ms);
+}
+
+int nft_remove_from_blacklist(const char *ip) {
+    return nft_update_string(false, true, ip);
+}
+
+int nft_add_to_whitelist(const char *ip) {
+    return nft_update_string(true, false, ip);
+}
+
+int nft_remove_from_whitelist(const char *ip) {
+    return nft_update_string(false, false, ip);
 }
@@ -3,6 +3,8 @@
 #include "ip_utils.h"
 #include "whitelist.h"
 #include "log.h"
+#include "daemon.h"
+#include "metrics.h"
 #include <sys/file.h>
 #include <fcntl.h>
 #include <sys/wait.h>
@@ -30,13 +32,13 @@ static void async_ban_ip(const char *ip) {
     
     if (pid < 0) {
         /* fork失败，同步执行 */
-        ban_ip(ip, true);
+        ban_ip(ip, true, BAN_SOURCE_PAM);
         return;
     }
     
     if (pid == 0) {
         /* 子进程：执行封禁操作 */
-        ban_ip(ip, true);
+        ban_ip(ip, true, BAN_SOURCE_PAM);
         _exit(0);  /* 子进程退出 */
     }
     
@@ -49,26 +51,53 @@ int pam_check_failed_login(void) {
         return SUCCESS;
     }
     
+    /* 各阶段耗时写入共享直方图，bip stats --latency 查看 */
+    uint64_t begin = metrics_now_ns();
+    uint64_t t = begin;
+    
+    /* 守护进程在运行时只发送一个数据报 */
+    int notified = daemon_notify("check", ip);
+    metrics_lap(LATENCY_CHECK_NOTIFY, &t);
+    if (notified == SUCCESS) {
+        metrics_lap(LATENCY_CHECK_TOTAL, &begin);
+        return SUCCESS;
+    }
+    /* 守护进程繁忙时不丢弃安全事件：写入本地计数文件，守护进程稍后合并 */
+    if (notified == ERROR_NETWORK) {
+        log_write("[守护进程繁忙] IP=%s 本次失败改为本地计数", ip);
+    }
+    
     /* 检查白名单（快速路径） */
-    if (is_in_whitelist(ip)) {
+    bool whitelisted = is_in_whitelist(ip);
+    metrics_lap(LATENCY_CHECK_WHITELIST, &t);
+    if (whitelisted) {
         log_write("[白名单放行] IP=%s", ip);
+        metrics_lap(LATENCY_CHECK_LOG, &t);
+        metrics_lap(LATENCY_CHECK_TOTAL, &begin);
         return SUCCESS;
     }
     
     /* 记录失败次数 */
+    metrics_inc(METRIC_FAILURES_PAM);
     int count = get_failure_count(ip);
     count++;
+    metrics_lap(LATENCY_CHECK_COUNT, &t);
     record_failure(ip);
+    metrics_lap(LATENCY_CHECK_RECORD, &t);
     
     int max_retries = get_max_retries_from_config();
+    metrics_lap(LATENCY_CHECK_CONFIG, &t);
     log_write("[验证失败] IP=%s (第 %d/%d 次)", ip, count, max_retries);
+    metrics_lap(LATENCY_CHECK_LOG, &t);
     
     /* 达到阈值，异步封禁（不阻塞SSH） */
     if (count >= max_retries) {
         async_ban_ip(ip);
+        metrics_lap(LATENCY_CHECK_FORK, &t);
         clear_failure_record(ip);
     }
     
+    metrics_lap(LATENCY_CHECK_TOTAL, &begin);
     return SUCCESS;
 }
 
@@ -78,12 +107,26 @@ int pam_clean_on_success(void) {
         return SUCCESS;
     }
     
+    uint64_t begin = metrics_now_ns();
+    uint64_t t = begin;
+    
+    int notified = daemon_notify("clean", ip);
+    metrics_lap(LATENCY_CLEAN_NOTIFY, &t);
+    if (notified == SUCCESS) {
+        metrics_lap(LATENCY_CLEAN_TOTAL, &begin);
+        return SUCCESS;
+    }
+    
     int count = get_failure_count(ip);
+    metrics_lap(LATENCY_CLEAN_COUNT, &t);
     if (count > 0) {
         log_write("[登录成功] IP=%s (计数已重置)", ip);
+        metrics_lap(LATENCY_CLEAN_LOG, &t);
         clear_failure_record(ip);
+        metrics_lap(LATENCY_CLEAN_CLEAR, &t);
     }
     
+    metrics_lap(LATENCY_CLEAN_TOTAL, &begin);
     return SUCCESS;
 }
 
@@ -0,0 +1,412 @@
+#include "restore.h"
+#include "nftables.h"
+#include "geoblock.h"
+#include "ban.h"
+#include "whitelist.h"
+#include "log.h"
+#include "store.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define RESTORE_MAX_THREADS 8
+#define RESTORE_THREAD_MIN 4096    /* 条目少于此数时单线程校验 */
+#define RESTORE_MAX_REPORT 10      /* 每个列表最多逐条报告的失败条目 */
+
+/* 条目状态 */
+enum {
+    ENTRY_OK = 0,
+    ENTRY_INVALID,     /* 格式无效 */
+    ENTRY_COVERED,     /* 重复或已被更大网段覆盖 */
+    ENTRY_FAILED       /* 内核拒绝 */
+};
+
+typedef struct {
+    nft_interval_t iv;
+    char ip[IP_STR_LEN];
+    int line;
+    int status;
+    bool parsed;        /* 已由存储层解析，无需再校验 */
+    uint64_t timeout_ms;    /* 剩余封禁时长，0为永久（白名单恒为0） */
+} restore_entry_t;
+
+typedef struct {
+    const char *file;
+    const char *label;
+    bool blacklist;
+    bool from_store;            /* 从封禁存储（快照+日志）读取 */
+    restore_entry_t *entries;
+    size_t count;
+    size_t cap;
+    size_t expired;             /* 已到期未恢复的封禁记录 */
+    restore_entry_t **kept;     /* 去重后待提交条目（IPv4在前） */
+    size_t kept_v4;
+    size_t kept_v6;
+} restore_list_t;
+
+typedef struct {
+    restore_entry_t *entries;
+    size_t count;
+} validate_job_t;
+
+/* 读取封禁存储，地址已是二进制形式 */
+static int load_store_list(restore_list_t *list) {
+    store_view_t view;
+    if (store_load(&view) != SUCCESS) {
+        return ERROR_FILE;
+    }
+    if (view.invalid > 0) {
+        log_write("[系统恢复] %s 中有 %zu 行无效，已跳过", list->file, view.invalid);
+    }
+    if (view.corrupt > 0) {
+        log_write("[系统恢复] %s 中有 %zu 条记录校验失败，已跳过", PERSIST_JOURNAL_FILE, view.corrupt);
+    }
+
+    list->entries = calloc(view.count ? view.count : 1, sizeof(*list->entries));
+    if (!list->entries) {
+        store_view_free(&view);
+        return ERROR_FILE;
+    }
+    list->cap = view.count;
+
+    /* 已到期的记录不再恢复，其余按剩余时长恢复，避免每次恢复都重新计满封禁时间 */
+    time_t now = time(NULL);
+    for (size_t i = 0; i < view.count; i++) {
+        const store_entry_t *s = &view.entries[i];
+        if (!store_entry_live(s, now)) {
+            list->expired++;
+            continue;
+        }
+        restore_entry_t *e = &list->entries[list->count++];
+        e->line = (int)(i + 1);
+        e->parsed = true;
+        e->timeout_ms = store_remaining_ms(s, now);
+        nft_interval_from_addr(&s->addr, &e->iv);
+        ip_addr_format(&s->addr, e->ip, sizeof(e->ip));
+    }
+
+    store_view_free(&view);
+    return SUCCESS;
+}
+
+/* 一次性读取持久化文件 */
+static int load_list(restore_list_t *list) {
+    if (list->from_store) {
+        return load_store_list(list);
+    }
+
+    FILE *fp = fopen(list->file, "r");
+    if (!fp) {
+        return SUCCESS;  /* 文件不存在 */
+    }
+
+    char line[MAX_LINE_LEN];
+    int line_no = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = 0;
+
+        /* 提取IP部分 */
+        char *pipe = strchr(line, '|');
+        if (pipe) *pipe = '\0';
+
+        if (strlen(line) == 0) continue;
+
+        if (list->count == list->cap) {
+            size_t new_cap = list->cap ? list->cap * 2 : 1024;
+            restore_entry_t *p = realloc(list->entries, new_cap * sizeof(*p));
+            if (!p) {
+                fclose(fp);
+                return ERROR_FILE;
+            }
+            list->entries = p;
+            list->cap = new_cap;
+        }
+
+        restore_entry_t *e = &list->entries[list->count++];
+        memset(e, 0, sizeof(*e));
+        e->line = line_no;
+        if (strlen(line) >= sizeof(e->ip)) {
+            snprintf(e->ip, sizeof(e->ip), "%.40s...", line);
+            e->status = ENTRY_INVALID;
+        } else {
+            strcpy(e->ip, line);
+        }
+    }
+
+    fclose(fp);
+    return SUCCESS;
+}
+
+static void* validate_worker(void *arg) {
+    validate_job_t *job = (validate_job_t *)arg;
+
+    for (size_t i = 0; i < job->count; i++) {
+        restore_entry_t *e = &job->entries[i];
+        if (e->status == ENTRY_OK && !e->parsed && nft_parse_interval(e->ip, &e->iv) != SUCCESS) {
+            e->status = ENTRY_INVALID;
+        }
+    }
+    return NULL;
+}
+
+/* 多线程校验并解析为二进制区间 */
+static void validate_list(restore_list_t *list) {
+    int nthreads = 1;
+    if (list->count >= RESTORE_THREAD_MIN) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 1 ? (int)cpus : 1;
+        if (nthreads > RESTORE_MAX_THREADS) nthreads = RESTORE_MAX_THREADS;
+    }
+
+    validate_job_t jobs[RESTORE_MAX_THREADS];
+    pthread_t threads[RESTORE_MAX_THREADS];
+    bool started[RESTORE_MAX_THREADS] = {false};
+    size_t chunk = (list->count + nthreads - 1) / nthreads;
+
+    for (int t = 0; t < nthreads; t++) {
+        size_t begin = (size_t)t * chunk;
+        jobs[t].entries = list->entries + begin;
+        jobs[t].count = begin >= list->count ? 0 :
+                        (list->count - begin < chunk ? list->count - begin : chunk);
+
+        if (t > 0 && pthread_create(&threads[t], NULL, validate_worker, &jobs[t]) == 0) {
+            started[t] = true;
+        }
+    }
+
+    /* 主线程处理第一段，以及未能启动线程的分段 */
+    validate_worker(&jobs[0]);
+    for (int t = 1; t < nthreads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            validate_worker(&jobs[t]);
+        }
+    }
+}
+
+/* 排序：地址族、起始地址升序，起点相同时范围大的在前 */
+static int cmp_entry(const void *a, const void *b) {
+    const restore_entry_t *x = *(restore_entry_t * const *)a;
+    const restore_entry_t *y = *(restore_entry_t * const *)b;
+
+    if (x->iv.klen != y->iv.klen) {
+        return x->iv.klen - y->iv.klen;
+    }
+    int c = memcmp(x->iv.start, y->iv.start, x->iv.klen);
+    if (c != 0) return c;
+    if (x->iv.has_end != y->iv.has_end) {
+        return x->iv.has_end ? 1 : -1;
+    }
+    c = memcmp(y->iv.end, x->iv.end, x->iv.klen);
+    if (c != 0) return c;
+    return x->line - y->line;
+}
+
+/* 去除重复和被覆盖的条目（前缀之间只有包含或不相交两种关系） */
+static int prune_list(restore_list_t *list) {
+    list->kept = malloc((list->count ? list->count : 1) * sizeof(*list->kept));
+    if (!list->kept) {
+        return ERROR_FILE;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->entries[i].status == ENTRY_OK) {
+            list->kept[n++] = &list->entries[i];
+        }
+    }
+    qsort(list->kept, n, sizeof(*list->kept), cmp_entry);
+
+    size_t out = 0;
+    restore_entry_t *cover = NULL;
+    for (size_t i = 0; i < n; i++) {
+        restore_entry_t *e = list->kept[i];
+        if (cover && cover->iv.klen == e->iv.klen &&
+            (!cover->iv.has_end || memcmp(e->iv.start, cover->iv.end, e->iv.klen) < 0)) {
+            /* 被覆盖条目的剩余时长更长时，覆盖它的网段取较晚者（与合并网段一致） */
+            if (cover->timeout_ms != 0 && (e->timeout_ms == 0 || e->timeout_ms > cover->timeout_ms)) {
+                cover->timeout_ms = e->timeout_ms;
+            }
+            e->status = ENTRY_COVERED;
+            continue;
+        }
+        cover = e;
+        list->kept[out++] = e;
+        if (e->iv.klen == 4) {
+            list->kept_v4++;
+        } else {
+            list->kept_v6++;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/* 将一个列表的v4/v6元素写入批处理，每个元素使用自己的剩余时长 */
+static int put_list(nft_batch_t *batch, const restore_list_t *list) {
+    size_t total = list->kept_v4 + list->kept_v6;
+    if (total == 0) {
+        return SUCCESS;
+    }
+
+    const nft_interval_t **ivs = malloc(total * sizeof(*ivs));
+    uint64_t *timeouts = malloc(total * sizeof(*timeouts));
+    if (!ivs || !timeouts) {
+        free(ivs);
+        free(timeouts);
+        return ERROR_FILE;
+    }
+    for (size_t i = 0; i < total; i++) {
+        ivs[i] = &list->kept[i]->iv;
+        timeouts[i] = list->kept[i]->timeout_ms;
+    }
+
+    const char *set_v4 = list->blacklist ? NFT_SET : NFT_WHITELIST;
+    const char *set_v6 = list->blacklist ? NFT_SET_V6 : NFT_WHITELIST_V6;
+    nft_batch_put_timed_elements(batch, set_v4, ivs, timeouts, list->kept_v4);
+    nft_batch_put_timed_elements(batch, set_v6, ivs + list->kept_v4, timeouts + list->kept_v4, list->kept_v6);
+
+    free(ivs);
+    free(timeouts);
+    return SUCCESS;
+}
+
+/* 事务失败时逐条提交，定位被内核拒绝的条目 */
+static void commit_one_by_one(restore_list_t *list) {
+    for (size_t i = 0; i < list->kept_v4 + list->kept_v6; i++) {
+        restore_entry_t *e = list->kept[i];
+        int ret;
+        if (list->blacklist) {
+            ip_addr_t addr;
+            ret = nft_interval_to_addr(&e->iv, &addr);
+            if (ret == SUCCESS) {
+                ret = nft_add_timed_to_blacklist(&addr, e->timeout_ms);
+            }
+        } else {
+            ret = nft_add_to_whitelist(e->ip);
+        }
+        if (ret != SUCCESS) {
+            e->status = ENTRY_FAILED;
+        }
+    }
+}
+
+/* 报告失败条目并输出汇总 */
+static void report_list(const restore_list_t *list) {
+    int restored = 0, covered = 0, failed = 0;
+
+    for (size_t i = 0; i < list->count; i++) {
+        const restore_entry_t *e = &list->entries[i];
+        switch (e->status) {
+        case ENTRY_OK:
+            restored++;
+            break;
+        case ENTRY_COVERED:
+            covered++;
+            break;
+        default:
+            if (failed < RESTORE_MAX_REPORT) {
+                const char *reason = (e->status == ENTRY_INVALID) ? "无效条目" : "提交失败";
+                log_write("[系统恢复] %s 第 %d 行 %s: %s", list->file, e->line, reason, e->ip);
+                printf("%s  ⚠️  %s 第 %d 行 %s: %s%s\n", C_YELLOW, list->file, e->line, reason, e->ip, C_RESET);
+            }
+            failed++;
+            break;
+        }
+    }
+
+    if (failed > RESTORE_MAX_REPORT) {
+        log_write("[系统恢复] %s 另有 %d 条失败未列出", list->file, failed - RESTORE_MAX_REPORT);
+    }
+
+    log_write("[系统恢复] 已从磁盘恢复 %d 个%s IP (覆盖跳过 %d, 已到期跳过 %zu, 失败 %d)",
+              restored, list->label, covered, list->expired, failed);
+
+    char message[MAX_LINE_LEN];
+    snprintf(message, sizeof(message), "✅ 已从磁盘恢复 %d 个%s IP", restored, list->label);
+    msg(C_GREEN, message);
+    if (failed > 0) {
+        snprintf(message, sizeof(message), "⚠️  %d 条%s记录恢复失败，详见日志", failed, list->label);
+        msg(C_YELLOW, message);
+    }
+}
+
+static void free_list(restore_list_t *list) {
+    free(list->entries);
+    free(list->kept);
+}
+
+int restore_all_lists(void) {
+    /* 防火墙后端不可用时逐条恢复，失败原因逐条记录到日志 */
+    if (!nft_available()) {
+        restore_from_persist();
+        whitelist_restore();
+        return SUCCESS;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    restore_list_t lists[2];
+    memset(lists, 0, sizeof(lists));
+    lists[0].file = PERSIST_FILE;
+    lists[0].label = "黑名单";
+    lists[0].blacklist = true;
+    lists[0].from_store = true;
+    lists[1].file = WHITELIST_FILE;
+    lists[1].label = "白名单";
+    lists[1].blacklist = false;
+
+    int ret = SUCCESS;
+    for (size_t i = 0; i < ARRAY_SIZE(lists) && ret == SUCCESS; i++) {
+        ret = load_list(&lists[i]);
+        if (ret == SUCCESS) {
+            validate_list(&lists[i]);
+            ret = prune_list(&lists[i]);
+        }
+    }
+    if (ret != SUCCESS) {
+        free_list(&lists[0]);
+        free_list(&lists[1]);
+        return ret;
+    }
+
+    /* 所有集合的元素在同一个事务中提交 */
+    nft_batch_t batch;
+    nft_batch_init(&batch);
+    put_list(&batch, &lists[0]);
+    put_list(&batch, &lists[1]);
+
+    int err = nft_batch_commit(&batch);
+    if (err == -ENOENT) {
+        init_nftables_rules();
+        err = nft_batch_commit(&batch);
+    }
+    nft_batch_free(&batch);
+
+    if (err < 0) {
+        log_write("[系统恢复] 批量事务提交失败: %s，改为逐条提交", strerror(-err));
+        commit_one_by_one(&lists[0]);
+        commit_one_by_one(&lists[1]);
+    }
+
+    /* 国家过滤集合在规则重建后为空，按离线数据库全量加载 */
+    geo_filter_t geo_filter;
+    geo_filter_load(&geo_filter);
+    if (geo_filter.mode != GEO_FILTER_OFF) {
+        geoblock_sync(true, NULL, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long elapsed_ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+
+    report_list(&lists[0]);
+    report_list(&lists[1]);
+    log_write("[系统恢复] 批量恢复耗时 %ld ms", elapsed_ms);
+
+    free_list(&lists[0]);
+    free_list(&lists[1]);
+    return SUCCESS;
+}
@@ -2,366 +2,488 @@
 #include "nftables.h"
 #include "log.h"
 #include "geo.h"
-#include <ctype.h>
+#include "ip_utils.h"
+#include "store.h"
+#include "metrics.h"
 
-void show_active_bans(void) {
+static void heap_sift_down(elem_heap_t *h, size_t i) {
+    for (;;) {
+        size_t largest = i, l = 2 * i + 1, r = l + 1;
+        if (l < h->count && h->rows[l].key > h->rows[largest].key) largest = l;
+        if (r < h->count && h->rows[r].key > h->rows[largest].key) largest = r;
+        if (largest == i) return;
+        elem_row_t tmp = h->rows[i];
+        h->rows[i] = h->rows[largest];
+        h->rows[largest] = tmp;
+        i = largest;
+    }
+}
+
+static void heap_offer(elem_heap_t *h, const nft_element_t *elem, uint64_t key) {
+    if (h->count < ARRAY_SIZE(h->rows)) {
+        size_t i = h->count++;
+        h->rows[i] = (elem_row_t){ *elem, key };
+        while (i > 0 && h->rows[(i - 1) / 2].key < h->rows[i].key) {
+            elem_row_t tmp = h->rows[i];
+            h->rows[i] = h->rows[(i - 1) / 2];
+            h->rows[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (key < h->rows[0].key) {
+        h->rows[0] = (elem_row_t){ *elem, key };
+        heap_sift_down(h, 0);
+    }
+}
+
+/* 依次弹出堆顶，rows按key升序排列 */
+static void heap_sort(elem_heap_t *h) {
+    size_t count = h->count;
+    while (h->count > 1) {
+        elem_row_t tmp = h->rows[0];
+        h->rows[0] = h->rows[--h->count];
+        h->rows[h->count] = tmp;
+        heap_sift_down(h, 0);
+    }
+    h->count = count;
+}
+
+static uint64_t elem_elapsed(const nft_element_t *elem) {
+    return elem->timeout_ms > elem->expires_ms ? elem->timeout_ms - elem->expires_ms : 0;
+}
+
+static int snapshot_banned(const nft_element_t *elem, void *ctx) {
+    list_snapshot_t *snap = ctx;
+    snap->banned[elem->iv.klen == 16]++;
+    if (elem->timeout_ms == 0) {
+        snap->permanent++;
+        return 0;
+    }
+    heap_offer(&snap->soonest, elem, elem->expires_ms);
+    heap_offer(&snap->newest, elem, elem_elapsed(elem));
+    return 0;
+}
+
+static int snapshot_rate(const nft_element_t *elem, void *ctx) {
+    list_snapshot_t *snap = ctx;
+    snap->rate_tracked[elem->iv.klen == 16]++;
+    heap_offer(&snap->rate_newest, elem, elem_elapsed(elem));
+    return 0;
+}
+
+int list_snapshot_take(list_snapshot_t *snap) {
+    memset(snap, 0, sizeof(*snap));
+    if (nft_dump_set(NFT_SET, snapshot_banned, snap) != SUCCESS ||
+        nft_dump_set(NFT_SET_V6, snapshot_banned, snap) != SUCCESS) {
+        return ERROR_NETWORK;
+    }
+    /* 限速集合只影响限速一节，读取失败时该节显示无数据 */
+    if (nft_dump_set(NFT_RATELIMIT, snapshot_rate, snap) == SUCCESS &&
+        nft_dump_set(NFT_RATELIMIT_V6, snapshot_rate, snap) == SUCCESS) {
+        heap_sort(&snap->rate_newest);
+    } else {
+        snap->rate_tracked[0] = snap->rate_tracked[1] = 0;
+        snap->rate_newest.count = 0;
+    }
+    heap_sort(&snap->soonest);
+    heap_sort(&snap->newest);
+    snap->valid = true;
+    return SUCCESS;
+}
+
+static void format_seconds(long long total_s, char *buf, size_t size) {
+    long long h = total_s / 3600;
+    long long m = (total_s % 3600) / 60;
+    long long s = total_s % 60;
+    if (h > 0) {
+        snprintf(buf, size, "%lldh%lldm%llds", h, m, s);
+    } else if (m > 0) {
+        snprintf(buf, size, "%lldm%llds", m, s);
+    } else {
+        snprintf(buf, size, "%llds", s);
+    }
+}
+
+static void print_element(const nft_element_t *elem, uint64_t ms, const char *suffix) {
+    ip_addr_t addr;
+    char ip[IP_STR_LEN];
+    nft_interval_to_addr(&elem->iv, &addr);
+    ip_addr_format(&addr, ip, sizeof(ip));
+    char time_str[64];
+    format_seconds((long long)(ms / 1000), time_str, sizeof(time_str));
+    printf("  - %-20s %s%s\n", ip, time_str, suffix);
+}
+
+static bool same_element(const nft_element_t *a, const nft_element_t *b) {
+    return a->iv.klen == b->iv.klen && memcmp(a->iv.start, b->iv.start, a->iv.klen) == 0;
+}
+
+void show_active_bans(const list_snapshot_t *snap) {
     msg(C_CYAN, "=== 🔥 活跃封禁列表 (即将过期 ↑ / 最新封禁 ↓) ===");
     
-    /* 获取所有封禁IP和过期时间 */
-    char command[MAX_COMMAND_LEN];
-    snprintf(command, sizeof(command),
-             "{ nft list set %s %s 2>/dev/null; nft list set %s %s 2>/dev/null; } | "
-             "sed 's/,/\\n/g' | grep -E 'expires [0-9]+(s|m|h|d|ms)' | "
-             "awk '{ip=\"\"; time=\"\"; for(i=1;i<=NF;i++) { if($i==\"expires\") time=$(i+1); else if($i==\"timeout\") ip=$(i-1) } if(ip && time) print ip\" \"time}'",
-             NFT_TABLE, NFT_SET, NFT_TABLE, NFT_SET_V6);
-    
-    FILE *fp = popen(command, "r");
-    if (!fp) {
+    if (!snap || !snap->valid) {
         printf("(无法获取数据)\n\n");
         return;
     }
     
-    /* 读取所有数据到数组 */
-    typedef struct { char ip[MAX_IP_LEN]; char time_str[64]; long long total_s; } ban_entry_t;
-    ban_entry_t entries[1024];
-    int total = 0;
-    char line[MAX_LINE_LEN];
-    
-    while (fgets(line, sizeof(line), fp) && total < 1024) {
-        line[strcspn(line, "\n")] = 0;
-        if (strlen(line) > 0) {
-            char ip[MAX_IP_LEN] = {0};
-            char time_raw[64] = {0};
-            if (sscanf(line, "%s %s", ip, time_raw) == 2) {
-                // 解析nft时间格式：86394588ms, 23h59m54s等
-                long long total_s = 0;
-                char *p = time_raw;
-                long long num = 0;
-                
-                while (*p) {
-                    if (isdigit(*p)) {
-                        num = num * 10 + (*p - '0');
-                    } else {
-                        if (*p == 'd') total_s += num * 86400;
-                        else if (*p == 'h') total_s += num * 3600;
-                        else if (*p == 'm' && *(p+1) == 's') { total_s += num / 1000; p++; }
-                        else if (*p == 'm') total_s += num * 60;
-                        else if (*p == 's') total_s += num;
-                        num = 0;
-                    }
-                    p++;
-                }
-                
-                long long h = total_s / 3600;
-                long long m = (total_s % 3600) / 60;
-                long long s = total_s % 60;
-                
-                if (h > 0) {
-                    snprintf(entries[total].time_str, sizeof(entries[total].time_str), "%lldh%lldm%llds", h, m, s);
-                } else if (m > 0) {
-                    snprintf(entries[total].time_str, sizeof(entries[total].time_str), "%lldm%llds", m, s);
-                } else {
-                    snprintf(entries[total].time_str, sizeof(entries[total].time_str), "%llds", s);
-                }
-                
-                snprintf(entries[total].ip, sizeof(entries[total].ip), "%s", ip);
-                entries[total].total_s = total_s;
-                total++;
-            }
+    size_t timed = snap->banned[0] + snap->banned[1] - snap->permanent;
+    if (timed == 0) {
+        if (snap->permanent > 0) {
+            printf("(另有 %zu 条永久封禁)\n\n", snap->permanent);
+        } else {
+            printf("(目前没有被封禁的 IP)\n\n");
         }
-    }
-    pclose(fp);
-    
-    if (total == 0) {
-        printf("(目前没有被封禁的 IP)\n\n");
         return;
     }
     
-    /* 冒泡排序（按剩余时间升序） */
-    for (int i = 0; i < total - 1; i++) {
-        for (int j = 0; j < total - i - 1; j++) {
-            if (entries[j].total_s > entries[j + 1].total_s) {
-                ban_entry_t temp = entries[j];
-                entries[j] = entries[j + 1];
-                entries[j + 1] = temp;
+    printf("%s    %-20s   %-15s%s\n", C_YELLOW, "IP 地址", "剩余时间", C_RESET);
+    printf("-------------------------------------\n");
+    
+    /* 总数不超过两组之和时全部按剩余时间显示 */
+    if (timed <= ACTIVE_SHOW * 2) {
+        for (size_t i = 0; i < snap->soonest.count; i++) {
+            print_element(&snap->soonest.rows[i].elem, snap->soonest.rows[i].elem.expires_ms, "");
+        }
+    } else {
+        for (size_t i = 0; i < ACTIVE_SHOW; i++) {
+            print_element(&snap->soonest.rows[i].elem, snap->soonest.rows[i].elem.expires_ms, "");
+        }
+        
+        /* 最新封禁中排除已作为即将过期显示的条目，最新的排在最后 */
+        const nft_element_t *latest[ACTIVE_SHOW];
+        size_t shown = 0;
+        for (size_t i = 0; i < snap->newest.count && shown < ACTIVE_SHOW; i++) {
+            const nft_element_t *elem = &snap->newest.rows[i].elem;
+            bool dup = false;
+            for (size_t j = 0; j < ACTIVE_SHOW; j++) {
+                dup |= same_element(elem, &snap->soonest.rows[j].elem);
             }
+            if (!dup) {
+                latest[shown++] = elem;
+            }
+        }
+        printf("\033[2m  ... (省略 %zu 条)\033[0m\n", timed - ACTIVE_SHOW - shown);
+        while (shown > 0) {
+            const nft_element_t *elem = latest[--shown];
+            print_element(elem, elem->expires_ms, "");
         }
     }
     
-    printf("%s    %-20s   %-15s%s\n", C_YELLOW, "IP 地址", "剩余时间", C_RESET);
-    printf("-------------------------------------\n");
-    
-    /* 显示前2条（即将过期） */
-    int show_first = (total >= 2) ? 2 : total;
-    for (int i = 0; i < show_first; i++) {
-        printf("  - %-20s %s\n", entries[i].ip, entries[i].time_str);
+    if (snap->permanent > 0) {
+        printf("\033[2m  (另有 %zu 条永久封禁)\033[0m\n", snap->permanent);
     }
+    printf("\n");
+}
+
+void show_rate_limit(const list_snapshot_t *snap) {
+    char title[MAX_LINE_LEN];
+    snprintf(title, sizeof(title), "=== ⚡ SSH 速率限制 (%d/分钟，超速封禁 %s) ===",
+             get_rate_limit_from_config(), get_rate_ban_time_from_config());
+    msg(C_CYAN, title);
     
-    /* 显示省略号（如果总数大于4） */
-    if (total > 4) {
-        printf("\033[2m  ... (省略 %d 条)\033[0m\n", total - 4);
+    if (!snap || !snap->valid) {
+        printf("(无法获取数据)\n\n");
+        return;
     }
     
-    /* 显示后2条（最新封禁） */
-    if (total > 2) {
-        int show_last_start = (total > 4) ? total - 2 : 2;
-        for (int i = show_last_start; i < total; i++) {
-            printf("  - %-20s %s\n", entries[i].ip, entries[i].time_str);
-        }
+    size_t tracked = snap->rate_tracked[0] + snap->rate_tracked[1];
+    if (tracked == 0) {
+        printf("(当前没有跟踪中的来源)\n\n");
+        return;
     }
     
+    printf("跟踪中的来源: %s%zu%s 个 (IPv4 %zu / IPv6 %zu)\n",
+           C_YELLOW, tracked, C_RESET, snap->rate_tracked[0], snap->rate_tracked[1]);
+    for (size_t i = 0; i < snap->rate_newest.count && i < ACTIVE_SHOW; i++) {
+        const nft_element_t *elem = &snap->rate_newest.rows[i].elem;
+        print_element(elem, snap->rate_newest.rows[i].key, " 前");
+    }
     printf("\n");
 }
 
-/* 检查段idx是否会被更精确的段取代（相同count但更小mask） */
-static inline bool is_agg_replaced(void *agg_array, int agg_count, int idx) {
-    struct agg_entry { char subnet[64]; int count; int mask; };
-    struct agg_entry *agg = (struct agg_entry *)agg_array;
-    
-    for (int j = 0; j < agg_count; ++j) {
-        if (agg[j].mask > agg[idx].mask && agg[j].count == agg[idx].count && 
-            strncmp(agg[j].subnet, agg[idx].subnet, strlen(agg[idx].subnet)) == 0) {
-            return true;
-        }
+#define AGG_SHOW_LINES 20       /* 聚合统计最多显示的网段行数 */
+#define AGG_SHOW_CHILDREN 2     /* 每个网段最多展开的子网段数 */
+
+/* 聚合网段 */
+typedef struct {
+    ip_addr_t prefix;
+    size_t count;
+    int parent;         /* 显示层级中的上级网段，-1为顶层 */
+    int depth;
+    bool replaced;      /* 存在数量相同的更小网段时只显示更小的 */
+} agg_node_t;
+
+typedef struct {
+    agg_node_t *nodes;
+    size_t count;
+    size_t cap;
+} agg_list_t;
+
+/* 显示顺序：同一上级下按数量降序，数量相同按地址 */
+typedef struct {
+    int parent;
+    size_t count;
+    int index;
+} agg_order_t;
+
+static int cmp_agg_prefix(const void *a, const void *b) {
+    return ip_addr_cmp(&((const agg_node_t *)a)->prefix, &((const agg_node_t *)b)->prefix);
+}
+
+static int cmp_agg_order(const void *a, const void *b) {
+    const agg_order_t *x = a, *y = b;
+    if (x->parent != y->parent) return x->parent < y->parent ? -1 : 1;
+    if (x->count != y->count) return x->count > y->count ? -1 : 1;
+    return x->index - y->index;
+}
+
+static int agg_push(agg_list_t *list, const ip_addr_t *prefix, size_t count) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        agg_node_t *nodes = realloc(list->nodes, cap * sizeof(*nodes));
+        if (!nodes) return ERROR_FILE;
+        list->nodes = nodes;
+        list->cap = cap;
     }
-    return false;
+    agg_node_t *node = &list->nodes[list->count++];
+    node->prefix = *prefix;
+    node->count = count;
+    node->parent = -1;
+    node->depth = 0;
+    node->replaced = false;
+    return SUCCESS;
 }
 
-void show_subnet_aggregation(void) {
-    msg(C_CYAN, "=== 📊 攻击源聚合统计 (IP 段归类) ===");
-    
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    if (!fp) {
-        printf("(暂无IP信息)\n\n");
-        return;
+/* 128位整数形式的地址，排序和截取前缀都是整数运算 */
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+    uint8_t prefixlen;
+} agg_key_t;
+
+static void agg_key_from_addr(const ip_addr_t *addr, agg_key_t *key) {
+    key->hi = key->lo = 0;
+    for (int i = 0; i < 8; i++) {
+        key->hi = (key->hi << 8) | addr->addr[i];
+        key->lo = (key->lo << 8) | addr->addr[i + 8];
     }
-    
-    /* 统计各级网段 */
-    struct { char subnet[64]; int count; int mask; } agg[256];
-    int agg_count = 0;
-    int v6_count = 0;
-    char line[MAX_LINE_LEN];
-    
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\n")] = 0;
-        if (strlen(line) == 0) continue;
-        
-        /* 提取IP部分 */
-        char *pipe = strchr(line, '|');
-        if (pipe) *pipe = '\0';
-        
-        if (strchr(line, ':')) {
-            v6_count++;
-            continue;
+    key->prefixlen = addr->prefixlen;
+}
+
+static void agg_key_to_addr(uint64_t hi, uint64_t lo, uint8_t family, int level, ip_addr_t *addr) {
+    addr->family = family;
+    addr->prefixlen = (uint8_t)level;
+    for (int i = 7; i >= 0; i--) {
+        addr->addr[i] = (uint8_t)hi;
+        addr->addr[i + 8] = (uint8_t)lo;
+        hi >>= 8;
+        lo >>= 8;
+    }
+}
+
+/* LSD基数排序（按字节，稳定），所有元素该字节相同的趟次跳过：IPv4只需4趟 */
+static int radix_sort_keys(agg_key_t *keys, size_t n) {
+    if (n < 2) return SUCCESS;
+    agg_key_t *tmp = malloc(n * sizeof(*tmp));
+    if (!tmp) return ERROR_FILE;
+    agg_key_t *src = keys, *dst = tmp;
+    for (int pass = 0; pass < 16; pass++) {
+        int shift = (pass % 8) * 8;
+        bool low = pass < 8;
+        size_t counts[256] = {0};
+        for (size_t i = 0; i < n; i++) {
+            counts[((low ? src[i].lo : src[i].hi) >> shift) & 0xff]++;
         }
-        
-        /* 解析IPv4，统计/8, /16, /24 */
-        unsigned int a, b, c, d;
-        if (sscanf(line, "%u.%u.%u.%u", &a, &b, &c, &d) == 4) {
-            char subnet_24[64], subnet_16[64], subnet_8[64];
-            snprintf(subnet_24, sizeof(subnet_24), "%u.%u.%u", a, b, c);
-            snprintf(subnet_16, sizeof(subnet_16), "%u.%u", a, b);
-            snprintf(subnet_8, sizeof(subnet_8), "%u", a);
-            
-            /* 统计/24 */
-            int found = 0;
-            for (int i = 0; i < agg_count; ++i) {
-                if (agg[i].mask == 24 && strcmp(agg[i].subnet, subnet_24) == 0) {
-                    agg[i].count++;
-                    found = 1;
-                    break;
-                }
-            }
-            if (!found && agg_count < 256) {
-                snprintf(agg[agg_count].subnet, sizeof(agg[agg_count].subnet), "%s", subnet_24);
-                agg[agg_count].count = 1;
-                agg[agg_count].mask = 24;
-                agg_count++;
-            }
-            
-            /* 统计/16 */
-            found = 0;
-            for (int i = 0; i < agg_count; ++i) {
-                if (agg[i].mask == 16 && strcmp(agg[i].subnet, subnet_16) == 0) {
-                    agg[i].count++;
-                    found = 1;
-                    break;
-                }
-            }
-            if (!found && agg_count < 256) {
-                snprintf(agg[agg_count].subnet, sizeof(agg[agg_count].subnet), "%s", subnet_16);
-                agg[agg_count].count = 1;
-                agg[agg_count].mask = 16;
-                agg_count++;
-            }
-            
-            /* 统计/8 */
-            found = 0;
-            for (int i = 0; i < agg_count; ++i) {
-                if (agg[i].mask == 8 && strcmp(agg[i].subnet, subnet_8) == 0) {
-                    agg[i].count++;
-                    found = 1;
-                    break;
-                }
-            }
-            if (!found && agg_count < 256) {
-                snprintf(agg[agg_count].subnet, sizeof(agg[agg_count].subnet), "%s", subnet_8);
-                agg[agg_count].count = 1;
-                agg[agg_count].mask = 8;
-                agg_count++;
-            }
+        bool uniform = false;
+        size_t offset = 0;
+        for (int d = 0; d < 256; d++) {
+            uniform |= (counts[d] == n);
+            size_t c = counts[d];
+            counts[d] = offset;
+            offset += c;
         }
-    }
-    fclose(fp);
-    
-    /* 第一步：按count降序排序，同count时按IP第一段数字排序 */
-    for (int i = 0; i < agg_count - 1; ++i) {
-        for (int j = i + 1; j < agg_count; ++j) {
-            bool should_swap = false;
-            
-            if (agg[j].count > agg[i].count) {
-                should_swap = true;
-            } else if (agg[j].count == agg[i].count) {
-                /* 同count时，按IP第一段数字排序 */
-                int ip_i = atoi(agg[i].subnet);
-                int ip_j = atoi(agg[j].subnet);
-                if (ip_j < ip_i) {
-                    should_swap = true;
-                }
-            }
-            
-            if (should_swap) {
-                char tmp_subnet[64];
-                int tmp_count = agg[i].count, tmp_mask = agg[i].mask;
-                strcpy(tmp_subnet, agg[i].subnet);
-                agg[i].count = agg[j].count;
-                agg[i].mask = agg[j].mask;
-                strcpy(agg[i].subnet, agg[j].subnet);
-                agg[j].count = tmp_count;
-                agg[j].mask = tmp_mask;
-                strcpy(agg[j].subnet, tmp_subnet);
-            }
+        if (uniform) continue;
+        for (size_t i = 0; i < n; i++) {
+            dst[counts[((low ? src[i].lo : src[i].hi) >> shift) & 0xff]++] = src[i];
         }
+        agg_key_t *t = src;
+        src = dst;
+        dst = t;
     }
-    
-    /* 第二步：将子网段移到父网段后面形成层级 */
-    for (int i = 0; i < agg_count; ++i) {
-        /* 查找i的所有直接子网段（下一级），移到i后面 */
-        int insert_pos = i + 1;
-        
-        /* 先跳过已经在正确位置的子网 */
-        while (insert_pos < agg_count && 
-               agg[insert_pos].mask > agg[i].mask && 
-               strncmp(agg[insert_pos].subnet, agg[i].subnet, strlen(agg[i].subnet)) == 0) {
-            insert_pos++;
+    if (src != keys) {
+        memcpy(keys, src, n * sizeof(*keys));
+    }
+    free(tmp);
+    return SUCCESS;
+}
+
+/*
+ * 统计有序地址中某一层级的网段：同一网段的地址在排序后相邻，一次线性扫描完成。
+ * 比该层级更大的网段条目不计入，只保留数量不少于2的网段。
+ */
+static int count_level(const agg_key_t *keys, size_t n, uint8_t family, int level, agg_list_t *list) {
+    int bits = (family == AF_INET) ? level + 96 : level;
+    uint64_t mask_hi = bits >= 64 ? UINT64_MAX : UINT64_MAX << (64 - bits);
+    uint64_t mask_lo = bits <= 64 ? 0 : UINT64_MAX << (128 - bits);
+    uint64_t hi = 0, lo = 0;
+    size_t run = 0;
+    ip_addr_t prefix;
+    for (size_t i = 0; i <= n; i++) {
+        if (i < n && keys[i].prefixlen < level) continue;
+        if (i < n && run > 0 && (keys[i].hi & mask_hi) == hi && (keys[i].lo & mask_lo) == lo) {
+            run++;
+            continue;
         }
-        
-        /* 从insert_pos后面查找其他子网 */
-        for (int j = insert_pos; j < agg_count; ++j) {
-            /* 检查j是否是i的子网（前缀完全匹配且mask更大） */
-            size_t prefix_len = strlen(agg[i].subnet);
-            if (agg[j].mask > agg[i].mask && 
-                strncmp(agg[j].subnet, agg[i].subnet, prefix_len) == 0 &&
-                (agg[j].subnet[prefix_len] == '.' || agg[j].subnet[prefix_len] == '\0')) {
-                /* j是i的子网，移动到insert_pos */
-                char tmp_subnet[64];
-                int tmp_count = agg[j].count, tmp_mask = agg[j].mask;
-                strcpy(tmp_subnet, agg[j].subnet);
-                
-                /* 将insert_pos到j-1的元素向后移动 */
-                for (int k = j; k > insert_pos; --k) {
-                    agg[k].count = agg[k-1].count;
-                    agg[k].mask = agg[k-1].mask;
-                    strcpy(agg[k].subnet, agg[k-1].subnet);
-                }
-                
-                /* 插入到insert_pos */
-                agg[insert_pos].count = tmp_count;
-                agg[insert_pos].mask = tmp_mask;
-                strcpy(agg[insert_pos].subnet, tmp_subnet);
-                insert_pos++;
-            }
+        if (run >= 2) {
+            agg_key_to_addr(hi, lo, family, level, &prefix);
+            if (agg_push(list, &prefix, run) != SUCCESS) return ERROR_FILE;
+        }
+        if (i < n) {
+            hi = keys[i].hi & mask_hi;
+            lo = keys[i].lo & mask_lo;
+            run = 1;
         }
     }
-    
-    /* 输出聚合结果，只显示count>=2的，并去重：如果大段和小段数量相同则只显示小段 */
-    bool has_output = false;
-    int show_count = 0;
-    int aggregated_count = 0;
-    
-    for (int i = 0; i < agg_count && show_count < 10; ++i) {
-        if (agg[i].count < 2 || is_agg_replaced(agg, agg_count, i)) {
-            continue;
+    return SUCCESS;
+}
+
+/* 按地址排序后网段先于其包含的子网段，用栈找到最近的上级网段 */
+static void agg_link(agg_node_t *nodes, size_t count, bool mark_replaced) {
+    int *stack = malloc((count + 1) * sizeof(*stack));
+    if (!stack) return;
+    int top = 0;
+    for (size_t i = 0; i < count; i++) {
+        while (top > 0 && !ip_addr_contains(&nodes[stack[top - 1]].prefix, &nodes[i].prefix)) {
+            top--;
         }
-        
-        has_output = true;
-        
-        /* 检查是否是子网（用于缩进显示和重复计数检测） */
-        bool is_child = false;
-        for (int k = 0; k < i; ++k) {
-            if (agg[k].count >= 2 && agg[k].mask < agg[i].mask && 
-                !is_agg_replaced(agg, agg_count, k)) {
-                size_t prefix_len = strlen(agg[k].subnet);
-                if (strncmp(agg[i].subnet, agg[k].subnet, prefix_len) == 0 &&
-                    (agg[i].subnet[prefix_len] == '.' || agg[i].subnet[prefix_len] == '\0')) {
-                    is_child = true;
-                    break;
-                }
+        if (top > 0) {
+            agg_node_t *parent = &nodes[stack[top - 1]];
+            if (mark_replaced) {
+                parent->replaced |= (parent->count == nodes[i].count);
+            } else {
+                nodes[i].parent = stack[top - 1];
+                nodes[i].depth = parent->depth + 1;
             }
         }
-        
-        /* 非子网段才计入aggregated_count（避免重复计数） */
-        if (!is_child) {
-            aggregated_count += agg[i].count;
-        }
-        
-        /* 显示段信息，子网段增加缩进 */
-        char display_subnet[64];
-        const char *suffix = (agg[i].mask == 8) ? ".0.0.0/8" : (agg[i].mask == 16) ? ".0.0/16" : ".0/24";
-        snprintf(display_subnet, sizeof(display_subnet), "%s%s", agg[i].subnet, suffix);
-        
-        if (is_child) {
-            printf("    └─ %-19s %s(%d 个)%s\n", display_subnet, C_RED, agg[i].count, C_RESET);
+        stack[top++] = (int)i;
+    }
+    free(stack);
+}
+
+/* 按数量降序输出parent的子网段，深层网段缩进，数量列对齐 */
+static void print_agg(const agg_node_t *nodes, const agg_order_t *order, const size_t *first,
+                      int parent, size_t *lines) {
+    size_t limit = parent < 0 ? SIZE_MAX : AGG_SHOW_CHILDREN;
+    for (size_t k = first[parent + 1];
+         k < first[parent + 2] && k - first[parent + 1] < limit && *lines < AGG_SHOW_LINES; k++) {
+        const agg_node_t *node = &nodes[order[k].index];
+        char text[IP_STR_LEN];
+        ip_addr_format(&node->prefix, text, sizeof(text));
+        if (node->depth == 0) {
+            printf("  - %-22s %s(%zu 个)%s\n", text, C_RED, node->count, C_RESET);
         } else {
-            printf("  - %-22s %s(%d 个)%s\n", display_subnet, C_RED, agg[i].count, C_RESET);
+            int width = 23 - node->depth * 4;
+            printf("%*s└─ %-*s %s(%zu 个)%s\n", node->depth * 4, "", width > 0 ? width : 0, text,
+                   C_RED, node->count, C_RESET);
         }
-        show_count++;
+        (*lines)++;
+        print_agg(nodes, order, first, order[k].index, lines);
     }
+}
+
+void show_subnet_aggregation(void) {
+    msg(C_CYAN, "=== 📊 攻击源聚合统计 (IP 段归类) ===");
     
-    /* 计算散乱IP数量 */
-    int total_ipv4 = 0;
-    FILE *fp_count = fopen(PERSIST_FILE, "r");
-    if (fp_count) {
-        char line_tmp[MAX_LINE_LEN];
-        while (fgets(line_tmp, sizeof(line_tmp), fp_count)) {
-            line_tmp[strcspn(line_tmp, "\n")] = 0;
-            if (strlen(line_tmp) > 0) {
-                char *pipe = strchr(line_tmp, '|');
-                if (pipe) *pipe = '\0';
-                if (!strchr(line_tmp, ':')) total_ipv4++;
-            }
-        }
-        fclose(fp_count);
+    store_view_t view;
+    if (store_load(&view) != SUCCESS || view.count == 0) {
+        store_view_free(&view);
+        printf("(暂无IP信息)\n\n");
+        return;
     }
-    int scattered_count = total_ipv4 - aggregated_count;
     
-    /* 如果没有任何数据 */
-    if (total_ipv4 == 0 && v6_count == 0) {
-        printf("(暂无IP信息)\n\n");
+    /* 按地址族分开后各自基数排序，各层级的网段都是连续区间 */
+    size_t n = view.count;
+    agg_key_t *keys = malloc(n * sizeof(*keys));
+    if (!keys) {
+        store_view_free(&view);
+        printf("(内存不足)\n\n");
         return;
     }
+    size_t v4_count = 0, v6_pos = n;
+    for (size_t i = 0; i < n; i++) {
+        const ip_addr_t *addr = &view.entries[i].addr;
+        agg_key_from_addr(addr, &keys[addr->family == AF_INET6 ? --v6_pos : v4_count++]);
+    }
+    store_view_free(&view);
+    agg_key_t *keys_v6 = keys + v4_count;
+    size_t v6_count = n - v4_count;
     
-    /* 显示散乱IP */
-    if (scattered_count > 0 || (!has_output && total_ipv4 > 0)) {
-        if (scattered_count > 0) {
-            printf("  - (散乱 IPv4)       (%d 个)\n", scattered_count);
-        } else {
-            printf("  - (散乱 IPv4)\n");
+    agg_list_t list = {0};
+    int levels[MAX_AGG_LEVELS];
+    int rc = radix_sort_keys(keys, v4_count);
+    if (rc == SUCCESS) {
+        rc = radix_sort_keys(keys_v6, v6_count);
+    }
+    int level_count = get_agg_levels_from_config(false, levels);
+    for (int l = 0; l < level_count && rc == SUCCESS; l++) {
+        rc = count_level(keys, v4_count, AF_INET, levels[l], &list);
+    }
+    level_count = get_agg_levels_from_config(true, levels);
+    for (int l = 0; l < level_count && rc == SUCCESS; l++) {
+        rc = count_level(keys_v6, v6_count, AF_INET6, levels[l], &list);
+    }
+    free(keys);
+    
+    /* 去掉被更小网段取代的层级，再建立显示层级 */
+    qsort(list.nodes, list.count, sizeof(*list.nodes), cmp_agg_prefix);
+    agg_link(list.nodes, list.count, true);
+    size_t shown = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        if (!list.nodes[i].replaced) {
+            list.nodes[shown++] = list.nodes[i];
         }
     }
+    agg_link(list.nodes, shown, false);
     
-    if (v6_count > 0) {
-        printf("  - (IPv6 地址)           (%d 个)\n", v6_count);
+    size_t aggregated[2] = {0, 0};
+    agg_order_t *order = malloc((shown + 1) * sizeof(*order));
+    size_t *first = calloc(shown + 2, sizeof(*first));
+    if (rc != SUCCESS || !order || !first) {
+        shown = 0;
+    }
+    for (size_t i = 0; i < shown; i++) {
+        const agg_node_t *node = &list.nodes[i];
+        order[i] = (agg_order_t){ node->parent, node->count, (int)i };
+        first[node->parent + 2]++;
+        if (node->parent < 0) {
+            aggregated[node->prefix.family == AF_INET6] += node->count;
+        }
+    }
+    if (shown > 0) {
+        qsort(order, shown, sizeof(*order), cmp_agg_order);
+        for (size_t i = 2; i < shown + 2; i++) {
+            first[i] += first[i - 1];
+        }
+    }
+    
+    size_t lines = 0;
+    if (shown > 0) {
+        print_agg(list.nodes, order, first, -1, &lines);
+    }
+    if (shown > lines) {
+        printf("\033[2m  ... (省略 %zu 个网段)\033[0m\n", shown - lines);
+    }
+    free(order);
+    free(first);
+    free(list.nodes);
+    
+    /* 不属于任何显示网段的地址 */
+    size_t scattered_v4 = v4_count - aggregated[0];
+    size_t scattered_v6 = v6_count - aggregated[1];
+    if (scattered_v4 > 0) {
+        printf("  - %-24s (%zu 个)\n", "(散乱 IPv4)", scattered_v4);
+    }
+    if (scattered_v6 > 0) {
+        printf("  - %-24s (%zu 个)\n", "(散乱 IPv6)", scattered_v6);
     }
     
     printf("\n");
@@ -369,21 +491,18 @@ void show_subnet_aggregation(void) {
 
 void show_country_stats(void) {
     msg(C_CYAN, "=== 🌍 攻击源国家/地区统计 ===");
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    if (!fp) {
+    store_view_t view;
+    if (store_load(&view) != SUCCESS) {
         printf("(暂无数据)\n\n");
         return;
     }
     struct { char code[MAX_COUNTRY_CODE]; int count; } stats[128];
     int stat_count = 0;
-    char line[MAX_LINE_LEN];
     bool has_data = false;
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\n")] = 0;
-        char *pipe = strchr(line, '|');
-        if (pipe && strlen(pipe + 1) > 0) {
+    for (size_t n = 0; n < view.count; n++) {
+        const char *code = view.entries[n].country;
+        if (code[0] != '\0') {
             has_data = true;
-            char *code = pipe + 1;
             int found = 0;
             for (int i = 0; i < stat_count; ++i) {
                 if (strcmp(stats[i].code, code) == 0) {
@@ -400,7 +519,7 @@ void show_country_stats(void) {
             }
         }
     }
-    fclose(fp);
+    store_view_free(&view);
     if (!has_data) {
         printf("(暂无国家信息)\n\n");
         return;
@@ -427,26 +546,25 @@ void show_country_stats(void) {
 }
 
 void show_statistics(void) {
-    int nft_v4_count = nft_get_set_count(NFT_SET);
-    int nft_v6_count = nft_get_set_count(NFT_SET_V6);
-    int nft_count = nft_v4_count + nft_v6_count;
+    /* 内核集合只读取一次，各节共用 */
+    list_snapshot_t snap;
+    list_snapshot_take(&snap);
+    size_t nft_count = snap.banned[0] + snap.banned[1];
     
     int local_count = 0;
-    FILE *fp = fopen(PERSIST_FILE, "r");
-    if (fp) {
-        char line[MAX_LINE_LEN];
-        while (fgets(line, sizeof(line), fp)) {
-            if (strlen(line) > 1) local_count++;
-        }
-        fclose(fp);
+    store_view_t view;
+    if (store_load(&view) == SUCCESS) {
+        local_count = (int)view.count;
+        store_view_free(&view);
     }
     
     msg(C_CYAN, "=== 🛡️  BIP 防护概览 ===");
-    printf("当前生效: %s%d%s 条  |  本地记录: %s%d%s 条\n\n",
+    printf("当前生效: %s%zu%s 条  |  本地记录: %s%d%s 条\n\n",
            C_GREEN, nft_count, C_RESET,
            C_YELLOW, local_count, C_RESET);
     
-    show_active_bans();
+    show_active_bans(&snap);
+    show_rate_limit(&snap);
     show_subnet_aggregation();
     show_country_stats();
     
@@ -455,6 +573,48 @@ void show_statistics(void) {
     printf("\n");
 }
 
+/* 耗时按量级选择单位 */
+static void format_latency(uint64_t ns, char *buf, size_t size) {
+    if (ns < 1000) {
+        snprintf(buf, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 1000000) {
+        snprintf(buf, size, "%.1fus", (double)ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, size, "%.2fms", (double)ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.2fs", (double)ns / 1e9);
+    }
+}
+
+void show_latency_stats(void) {
+    msg(C_CYAN, "=== ⏱️  PAM 路径耗时 ===");
+    printf("%-18s %12s %10s %10s %10s %12s\n", "阶段", "次数", "p50", "p99", "p999", "最大");
+    
+    bool any = false;
+    for (int p = 0; p < LATENCY_COUNT; p++) {
+        latency_summary_t sum;
+        if (metrics_latency((latency_phase_t)p, &sum) != SUCCESS) {
+            msg(C_RED, "❌ 无法读取计数文件: " METRICS_SHM_FILE);
+            return;
+        }
+        if (sum.count == 0) continue;
+        any = true;
+        
+        char p50[16], p99[16], p999[16], max[16];
+        format_latency(sum.p50_ns, p50, sizeof(p50));
+        format_latency(sum.p99_ns, p99, sizeof(p99));
+        format_latency(sum.p999_ns, p999, sizeof(p999));
+        format_latency(sum.max_ns, max, sizeof(max));
+        const char *color = (p == LATENCY_CHECK_TOTAL || p == LATENCY_CLEAN_TOTAL) ? C_YELLOW : "";
+        printf("%s%-16s%s %10llu %10s %10s %10s %10s\n", color, latency_phase_name((latency_phase_t)p),
+               *color ? C_RESET : "", (unsigned long long)sum.count, p50, p99, p999, max);
+    }
+    if (!any) {
+        printf("  (暂无记录，bip check/clean 运行后出现)\n");
+    }
+    printf("\n");
+}
+
 void show_statistics_watch(bool watch_mode) {
     if (!watch_mode) {
         show_statistics();
@@ -0,0 +1,950 @@
+#include "store.h"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define STORE_RECORD_LEN 48
+#define STORE_COMPACT_RECORDS 4096
+
+/* 日志操作类型 */
+#define STORE_OP_ADD 'A'
+#define STORE_OP_REMOVE 'D'
+#define STORE_OP_ANNOTATE 'C'
+
+/*
+ * 日志记录（48字节，小端）：
+ *   [0] 操作  [1] 地址族  [2] 前缀长度  [3] 来源
+ *   [4..5] 国家代码  [6..7] 保留  [8..23] 地址
+ *   [24..31] 写入时间  [32..39] 到期时间  [40..43] 保留
+ *   [44..47] 前44字节的CRC32
+ */
+
+#define STORE_DB_MAGIC "BBDB"
+#define STORE_DB_VERSION 1
+
+/* 快照文件头 */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_count;
+    uint32_t index_size;        /* 2的幂，大于记录数的两倍 */
+    int64_t created_at;
+    uint64_t reserved[5];
+} store_db_header_t;
+
+/* 快照记录（定长，可直接映射） */
+typedef struct {
+    uint8_t family;
+    uint8_t prefixlen;
+    uint8_t source;
+    uint8_t reserved;
+    char country[2];
+    uint16_t reserved2;
+    uint8_t addr[16];
+    int64_t banned_at;
+    int64_t expires_at;
+    uint32_t hits;
+    uint32_t reserved3;
+} store_db_record_t;
+
+/* 映射的快照：文件头、记录数组、开放寻址索引（记录下标+1，0表示空） */
+typedef struct {
+    void *base;
+    size_t size;
+    const store_db_header_t *header;
+    const store_db_record_t *records;
+    const uint32_t *index;
+} store_db_t;
+
+/* 合并过程中的条目（删除后保留位置，重新封禁时复用） */
+typedef struct {
+    store_entry_t entry;
+    bool live;
+} store_slot_t;
+
+typedef struct {
+    store_slot_t *slots;
+    size_t count;
+    size_t cap;
+    uint32_t *index;        /* 开放寻址，保存 slots 下标+1，0表示空 */
+    size_t index_size;
+    size_t invalid;
+    size_t corrupt;
+} store_builder_t;
+
+static uint32_t crc32_calc(const uint8_t *data, size_t len) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c >> 1) ^ (0xEDB88320u & (0u - (c & 1u)));
+            }
+            table[n] = c;
+        }
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+bool store_entry_live(const store_entry_t *e, time_t now) {
+    return e->expires_at == 0 || e->expires_at > now;
+}
+
+uint64_t store_remaining_ms(const store_entry_t *e, time_t now) {
+    return e->expires_at == 0 ? 0 : (uint64_t)(e->expires_at - now) * 1000;
+}
+
+const char* ban_source_name(uint8_t source) {
+    switch (source) {
+    case BAN_SOURCE_MANUAL:    return "manual";
+    case BAN_SOURCE_PAM:       return "pam";
+    case BAN_SOURCE_RATELIMIT: return "ratelimit";
+    case BAN_SOURCE_IMPORT:    return "import";
+    case BAN_SOURCE_LOG:       return "log";
+    default:                   return "-";
+    }
+}
+
+static int lock_store(int operation) {
+    char lock_file[MAX_PATH_LEN];
+    snprintf(lock_file, sizeof(lock_file), "%s.lock", PERSIST_FILE);
+
+    int lock_fd = open(lock_file, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+    if (lock_fd < 0) {
+        return -1;
+    }
+    if (flock(lock_fd, operation) != 0) {
+        close(lock_fd);
+        return -1;
+    }
+    return lock_fd;
+}
+
+static void unlock_store(int lock_fd) {
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+}
+
+static bool valid_addr(uint8_t family, uint8_t prefixlen) {
+    if (family == AF_INET) return prefixlen <= 32;
+    if (family == AF_INET6) return prefixlen <= 128;
+    return false;
+}
+
+static void copy_country(char *dst, const char *src) {
+    dst[0] = '\0';
+    if (isalpha((unsigned char)src[0]) && isalpha((unsigned char)src[1])) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = '\0';
+    }
+}
+
+static void encode_record(uint8_t *rec, char op, const store_entry_t *e) {
+    memset(rec, 0, STORE_RECORD_LEN);
+    rec[0] = (uint8_t)op;
+    rec[1] = e->addr.family;
+    rec[2] = e->addr.prefixlen;
+    rec[3] = e->source;
+    if (strlen(e->country) == 2) {
+        rec[4] = (uint8_t)e->country[0];
+        rec[5] = (uint8_t)e->country[1];
+    }
+    memcpy(rec + 8, e->addr.addr, sizeof(e->addr.addr));
+    put_u64(rec + 24, (uint64_t)e->banned_at);
+    put_u64(rec + 32, (uint64_t)e->expires_at);
+    put_u32(rec + 44, crc32_calc(rec, 44));
+}
+
+static bool decode_record(const uint8_t *rec, char *op, store_entry_t *e) {
+    if (get_u32(rec + 44) != crc32_calc(rec, 44)) {
+        return false;
+    }
+    if (rec[0] != STORE_OP_ADD && rec[0] != STORE_OP_REMOVE && rec[0] != STORE_OP_ANNOTATE) {
+        return false;
+    }
+    if (!valid_addr(rec[1], rec[2])) {
+        return false;
+    }
+
+    *op = (char)rec[0];
+    memset(e, 0, sizeof(*e));
+    e->addr.family = rec[1];
+    e->addr.prefixlen = rec[2];
+    memcpy(e->addr.addr, rec + 8, sizeof(e->addr.addr));
+    e->source = rec[3];
+    copy_country(e->country, (const char *)rec + 4);
+    e->banned_at = (time_t)get_u64(rec + 24);
+    e->expires_at = (time_t)get_u64(rec + 32);
+    e->hits = 1;
+    return true;
+}
+
+/* 把一条操作应用到单个条目上（合并和单条查询共用） */
+static void apply_op(store_entry_t *e, bool *live, char op, const store_entry_t *rec) {
+    if (op == STORE_OP_REMOVE) {
+        *live = false;
+        return;
+    }
+    if (op == STORE_OP_ANNOTATE) {
+        if (*live) {
+            snprintf(e->country, sizeof(e->country), "%s", rec->country);
+        }
+        return;
+    }
+
+    /* 重复封禁累加次数并保留已有的国家信息；解封后重新封禁从头计数 */
+    if (*live) {
+        e->hits += rec->hits;
+        e->source = rec->source;
+        e->banned_at = rec->banned_at;
+        e->expires_at = rec->expires_at;
+        if (rec->country[0] != '\0') {
+            snprintf(e->country, sizeof(e->country), "%s", rec->country);
+        }
+    } else {
+        *e = *rec;
+        *live = true;
+    }
+}
+
+/* 在一次加锁中追加多条记录 */
+static int append_records(const uint8_t *recs, size_t count) {
+    int lock_fd = lock_store(LOCK_EX);
+    if (lock_fd < 0) {
+        return ERROR_FILE;
+    }
+
+    int fd = open(PERSIST_JOURNAL_FILE, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        unlock_store(lock_fd);
+        return ERROR_FILE;
+    }
+
+    /* 上次写入中断留下的半条记录，截断后再追加 */
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size % STORE_RECORD_LEN != 0) {
+        if (ftruncate(fd, st.st_size - st.st_size % STORE_RECORD_LEN) != 0) {
+            close(fd);
+            unlock_store(lock_fd);
+            return ERROR_FILE;
+        }
+    }
+
+    size_t left = count * STORE_RECORD_LEN;
+    while (left > 0) {
+        ssize_t n = write(fd, recs, left);
+        if (n <= 0) break;
+        recs += n;
+        left -= (size_t)n;
+    }
+    close(fd);
+    unlock_store(lock_fd);
+
+    return (left == 0) ? SUCCESS : ERROR_FILE;
+}
+
+static int append_record(char op, const store_entry_t *e) {
+    uint8_t rec[STORE_RECORD_LEN];
+    encode_record(rec, op, e);
+    return append_records(rec, 1);
+}
+
+int store_add(const ip_addr_t *addr, const char *country, ban_source_t source, time_t expires_at) {
+    if (!addr) {
+        return ERROR_INVALID_ARG;
+    }
+    store_entry_t e = {0};
+    e.addr = *addr;
+    copy_country(e.country, country ? country : "");
+    e.source = (uint8_t)source;
+    e.banned_at = time(NULL);
+    e.expires_at = expires_at;
+    return append_record(STORE_OP_ADD, &e);
+}
+
+int store_remove(const ip_addr_t *addr) {
+    if (!addr) {
+        return ERROR_INVALID_ARG;
+    }
+    store_entry_t e = {0};
+    e.addr = *addr;
+    e.banned_at = time(NULL);
+    return append_record(STORE_OP_REMOVE, &e);
+}
+
+int store_annotate(const ip_addr_t *addr, const char *country) {
+    if (!addr || !country || strlen(country) != 2) {
+        return ERROR_INVALID_ARG;
+    }
+    store_entry_t e = {0};
+    e.addr = *addr;
+    copy_country(e.country, country);
+    e.banned_at = time(NULL);
+    return append_record(STORE_OP_ANNOTATE, &e);
+}
+
+int store_annotate_batch(const store_entry_t *entries, size_t count) {
+    if (!entries) {
+        return ERROR_INVALID_ARG;
+    }
+    if (count == 0) {
+        return SUCCESS;
+    }
+
+    uint8_t *recs = malloc(count * STORE_RECORD_LEN);
+    if (!recs) {
+        return ERROR_FILE;
+    }
+
+    size_t n = 0;
+    time_t now = time(NULL);
+    for (size_t i = 0; i < count; i++) {
+        if (strlen(entries[i].country) != 2) continue;
+        store_entry_t e = {0};
+        e.addr = entries[i].addr;
+        copy_country(e.country, entries[i].country);
+        e.banned_at = now;
+        encode_record(recs + n * STORE_RECORD_LEN, STORE_OP_ANNOTATE, &e);
+        n++;
+    }
+
+    int ret = (n > 0) ? append_records(recs, n) : SUCCESS;
+    free(recs);
+    return ret;
+}
+
+/* 映射快照文件并校验文件头（索引在探测时检查边界，打开开销与条目数无关） */
+static int db_open(store_db_t *db) {
+    memset(db, 0, sizeof(*db));
+
+    int fd = open(PERSIST_DB_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return (errno == ENOENT) ? ERROR_FILE : ERROR_INVALID_ARG;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(store_db_header_t)) {
+        close(fd);
+        return ERROR_INVALID_ARG;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return ERROR_INVALID_ARG;
+    }
+
+    const store_db_header_t *h = base;
+    size_t size = (size_t)st.st_size;
+    bool valid = memcmp(h->magic, STORE_DB_MAGIC, 4) == 0 && h->version == STORE_DB_VERSION &&
+                 h->index_size > 0 && (h->index_size & (h->index_size - 1)) == 0 &&
+                 h->index_size > h->record_count &&
+                 size == sizeof(*h) + (size_t)h->record_count * sizeof(store_db_record_t) +
+                         (size_t)h->index_size * sizeof(uint32_t);
+
+    if (!valid) {
+        munmap(base, size);
+        return ERROR_INVALID_ARG;
+    }
+
+    db->base = base;
+    db->size = size;
+    db->header = h;
+    db->records = (const store_db_record_t *)((const uint8_t *)base + sizeof(*h));
+    db->index = (const uint32_t *)(db->records + h->record_count);
+    return SUCCESS;
+}
+
+static void db_close(store_db_t *db) {
+    if (db->base) {
+        munmap(db->base, db->size);
+    }
+    memset(db, 0, sizeof(*db));
+}
+
+static void db_record_to_entry(const store_db_record_t *r, store_entry_t *e) {
+    memset(e, 0, sizeof(*e));
+    e->addr.family = r->family;
+    e->addr.prefixlen = r->prefixlen;
+    memcpy(e->addr.addr, r->addr, sizeof(e->addr.addr));
+    copy_country(e->country, r->country);
+    e->source = r->source;
+    e->hits = r->hits;
+    e->banned_at = (time_t)r->banned_at;
+    e->expires_at = (time_t)r->expires_at;
+}
+
+static const store_db_record_t* db_find(const store_db_t *db, const ip_addr_t *addr) {
+    uint32_t mask = db->header->index_size - 1;
+    uint32_t i = ip_addr_hash(addr) & mask;
+
+    /* 探测次数有上限，损坏的索引不会导致死循环或越界 */
+    for (uint32_t probes = 0; probes <= mask && db->index[i] != 0; probes++) {
+        if (db->index[i] > db->header->record_count) {
+            return NULL;
+        }
+        const store_db_record_t *r = &db->records[db->index[i] - 1];
+        if (r->family == addr->family && r->prefixlen == addr->prefixlen &&
+            memcmp(r->addr, addr->addr, sizeof(r->addr)) == 0) {
+            return r;
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+/* 查找地址对应的槽位，不存在时返回NULL并给出插入位置 */
+static store_slot_t* builder_find(store_builder_t *b, const ip_addr_t *addr, size_t *pos) {
+    size_t mask = b->index_size - 1;
+    size_t i = ip_addr_hash(addr) & mask;
+
+    while (b->index[i] != 0) {
+        store_slot_t *slot = &b->slots[b->index[i] - 1];
+        if (ip_addr_equal(&slot->entry.addr, addr)) {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+    *pos = i;
+    return NULL;
+}
+
+static int builder_grow_index(store_builder_t *b) {
+    size_t new_size = b->index_size ? b->index_size * 2 : 1024;
+    uint32_t *index = calloc(new_size, sizeof(*index));
+    if (!index) {
+        return ERROR_FILE;
+    }
+
+    free(b->index);
+    b->index = index;
+    b->index_size = new_size;
+
+    for (size_t k = 0; k < b->count; k++) {
+        size_t i = ip_addr_hash(&b->slots[k].entry.addr) & (new_size - 1);
+        while (index[i] != 0) {
+            i = (i + 1) & (new_size - 1);
+        }
+        index[i] = (uint32_t)(k + 1);
+    }
+    return SUCCESS;
+}
+
+static int builder_apply(store_builder_t *b, char op, const store_entry_t *rec) {
+    /* 负载因子保持在1/2以下 */
+    if ((b->count + 1) * 2 > b->index_size && builder_grow_index(b) != SUCCESS) {
+        return ERROR_FILE;
+    }
+
+    size_t pos = 0;
+    store_slot_t *slot = builder_find(b, &rec->addr, &pos);
+    if (slot) {
+        apply_op(&slot->entry, &slot->live, op, rec);
+        return SUCCESS;
+    }
+    if (op != STORE_OP_ADD) {
+        return SUCCESS;
+    }
+
+    if (b->count == b->cap) {
+        size_t new_cap = b->cap ? b->cap * 2 : 256;
+        store_slot_t *p = realloc(b->slots, new_cap * sizeof(*p));
+        if (!p) return ERROR_FILE;
+        b->slots = p;
+        b->cap = new_cap;
+    }
+
+    slot = &b->slots[b->count];
+    slot->entry = *rec;
+    slot->live = true;
+    b->index[pos] = (uint32_t)(++b->count);
+    return SUCCESS;
+}
+
+/* 解析文本列表的一行（"IP" 或 "IP|国家代码"），空行返回false且不计为无效 */
+static bool parse_text_line(char *line, store_entry_t *e, bool *invalid) {
+    *invalid = false;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0') return false;
+
+    const char *country = "";
+    char *pipe = strchr(line, '|');
+    if (pipe) {
+        *pipe = '\0';
+        country = pipe + 1;
+    }
+
+    memset(e, 0, sizeof(*e));
+    if (ip_addr_parse(line, &e->addr) != SUCCESS) {
+        *invalid = true;
+        return false;
+    }
+    copy_country(e->country, country);
+    e->hits = 1;
+    return true;
+}
+
+/* 首次升级时导入旧版本的文本列表 */
+static int load_text_snapshot(store_builder_t *b) {
+    FILE *fp = fopen(PERSIST_FILE, "r");
+    if (!fp) {
+        return SUCCESS;
+    }
+
+    struct stat st;
+    time_t mtime = (fstat(fileno(fp), &st) == 0) ? st.st_mtime : time(NULL);
+
+    char line[MAX_LINE_LEN];
+    while (fgets(line, sizeof(line), fp)) {
+        store_entry_t e;
+        bool invalid;
+        if (!parse_text_line(line, &e, &invalid)) {
+            if (invalid) b->invalid++;
+            continue;
+        }
+        e.source = BAN_SOURCE_IMPORT;
+        e.banned_at = mtime;
+        if (builder_apply(b, STORE_OP_ADD, &e) != SUCCESS) {
+            fclose(fp);
+            return ERROR_FILE;
+        }
+    }
+
+    fclose(fp);
+    return SUCCESS;
+}
+
+static int load_snapshot(store_builder_t *b) {
+    store_db_t db;
+    int ret = db_open(&db);
+    if (ret == ERROR_FILE) {
+        return load_text_snapshot(b);
+    }
+    if (ret != SUCCESS) {
+        log_write("[持久化] %s 已损坏，改为从 %s 读取", PERSIST_DB_FILE, PERSIST_FILE);
+        return load_text_snapshot(b);
+    }
+
+    for (uint32_t i = 0; i < db.header->record_count; i++) {
+        const store_db_record_t *r = &db.records[i];
+        if (!valid_addr(r->family, r->prefixlen)) continue;
+
+        store_entry_t e;
+        db_record_to_entry(r, &e);
+        if (builder_apply(b, STORE_OP_ADD, &e) != SUCCESS) {
+            db_close(&db);
+            return ERROR_FILE;
+        }
+    }
+
+    db_close(&db);
+    return SUCCESS;
+}
+
+/* 读取整个日志（末尾不足一条的部分是中断写入留下的，不读取） */
+static uint8_t* read_journal(size_t *count) {
+    *count = 0;
+    int fd = open(PERSIST_JOURNAL_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < STORE_RECORD_LEN) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size - (size_t)st.st_size % STORE_RECORD_LEN;
+    uint8_t *buf = malloc(size);
+    size_t got = 0;
+    while (buf && got < size) {
+        ssize_t n = read(fd, buf + got, size - got);
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+
+    *count = got / STORE_RECORD_LEN;
+    return buf;
+}
+
+static int replay_journal(store_builder_t *b) {
+    size_t count;
+    uint8_t *buf = read_journal(&count);
+
+    for (size_t i = 0; i < count; i++) {
+        char op;
+        store_entry_t e;
+        /* 损坏的记录之后仍有正常追加的记录，跳过坏记录继续回放 */
+        if (!decode_record(buf + i * STORE_RECORD_LEN, &op, &e)) {
+            b->corrupt++;
+            continue;
+        }
+        if (builder_apply(b, op, &e) != SUCCESS) {
+            free(buf);
+            return ERROR_FILE;
+        }
+    }
+
+    free(buf);
+    return SUCCESS;
+}
+
+bool store_lookup(const ip_addr_t *addr, store_entry_t *entry) {
+    if (!addr || !entry) {
+        return false;
+    }
+
+    int lock_fd = lock_store(LOCK_SH);
+
+    bool live = false;
+    store_db_t db;
+    if (db_open(&db) == SUCCESS) {
+        const store_db_record_t *r = db_find(&db, addr);
+        if (r) {
+            db_record_to_entry(r, entry);
+            live = true;
+        }
+        db_close(&db);
+    }
+
+    /* 日志长度有上限，顺序扫描即可 */
+    size_t count;
+    uint8_t *buf = read_journal(&count);
+    for (size_t i = 0; i < count; i++) {
+        char op;
+        store_entry_t e;
+        if (!decode_record(buf + i * STORE_RECORD_LEN, &op, &e)) {
+            continue;
+        }
+        if (ip_addr_equal(&e.addr, addr)) {
+            apply_op(entry, &live, op, &e);
+        }
+    }
+    free(buf);
+
+    if (lock_fd >= 0) {
+        unlock_store(lock_fd);
+    }
+    return live;
+}
+
+static int build_view(store_view_t *view) {
+    store_builder_t b = {0};
+    int ret = load_snapshot(&b);
+    if (ret == SUCCESS) {
+        ret = replay_journal(&b);
+    }
+    free(b.index);
+
+    if (ret != SUCCESS) {
+        free(b.slots);
+        return ret;
+    }
+
+    /* 只保留有效条目 */
+    store_entry_t *entries = malloc((b.count ? b.count : 1) * sizeof(*entries));
+    if (!entries) {
+        free(b.slots);
+        return ERROR_FILE;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < b.count; i++) {
+        if (b.slots[i].live) {
+            entries[count++] = b.slots[i].entry;
+        }
+    }
+    free(b.slots);
+
+    view->entries = entries;
+    view->count = count;
+    view->invalid = b.invalid;
+    view->corrupt = b.corrupt;
+    return SUCCESS;
+}
+
+int store_load(store_view_t *view) {
+    if (!view) {
+        return ERROR_INVALID_ARG;
+    }
+    memset(view, 0, sizeof(*view));
+
+    /* 共享锁：与追加和合并互斥，读取之间可并发 */
+    int lock_fd = lock_store(LOCK_SH);
+    int ret = build_view(view);
+    if (lock_fd >= 0) {
+        unlock_store(lock_fd);
+    }
+    return ret;
+}
+
+void store_view_free(store_view_t *view) {
+    if (!view) return;
+    free(view->entries);
+    memset(view, 0, sizeof(*view));
+}
+
+/* 生成快照文件内容：文件头、记录、索引 */
+static uint8_t* db_serialize(const store_view_t *view, size_t *size) {
+    uint32_t index_size = 1024;
+    while (index_size < view->count * 2 + 1) {
+        index_size *= 2;
+    }
+
+    *size = sizeof(store_db_header_t) + view->count * sizeof(store_db_record_t) +
+            (size_t)index_size * sizeof(uint32_t);
+    uint8_t *base = calloc(1, *size);
+    if (!base) {
+        return NULL;
+    }
+
+    store_db_header_t *h = (store_db_header_t *)base;
+    memcpy(h->magic, STORE_DB_MAGIC, 4);
+    h->version = STORE_DB_VERSION;
+    h->record_count = (uint32_t)view->count;
+    h->index_size = index_size;
+    h->created_at = (int64_t)time(NULL);
+
+    store_db_record_t *records = (store_db_record_t *)(base + sizeof(*h));
+    uint32_t *index = (uint32_t *)(records + view->count);
+
+    for (size_t k = 0; k < view->count; k++) {
+        const store_entry_t *e = &view->entries[k];
+        store_db_record_t *r = &records[k];
+        r->family = e->addr.family;
+        r->prefixlen = e->addr.prefixlen;
+        r->source = e->source;
+        if (strlen(e->country) == 2) {
+            memcpy(r->country, e->country, 2);
+        }
+        memcpy(r->addr, e->addr.addr, sizeof(r->addr));
+        r->banned_at = (int64_t)e->banned_at;
+        r->expires_at = (int64_t)e->expires_at;
+        r->hits = e->hits;
+
+        uint32_t i = ip_addr_hash(&e->addr) & (index_size - 1);
+        while (index[i] != 0) {
+            i = (i + 1) & (index_size - 1);
+        }
+        index[i] = (uint32_t)(k + 1);
+    }
+    return base;
+}
+
+/* 把一个完整列表写成新快照并清空日志（需持有排他锁） */
+static int write_snapshot(const store_view_t *view) {
+    size_t size;
+    uint8_t *data = db_serialize(view, &size);
+    if (!data) {
+        return ERROR_FILE;
+    }
+
+    char temp_file[MAX_PATH_LEN];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", PERSIST_DB_FILE);
+    int fd = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        free(data);
+        return ERROR_FILE;
+    }
+
+    const uint8_t *p = data;
+    size_t left = size;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0) break;
+        p += n;
+        left -= (size_t)n;
+    }
+    free(data);
+
+    bool ok = left == 0 && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(temp_file, PERSIST_DB_FILE) != 0) {
+        remove(temp_file);
+        return ERROR_FILE;
+    }
+
+    /* 快照已落盘；此处崩溃时日志会被重复回放，只会多计封禁次数 */
+    fd = open(PERSIST_JOURNAL_FILE, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return SUCCESS;
+}
+
+static int compact_locked(void) {
+    store_view_t view = {0};
+    if (build_view(&view) != SUCCESS) {
+        return ERROR_FILE;
+    }
+    int ret = write_snapshot(&view);
+    store_view_free(&view);
+    return ret;
+}
+
+int store_compact(void) {
+    int lock_fd = lock_store(LOCK_EX);
+    if (lock_fd < 0) {
+        return ERROR_FILE;
+    }
+    int ret = compact_locked();
+    unlock_store(lock_fd);
+    return ret;
+}
+
+int store_rewrite(store_rewrite_fn fn, void *ctx) {
+    if (!fn) {
+        return ERROR_INVALID_ARG;
+    }
+
+    int lock_fd = lock_store(LOCK_EX);
+    if (lock_fd < 0) {
+        return ERROR_FILE;
+    }
+
+    store_view_t current = {0};
+    int ret = build_view(&current);
+    if (ret == SUCCESS) {
+        /* 回调未给出新列表表示无需改写 */
+        store_view_t replacement = {0};
+        ret = fn(&current, &replacement, ctx);
+        if (ret == SUCCESS && replacement.entries) {
+            ret = write_snapshot(&replacement);
+        }
+        store_view_free(&replacement);
+    }
+    store_view_free(&current);
+
+    unlock_store(lock_fd);
+    return ret;
+}
+
+void store_maybe_compact(void) {
+    struct stat st;
+    if (stat(PERSIST_JOURNAL_FILE, &st) != 0 ||
+        st.st_size < (off_t)STORE_COMPACT_RECORDS * STORE_RECORD_LEN) {
+        return;
+    }
+
+    int lock_fd = lock_store(LOCK_EX | LOCK_NB);
+    if (lock_fd < 0) {
+        return;
+    }
+
+    /* 拿到锁后重新确认，其他进程可能刚刚完成合并 */
+    if (stat(PERSIST_JOURNAL_FILE, &st) == 0 &&
+        st.st_size >= (off_t)STORE_COMPACT_RECORDS * STORE_RECORD_LEN) {
+        compact_locked();
+    }
+    unlock_store(lock_fd);
+}
+
+int store_import(const char *path, size_t *imported, size_t *invalid) {
+    if (!path || !imported || !invalid) {
+        return ERROR_INVALID_ARG;
+    }
+    *imported = 0;
+    *invalid = 0;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return ERROR_FILE;
+    }
+
+    uint8_t *recs = NULL;
+    size_t count = 0, cap = 0;
+    time_t now = time(NULL);
+    char line[MAX_LINE_LEN];
+
+    while (fgets(line, sizeof(line), fp)) {
+        store_entry_t e;
+        bool bad;
+        if (!parse_text_line(line, &e, &bad)) {
+            if (bad) (*invalid)++;
+            continue;
+        }
+        e.source = BAN_SOURCE_IMPORT;
+        e.banned_at = now;
+
+        if (count == cap) {
+            size_t new_cap = cap ? cap * 2 : 1024;
+            uint8_t *p = realloc(recs, new_cap * STORE_RECORD_LEN);
+            if (!p) {
+                free(recs);
+                fclose(fp);
+                return ERROR_FILE;
+            }
+            recs = p;
+            cap = new_cap;
+        }
+        encode_record(recs + count * STORE_RECORD_LEN, STORE_OP_ADD, &e);
+        count++;
+    }
+    fclose(fp);
+
+    /* 一次写入日志后立即合并，避免大量导入拖慢后续读取 */
+    int ret = SUCCESS;
+    if (count > 0) {
+        ret = append_records(recs, count);
+        if (ret == SUCCESS) {
+            store_compact();
+        }
+    }
+    free(recs);
+
+    *imported = count;
+    return ret;
+}
+
+int store_export(FILE *fp) {
+    if (!fp) {
+        return ERROR_INVALID_ARG;
+    }
+
+    store_view_t view;
+    if (store_load(&view) != SUCCESS) {
+        return ERROR_FILE;
+    }
+
+    for (size_t i = 0; i < view.count; i++) {
+        char ip[IP_STR_LEN];
+        ip_addr_format(&view.entries[i].addr, ip, sizeof(ip));
+        if (view.entries[i].country[0] != '\0') {
+            fprintf(fp, "%s|%s\n", ip, view.entries[i].country);
+        } else {
+            fprintf(fp, "%s\n", ip);
+        }
+    }
+
+    store_view_free(&view);
+    return SUCCESS;
+}
@@ -0,0 +1,673 @@
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/wait.h>
+
+/* 原函数（链接参数 -Wl,--wrap=<名称> 提供） */
+int __real_system(const char *command);
+FILE* __real_popen(const char *command, const char *type);
+int __real_pclose(FILE *fp);
+FILE* __real_fopen(const char *path, const char *mode);
+int __real_fclose(FILE *fp);
+int __real_open(const char *path, int flags, ...);
+int __real_rename(const char *oldpath, const char *newpath);
+int __real_mkstemp(char *template);
+FILE* __real_fdopen(int fd, const char *mode);
+int __real_close(int fd);
+int __real_unlink(const char *path);
+
+#define TRACE_MAX_COMMANDS 32
+#define TRACE_MAX_STREAMS 16        /* 同时打开的popen流、写入流和写入描述符 */
+#define TRACE_KEY_LEN 48
+#define TRACE_TOP_FILES 20
+
+/* 按命令（管道各段程序名）汇总 */
+typedef struct {
+    char key[TRACE_KEY_LEN];
+    unsigned count;
+    unsigned failed;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} command_stat_t;
+
+/* 按文件汇总 */
+typedef struct {
+    char *path;
+    unsigned opens;
+    unsigned rewrites;          /* 截断打开或被rename替换 */
+    uint64_t rewrite_bytes;
+    uint64_t append_bytes;
+} file_stat_t;
+
+/* 尚未pclose的popen流 */
+typedef struct {
+    FILE *fp;
+    char command[MAX_COMMAND_LEN];
+    uint64_t start_ns;
+} pending_command_t;
+
+/* 以写方式打开的文件流，fclose时按文件大小变化计算写入字节 */
+typedef struct {
+    FILE *fp;
+    char *path;
+    bool truncated;
+    off_t initial;
+} write_stream_t;
+
+/* 以写方式打开的描述符（open/mkstemp），close时按文件大小变化计算写入字节；path为NULL表示空位 */
+typedef struct {
+    int fd;
+    char *path;
+    bool truncated;
+    off_t initial;
+} write_fd_t;
+
+static struct {
+    int fd;                 /* 跟踪输出，-1为未跟踪 */
+    pid_t pid;
+    uint64_t start_ns;
+    command_stat_t commands[TRACE_MAX_COMMANDS];
+    size_t n_commands;
+    file_stat_t *files;
+    size_t n_files;
+    size_t cap_files;
+    pending_command_t pending[TRACE_MAX_STREAMS];
+    write_stream_t streams[TRACE_MAX_STREAMS];
+    write_fd_t fds[TRACE_MAX_STREAMS];
+    unsigned unlinks;
+} trace = { .fd = -1 };
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* 一行一次write，多进程写同一文件时不交错 */
+static void emit(const char *format, ...) {
+    char line[MAX_COMMAND_LEN + 256];
+    int len = snprintf(line, sizeof(line), "[trace %d] ", (int)getpid());
+    va_list args;
+    va_start(args, format);
+    len += vsnprintf(line + len, sizeof(line) - (size_t)len - 1, format, args);
+    va_end(args);
+    if (len > (int)sizeof(line) - 2) {
+        len = (int)sizeof(line) - 2;
+    }
+    line[len++] = '\n';
+    ssize_t n = write(trace.fd, line, (size_t)len);
+    (void)n;
+}
+
+static void format_status(int status, char *buf, size_t size) {
+    if (status == -1) {
+        snprintf(buf, size, "失败");
+    } else if (WIFEXITED(status)) {
+        snprintf(buf, size, "exit=%d", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        snprintf(buf, size, "sig=%d", WTERMSIG(status));
+    } else {
+        snprintf(buf, size, "status=%d", status);
+    }
+}
+
+/* 命令汇总键：管道/命令列表各段的程序名，如 ss|grep|awk|head */
+static void command_key(const char *command, char *key, size_t size) {
+    size_t len = 0;
+    key[0] = '\0';
+    const char *p = command;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == '(') p++;
+        const char *word = p;
+        while (*p && !strchr(" \t|;&)", *p)) p++;
+        const char *base = word;
+        for (const char *q = word; q < p; q++) {
+            if (*q == '/') base = q + 1;
+        }
+        size_t n = (size_t)(p - base);
+        if (n > 0 && len + n + 2 < size) {
+            if (len > 0) key[len++] = '|';
+            memcpy(key + len, base, n);
+            len += n;
+            key[len] = '\0';
+        }
+        /* 跳过参数和重定向（2>&1 中的&不是分隔符），停在 | ; && 处 */
+        while (*p && *p != '|' && *p != ';' && !(p[0] == '&' && p[1] == '&')) p++;
+        while (*p == '|' || *p == ';' || *p == '&') p++;
+    }
+}
+
+static file_stat_t* file_entry(const char *path) {
+    for (size_t i = 0; i < trace.n_files; i++) {
+        if (strcmp(trace.files[i].path, path) == 0) {
+            return &trace.files[i];
+        }
+    }
+    if (trace.n_files == trace.cap_files) {
+        size_t cap = trace.cap_files ? trace.cap_files * 2 : 32;
+        file_stat_t *grown = realloc(trace.files, cap * sizeof(*grown));
+        if (!grown) {
+            return NULL;
+        }
+        trace.files = grown;
+        trace.cap_files = cap;
+    }
+    file_stat_t *e = &trace.files[trace.n_files];
+    memset(e, 0, sizeof(*e));
+    e->path = strdup(path);
+    if (!e->path) {
+        return NULL;
+    }
+    trace.n_files++;
+    return e;
+}
+
+/* 记录一次写入结束（调用方持有trace_lock） */
+static void account_write(const char *path, bool truncated, uint64_t bytes) {
+    file_stat_t *e = file_entry(path);
+    if (e) {
+        if (truncated) {
+            e->rewrite_bytes += bytes;
+        } else {
+            e->append_bytes += bytes;
+        }
+    }
+}
+
+/* 登记写入描述符，path的所有权交给表（调用方持有trace_lock） */
+static void track_fd(int fd, char *path, bool truncated, off_t initial) {
+    for (size_t i = 0; i < TRACE_MAX_STREAMS; i++) {
+        if (!trace.fds[i].path) {
+            trace.fds[i] = (write_fd_t){ fd, path, truncated, initial };
+            return;
+        }
+    }
+    free(path);
+}
+
+/* 取出登记的写入描述符（调用方持有trace_lock） */
+static bool untrack_fd(int fd, write_fd_t *out) {
+    for (size_t i = 0; i < TRACE_MAX_STREAMS; i++) {
+        if (trace.fds[i].path && trace.fds[i].fd == fd) {
+            *out = trace.fds[i];
+            memset(&trace.fds[i], 0, sizeof(trace.fds[i]));
+            return true;
+        }
+    }
+    return false;
+}
+
+static void record_command(const char *command, uint64_t start_ns, int status) {
+    uint64_t elapsed = now_ns() - start_ns;
+    char key[TRACE_KEY_LEN];
+    command_key(command, key, sizeof(key));
+
+    pthread_mutex_lock(&trace_lock);
+    command_stat_t *c = NULL;
+    for (size_t i = 0; i < trace.n_commands; i++) {
+        if (strcmp(trace.commands[i].key, key) == 0) {
+            c = &trace.commands[i];
+            break;
+        }
+    }
+    if (!c && trace.n_commands < TRACE_MAX_COMMANDS) {
+        c = &trace.commands[trace.n_commands++];
+        memset(c, 0, sizeof(*c));
+        snprintf(c->key, sizeof(c->key), "%s", key);
+    }
+    if (c) {
+        c->count++;
+        c->total_ns += elapsed;
+        if (elapsed > c->max_ns) c->max_ns = elapsed;
+        if (status != 0) c->failed++;
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    char text[32];
+    format_status(status, text, sizeof(text));
+    emit("exec   %9.3fms %-8s %s", (double)elapsed / 1e6, text, command);
+}
+
+static int compare_commands(const void *a, const void *b) {
+    const command_stat_t *x = a;
+    const command_stat_t *y = b;
+    return (x->total_ns < y->total_ns) - (x->total_ns > y->total_ns);
+}
+
+static int compare_files(const void *a, const void *b) {
+    const file_stat_t *x = a;
+    const file_stat_t *y = b;
+    uint64_t bx = x->rewrite_bytes + x->append_bytes;
+    uint64_t by = y->rewrite_bytes + y->append_bytes;
+    if (bx != by) return (bx < by) - (bx > by);
+    return (x->opens < y->opens) - (x->opens > y->opens);
+}
+
+/* 退出时输出汇总（fork出的子进程只汇总自己的部分） */
+static void trace_summary(void) {
+    if (trace.fd < 0 || getpid() != trace.pid) {
+        return;
+    }
+    pthread_mutex_lock(&trace_lock);
+    qsort(trace.commands, trace.n_commands, sizeof(trace.commands[0]), compare_commands);
+    qsort(trace.files, trace.n_files, sizeof(trace.files[0]), compare_files);
+
+    unsigned spawns = 0;
+    uint64_t spawn_ns = 0;
+    emit("==== 外部命令 ====");
+    emit("   次数    总耗时ms      最大ms  失败  命令");
+    for (size_t i = 0; i < trace.n_commands; i++) {
+        const command_stat_t *c = &trace.commands[i];
+        emit("%7u %11.3f %11.3f %5u  %s", c->count, (double)c->total_ns / 1e6,
+             (double)c->max_ns / 1e6, c->failed, c->key);
+        spawns += c->count;
+        spawn_ns += c->total_ns;
+    }
+
+    unsigned opens = 0, rewrites = 0;
+    uint64_t rewrite_bytes = 0, append_bytes = 0;
+    emit("==== 文件 ====");
+    emit("  打开  重写     重写字节     追加字节  路径");
+    for (size_t i = 0; i < trace.n_files; i++) {
+        const file_stat_t *f = &trace.files[i];
+        if (i < TRACE_TOP_FILES) {
+            emit("%6u %5u %12llu %12llu  %s", f->opens, f->rewrites,
+                 (unsigned long long)f->rewrite_bytes, (unsigned long long)f->append_bytes, f->path);
+        }
+        opens += f->opens;
+        rewrites += f->rewrites;
+        rewrite_bytes += f->rewrite_bytes;
+        append_bytes += f->append_bytes;
+    }
+    if (trace.n_files > TRACE_TOP_FILES) {
+        emit("  ... 其余 %zu 个文件", trace.n_files - TRACE_TOP_FILES);
+    }
+    emit("合计: 运行 %.3fms，外部命令 %u 次 %.3fms，打开文件 %u 次，重写 %u 次 %llu 字节，追加 %llu 字节，删除 %u 次",
+         (double)(now_ns() - trace.start_ns) / 1e6, spawns, (double)spawn_ns / 1e6, opens, rewrites,
+         (unsigned long long)rewrite_bytes, (unsigned long long)append_bytes, trace.unlinks);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/* fork出的子进程从零开始统计，继承的流表不属于子进程 */
+static void trace_child(void) {
+    for (size_t i = 0; i < trace.n_files; i++) {
+        free(trace.files[i].path);
+    }
+    for (size_t i = 0; i < TRACE_MAX_STREAMS; i++) {
+        free(trace.streams[i].path);
+        free(trace.fds[i].path);
+    }
+    free(trace.files);
+    trace.files = NULL;
+    trace.n_files = trace.cap_files = 0;
+    trace.n_commands = 0;
+    trace.unlinks = 0;
+    memset(trace.pending, 0, sizeof(trace.pending));
+    memset(trace.streams, 0, sizeof(trace.streams));
+    memset(trace.fds, 0, sizeof(trace.fds));
+    trace.pid = getpid();
+    trace.start_ns = now_ns();
+    pthread_mutex_init(&trace_lock, NULL);
+}
+
+static void trace_init(void) {
+    const char *target = getenv("BIP_TRACE");
+    if (!target || target[0] == '\0' || strcmp(target, "0") == 0) {
+        return;
+    }
+    /* 复制标准错误，子进程重定向 stderr 不影响跟踪输出 */
+    int fd;
+    if (target[0] == '/') {
+        fd = __real_open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    } else {
+        fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+    }
+    if (fd < 0) {
+        return;
+    }
+    trace.fd = fd;
+    trace.pid = getpid();
+    trace.start_ns = now_ns();
+    atexit(trace_summary);
+    pthread_atfork(NULL, NULL, trace_child);
+}
+
+bool trace_enabled(void) {
+    pthread_once(&trace_once, trace_init);
+    return trace.fd >= 0;
+}
+
+uint64_t trace_start(void) {
+    return trace_enabled() ? now_ns() : 0;
+}
+
+void trace_command(const char *command, uint64_t start_ns, int status) {
+    if (trace_enabled() && start_ns != 0) {
+        record_command(command, start_ns, status);
+    }
+}
+
+int __wrap_system(const char *command) {
+    if (!trace_enabled() || !command) {
+        return __real_system(command);
+    }
+    uint64_t start = now_ns();
+    int status = __real_system(command);
+    record_command(command, start, status);
+    return status;
+}
+
+FILE* __wrap_popen(const char *command, const char *type) {
+    if (!trace_enabled()) {
+        return __real_popen(command, type);
+    }
+    uint64_t start = now_ns();
+    FILE *fp = __real_popen(command, type);
+    if (!fp) {
+        record_command(command, start, -1);
+        return NULL;
+    }
+    pthread_mutex_lock(&trace_lock);
+    for (size_t i = 0; i < TRACE_MAX_STREAMS; i++) {
+        if (!trace.pending[i].fp) {
+            trace.pending[i].fp = fp;
+            snprintf(trace.pending[i].command, sizeof(trace.pending[i].command), "%s", command);
+            trace.pending[i].start_ns = start;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return fp;
+}
+
+/* popen的耗时计到pclose为止（包含读取输出的时间） */
+int __wrap_pclose(FILE *fp) {
+    if (!trace_enabled()) {
+        return __real_pclose(fp);
+    }
+    pending_command_t cmd;
+    bool found = false;
+    pthread_mutex_lock(&trace_lock);
+    for (size_t i = 0; i < TRACE_MAX_STREAMS; i++) {
+        if (fp && trace.pending[i].fp == fp) {
+            cmd = trace.pending[i];
+            trace.pending[i].fp = NULL;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    int status = __real_pclose(fp);
+    if (found) {
+        record_command(cmd.command, cmd.start_ns, status);
+    }
+    return status;
+}
+
+FILE* __wrap_fopen(const char *path, const char *mode) {
+    FILE *fp = __real_fopen(path, mode);
+    if (!trace_enabled() || !path || !mode) {
+        return fp;
+    }
+    int err = errno;
+    bool writing = strpbrk(mode, "wa+") != NULL;
+    bool truncated = mode[0] == 'w';
+    off_t initial = 0;
+    struct stat st;
+    if (fp && writing && !truncated && fstat(fileno(fp), &st) == 0) {
+        initial = st.st_size;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    file_stat_t *e = file_entry(path);
+    if (e) {
+        e->opens++;
+        if (fp && truncated) e->rewrites++;
+    }
+    for (size_t i = 0; fp && writing && i < TRACE_MAX_STREAMS; i++) {
+        if (!trace.streams[i].fp) {
+            trace.streams[i].path = strdup(path);
+            if (trace.streams[i].path) {
+                trace.streams[i].fp = fp;
+                trace.streams[i].truncated = truncated;
+                trace.streams[i].initial = initial;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    if (fp) {
+        emit("open   %-3s %s", mode, path);
+    } else {
+        emit("open   %-3s %s (%s)", mode, path, strerror(err));
+    }
+    errno = err;
+    return fp;
+}
+
+int __wrap_fclose(FILE *fp) {
+    if (!trace_enabled() || !fp) {
+        return __real_fclose(fp);
+    }
+    write_stream_t stream;
+    bool found = false;
+    pthread_mutex_lock(&trace_lock);
+    for (size_t i = 0; i < TRACE_MAX_STREAMS; i++) {
+        if (trace.streams[i].fp == fp) {
+            stream = trace.streams[i];
+            memset(&trace.streams[i], 0, sizeof(trace.streams[i]));
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    if (!found) {
+        return __real_fclose(fp);
+    }
+
+    off_t size = stream.initial;
+    struct stat st;
+    fflush(fp);
+    if (fstat(fileno(fp), &st) == 0) {
+        size = st.st_size;
+    }
+    int ret = __real_fclose(fp);
+    int err = errno;
+
+    uint64_t bytes = size > stream.initial ? (uint64_t)(size - stream.initial) : 0;
+    pthread_mutex_lock(&trace_lock);
+    account_write(stream.path, stream.truncated, bytes);
+    pthread_mutex_unlock(&trace_lock);
+    emit("close  %s %s %lluB", stream.truncated ? "重写" : "追加", stream.path, (unsigned long long)bytes);
+    free(stream.path);
+    errno = err;
+    return ret;
+}
+
+int __wrap_open(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode = (mode_t)va_arg(args, int);
+        va_end(args);
+    }
+    int fd = __real_open(path, flags, mode);
+    if (!trace_enabled() || !path) {
+        return fd;
+    }
+    int err = errno;
+    int access_mode = flags & O_ACCMODE;
+    bool truncated = (flags & O_TRUNC) && access_mode != O_RDONLY;
+    off_t initial = 0;
+    struct stat st;
+    if (fd >= 0 && access_mode != O_RDONLY && !truncated && fstat(fd, &st) == 0) {
+        initial = st.st_size;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    file_stat_t *e = file_entry(path);
+    if (e) {
+        e->opens++;
+        if (fd >= 0 && truncated) e->rewrites++;
+    }
+    if (fd >= 0 && access_mode != O_RDONLY) {
+        char *copy = strdup(path);
+        if (copy) track_fd(fd, copy, truncated, initial);
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    char how[8];
+    snprintf(how, sizeof(how), "%s%s%s",
+             access_mode == O_RDONLY ? "r" : access_mode == O_WRONLY ? "w" : "rw",
+             (flags & O_APPEND) ? "a" : "", truncated ? "t" : "");
+    if (fd >= 0) {
+        emit("open   %-3s %s", how, path);
+    } else {
+        emit("open   %-3s %s (%s)", how, path, strerror(err));
+    }
+    errno = err;
+    return fd;
+}
+
+/* 临时文件rename到目标视为目标被重写一次，临时文件的统计并入目标 */
+int __wrap_rename(const char *oldpath, const char *newpath) {
+    if (!trace_enabled() || !oldpath || !newpath) {
+        return __real_rename(oldpath, newpath);
+    }
+    struct stat st;
+    off_t size = (stat(oldpath, &st) == 0 && S_ISREG(st.st_mode)) ? st.st_size : 0;
+    int ret = __real_rename(oldpath, newpath);
+    int err = errno;
+    if (ret != 0) {
+        emit("rename %s -> %s (%s)", oldpath, newpath, strerror(err));
+        errno = err;
+        return ret;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    file_stat_t *dst = file_entry(newpath);
+    if (dst) {
+        size_t di = (size_t)(dst - trace.files);
+        dst->rewrites++;
+        dst->rewrite_bytes += (uint64_t)size;
+        for (size_t i = 0; i < trace.n_files; i++) {
+            if (i != di && strcmp(trace.files[i].path, oldpath) == 0) {
+                trace.files[di].opens += trace.files[i].opens;
+                trace.files[di].append_bytes += trace.files[i].append_bytes;
+                free(trace.files[i].path);
+                trace.files[i] = trace.files[--trace.n_files];
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    emit("rename %s -> %s %lldB", oldpath, newpath, (long long)size);
+    errno = err;
+    return ret;
+}
+
+/* 临时文件：按新建文件统计，写入字节在close或fdopen流的fclose时计算 */
+int __wrap_mkstemp(char *template) {
+    int fd = __real_mkstemp(template);
+    if (!trace_enabled() || !template) {
+        return fd;
+    }
+    int err = errno;
+    pthread_mutex_lock(&trace_lock);
+    file_stat_t *e = file_entry(template);
+    if (e) {
+        e->opens++;
+        if (fd >= 0) e->rewrites++;
+    }
+    if (fd >= 0) {
+        char *copy = strdup(template);
+        if (copy) track_fd(fd, copy, true, 0);
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    if (fd >= 0) {
+        emit("open   tmp %s", template);
+    } else {
+        emit("open   tmp %s (%s)", template, strerror(err));
+    }
+    errno = err;
+    return fd;
+}
+
+/* 登记过的写入描述符转为写入流，之后由fclose统计（描述符随流一起关闭） */
+FILE* __wrap_fdopen(int fd, const char *mode) {
+    FILE *fp = __real_fdopen(fd, mode);
+    if (!trace_enabled() || !fp) {
+        return fp;
+    }
+    pthread_mutex_lock(&trace_lock);
+    write_fd_t w;
+    if (untrack_fd(fd, &w)) {
+        size_t i = 0;
+        while (i < TRACE_MAX_STREAMS && trace.streams[i].fp) i++;
+        if (i < TRACE_MAX_STREAMS) {
+            trace.streams[i] = (write_stream_t){ fp, w.path, w.truncated, w.initial };
+        } else {
+            free(w.path);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return fp;
+}
+
+int __wrap_close(int fd) {
+    if (!trace_enabled()) {
+        return __real_close(fd);
+    }
+    write_fd_t w;
+    pthread_mutex_lock(&trace_lock);
+    bool found = untrack_fd(fd, &w);
+    pthread_mutex_unlock(&trace_lock);
+    if (!found) {
+        return __real_close(fd);
+    }
+
+    off_t size = w.initial;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        size = st.st_size;
+    }
+    int ret = __real_close(fd);
+    int err = errno;
+
+    uint64_t bytes = size > w.initial ? (uint64_t)(size - w.initial) : 0;
+    pthread_mutex_lock(&trace_lock);
+    account_write(w.path, w.truncated, bytes);
+    pthread_mutex_unlock(&trace_lock);
+    emit("close  %s %s %lluB", w.truncated ? "重写" : "追加", w.path, (unsigned long long)bytes);
+    free(w.path);
+    errno = err;
+    return ret;
+}
+
+int __wrap_unlink(const char *path) {
+    int ret = __real_unlink(path);
+    if (!trace_enabled() || !path) {
+        return ret;
+    }
+    int err = errno;
+    if (ret == 0) {
+        pthread_mutex_lock(&trace_lock);
+        trace.unlinks++;
+        pthread_mutex_unlock(&trace_lock);
+        emit("unlink %s", path);
+    } else {
+        emit("unlink %s (%s)", path, strerror(err));
+    }
+    errno = err;
+    return ret;
+}
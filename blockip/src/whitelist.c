@@ -2,33 +2,87 @@
 #include "ip_utils.h"
 #include "nftables.h"
 #include "log.h"
+#include "lpm.h"
 
-bool is_in_whitelist(const char *ip) {
-    if (!ip) return false;
-    
+/* 编译后的白名单前缀树及其对应的源文件状态 */
+static lpm_t wl_trie;
+static struct stat wl_stat;
+static bool wl_loaded = false;
+
+/* 读取白名单文件中的全部有效条目 */
+static ip_addr_t* load_entries(size_t *count) {
+    *count = 0;
     FILE *fp = fopen(WHITELIST_FILE, "r");
-    if (!fp) return false;
-    
+    if (!fp) return NULL;
+
+    ip_addr_t *entries = NULL;
+    size_t cap = 0;
     char line[MAX_LINE_LEN];
-    bool found = false;
-    
+
     while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\n")] = 0;
-        
-        if (strlen(line) == 0) continue;
-        
-        if (ip_matches_whitelist_entry(ip, line)) {
-            found = true;
-            break;
+        line[strcspn(line, "\r\n")] = 0;
+
+        ip_addr_t entry;
+        if (ip_addr_parse(line, &entry) != SUCCESS) continue;
+
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 64;
+            ip_addr_t *p = realloc(entries, cap * sizeof(*p));
+            if (!p) break;
+            entries = p;
         }
+        entries[(*count)++] = entry;
     }
-    
+
     fclose(fp);
-    return found;
+    return entries;
+}
+
+static bool same_source(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+void whitelist_refresh(void) {
+    struct stat st;
+    if (stat(WHITELIST_FILE, &st) != 0) {
+        /* 文件不存在：清空 */
+        memset(&st, 0, sizeof(st));
+    }
+    if (wl_loaded && same_source(&st, &wl_stat)) {
+        return;
+    }
+
+    lpm_close(&wl_trie);
+    wl_stat = st;
+    wl_loaded = true;
+
+    /* 优先映射已编译的旁路文件，源文件变化后才重新编译 */
+    if (lpm_open(&wl_trie, WHITELIST_LPM_FILE, &st) == SUCCESS) {
+        return;
+    }
+
+    size_t count = 0;
+    ip_addr_t *entries = load_entries(&count);
+    lpm_build(&wl_trie, entries, count, &st, WHITELIST_LPM_FILE);
+    free(entries);
+}
+
+bool whitelist_match(const ip_addr_t *addr) {
+    return addr && lpm_lookup(&wl_trie, addr) >= 0;
+}
+
+bool is_in_whitelist(const char *ip) {
+    ip_addr_t addr;
+    if (!ip || ip_addr_parse(ip, &addr) != SUCCESS) return false;
+
+    whitelist_refresh();
+    return whitelist_match(&addr);
 }
 
 int whitelist_add_to_file(const char *ip) {
-    if (!ip) {
+    ip_addr_t addr;
+    if (!ip || ip_addr_parse(ip, &addr) != SUCCESS) {
         return ERROR_INVALID_ARG;
     }
     
@@ -37,8 +91,9 @@ int whitelist_add_to_file(const char *ip) {
     if (fp) {
         char line[MAX_LINE_LEN];
         while (fgets(line, sizeof(line), fp)) {
-            line[strcspn(line, "\n")] = 0;
-            if (strcmp(line, ip) == 0) {
+            line[strcspn(line, "\r\n")] = 0;
+            ip_addr_t entry;
+            if (ip_addr_parse(line, &entry) == SUCCESS && ip_addr_equal(&entry, &addr)) {
                 fclose(fp);
                 return SUCCESS;  /* 已存在 */
             }
@@ -52,14 +107,17 @@ int whitelist_add_to_file(const char *ip) {
         return ERROR_FILE;
     }
     
-    fprintf(fp, "%s\n", ip);
+    char canonical[IP_STR_LEN];
+    ip_addr_format(&addr, canonical, sizeof(canonical));
+    fprintf(fp, "%s\n", canonical);
     fclose(fp);
     
     return SUCCESS;
 }
 
 int whitelist_remove_from_file(const char *ip) {
-    if (!ip) {
+    ip_addr_t addr;
+    if (!ip || ip_addr_parse(ip, &addr) != SUCCESS) {
         return ERROR_INVALID_ARG;
     }
     
@@ -80,7 +138,8 @@ int whitelist_remove_from_file(const char *ip) {
     while (fgets(line, sizeof(line), fp)) {
         line[strcspn(line, "\n")] = 0;
         
-        if (strcmp(line, ip) != 0) {
+        ip_addr_t entry;
+        if (ip_addr_parse(line, &entry) != SUCCESS || !ip_addr_equal(&entry, &addr)) {
             fprintf(temp_fp, "%s\n", line);
         }
     }
@@ -113,7 +172,7 @@ void whitelist_show(void) {
         if (strlen(line) == 0) continue;
         
         total++;
-        if (strchr(line, ':')) {
+        if (is_ipv6(line)) {
             ipv6_count++;
         } else {
             ipv4_count++;
@@ -0,0 +1,81 @@
+/*
+ * sshd日志解析测试（make test）
+ *
+ * 每个用例按顺序喂入一组日志行，检查各行解析出的事件和IP。
+ * 解析器按 IP+端口 关联 Invalid user 与后续行，用例之间使用不同端口互不影响。
+ */
+#include "follow.h"
+#include "ip_utils.h"
+
+typedef struct {
+    const char *line;
+    sshd_event_t event;
+    const char *ip;         /* 期望的IP（事件为NONE时忽略） */
+} parse_step_t;
+
+static int failures = 0;
+
+static void run_case(const char *name, const parse_step_t *steps, size_t count) {
+    int failure_events = 0;
+    for (size_t i = 0; i < count; i++) {
+        char ip[IP_STR_LEN] = "";
+        sshd_event_t event = sshd_parse_line(steps[i].line, strlen(steps[i].line), false, ip, sizeof(ip));
+        if (event == SSHD_EVENT_FAILURE) failure_events++;
+
+        if (event != steps[i].event ||
+            (event != SSHD_EVENT_NONE && strcmp(ip, steps[i].ip) != 0)) {
+            printf("FAIL %s 第%zu行: 事件 %d（期望 %d） IP %s（期望 %s）\n  %s\n", name, i + 1,
+                   event, steps[i].event, ip, steps[i].ip ? steps[i].ip : "-", steps[i].line);
+            failures++;
+            return;
+        }
+    }
+    printf("ok   %s（%d 次失败）\n", name, failure_events);
+}
+
+#define RUN(name, ...) do { \
+    static const parse_step_t steps[] = { __VA_ARGS__ }; \
+    run_case(name, steps, ARRAY_SIZE(steps)); \
+} while (0)
+
+#define PREFIX "Jan  1 00:00:00 host sshd[4242]: "
+
+int main(void) {
+    RUN("不存在的用户尝试密码只计一次",
+        { PREFIX "Invalid user admin from 203.0.113.5 port 40001", SSHD_EVENT_NONE, NULL },
+        { PREFIX "Failed password for invalid user admin from 203.0.113.5 port 40001 ssh2",
+          SSHD_EVENT_FAILURE, "203.0.113.5" },
+        { PREFIX "Failed password for invalid user admin from 203.0.113.5 port 40001 ssh2",
+          SSHD_EVENT_FAILURE, "203.0.113.5" },
+        { PREFIX "Connection closed by invalid user admin 203.0.113.5 port 40001 [preauth]",
+          SSHD_EVENT_NONE, NULL });
+
+    RUN("只探测用户名的连接在结束时计一次",
+        { PREFIX "Invalid user test from 2001:db8::7 port 40002", SSHD_EVENT_NONE, NULL },
+        { PREFIX "Connection closed by invalid user test 2001:db8::7 port 40002 [preauth]",
+          SSHD_EVENT_FAILURE, "2001:db8::7" });
+
+    RUN("Disconnected 同样结束暂存",
+        { PREFIX "Invalid user oracle from 198.51.100.9 port 40003", SSHD_EVENT_NONE, NULL },
+        { PREFIX "Disconnected from invalid user oracle 198.51.100.9 port 40003 [preauth]",
+          SSHD_EVENT_FAILURE, "198.51.100.9" });
+
+    RUN("不同连接互不消化",
+        { PREFIX "Invalid user a from 192.0.2.1 port 40004", SSHD_EVENT_NONE, NULL },
+        { PREFIX "Failed password for invalid user a from 192.0.2.1 port 40005 ssh2",
+          SSHD_EVENT_FAILURE, "192.0.2.1" },
+        { PREFIX "Connection closed by invalid user a 192.0.2.1 port 40004 [preauth]",
+          SSHD_EVENT_FAILURE, "192.0.2.1" });
+
+    RUN("存在的用户",
+        { PREFIX "Failed password for root from 192.0.2.2 port 40006 ssh2", SSHD_EVENT_FAILURE, "192.0.2.2" },
+        { PREFIX "Connection closed by authenticating user root 192.0.2.2 port 40006 [preauth]",
+          SSHD_EVENT_NONE, NULL },
+        { PREFIX "Accepted password for root from 192.0.2.2 port 40007 ssh2", SSHD_EVENT_SUCCESS, "192.0.2.2" });
+
+    RUN("未认证的连接",
+        { PREFIX "Connection closed by 192.0.2.3 port 40008 [preauth]", SSHD_EVENT_FAILURE, "192.0.2.3" },
+        { PREFIX "Did not receive identification string from 192.0.2.3 port 40009", SSHD_EVENT_FAILURE, "192.0.2.3" });
+
+    return failures ? 1 : 0;
+}